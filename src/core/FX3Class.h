@@ -15,6 +15,7 @@
 #include <functional>
 #include "../Interface.h"
 #include "dsp/ringbuffer.h"
+#include "thread_sched.h"
 
 class fx3class
 {
@@ -27,11 +28,20 @@ public:
 	virtual bool SetArgument(uint16_t index, uint16_t value) = 0;
 	virtual bool GetHardwareInfo(uint32_t* data) = 0;
 	virtual bool ReadDebugTrace(uint8_t* pdata, uint8_t len) = 0;
-	virtual void StartStream(ringbuffer<int16_t>& input, int numofblock) = 0;
+	// stream blocks of input.getBlockSize() samples with numofblock transfers in flight
+	virtual bool StartStream(ringbuffer<int16_t>& input, int numofblock) = 0;
 	virtual void StopStream() = 0;
+	// placement and scheduling of the thread that completes the transfers, used from the next StartStream
+	virtual void SetEventThreadSched(const thread_sched& sched) {}
 	virtual bool Enumerate(unsigned char& idx, char* lbuf) = 0;
 };
 
 extern "C" fx3class* CreateUsbHandler();
 
+// hardware-free fx3class, see FX3Emulator.h for the config string; nullptr if it is invalid
+extern "C" fx3class* CreateEmulatorHandler(const char* config);
+
+// fx3class streaming a raw ADC capture, see FX3Replay.h; nullptr if the file can not be mapped
+extern "C" fx3class* CreateReplayHandler(const char* config);
+
 #endif // FX3CLASS_H
@@ -0,0 +1,577 @@
+#include "license.txt"
+#include "FX3Emulator.h"
+#include "config.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <algorithm>
+#include <string>
+#include <chrono>
+
+using namespace std::chrono;
+
+static const double full_scale = 32767.0;
+static const double two_pi = 6.283185307179586;
+
+// IF and half its band of the tuners
+static const double r82xx_if = 4570000.0;
+static const double r82xx_band = 4000000.0;
+static const double r3_if = 20000000.0;
+static const double r3_band = 8000000.0;
+
+static double level(double dBFS)
+{
+	return full_scale * pow(10.0, dBFS / 20.0);
+}
+
+fx3class* CreateEmulatorHandler(const char* config)
+{
+	auto emu = new fx3emulator();
+	if (!emu->Configure(config ? config : ""))
+	{
+		delete emu;
+		return nullptr;
+	}
+	return emu;
+}
+
+fx3emulator::fx3emulator() :
+	model(RX888r3),
+	realtime(true),
+	devices(1),
+	settleTime(0.0),
+	refScale(1.0),
+	tunerLo(0.0),
+	settleLeft(0),
+	noiseRms(0.0),
+	hasChirp(false),
+	burstFreq(0.0),
+	burstStart(0.0),
+	burstLength(0.0),
+	burstAmplitude(0.0),
+	generated(0),
+	rng(0x9E3779B97F4A7C15ull),
+	signalRate(0.0),
+	adcRate(DEFAULT_ADC_FREQ),
+	gpio(0),
+	producing(false),
+	tunerOn(false),
+	tunerFreq(0),
+	inputbuffer(nullptr),
+	finished(false),
+	produced(0),
+	clockNs(0),
+	eventSched { -1, SCHED_POLICY_OTHER, 0 },
+	run(false)
+{
+	for (auto& a : args)
+		a = 0;
+	sweep = chirp();
+}
+
+fx3emulator::~fx3emulator(void)
+{
+	StopStream();
+}
+
+bool fx3emulator::Configure(const char* config)
+{
+	static const struct { const char* name; RadioModel model; } models[] = {
+		{ "none", NORADIO }, { "bbrf103", BBRF103 }, { "hf103", HF103 },
+		{ "rx888", RX888 }, { "rx888r2", RX888r2 }, { "rx888r3", RX888r3 },
+		{ "rx999", RX999 }, { "rxlucy", RXLUCY },
+	};
+
+	std::string cfg(config);
+	size_t pos = 0;
+	while (pos < cfg.size())
+	{
+		size_t end = cfg.find(',', pos);
+		if (end == std::string::npos)
+			end = cfg.size();
+		std::string item = cfg.substr(pos, end - pos);
+		pos = end + 1;
+		if (item.empty())
+			continue;
+
+		size_t eq = item.find('=');
+		if (eq == std::string::npos)
+		{
+			DbgPrintf("emulator: missing value in '%s'\n", item.c_str());
+			return false;
+		}
+		std::string key = item.substr(0, eq);
+		const char* value = item.c_str() + eq + 1;
+
+		// up to 4 numbers separated by ':', n = -1 when malformed
+		double v[4] = { 0, 0, 0, 0 };
+		int n = 0;
+		for (const char* p = value; ; p++)
+		{
+			char* stop;
+			v[n] = strtod(p, &stop);
+			if (stop == p || (*stop != ':' && *stop != '\0'))
+			{
+				n = -1;
+				break;
+			}
+			n++;
+			p = stop;
+			if (*p == '\0')
+				break;
+			if (n == 4)
+			{
+				n = -1;
+				break;
+			}
+		}
+
+		if (key == "model")
+		{
+			bool found = false;
+			for (auto& m : models)
+			{
+				if (strcmp(value, m.name) == 0)
+				{
+					model = m.model;
+					found = true;
+				}
+			}
+			if (!found)
+			{
+				DbgPrintf("emulator: unknown model '%s'\n", value);
+				return false;
+			}
+		}
+		else if (key == "rate" && n == 1 && v[0] > 0)
+			adcRate = (uint32_t)v[0];
+		else if (key == "tone" && (n == 1 || n == 2))
+		{
+			toneFreqs.push_back(v[0]);
+			tones.push_back(tone());
+			tones.back().amplitude = level(n == 2 ? v[1] : 0.0);
+		}
+		else if (key == "rf" && (n == 1 || n == 2) && v[0] > 0)
+		{
+			rfFreqs.push_back(v[0]);
+			rfLevels.push_back(level(n == 2 ? v[1] : 0.0));
+			rfTones.push_back(tone());
+		}
+		else if (key == "settle" && n == 1 && v[0] >= 0)
+			settleTime = v[0];
+		else if (key == "ppm" && n == 1)
+			refScale = 1.0 + v[0] * 1e-6;
+		else if (key == "noise" && n == 1)
+			noiseRms = level(v[0]);
+		else if (key == "chirp" && (n == 3 || n == 4) && v[2] > 0)
+		{
+			hasChirp = true;
+			sweep.start = v[0];
+			sweep.stop = v[1];
+			sweep.period = v[2];
+			sweep.amplitude = level(n == 4 ? v[3] : 0.0);
+		}
+		else if (key == "burst" && (n == 3 || n == 4) && v[1] >= 0 && v[2] > 0)
+		{
+			burstFreq = v[0];
+			burstStart = v[1];
+			burstLength = v[2];
+			burstAmplitude = level(n == 4 ? v[3] : 0.0);
+		}
+		else if (key == "realtime" && n == 1)
+			realtime = v[0] != 0;
+		else if (key == "devices" && n == 1 && v[0] >= 1 && v[0] <= 255)
+			devices = (int)v[0];
+		else
+		{
+			DbgPrintf("emulator: invalid '%s'\n", item.c_str());
+			return false;
+		}
+	}
+
+	DbgPrintf("emulator: model %d rate %u %zu tones %zu rf%s%s\n", model, (uint32_t)adcRate,
+		tones.size(), rfTones.size(), noiseRms > 0 ? " noise" : "", hasChirp ? " chirp" : "");
+	return true;
+}
+
+bool fx3emulator::Open()
+{
+	return true;
+}
+
+bool fx3emulator::Control(FX3Command command, uint8_t data)
+{
+	switch (command)
+	{
+	case STARTFX3:
+		producing = true;
+		break;
+	case STOPFX3:
+		producing = false;
+		break;
+	case TUNERSTDBY:
+		tunerOn = false;
+		break;
+	case RESETFX3:
+		producing = false;
+		gpio = 0;
+		break;
+	default:
+		break;
+	}
+	return true;
+}
+
+bool fx3emulator::Control(FX3Command command, uint32_t data)
+{
+	switch (command)
+	{
+	case GPIOFX3:
+		gpio = data;
+		break;
+	case STARTADC:
+		if (data < MIN_ADC_FREQ || data > MAX_ADC_FREQ)
+			return false;
+		adcRate = data;
+		break;
+	case TUNERINIT:
+		tunerOn = true;
+		break;
+	default:
+		return Control(command, (uint8_t)data);
+	}
+	return true;
+}
+
+bool fx3emulator::Control(FX3Command command, uint64_t data)
+{
+	if (command == TUNERTUNE)
+	{
+		tunerFreq = data;
+		return true;
+	}
+	return Control(command, (uint32_t)data);
+}
+
+bool fx3emulator::SetArgument(uint16_t index, uint16_t value)
+{
+	if (index >= 256)
+		return false;
+	args[index] = value;
+	return true;
+}
+
+bool fx3emulator::GetHardwareInfo(uint32_t* data)
+{
+	const uint8_t d[4] = {
+		(uint8_t)model, FIRMWARE_VER_MAJOR, FIRMWARE_VER_MINOR, 0
+	};
+
+	memcpy(data, d, sizeof(d));
+	return true;
+}
+
+bool fx3emulator::ReadDebugTrace(uint8_t* pdata, uint8_t len)
+{
+	if (len > 0)
+		pdata[0] = 0;
+	return true;
+}
+
+bool fx3emulator::Enumerate(unsigned char& idx, char* lbuf)
+{
+	if (idx >= devices)
+		return false;
+
+	sprintf(lbuf, "SDDC emulator      sn:EMU%05d", idx);
+	return true;
+}
+
+void fx3emulator::SetupSignal(double rate)
+{
+	for (size_t i = 0; i < tones.size(); i++)
+	{
+		double w = two_pi * toneFreqs[i] / rate;
+		tones[i].re = 1.0;
+		tones[i].im = 0.0;
+		tones[i].c = cos(w);
+		tones[i].s = sin(w);
+	}
+
+	if (hasChirp)
+	{
+		sweep.length = (uint64_t)(sweep.period * rate);
+		if (sweep.length == 0)
+			sweep.length = 1;
+		sweep.pos = 0;
+		sweep.re = 1.0;
+		sweep.im = 0.0;
+		double dw = two_pi * (sweep.stop - sweep.start) / sweep.length / rate;
+		sweep.ddre = cos(dw);
+		sweep.ddim = sin(dw);
+	}
+
+	signalRate = rate;
+	SetupTuner(rate, tunerLo);
+}
+
+double fx3emulator::TunerLo() const
+{
+	if (!tunerOn)
+		return 0.0;
+
+	switch (model)
+	{
+	case BBRF103:
+	case RX888:
+	case RX888r2:
+		return (tunerFreq + r82xx_if) * refScale;
+	case RX888r3:
+		return tunerFreq * 1e6 * refScale;
+	default:
+		return 0.0;
+	}
+}
+
+void fx3emulator::SetupTuner(double rate, double lo)
+{
+	const double ifFreq = model == RX888r3 ? r3_if : r82xx_if;
+	const double band = model == RX888r3 ? r3_band : r82xx_band;
+
+	// the rotators go on with their phase at the new frequency
+	for (size_t i = 0; i < rfTones.size(); i++)
+	{
+		double f = lo - rfFreqs[i];
+		double w = two_pi * f / rate;
+		if (rfTones[i].re == 0.0 && rfTones[i].im == 0.0)
+			rfTones[i].re = 1.0;
+		rfTones[i].amplitude = lo > 0 && fabs(f - ifFreq) < band ? rfLevels[i] : 0.0;
+		rfTones[i].c = cos(w);
+		rfTones[i].s = sin(w);
+	}
+	tunerLo = lo;
+}
+
+void fx3emulator::Generate(int16_t* output, int n)
+{
+	// the tones are at their true frequency, the ADC samples at what its clock really is
+	const double rate = adcRate * refScale;
+	if (rate != signalRate)
+		SetupSignal(rate);
+
+	// DAT31 attenuates in 0.5 dB steps
+	const double att = pow(10.0, -0.5 * args[DAT31_ATT] / 20.0);
+	const bool rand = (gpio & RANDO) != 0;
+
+	// a retune is heard after the PLL locked
+	const double lo = TunerLo();
+	if (lo != tunerLo)
+	{
+		SetupTuner(rate, lo);
+		settleLeft = (uint64_t)(settleTime * rate);
+	}
+	const int unlocked = (int)std::min<uint64_t>(settleLeft, n);
+	settleLeft -= unlocked;
+
+	// the samples of the block that are in the burst
+	const uint64_t burstFirst = (uint64_t)(burstStart * rate);
+	const uint64_t burstEnd = burstFirst + (uint64_t)(burstLength * rate);
+	const double burstW = two_pi * burstFreq / rate;
+
+	for (int m = 0; m < n; m++)
+	{
+		double x = 0.0;
+		double vhf = 0.0;
+
+		if (m >= unlocked)
+		{
+			for (auto& t : rfTones)
+			{
+				vhf += t.amplitude * t.im;
+				double re = t.re * t.c - t.im * t.s;
+				t.im = t.re * t.s + t.im * t.c;
+				t.re = re;
+			}
+		}
+
+		for (auto& t : tones)
+		{
+			x += t.amplitude * t.im;
+			double re = t.re * t.c - t.im * t.s;
+			t.im = t.re * t.s + t.im * t.c;
+			t.re = re;
+		}
+
+		if (hasChirp)
+		{
+			if (sweep.pos == 0)
+			{
+				double w = two_pi * sweep.start / rate;
+				sweep.dre = cos(w);
+				sweep.dim = sin(w);
+			}
+			x += sweep.amplitude * sweep.im;
+			double re = sweep.re * sweep.dre - sweep.im * sweep.dim;
+			sweep.im = sweep.re * sweep.dim + sweep.im * sweep.dre;
+			sweep.re = re;
+			double dre = sweep.dre * sweep.ddre - sweep.dim * sweep.ddim;
+			sweep.dim = sweep.dre * sweep.ddim + sweep.dim * sweep.ddre;
+			sweep.dre = dre;
+			if (++sweep.pos == sweep.length)
+				sweep.pos = 0;
+		}
+
+		const uint64_t at = generated + m;
+		if (burstAmplitude > 0.0 && at >= burstFirst && at < burstEnd)
+			x += burstAmplitude * sin(burstW * (double)(at - burstFirst));
+
+		if (noiseRms > 0.0)
+		{
+			// sum of 4 uniforms, scaled to unit variance
+			double u = 0.0;
+			for (int k = 0; k < 4; k++)
+			{
+				rng ^= rng << 13;
+				rng ^= rng >> 7;
+				rng ^= rng << 17;
+				u += (rng >> 11) * (1.0 / 9007199254740992.0);
+			}
+			x += noiseRms * (u - 2.0) * 1.7320508075688772;
+		}
+
+		x = floor(x * att + vhf + 0.5);
+		int16_t val;
+		if (x >= 32767.0)
+			val = 32767;
+		else if (x <= -32768.0)
+			val = -32768;
+		else
+			val = (int16_t)x;
+
+		if (rand && (val & 1))
+			val ^= -2;
+
+		output[m] = val;
+	}
+	generated += n;
+
+	// keep the rotators on the unit circle
+	for (auto* v : { &tones, &rfTones })
+	{
+		for (auto& t : *v)
+		{
+			double g = 1.0 / sqrt(t.re * t.re + t.im * t.im);
+			t.re *= g;
+			t.im *= g;
+		}
+	}
+	if (hasChirp)
+	{
+		double g = 1.0 / sqrt(sweep.re * sweep.re + sweep.im * sweep.im);
+		sweep.re *= g;
+		sweep.im *= g;
+		g = 1.0 / sqrt(sweep.dre * sweep.dre + sweep.dim * sweep.dim);
+		sweep.dre *= g;
+		sweep.dim *= g;
+	}
+}
+
+void fx3emulator::Produce()
+{
+	ApplyThreadSched(eventSched);
+
+	const int samples = inputbuffer->getBlockSize();
+	std::vector<int16_t> scratch(samples);
+	uint64_t adcSample = 0;
+	uint64_t pendingDrop = 0;
+	auto next = steady_clock::now();
+	auto begin = next;      // of the emulated clock, moved on past the pauses
+
+	while (run)
+	{
+		if (!producing || finished)
+		{
+			std::this_thread::sleep_for(milliseconds(1));
+			auto now = steady_clock::now();
+			begin += now - next;
+			next = now;
+			continue;
+		}
+
+		int16_t* ptr;
+		if (realtime)
+		{
+			// one block per transfer time at the ADC rate
+			next += duration_cast<steady_clock::duration>(duration<double>((double)samples / adcRate));
+			auto now = steady_clock::now();
+			if (next > now)
+				std::this_thread::sleep_until(next);
+			else if (now - next > seconds(1))
+			{
+				// the source can not keep up, do not burst
+				begin += now - next;
+				next = now;
+			}
+			clockNs = duration_cast<nanoseconds>(next - begin).count();
+
+			// same as the USB completion: never wait for the consumer
+			ptr = inputbuffer->tryGetWritePtr();
+		}
+		else
+		{
+			// as fast as the pipeline consumes, nothing is lost
+			ptr = inputbuffer->getWritePtr();
+			if (!run)
+				break;
+		}
+
+		if (!Fill(ptr ? ptr : scratch.data(), samples))
+		{
+			DbgPrintf("emulator: end of the source after %" PRIu64 " samples\n", adcSample);
+			finished = true;
+			continue;
+		}
+
+		if (ptr == nullptr)
+		{
+			pendingDrop += samples;
+			adcSample += samples;
+			produced = adcSample;
+			continue;
+		}
+
+		auto meta = inputbuffer->getWriteMeta();
+		meta->stamp();
+		meta->sample = adcSample;
+		meta->flags = pendingDrop ? BLOCK_DISCONTINUITY : 0;
+		meta->dropped = pendingDrop;
+		meta->generation = inputbuffer->getGeneration();
+		adcSample += samples;
+		pendingDrop = 0;
+		inputbuffer->WriteDone();
+		produced = adcSample;
+	}
+}
+
+bool fx3emulator::StartStream(ringbuffer<int16_t>& input, int numofblock)
+{
+	inputbuffer = &input;
+	finished = false;
+	produced = 0;
+	clockNs = 0;
+	generated = 0;
+	run = true;
+	produce_thread = std::thread([this]() { this->Produce(); });
+	return true;
+}
+
+void fx3emulator::StopStream()
+{
+	if (!run)
+		return;
+
+	run = false;
+	produce_thread.join();
+}
@@ -0,0 +1,145 @@
+#ifndef FX3EMULATOR_H
+#define FX3EMULATOR_H
+
+//
+// fx3emulator: an fx3class without hardware
+// It reports one device of the configured RadioModel, keeps the GPIO,
+// tuner, ADC and argument state set through the FX3 commands, and while
+// the producer is on (STARTFX3..STOPFX3) streams synthesized ADC samples
+// at the ADC rate, paced like the USB transfers would be.
+//
+// Configuration string, comma separated:
+//   model=<none|bbrf103|hf103|rx888|rx888r2|rx888r3|rx999|rxlucy>  (rx888r3)
+//   rate=<Hz>                  ADC rate until STARTADC sets one (64000000)
+//   tone=<Hz>[:<dBFS>]         sine at the ADC input, repeatable (0 dBFS)
+//   noise=<dBFS>               white gaussian noise, rms level
+//   chirp=<Hz>:<Hz>:<s>[:<dBFS>]   linear sweep from..to in s seconds, repeating
+//   burst=<Hz>:<s>:<s>[:<dBFS>]    sine from s seconds after StartStream for s seconds, once
+//   rf=<Hz>[:<dBFS>]           sine at the VHF antenna, through the tuner, repeatable
+//   settle=<s>                 the tuner PLL locks s seconds after a retune (0)
+//   ppm=<ppm>                  error of the reference of the ADC clock and the tuner PLL (0)
+//   realtime=<0|1>             0 streams as fast as the pipeline consumes (1)
+//   devices=<n>                devices listed by Enumerate, each open one is independent (1)
+// Levels above full scale saturate like the ADC does, e.g. tone=1e6:3
+// clips. DAT31_ATT attenuates and RANDO randomizes the samples.
+// The tuner, on from TUNERINIT to TUNERSTDBY, mixes an rf sine to LO - rf
+// at the ADC when that is in its IF band: the R82xx of the rx888r2, bbrf103
+// and rx888 with the LO 4.57 MHz over TUNERTUNE, that of the rx888r3 with
+// TUNERTUNE the LO in MHz and a 20 MHz IF. While the PLL locks there is none.
+// DAT31_ATT is not in the way of the tuner.
+//
+// CreateUsbHandler() returns an emulator when SDDC_EMULATOR is set,
+// e.g. SDDC_EMULATOR="model=rx888r2,tone=10e6:-20,noise=-70".
+//
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "FX3Class.h"
+
+class fx3emulator : public fx3class
+{
+public:
+	fx3emulator();
+	virtual ~fx3emulator(void);
+
+	bool Configure(const char* config);
+
+	bool Open() override;
+	bool Control(FX3Command command, uint8_t data = 0) override;
+	bool Control(FX3Command command, uint32_t data) override;
+	bool Control(FX3Command command, uint64_t data) override;
+	bool SetArgument(uint16_t index, uint16_t value) override;
+	bool GetHardwareInfo(uint32_t* data) override;
+	bool ReadDebugTrace(uint8_t* pdata, uint8_t len) override;
+	bool StartStream(ringbuffer<int16_t>& input, int numofblock) override;
+	void StopStream() override;
+	void SetEventThreadSched(const thread_sched& sched) override { eventSched = sched; }
+	bool Enumerate(unsigned char& idx, char* lbuf) override;
+
+	// emulated device state
+	uint32_t GetAdcRate() const { return adcRate; }
+	uint32_t GetGpio() const { return gpio; }
+	bool IsProducing() const { return producing; }
+	bool IsTunerOn() const { return tunerOn; }
+	uint64_t GetTunerFreq() const { return tunerFreq; }
+	uint16_t GetArgument(uint16_t index) const { return index < 256 ? args[index].load() : 0; }
+
+	// true once the source has no more samples, see Fill()
+	bool IsFinished() const { return finished; }
+	// ADC samples of the stream since StartStream, the ones the consumer lost included
+	uint64_t GetProducedSamples() const { return produced; }
+	// ns the pacing of the stream ran for since StartStream with realtime=1, the
+	// time it was stopped or could not keep up left out: the emulated ADC clock
+	int64_t GetClockNs() const { return clockNs; }
+
+	// fill n samples of the signal and advance it, used by the stream
+	void Generate(int16_t* output, int n);
+
+protected:
+	// next block of the stream, false when the source is exhausted
+	virtual bool Fill(int16_t* output, int n) { Generate(output, n); return true; }
+
+private:
+	struct tone {
+		double amplitude;
+		double re, im;          // rotator
+		double c, s;            // step per sample
+	};
+
+	struct chirp {
+		double amplitude;
+		double start, stop;     // Hz
+		double period;          // s
+		uint64_t length;        // samples per sweep at the current rate
+		uint64_t pos;
+		double re, im;          // rotator
+		double dre, dim;        // step of the current frequency
+		double ddre, ddim;      // frequency step per sample
+	};
+
+	void SetupSignal(double rate);
+	double TunerLo() const;
+	void SetupTuner(double rate, double lo);
+	void Produce();
+
+	RadioModel model;
+	bool realtime;
+	int devices;
+	std::vector<double> toneFreqs;
+	std::vector<tone> tones;
+	std::vector<double> rfFreqs;
+	std::vector<double> rfLevels;
+	std::vector<tone> rfTones;
+	double settleTime;
+	double refScale;            // real over nominal frequency of the reference, of ppm
+	double tunerLo;             // LO the rf tones are set up for, 0 when off
+	uint64_t settleLeft;        // samples until the PLL is locked
+	double noiseRms;
+	chirp sweep;
+	bool hasChirp;
+	double burstFreq;
+	double burstStart, burstLength;     // s
+	double burstAmplitude;              // 0 for none
+	uint64_t generated;                 // samples generated since StartStream
+	uint64_t rng;
+	double signalRate;          // rate the rotators are set up for
+
+	std::atomic<uint32_t> adcRate;
+	std::atomic<uint32_t> gpio;
+	std::atomic<bool> producing;
+	std::atomic<bool> tunerOn;
+	std::atomic<uint64_t> tunerFreq;
+	std::atomic<uint16_t> args[256];
+
+	ringbuffer<int16_t>* inputbuffer;
+	std::atomic<bool> finished;
+	std::atomic<uint64_t> produced;
+	std::atomic<int64_t> clockNs;
+	thread_sched eventSched;
+	std::atomic<bool> run;
+	std::thread produce_thread;
+};
+
+#endif // FX3EMULATOR_H
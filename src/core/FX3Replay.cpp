@@ -0,0 +1,252 @@
+#include "license.txt"
+#include "FX3Replay.h"
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+fx3class* CreateReplayHandler(const char* config)
+{
+	auto replay = new fx3replay();
+	if (!replay->Configure(config ? config : ""))
+	{
+		delete replay;
+		return nullptr;
+	}
+	return replay;
+}
+
+fx3replay::fx3replay() :
+	offset(0),
+	loop(false),
+	data(nullptr),
+	length(0),
+	pos(0),
+	view(nullptr),
+	viewSize(0),
+#ifdef _WIN32
+	file(INVALID_HANDLE_VALUE),
+	mapping(nullptr)
+#else
+	fd(-1)
+#endif
+{
+}
+
+fx3replay::~fx3replay(void)
+{
+	// the producer reads the mapping
+	StopStream();
+	Unmap();
+}
+
+bool fx3replay::Configure(const char* config)
+{
+	std::string cfg(config);
+	if (cfg.find('=') == std::string::npos)
+		cfg = "file=" + cfg;
+
+	// take our keys, the rest configures the emulated device
+	std::string rest;
+	size_t p = 0;
+	while (p < cfg.size())
+	{
+		size_t end = cfg.find(',', p);
+		if (end == std::string::npos)
+			end = cfg.size();
+		std::string item = cfg.substr(p, end - p);
+		p = end + 1;
+
+		size_t eq = item.find('=');
+		std::string key = item.substr(0, eq);
+		const char* value = eq == std::string::npos ? "" : item.c_str() + eq + 1;
+		char* stop;
+
+		if (key == "file")
+			path = value;
+		else if (key == "offset")
+		{
+			offset = strtoull(value, &stop, 0);
+			if (stop == value || *stop != '\0' || (offset & 1))
+			{
+				DbgPrintf("replay: invalid '%s'\n", item.c_str());
+				return false;
+			}
+		}
+		else if (key == "loop")
+		{
+			long v = strtol(value, &stop, 10);
+			if (stop == value || *stop != '\0')
+			{
+				DbgPrintf("replay: invalid '%s'\n", item.c_str());
+				return false;
+			}
+			loop = v != 0;
+		}
+		else if (!item.empty())
+		{
+			if (!rest.empty())
+				rest += ',';
+			rest += item;
+		}
+	}
+
+	if (path.empty())
+	{
+		DbgPrintf("replay: no file\n");
+		return false;
+	}
+
+	if (!fx3emulator::Configure(rest.c_str()) || !Map())
+		return false;
+
+	DbgPrintf("replay: %s %" PRIu64 " samples%s\n", path.c_str(), length, loop ? " loop" : "");
+	return true;
+}
+
+bool fx3replay::Enumerate(unsigned char& idx, char* lbuf)
+{
+	if (idx > 0)
+		return false;
+
+	strcpy(lbuf, "SDDC replay        sn:REPLAY00");
+	return true;
+}
+
+bool fx3replay::StartStream(ringbuffer<int16_t>& input, int numofblock)
+{
+	// the sample counter starts over, so does the capture
+	pos = 0;
+	return fx3emulator::StartStream(input, numofblock);
+}
+
+bool fx3replay::Map()
+{
+	uint64_t size;
+
+#ifdef _WIN32
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		DbgPrintf("replay: can not open %s\n", path.c_str());
+		return false;
+	}
+	LARGE_INTEGER li;
+	if (!GetFileSizeEx(file, &li))
+		return false;
+	size = li.QuadPart;
+#else
+	fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		DbgPrintf("replay: can not open %s: %s\n", path.c_str(), strerror(errno));
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+		return false;
+	size = st.st_size;
+#endif
+
+	if (size < offset + sizeof(int16_t))
+	{
+		DbgPrintf("replay: %s has no samples after offset %" PRIu64 "\n", path.c_str(), offset);
+		return false;
+	}
+	if ((uint64_t)(size_t)size != size)
+	{
+		DbgPrintf("replay: %s is too large to map\n", path.c_str());
+		return false;
+	}
+
+#ifdef _WIN32
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL)
+		return false;
+	view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == NULL)
+	{
+		DbgPrintf("replay: MapViewOfFile failed %lu\n", GetLastError());
+		return false;
+	}
+#else
+	view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (view == MAP_FAILED)
+	{
+		view = nullptr;
+		DbgPrintf("replay: mmap failed: %s\n", strerror(errno));
+		return false;
+	}
+	// read ahead, the pages are touched once in order
+	madvise(view, size, MADV_SEQUENTIAL);
+#endif
+
+	viewSize = size;
+	data = (const int16_t*)((const char*)view + offset);
+	length = (size - offset) / sizeof(int16_t);
+	pos = 0;
+	return true;
+}
+
+void fx3replay::Unmap()
+{
+#ifdef _WIN32
+	if (view)
+		UnmapViewOfFile(view);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	mapping = nullptr;
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (view)
+		munmap(view, viewSize);
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
+#endif
+	view = nullptr;
+	data = nullptr;
+}
+
+bool fx3replay::Fill(int16_t* output, int n)
+{
+	uint64_t at = pos;
+
+	if (!loop)
+	{
+		// the last partial block is not streamed
+		if (length - at < (uint64_t)n)
+			return false;
+		memcpy(output, data + at, n * sizeof(int16_t));
+		pos = at + n;
+		return true;
+	}
+
+	while (n > 0)
+	{
+		uint64_t chunk = std::min<uint64_t>(n, length - at);
+		memcpy(output, data + at, chunk * sizeof(int16_t));
+		output += chunk;
+		n -= (int)chunk;
+		at += chunk;
+		if (at == length)
+			at = 0;
+	}
+	pos = at;
+	return true;
+}
@@ -0,0 +1,77 @@
+#ifndef FX3REPLAY_H
+#define FX3REPLAY_H
+
+//
+// fx3replay: an fx3class streaming a raw ADC capture
+// The file holds the int16 ADC samples as they came out of the USB
+// transfers (native byte order, no header), e.g. a raw dump of the
+// inputbuffer. It is memory mapped and copied block by block into the
+// inputbuffer, so RadioHandlerClass and r2iq run exactly as with the
+// hardware. The device state (model, ADC rate, GPIO, tuner, ..) is the
+// one of fx3emulator; the samples are replayed as recorded, the gains
+// and RANDO set through the commands do not change them.
+//
+// Configuration string, comma separated:
+//   file=<path>                the capture, required
+//   offset=<bytes>             skip a header or the start of the capture (0)
+//   loop=<0|1>                 restart at offset at the end of the file (0)
+//   realtime=<0|1>             1 paces the blocks at the ADC rate and drops
+//                              them when the pipeline falls behind, like the
+//                              USB transfers; 0 streams as fast as the
+//                              pipeline consumes, without losing a block (1)
+//   model=.., rate=..          as for fx3emulator
+// A bare path is the same as file=<path>. Without loop the stream ends
+// with the last full block, IsFinished() then returns true. A loop
+// restart is not flagged, the sample counter keeps running. Every
+// StartStream, i.e. every start of the pipeline, replays from offset.
+//
+// CreateUsbHandler() returns a replay when SDDC_REPLAY is set,
+// e.g. SDDC_REPLAY="file=capture.raw,rate=64e6,realtime=0".
+//
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include "FX3Emulator.h"
+
+class fx3replay : public fx3emulator
+{
+public:
+	fx3replay();
+	virtual ~fx3replay(void);
+
+	bool Configure(const char* config);
+
+	bool Enumerate(unsigned char& idx, char* lbuf) override;
+	bool StartStream(ringbuffer<int16_t>& input, int numofblock) override;
+
+	// capture length and position, in samples
+	uint64_t GetLength() const { return length; }
+	uint64_t GetPosition() const { return pos; }
+
+protected:
+	bool Fill(int16_t* output, int n) override;
+
+private:
+	bool Map();
+	void Unmap();
+
+	std::string path;
+	uint64_t offset;
+	bool loop;
+
+	const int16_t* data;        // mapped capture, from offset
+	uint64_t length;
+	std::atomic<uint64_t> pos;
+
+	void* view;                 // mapping as returned by the OS
+	size_t viewSize;
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#else
+	int fd;
+#endif
+};
+
+#endif // FX3REPLAY_H
@@ -3,12 +3,16 @@
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#include <math.h>
+#include <algorithm>
 #include "pffft/pf_mixer.h"
 #include "RadioHandler.h"
 #include "config.h"
 #include "fft_mt_r2iq.h"
 #include "config.h"
 #include "PScope_uti.h"
+#include "recorder.h"
+#include "history.h"
 #include "../Interface.h"
 
 #include <chrono>
@@ -19,23 +23,65 @@ using namespace std::chrono;
 
 unsigned long Failures = 0;
 
-void RadioHandlerClass::OnDataPacket()
+// an output besides the main one: its ring, the fine tuning of its callback
+// thread and its settings
+struct RadioHandlerClass::output_channel {
+	output_channel(int blocks, uint64_t freq) :
+		ring(blocks),
+		fc(0.0f),
+		freq(freq),
+		decimate(-1),
+		enabled(true)
+	{
+	}
+
+	ringbuffer<float> ring;
+	shift_limited_unroll_C_sse_data_t stateFineTune;
+	float fc;
+	uint64_t freq;      // wished frequency
+	int decimate;       // -1 for the one of Start
+	bool enabled;
+	std::thread thread;
+};
+
+void RadioHandlerClass::OnDataPacket(int channel)
 {
-	auto len = outputbuffer.getBlockSize() / 2 / sizeof(float);
+	output_channel* const ch = channel == 0 ? nullptr : channels[channel - 1];
+	ringbuffer<float>& ring = ch ? ch->ring : outputbuffer;
+	shift_limited_unroll_C_sse_data_t* const state = ch ? &ch->stateFineTune : stateFineTune;
+	float& shift = ch ? ch->fc : fc;
+	auto len = ring.getBlockSize() / 2 / sizeof(float);
+	const bool hold = holdBlocks;
 
 	while(run)
 	{
-		auto buf = outputbuffer.getReadPtr();
+		auto buf = hold ? ring.getHoldPtr() : ring.getReadPtr();
 
 		if (!run)
 			break;
 
-		if (fc != 0.0f)
+		const blockmeta& meta = hold ? *ring.getHoldMeta() : *ring.getReadMeta();
+		if (channel == 0 && (meta.flags & BLOCK_DISCONTINUITY))
 		{
-			std::unique_lock<std::mutex> lk(fc_mutex);
-			shift_limited_unroll_C_sse_inp_c((complexf*)buf, len, stateFineTune);
+			droppedSamples += meta.dropped;
+			discontinuities++;
 		}
 
+		// the fine tuning, from the sample the r2iq made the retune at
+		uint32_t done = 0;
+		if (meta.shift != shift)
+		{
+			done = (meta.flags & BLOCK_RETUNED) ? std::min<uint32_t>(meta.tuneOffset, len) : 0;
+			if (shift != 0.0f && done > 0)
+				shift_limited_unroll_C_sse_inp_c((complexf*)buf, done, state);
+			// the mixer goes on from its phase, no step in the output
+			float phase = atan2f(state->phase_state_q[0], state->phase_state_i[0]);
+			*state = shift_limited_unroll_C_sse_init(meta.shift, phase);
+			shift = meta.shift;
+		}
+		if (shift != 0.0f)
+			shift_limited_unroll_C_sse_inp_c((complexf*)buf + done, len - done, state);
+
 #ifdef _DEBUG		//PScope buffer screenshot
 		if (saveADCsamplesflag == true)
 		{
@@ -48,18 +94,50 @@ void RadioHandlerClass::OnDataPacket()
 		}
 #endif
 
-		Callback(callbackContext, buf, len);
+		// the recordings and the time machine are of the main channel
+		if (channel == 0)
+		{
+			if (iqRecorder->IsOpen())
+				iqRecorder->Push(buf, len * 2 * sizeof(float), meta);
+			if (historyIQ)
+				timeMachine->Push(buf, len * 2 * sizeof(float), meta);
+			if (historyLevel > 0 && meta.peak >= historyLevel && timeMachine->IsOpen() && !timeMachine->IsCapturing())
+			{
+				// the block that crossed the level, in ADC samples for the raw history that
+				// is ahead of this block by the rings and the r2iq
+				const uint64_t ratio = historyIQ ? 1 : 2 << meta.decimation;
+				char name[32];
+				snprintf(name, sizeof(name), "-%04u", historyCaptures);
+				if (timeMachine->TriggerSamples((historyBase + name).c_str(), historyPre, historyPost,
+					meta.sample * ratio, (meta.sample + len) * ratio - 1))
+					historyCaptures++;
+			}
+		}
+
+		if (CallbackEx)
+			CallbackEx(callbackContext, buf, len, meta);
+		else
+			Callback(callbackContext, buf, len);
 
-		outputbuffer.ReadDone();
+		// a holding reader frees the block with ReleaseBlock()
+		if (hold)
+			ring.HoldDone();
+		else
+			ring.ReadDone();
 
-		SamplesXIF += len;
+		if (channel == 0)
+			SamplesXIF += len;
 	}
 }
 
 RadioHandlerClass::RadioHandlerClass() :
+	r2iqCntrl(nullptr),
+	Callback(nullptr),
+	CallbackEx(nullptr),
 	DbgPrintFX3(nullptr),
 	GetConsoleIn(nullptr),
 	run(false),
+	holdBlocks(false),
 	pga(false),
 	dither(false),
 	randout(false),
@@ -67,16 +145,51 @@ RadioHandlerClass::RadioHandlerClass() :
 	biasT_VHF(false),
 	firmware(0),
 	modeRF(NOMODE),
+	transferSize(DEFAULT_TRANSFER_SIZE),
+	concurrentTransfers(DEFAULT_CONCURRENT_TRANSFERS),
+	outputbuffer(DEFAULT_OUTPUT_BLOCKS),
+	rolloverBytes(0),
+	rolloverSeconds(0.0),
+	rawRecorder(new recorder()),
+	iqRecorder(new recorder()),
+	tunedFreq(0),
+	loFreq(0),
+	attIdx(0),
+	gainIdx(0),
+	timeMachine(new history()),
+	historySeconds(0.0),
+	historyIQ(false),
+	historyLevel(0),
+	historyPre(0.0),
+	historyPost(0.0),
+	historyCaptures(0),
+	spectrumDetector(new detector()),
+	detectThreshold(0.0f),
+	detectTau(1.0),
+	detectAverage(1),
+	detectMinBins(1),
+	droppedSamples(0),
+	discontinuities(0),
 	adcrate(DEFAULT_ADC_FREQ),
+	ppm(0.0),
 	fc(0.0f),
 	hardware(new DummyRadio(nullptr))
 {
 	stateFineTune = new shift_limited_unroll_C_sse_data_t();
+
+	ThreadSchedDefaults(schedConfig);
+	ThreadSchedFromEnv(schedConfig);
 }
 
 RadioHandlerClass::~RadioHandlerClass()
 {
+	for (auto ch : channels)
+		delete ch;
 	delete stateFineTune;
+	delete rawRecorder;
+	delete iqRecorder;
+	delete timeMachine;
+	delete spectrumDetector;
 }
 
 const char *RadioHandlerClass::getName() const
@@ -84,6 +197,12 @@ const char *RadioHandlerClass::getName() const
 	return hardware->getName();
 }
 
+bool RadioHandlerClass::Init(fx3class* Fx3, void (*callback)(void*context, const float*, uint32_t, const blockmeta&), r2iqControlClass *r2iqCntrl, void *context)
+{
+	this->CallbackEx = callback;
+	return Init(Fx3, (void (*)(void*, const float*, uint32_t))nullptr, r2iqCntrl, context);
+}
+
 bool RadioHandlerClass::Init(fx3class* Fx3, void (*callback)(void*context, const float*, uint32_t), r2iqControlClass *r2iqCntrl, void *context)
 {
 	uint8_t rdata[4];
@@ -144,11 +263,275 @@ bool RadioHandlerClass::Init(fx3class* Fx3, void (*callback)(void*context, const
 	return true;
 }
 
-bool RadioHandlerClass::Start(int srate_idx)
+bool RadioHandlerClass::SetTransferParams(uint32_t size, uint32_t count)
 {
-	Stop();
-	DbgPrintf("RadioHandlerClass::Start\n");
+	if (size % 16384 != 0 || count < 1 || count > QUEUE_SIZE)
+	{
+		DbgPrintf("invalid transfer size %u or count %u\n", size, count);
+		return false;
+	}
+	if (r2iqCntrl && !r2iqCntrl->checkBlockSize(size / sizeof(int16_t)))
+	{
+		DbgPrintf("transfer size %u does not match the r2iq fft overlap\n", size);
+		return false;
+	}
+
+	transferSize = size;
+	concurrentTransfers = count;
+	return true;
+}
+
+bool RadioHandlerClass::SetOutputBlocks(int count)
+{
+	if (run || count < MIN_OUTPUT_BLOCKS || count > MAX_OUTPUT_BLOCKS)
+	{
+		DbgPrintf("can not use %d output blocks\n", count);
+		return false;
+	}
+
+	outputbuffer.setCount(count);
+	for (auto ch : channels)
+		ch->ring.setCount(count);
+	return true;
+}
+
+bool RadioHandlerClass::SetChannels(int count)
+{
+	if (run || !r2iqCntrl || count < 1 || count > r2iqCntrl->getMaxChannels())
+	{
+		DbgPrintf("can not make %d channels\n", count);
+		return false;
+	}
+
+	while ((int)channels.size() > count - 1)
+	{
+		r2iqCntrl->setChannelOutput((int)channels.size(), nullptr);
+		delete channels.back();
+		channels.pop_back();
+	}
+	while ((int)channels.size() < count - 1)
+	{
+		channels.push_back(new output_channel(outputbuffer.getCount(), tunedFreq));
+		r2iqCntrl->setChannelOutput((int)channels.size(), &channels.back()->ring);
+		RetuneChannel((int)channels.size());
+	}
+	return true;
+}
+
+bool RadioHandlerClass::TuneChannel(int channel, uint64_t freq)
+{
+	if (channel == 0)
+	{
+		TuneLO(freq);
+		return true;
+	}
+	if (channel < 0 || channel > (int)channels.size())
+		return false;
+
+	const uint64_t was = channels[channel - 1]->freq;
+	channels[channel - 1]->freq = freq;
+	if (!RetuneChannel(channel))
+	{
+		channels[channel - 1]->freq = was;
+		return false;
+	}
+	SettingsChanged();
+	return true;
+}
+
+bool RadioHandlerClass::RetuneChannel(int channel)
+{
+	// as the main one in TuneLO, the band at the ADC starts at the tuner LO
+	const double nyquist = GetEffectiveSampleRate() / 2;
+	const int64_t offset = (int64_t)channels[channel - 1]->freq - (int64_t)loFreq;
+	if (offset < 0 || offset > nyquist)
+	{
+		DbgPrintf("channel %d at %" PRIu64 " is outside the band of the tuner LO\n", channel, channels[channel - 1]->freq);
+		return false;
+	}
+	r2iqCntrl->setChannelOffset(channel, (float)(offset / nyquist));
+	return true;
+}
+
+uint64_t RadioHandlerClass::GetChannelFrequency(int channel) const
+{
+	if (channel == 0)
+		return tunedFreq;
+	if (channel < 0 || channel > (int)channels.size())
+		return 0;
+	return channels[channel - 1]->freq;
+}
+
+bool RadioHandlerClass::SetChannelRate(int channel, int srate_idx)
+{
+	if (channel == 0)
+		return UpdateOutputRate(srate_idx);
+	if (channel < 0 || channel > (int)channels.size())
+		return false;
+
+	const int decimate = Decimation(srate_idx);
+	channels[channel - 1]->decimate = decimate;
+	r2iqCntrl->setChannelDecimate(channel, decimate);
+	SettingsChanged();
+	return true;
+}
+
+bool RadioHandlerClass::EnableChannel(int channel, bool enable)
+{
+	if (channel == 0)
+		return enable;
+	if (channel < 0 || channel > (int)channels.size())
+		return false;
+
+	channels[channel - 1]->enabled = enable;
+	r2iqCntrl->enableChannel(channel, enable);
+	return true;
+}
+
+void RadioHandlerClass::ReleaseBlock(int channel)
+{
+	if (channel == 0)
+		outputbuffer.ReadDone();
+	else
+		channels[channel - 1]->ring.ReadDone();
+}
+
+void RadioHandlerClass::SetRecording(const char* rawBase, const char* iqBase, uint64_t rolloverBytes, double rolloverSeconds)
+{
+	this->rawBase = rawBase ? rawBase : "";
+	this->iqBase = iqBase ? iqBase : "";
+	this->rolloverBytes = rolloverBytes;
+	this->rolloverSeconds = rolloverSeconds;
+}
+
+void RadioHandlerClass::SetHistory(double seconds, bool iq)
+{
+	historySeconds = seconds;
+	historyIQ = iq;
+	if (seconds <= 0 && !run)
+		timeMachine->Close();
+}
 
+bool RadioHandlerClass::TriggerHistory(const char* base, double pre, double post, int64_t atNs)
+{
+	return run && timeMachine->Trigger(base, pre, post, atNs);
+}
+
+void RadioHandlerClass::SetHistoryTrigger(int level, const char* base, double pre, double post)
+{
+	historyLevel = base ? level : 0;
+	historyBase = base ? base : "";
+	historyPre = pre;
+	historyPost = post;
+}
+
+bool RadioHandlerClass::SetDetector(float threshold, double tau, int average, int minBins, detection_cb callback, void* context)
+{
+	if (threshold > 0 && (tau <= 0 || average < 1 || minBins < 1))
+		return false;
+
+	detectThreshold = threshold > 0 ? threshold : 0.0f;
+	detectTau = tau;
+	detectAverage = average;
+	detectMinBins = minBins;
+	spectrumDetector->SetCallback(callback, context);
+	return true;
+}
+
+void RadioHandlerClass::StartRecording(int decimate)
+{
+	recorder_info info;
+	info.gain = GetGain();
+	info.hw = getName();
+
+	if (!rawBase.empty())
+	{
+		info.datatype = "ri16_le";
+		info.sampleRate = adcrate;
+		info.frequency = (double)loFreq;
+		if (!rawRecorder->Open(rawBase.c_str(), info, rolloverBytes, rolloverSeconds))
+			DbgPrintf("RadioHandlerClass::Start can not record to %s\n", rawBase.c_str());
+	}
+	if (!iqBase.empty())
+	{
+		info.datatype = "cf32_le";
+		info.sampleRate = (double)adcrate / (2 << decimate);
+		info.frequency = (double)tunedFreq;
+		if (!iqRecorder->Open(iqBase.c_str(), info, rolloverBytes, rolloverSeconds))
+			DbgPrintf("RadioHandlerClass::Start can not record to %s\n", iqBase.c_str());
+	}
+
+	if (historySeconds > 0)
+	{
+		info.datatype = historyIQ ? "cf32_le" : "ri16_le";
+		info.sampleRate = historyIQ ? (double)adcrate / (2 << decimate) : adcrate;
+		info.frequency = (double)(historyIQ ? tunedFreq : loFreq);
+		if (!timeMachine->Open(info, historySeconds))
+			DbgPrintf("RadioHandlerClass::Start can not keep %.1f s of history\n", historySeconds);
+	}
+	else
+	{
+		timeMachine->Close();
+	}
+
+	r2iqCntrl->setInputTap(0, rawRecorder->IsOpen() ? rawRecorder : nullptr);
+	r2iqCntrl->setInputTap(1, timeMachine->IsOpen() && !historyIQ ? timeMachine : nullptr);
+
+	bool detect = (detectThreshold > 0 || spectrumDetector->HasSpectrumCallback()) &&
+		spectrumDetector->Configure(adcrate, detectThreshold, detectTau, detectAverage, detectMinBins);
+	r2iqCntrl->setDetector(detect ? spectrumDetector : nullptr);
+}
+
+void RadioHandlerClass::StopRecording()
+{
+	r2iqCntrl->setInputTap(0, nullptr);
+	r2iqCntrl->setInputTap(1, nullptr);
+	r2iqCntrl->setDetector(nullptr);
+	rawRecorder->Close();
+	iqRecorder->Close();
+	timeMachine->Finish();
+}
+
+float RadioHandlerClass::GetFullScale() const
+{
+	// the r2iq scales by the gain of the hardware, the forward fft by halfFft / 4
+	return hardware->getGain() * 32768.0f * FFTN_R_ADC / 8;
+}
+
+int RadioHandlerClass::OutputBlockSize() const
+{
+	// every output block holds the complex samples of one input block
+	return transferSize / sizeof(int16_t) / 2 * 2 * sizeof(float);
+}
+
+float* RadioHandlerClass::GetOutputBlock(int index, int channel)
+{
+	if (index < 0 || index >= outputbuffer.getCount() || channel < 0 || channel > (int)channels.size())
+		return nullptr;
+	ringbuffer<float>& ring = channel == 0 ? outputbuffer : channels[channel - 1]->ring;
+	ring.setBlockSize(OutputBlockSize());
+	return ring.getBlock(index);
+}
+
+float RadioHandlerClass::GetGain() const
+{
+	const float* steps;
+	float gain = 0.0f;
+
+	if (attIdx < GetRFAttSteps(&steps))
+		gain += steps[attIdx];
+	if (gainIdx < GetIFGainSteps(&steps))
+		gain += steps[gainIdx];
+	return gain;
+}
+
+void RadioHandlerClass::SetThreadSched(ThreadRole role, const thread_sched& sched)
+{
+	schedConfig.role[role] = sched;
+}
+
+int RadioHandlerClass::Decimation(int srate_idx) const
+{
 	int	decimate = 4 - srate_idx;   // 5 IF bands
 	if (adcnominalfreq > N2_BANDSWITCH) 
 		decimate = 5 - srate_idx;   // 6 IF bands
@@ -157,30 +540,89 @@ bool RadioHandlerClass::Start(int srate_idx)
 		decimate = 0;
 		DbgPrintf("WARNING decimate mismatch at srate_idx = %d\n", srate_idx);
 	}
+	return decimate;
+}
+
+bool RadioHandlerClass::Start(int srate_idx)
+{
+	Stop();
+	DbgPrintf("RadioHandlerClass::Start\n");
+
+	int decimate = Decimation(srate_idx);
 	run = true;
-	count = 0;
+	droppedSamples = 0;
+	discontinuities = 0;
+	fc = 0.0f;
+	*stateFineTune = shift_limited_unroll_C_sse_init(0.0f, 0.0f);
 
 	hardware->FX3producerOn();  // FX3 start the producer
 
-	outputbuffer.setBlockSize(EXT_BLOCKLEN * 2 * sizeof(float));
+	inputbuffer.setBlockSize(transferSize / sizeof(int16_t));
+	outputbuffer.setBlockSize(OutputBlockSize());
+	for (size_t c = 0; c < channels.size(); c++)
+	{
+		output_channel* ch = channels[c];
+		ch->ring.setBlockSize(OutputBlockSize());
+		ch->fc = 0.0f;
+		ch->stateFineTune = shift_limited_unroll_C_sse_init(0.0f, 0.0f);
+		r2iqCntrl->setChannelDecimate((int)c + 1, ch->decimate < 0 ? decimate : ch->decimate);
+		r2iqCntrl->enableChannel((int)c + 1, ch->enabled);
+	}
+
+	if (schedConfig.lockMemory)
+		LockProcessMemory();
+	r2iqCntrl->setThreadSched(schedConfig.role[THREAD_R2IQ]);
+	fx3->SetEventThreadSched(schedConfig.role[THREAD_USB]);
 
 	// 0,1,2,3,4 => 32,16,8,4,2 MHz
 	r2iqCntrl->setDecimate(decimate);
+	StartRecording(decimate);
 	r2iqCntrl->TurnOn();
-	fx3->StartStream(inputbuffer, QUEUE_SIZE);
+	if (!fx3->StartStream(inputbuffer, concurrentTransfers))
+	{
+		DbgPrintf("RadioHandlerClass::Start failed to start the USB stream\n");
+		r2iqCntrl->TurnOff();
+		StopRecording();
+		hardware->FX3producerOff();
+		run = false;
+		return false;
+	}
 
 	submit_thread = std::thread(
 		[this]() {
-			this->OnDataPacket();
+			ApplyThreadSched(schedConfig.role[THREAD_CALLBACK]);
+			this->OnDataPacket(0);
 		});
+	for (size_t c = 0; c < channels.size(); c++)
+	{
+		channels[c]->thread = std::thread(
+			[this, c]() {
+				ApplyThreadSched(schedConfig.role[THREAD_CALLBACK]);
+				this->OnDataPacket((int)c + 1);
+			});
+	}
 
 	show_stats_thread = std::thread([this](void*) {
+		ApplyThreadSched(schedConfig.role[THREAD_STATS]);
 		this->CaculateStats();
 	}, nullptr);
 
 	return true;
 }
 
+bool RadioHandlerClass::UpdateOutputRate(int srate_idx)
+{
+	std::unique_lock<std::mutex> lk(stop_mutex);
+	if (!run || iqRecorder->IsOpen() || (timeMachine->IsOpen() && historyIQ))
+		return false;
+
+	int decimate = Decimation(srate_idx);
+	DbgPrintf("RadioHandlerClass::UpdateOutputRate decimate %d\n", decimate);
+	r2iqCntrl->setDecimate(decimate);
+	SettingsChanged();
+	return true;
+}
+
 bool RadioHandlerClass::Stop()
 {
 	std::unique_lock<std::mutex> lk(stop_mutex);
@@ -200,6 +642,10 @@ bool RadioHandlerClass::Stop()
 
 		submit_thread.join();
 		DbgPrintf("submit_thread join1\n");
+		for (auto ch : channels)
+			ch->thread.join();
+
+		StopRecording();
 
 		hardware->FX3producerOff();     //FX3 stop the producer
 	}
@@ -220,6 +666,7 @@ bool RadioHandlerClass::UpdateSampleRate(uint32_t samplefreq)
 	hardware->Initialize(samplefreq);
 
 	this->adcrate = samplefreq;
+	SettingsChanged();
 
 	return 0;
 }
@@ -229,6 +676,9 @@ int RadioHandlerClass::UpdateattRF(int att)
 {
 	if (hardware->UpdateattRF(att))
 	{
+		attIdx = att;
+		spectrumDetector->Reset();
+		SettingsChanged();
 		return att;
 	}
 	return 0;
@@ -239,6 +689,9 @@ int RadioHandlerClass::UpdateIFGain(int idx)
 {
 	if (hardware->UpdateGainIF(idx))
 	{
+		gainIdx = idx;
+		spectrumDetector->Reset();
+		SettingsChanged();
 		return idx;
 	}
 
@@ -267,6 +720,8 @@ bool RadioHandlerClass::UpdatemodeRF(rf_mode mode)
 			r2iqCntrl->setSideband(true);
 		else
 			r2iqCntrl->setSideband(false);
+		spectrumDetector->Reset();
+		SettingsChanged();
 	}
 	return true;
 }
@@ -278,26 +733,43 @@ rf_mode RadioHandlerClass::PrepareLo(uint64_t lo)
 
 uint64_t RadioHandlerClass::TuneLO(uint64_t wishedFreq)
 {
-	uint64_t actLo;
-
-	actLo = hardware->TuneLo(wishedFreq);
+	// the tuner makes its LO of the same reference, it is off by the ppm too
+	const double correction = 1.0 + ppm * 1e-6;
+	const uint64_t actLo = (uint64_t)llround(hardware->TuneLo((uint64_t)llround(wishedFreq / correction)) * correction);
+
+	// another tuner LO is another spectrum at the ADC
+	if (actLo != loFreq)
+		spectrumDetector->Reset();
+	tunedFreq = wishedFreq;
+	loFreq = actLo;
+	rawRecorder->SetFrequency((double)actLo);
+	iqRecorder->SetFrequency((double)wishedFreq);
+	timeMachine->SetFrequency((double)(historyIQ ? wishedFreq : actLo));
 
 	// we need shift the samples
 	int64_t offset = wishedFreq - actLo;
+	spectrumDetector->SetTuning((double)wishedFreq, (double)offset, GetmodeRF() == VHFMODE);
 	DbgPrintf("Offset freq %" PRIi64 "\n", offset);
-	float fc = r2iqCntrl->setFreqOffset(offset / (getSampleRate() / 2.0f));
-	if (GetmodeRF() == VHFMODE)
-		fc = -fc;   // sign change with sideband used
-	if (this->fc != fc)
-	{
-		std::unique_lock<std::mutex> lk(fc_mutex);
-		*stateFineTune = shift_limited_unroll_C_sse_init(fc, 0.0F);
-		this->fc = fc;
-	}
+	// the r2iq takes it at its next input block and hands the rest on for the mixer
+	// of OnDataPacket in the metadata of the block, see BLOCK_RETUNED
+	r2iqCntrl->setFreqOffset((float)(offset / (GetEffectiveSampleRate() / 2)));
+	// the other channels stay at their frequency, as far as the new band has it
+	for (size_t c = 0; c < channels.size(); c++)
+		RetuneChannel((int)c + 1);
+	SettingsChanged();
 
 	return wishedFreq;
 }
 
+void RadioHandlerClass::SetPpm(double value)
+{
+	ppm = value;
+	// the tuner and the DDC again, at the same frequency; before the first TuneLO
+	// that one takes it
+	if (tunedFreq != 0)
+		TuneLO(tunedFreq);
+}
+
 bool RadioHandlerClass::UptDither(bool b)
 {
 	dither = b;
@@ -305,6 +777,7 @@ bool RadioHandlerClass::UptDither(bool b)
 		hardware->FX3SetGPIO(DITH);
 	else
 		hardware->FX3UnsetGPIO(DITH);
+	SettingsChanged();
 	return dither;
 }
 
@@ -315,6 +788,7 @@ bool RadioHandlerClass::UptPga(bool b)
 		hardware->FX3SetGPIO(PGA_EN);
 	else
 		hardware->FX3UnsetGPIO(PGA_EN);
+	SettingsChanged();
 	return pga;
 }
 
@@ -326,9 +800,29 @@ bool RadioHandlerClass::UptRand(bool b)
 	else
 		hardware->FX3UnsetGPIO(RANDO);
 	r2iqCntrl->updateRand(randout);
+	SettingsChanged();
 	return randout;
 }
 
+void RadioHandlerClass::SettingsChanged()
+{
+	if (r2iqCntrl)
+	{
+		r2iqCntrl->nextGeneration();
+		inputbuffer.setGeneration(r2iqCntrl->getGeneration());
+	}
+}
+
+uint32_t RadioHandlerClass::GetGeneration() const
+{
+	return r2iqCntrl ? r2iqCntrl->getGeneration() : 0;
+}
+
+uint64_t RadioHandlerClass::GetAdcSamples() const
+{
+	return r2iqCntrl ? r2iqCntrl->getInputSamples() : 0;
+}
+
 void RadioHandlerClass::CaculateStats()
 {
 	high_resolution_clock::time_point EndingTime;
@@ -8,12 +8,19 @@
 #include <stdlib.h>
 #include <math.h>
 #include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
 #include "FX3Class.h"
+#include "thread_sched.h"
+#include "detector.h"
 
 #include "dsp/ringbuffer.h"
 
 class RadioHardware;
 class r2iqControlClass;
+class recorder;
+class history;
 
 enum {
     RESULT_OK,
@@ -31,7 +38,71 @@ public:
     RadioHandlerClass();
     virtual ~RadioHandlerClass();
     bool Init(fx3class* Fx3, void (*callback)(void* context, const float*, uint32_t), r2iqControlClass *r2iqCntrl = nullptr, void* context = nullptr);
+    // same as above, the callback receives the side information of each block too
+    bool Init(fx3class* Fx3, void (*callback)(void* context, const float*, uint32_t, const blockmeta&), r2iqControlClass *r2iqCntrl = nullptr, void* context = nullptr);
+    // USB transfer size in bytes and number of transfers in flight, used from the next Start
+    bool SetTransferParams(uint32_t size, uint32_t count);
+    // blocks of the output ring between the r2iq and the callback, set while stopped;
+    // more absorb longer stalls of the callback, at the memory of a block each
+    bool SetOutputBlocks(int count);
+    uint32_t GetTransferSize() const { return transferSize; }
+    uint32_t GetConcurrentTransfers() const { return concurrentTransfers; }
+    // placement and scheduling of the pipeline threads, defaults from the env, used from the next Start
+    void SetThreadSched(ThreadRole role, const thread_sched& sched);
+    const thread_sched& GetThreadSched(ThreadRole role) const { return schedConfig.role[role]; }
+    void SetMemoryLock(bool lock) { schedConfig.lockMemory = lock; }
+    bool GetMemoryLock() const { return schedConfig.lockMemory; }
+    // record the raw ADC and/or the IQ stream as SigMF from the next Start until Stop,
+    // nullptr for none, rollover 0 for one file; see recorder.h
+    void SetRecording(const char* rawBase, const char* iqBase, uint64_t rolloverBytes = 0, double rolloverSeconds = 0.0);
+    const recorder* GetRecorder(bool iq) const { return iq ? iqRecorder : rawRecorder; }
+    // keep the last seconds of the raw ADC or the IQ stream in memory from the next Start,
+    // 0 for none; see history.h
+    void SetHistory(double seconds, bool iq = false);
+    // while streaming save pre seconds before to post seconds after now, or the host time atNs
+    bool TriggerHistory(const char* base, double pre, double post, int64_t atNs = 0);
+    // from the next Start capture <base>-0000, <base>-0001, .. when a block peaks at level or above, 0 for none;
+    // pre seconds before to post seconds after that block
+    void SetHistoryTrigger(int level, const char* base, double pre, double post);
+    const history* GetHistory() const { return timeMachine; }
+    // from the next Start report signals threshold dB over the noise floor of the forward
+    // spectrum, the floor tracked with time constant tau; threshold 0 for none, see detector.h
+    bool SetDetector(float threshold, double tau, int average, int minBins, detection_cb callback, void* context = nullptr);
+    // from the next Start every averaged spectrum of the detector, nullptr for none
+    void SetSpectrum(spectrum_cb callback, void* context = nullptr) { spectrumDetector->SetSpectrumCallback(callback, context); }
+    const detector* GetDetector() const { return spectrumDetector; }
+    // a threshold or a spectrum callback is set
+    bool HasDetector() const { return detectThreshold > 0 || spectrumDetector->HasSpectrumCallback(); }
+    // zero copy readers: from the next Start the blocks given to the callback stay the
+    // reader's until ReleaseBlock(), which frees the oldest one; blocks not freed stall
+    // the r2iq and then the USB, as a slow callback does
+    void SetBlockHold(bool hold) { holdBlocks = hold; }
+    void ReleaseBlock(int channel = 0);
+    // the blocks of the output ring the callback's data points into, valid until
+    // the transfer size changes
+    int GetOutputBlocks() const { return outputbuffer.getCount(); }
+    float* GetOutputBlock(int index, int channel = 0);
+    // outputs besides the main one, channel 0, made by the r2iq from the same ADC
+    // stream and forward fft: each with a frequency and rate of its own within the
+    // band the tuner LO puts at the ADC. Their blocks go to the callback from a
+    // thread per channel with blockmeta::channel set and the sample count of the
+    // ADC, so that the channels line up in time. Set while stopped, up to what the
+    // r2iq can make; the new ones are enabled at the rate of Start
+    bool SetChannels(int count);
+    int GetChannels() const { return 1 + (int)channels.size(); }
+    // frequency of a channel, channel 0 is TuneLO; the others follow a change of
+    // the tuner LO. false when it is outside the band at the ADC
+    bool TuneChannel(int channel, uint64_t freq);
+    uint64_t GetChannelFrequency(int channel) const;
+    // rate of a channel from its next output block on, as UpdateOutputRate
+    bool SetChannelRate(int channel, int srate_idx);
+    // a disabled channel makes no blocks, the main one is always on
+    bool EnableChannel(int channel, bool enable);
     bool Start(int srate_idx);
+    // while streaming, the rate of srate_idx from the next output block on, flagged
+    // BLOCK_RATE_CHANGED; USB and the threads go on. false when not streaming or when
+    // IQ is recorded or kept in the history, their files have one rate: Start again
+    bool UpdateOutputRate(int srate_idx);
     bool Stop();
     bool Close();
     bool IsReady(){return true;}
@@ -52,11 +123,28 @@ public:
     bool GetRand () {return randout;}
     uint16_t GetFirmware() { return firmware; }
 
-    uint32_t getSampleRate() { return adcrate; }
+    uint32_t getSampleRate() const { return adcrate; }
+    // frequency error of the reference in ppm, positive when it runs fast; TuneLO
+    // asks the tuner for the LO that is right with it and the DDC shifts by what
+    // the ADC really samples, so the frequencies are true without a resampler
+    void SetPpm(double ppm);
+    double GetPpm() const { return ppm; }
+    // the ADC rate the reference really makes, getSampleRate() corrected by the ppm
+    double GetEffectiveSampleRate() const { return adcrate * (1.0 + ppm * 1e-6); }
+    // IQ amplitude of a full scale sine at the ADC
+    float GetFullScale() const;
     bool UpdateSampleRate(uint32_t samplerate);
 
     float getBps() const { return mBps; }
     float getSpsIF() const {return mSpsIF; }
+    uint64_t getDroppedSamples() const { return droppedSamples; }
+    // the sample counter of the ADC: samples of the stream since Start, lost ones
+    // included, as far as the r2iq has taken them; blockmeta::sample counts the same
+    // at the output rate
+    uint64_t GetAdcSamples() const;
+    uint32_t getDiscontinuities() const { return discontinuities; }
+    // settings generation, recorded in blockmeta::generation of the blocks that arrive from the ADC after the change
+    uint32_t GetGeneration() const;
 
     const char* getName() const;
     RadioModel getModel() { return radio; }
@@ -83,16 +171,24 @@ private:
     void AdcSamplesProcess();
     void AbortXferLoop(int qidx);
     void CaculateStats();
-    void OnDataPacket();
+    void OnDataPacket(int channel);
+    void SettingsChanged();
+    void StartRecording(int decimate);
+    int Decimation(int srate_idx) const;
+    void StopRecording();
+    int OutputBlockSize() const;
+    bool RetuneChannel(int channel);
+    float GetGain() const;
     r2iqControlClass* r2iqCntrl;
 
     void (*Callback)(void* context, const float *data, uint32_t length);
+    void (*CallbackEx)(void* context, const float *data, uint32_t length, const blockmeta& meta);
     void *callbackContext;
     void (*DbgPrintFX3)(const char* fmt, ...);
     bool (*GetConsoleIn)(char* buf, int maxlen);
 
     bool run;
-    unsigned long count;    // absolute index
+    bool holdBlocks;
 
     bool pga;
     bool dither;
@@ -104,9 +200,41 @@ private:
     RadioModel radio;
 
     // transfer variables
+    uint32_t transferSize;
+    uint32_t concurrentTransfers;
+    ThreadSchedConfig schedConfig;
     ringbuffer<int16_t> inputbuffer;
     ringbuffer<float> outputbuffer;
 
+    // recording
+    std::string rawBase;
+    std::string iqBase;
+    uint64_t rolloverBytes;
+    double rolloverSeconds;
+    recorder* rawRecorder;
+    recorder* iqRecorder;
+    uint64_t tunedFreq;     // wished frequency of the last TuneLO
+    uint64_t loFreq;        // tuner LO, 0 in HF
+    int attIdx;
+    int gainIdx;
+
+    // time machine
+    history* timeMachine;
+    double historySeconds;
+    bool historyIQ;
+    int historyLevel;
+    std::string historyBase;
+    double historyPre;
+    double historyPost;
+    uint32_t historyCaptures;
+
+    // signal detector
+    detector* spectrumDetector;
+    float detectThreshold;
+    double detectTau;
+    int detectAverage;
+    int detectMinBins;
+
     // threads
     std::thread show_stats_thread;
     std::thread submit_thread;
@@ -116,15 +244,21 @@ private:
     unsigned long SamplesXIF;
     float	mBps;
     float	mSpsIF;
+    std::atomic<uint64_t> droppedSamples;   // output samples lost since Start
+    std::atomic<uint32_t> discontinuities;  // number of gaps since Start
 
     fx3class *fx3;
     uint32_t adcrate;
+    double ppm;
 
-    std::mutex fc_mutex;
     std::mutex stop_mutex;
-    float fc;
+    float fc;           // the shift of stateFineTune, the callback thread's
     RadioHardware* hardware;
     shift_limited_unroll_C_sse_data_t* stateFineTune;
+
+    // the outputs of SetChannels, channels[0] is channel 1
+    struct output_channel;
+    std::vector<output_channel*> channels;
 };
 
 extern unsigned long Failures;
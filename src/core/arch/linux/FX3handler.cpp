@@ -1,24 +1,81 @@
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
+#include <inttypes.h>
 
 #include "FX3handler.h"
 #include "usb_device.h"
 #include "ezusb.h"
 #include "firmware.h"
 
+#include <atomic>
+#include <mutex>
+
 #define firmware_data ((const char *)FIRMWARE)
 #define firmware_size sizeof(FIRMWARE)
 
+// the devices share one libusb context, one thread handles the events
+// of all the streaming ones; it runs while there is at least one
+class usb_event_thread
+{
+public:
+    void Add(const thread_sched& sched)
+    {
+        std::lock_guard<std::mutex> lk(mutex);
+        if (streams++ > 0)
+            return;
+        run = true;
+        thread = std::thread([this, sched]()
+            {
+                ApplyThreadSched(sched);
+                while (run)
+                    usb_device_handle_all_events(100);
+            });
+    }
+
+    void Remove()
+    {
+        std::lock_guard<std::mutex> lk(mutex);
+        if (--streams > 0)
+            return;
+        run = false;
+        thread.join();
+    }
+
+private:
+    std::mutex mutex;
+    int streams = 0;
+    std::atomic<bool> run { false };
+    std::thread thread;
+};
+
+static usb_event_thread eventThread;
+
+// the device list of the last enumeration, refreshed when an enumeration starts at 0
+static std::mutex deviceListMutex;
+static struct usb_device_info *deviceList = nullptr;
+static int deviceCount = 0;
+
 fx3class *CreateUsbHandler()
 {
+    const char *emulator = getenv("SDDC_EMULATOR");
+    if (emulator)
+        return CreateEmulatorHandler(emulator);
+
+    const char *replay = getenv("SDDC_REPLAY");
+    if (replay)
+        return CreateReplayHandler(replay);
+
     return new fx3handler();
 }
 
 fx3handler::fx3handler()
 {
-    usb_device_infos = nullptr;
+    devidx = 0;
     dev = nullptr;
+    stream = nullptr;
+    eventSched = { -1, SCHED_POLICY_OTHER, 0 };
 }
 
 fx3handler::~fx3handler()
@@ -75,48 +132,72 @@ bool fx3handler::GetHardwareInfo(uint32_t *data)
     return usb_device_control(this->dev, TESTFX3, 0, 0, (uint8_t *)data, sizeof(*data), 1) == 0;
 }
 
-void fx3handler::StartStream(ringbuffer<int16_t> &input, int numofblock)
+bool fx3handler::StartStream(ringbuffer<int16_t> &input, int numofblock)
 {
     inputbuffer = &input;
-    stream = streaming_open_async(this->dev, transferSize, concurrentTransfers, PacketRead, this);
-    input.setBlockSize(streaming_framesize(stream) / sizeof(int16_t));
+    pendingDrop = 0;
+    adcSample = 0;
 
-    DbgPrintf("StartStream blocksize=%d\n", input.getBlockSize());
-
-    // Start background thread to poll the events
-    run = true;
-    if (stream)
+    // streaming_open_async() checks the size against the endpoint max burst
+    stream = streaming_open_async(this->dev, input.getBlockSize() * sizeof(int16_t), numofblock, PacketRead, this);
+    if (stream == nullptr)
     {
-        streaming_start(stream);
+        DbgPrintf("StartStream failed blocksize=%d transfers=%d\n", input.getBlockSize(), numofblock);
+        return false;
     }
 
-    poll_thread = std::thread(
-        [this]()
-        {
-            while (run)
-            {
-                usb_device_handle_events(this->dev);
-            }
-        });
+    DbgPrintf("StartStream blocksize=%d transfers=%d\n", input.getBlockSize(), numofblock);
+
+    streaming_start(stream);
+    eventThread.Add(eventSched);
+
+    return true;
 }
 
 void fx3handler::StopStream()
 {
-    run = false;
-    poll_thread.join();
+    if (stream == nullptr)
+        return;
+
+    eventThread.Remove();
 
     streaming_stop(stream);
     streaming_close(stream);
+    stream = nullptr;
 }
 
 void fx3handler::PacketRead(uint32_t data_size, uint8_t *data, void *context)
 {
     fx3handler *handler = (fx3handler *)context;
+    auto *input = handler->inputbuffer;
+    uint32_t samples = data_size / sizeof(int16_t);
 
-    auto *ptr = handler->inputbuffer->getWritePtr();
-    assert(data_size == handler->inputbuffer->getBlockSize() * sizeof(int16_t));
+    // never block the libusb event thread: when r2iq falls behind the block
+    // is dropped and the gap is reported with the next block in the ring
+    auto *ptr = input->tryGetWritePtr();
+    if (ptr == nullptr)
+    {
+        handler->pendingDrop += samples;
+        handler->adcSample += samples;
+        return;
+    }
+
+    assert(data_size == input->getBlockSize() * sizeof(int16_t));
     memcpy(ptr, data, data_size);
-    handler->inputbuffer->WriteDone();
+
+    auto *meta = input->getWriteMeta();
+    meta->stamp();
+    meta->sample = handler->adcSample;
+    handler->adcSample += samples;
+    meta->flags = handler->pendingDrop ? BLOCK_DISCONTINUITY : 0;
+    meta->dropped = handler->pendingDrop;
+    meta->generation = input->getGeneration();
+    if (handler->pendingDrop)
+    {
+        DbgPrintf("USB dropped %" PRIu64 " samples\n", handler->pendingDrop);
+        handler->pendingDrop = 0;
+    }
+    input->WriteDone();
 }
 
 bool fx3handler::ReadDebugTrace(uint8_t *pdata, uint8_t len)
@@ -126,13 +207,16 @@ bool fx3handler::ReadDebugTrace(uint8_t *pdata, uint8_t len)
 
 bool fx3handler::Enumerate(unsigned char &idx, char *lbuf)
 {
-    if (idx >= usb_device_count_devices()) return false;
-
-    if (usb_device_infos == nullptr) {
-        usb_device_get_device_list(&usb_device_infos);
+    std::lock_guard<std::mutex> lk(deviceListMutex);
+    if (idx == 0 || deviceList == nullptr) {
+        if (deviceList)
+            usb_device_free_device_list(deviceList);
+        deviceList = nullptr;
+        deviceCount = usb_device_get_device_list(&deviceList);
     }
+    if (deviceList == nullptr || idx >= deviceCount) return false;
 
-    auto dev = &usb_device_infos[idx];
+    auto dev = &deviceList[idx];
 
     strcpy (lbuf, (const char*)dev->product);
     while (strlen(lbuf) < 18) strcat(lbuf, " ");
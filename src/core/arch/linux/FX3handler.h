@@ -24,8 +24,9 @@ public:
 	bool SetArgument(uint16_t index, uint16_t value) override;
 	bool GetHardwareInfo(uint32_t* data) override;
 	bool ReadDebugTrace(uint8_t* pdata, uint8_t len) override;
-	void StartStream(ringbuffer<int16_t>& input, int numofblock) override;
+	bool StartStream(ringbuffer<int16_t>& input, int numofblock) override;
 	void StopStream() override;
+	void SetEventThreadSched(const thread_sched& sched) override { eventSched = sched; }
 	bool Enumerate(unsigned char &idx, char *lbuf) override;
 
 private:
@@ -37,12 +38,12 @@ private:
 	static void PacketRead(uint32_t data_size, uint8_t *data, void *context);
 
 	uint32_t devidx;
-	struct usb_device_info *usb_device_infos;
 	usb_device_t *dev;
 	streaming_t *stream;
 	ringbuffer<int16_t> *inputbuffer;
-    bool run;
-    std::thread poll_thread;
+	uint64_t pendingDrop;   // samples lost since the last block written
+	uint64_t adcSample;     // ADC samples received since StartStream
+	thread_sched eventSched;
 };
 
 
@@ -33,6 +33,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <libusb.h>
 
 #include "usb_device.h"
@@ -70,6 +71,38 @@ static struct usb_device_id usb_device_ids[] = {
 static int n_usb_device_ids = sizeof(usb_device_ids) / sizeof(usb_device_ids[0]);
 
 
+/* one libusb context for all the open devices of the process, so that
+ * one thread can handle the events of all of them */
+static pthread_mutex_t shared_context_mutex = PTHREAD_MUTEX_INITIALIZER;
+static libusb_context *shared_context = 0;
+static int shared_context_users = 0;
+
+static int acquire_context(libusb_context **ctx)
+{
+  int ret = 0;
+  pthread_mutex_lock(&shared_context_mutex);
+  if (shared_context_users == 0) {
+    ret = libusb_init(&shared_context);
+  }
+  if (ret == 0) {
+    shared_context_users++;
+    *ctx = shared_context;
+  }
+  pthread_mutex_unlock(&shared_context_mutex);
+  return ret;
+}
+
+static void release_context()
+{
+  pthread_mutex_lock(&shared_context_mutex);
+  if (--shared_context_users == 0) {
+    libusb_exit(shared_context);
+    shared_context = 0;
+  }
+  pthread_mutex_unlock(&shared_context_mutex);
+}
+
+
 int usb_device_count_devices()
 {
   int ret_val = -1;
@@ -237,7 +270,7 @@ usb_device_t *usb_device_open(int index, const char* image,
   usb_device_t *ret_val = 0;
   libusb_context *ctx = 0;
 
-  int ret = libusb_init(&ctx);
+  int ret = acquire_context(&ctx);
   if (ret < 0) {
     log_usb_error(ret, __func__, __FILE__, __LINE__);
     goto FAIL0;
@@ -331,7 +364,7 @@ usb_device_t *usb_device_open(int index, const char* image,
 FAIL2:
   libusb_close(dev_handle);
 FAIL1:
-  libusb_exit(0);
+  release_context();
 FAIL0:
   return ret_val;
 }
@@ -341,7 +374,7 @@ void usb_device_close(usb_device_t *this)
 {
   libusb_close(this->dev_handle);
   free(this);
-  libusb_exit(0);
+  release_context();
   return;
 }
 
@@ -351,6 +384,19 @@ int usb_device_handle_events(usb_device_t *this)
   return libusb_handle_events_completed(this->context, &this->completed);
 }
 
+
+int usb_device_handle_all_events(int timeout_ms)
+{
+  struct timeval tv = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+  libusb_context *ctx = 0;
+  if (acquire_context(&ctx) < 0) {
+    return -1;
+  }
+  int ret = libusb_handle_events_timeout_completed(ctx, &tv, 0);
+  release_context();
+  return ret;
+}
+
 int usb_device_control(usb_device_t *this, uint8_t request, uint16_t value,
                        uint16_t index, uint8_t *data, uint16_t length, int read) {
 
@@ -48,6 +48,10 @@ usb_device_t *usb_device_open(int index, const char* image,
 
 int usb_device_handle_events(usb_device_t *t);
 
+/* the events of all the open devices, they share one libusb context;
+ * returns after at most timeout_ms */
+int usb_device_handle_all_events(int timeout_ms);
+
 void usb_device_close(usb_device_t *t);
 
 int usb_device_control(usb_device_t *t, uint8_t request, uint16_t value,
@@ -8,6 +8,7 @@
 // modified 2017 11 30 ik1xpv@gmail.com, http://www.steila.com/blog
 // 
 #include <windows.h>
+#include <inttypes.h>
 #include "../../config.h"
 #include "FX3handler.h"
 #include "./CyAPI/CyAPI.h"
@@ -20,12 +21,21 @@
 
 fx3class* CreateUsbHandler()
 {
+	const char* emulator = getenv("SDDC_EMULATOR");
+	if (emulator)
+		return CreateEmulatorHandler(emulator);
+
+	const char* replay = getenv("SDDC_REPLAY");
+	if (replay)
+		return CreateReplayHandler(replay);
+
 	return new fx3handler();
 }
 
 fx3handler::fx3handler():
 	fx3dev (nullptr),
 	Fx3IsOn (false),
+	eventSched { -1, SCHED_POLICY_OTHER, 0 },
 	devidx (0)
 {
 
@@ -98,12 +108,6 @@ bool  fx3handler::Open() {
 		return r;      // init failed
 	}
 
-	long pktSize = EndPt->MaxPktSize;
-	EndPt->SetXferSize(transferSize);
-	long ppx = transferSize / pktSize;
-	DbgPrintf("buffer transferSize = %d. packet size = %ld. packets per transfer = %ld\n"
-		, transferSize, pktSize, ppx);
-
 	uint8_t data[4];
 	GetHardwareInfo((uint32_t*)&data);
 
@@ -329,21 +333,31 @@ void fx3handler::CleanupDataXfer(void** context)
 	delete (readContext);
 }
 
-#define USB_READ_CONCURRENT 4
-
 void fx3handler::AdcSamplesProcess()
 {
 	DbgPrintf("AdcSamplesProc thread runs\n");
 	int buf_idx;            // queue index
 	int read_idx;
-	void*		contexts[USB_READ_CONCURRENT];
-
-	memset(contexts, 0, sizeof(contexts));
+	const uint32_t samples = inputbuffer->getBlockSize();
+	const long transferSize = samples * sizeof(int16_t);
+	std::vector<void*> contexts(numofblock, nullptr);
+	std::vector<bool> inRing(numofblock, false);
+	// the transfers the ring has no free block for read into here and are dropped,
+	// the DMA never overwrites a block r2iq has not read yet
+	std::vector<int16_t> spare(samples);
+	int reserved = 0;		// blocks from write_index on under a transfer
+	uint64_t adcSample = 0;	// ADC samples received since StartStream
+	uint64_t pendingDrop = 0;
+
+	auto submit = [&](int n) {
+		inRing[n] = reserved < inputbuffer->getFreeCount();
+		auto ptr = inRing[n] ? inputbuffer->peekWritePtr(reserved++) : spare.data();
+		return BeginDataXfer((uint8_t*)ptr, transferSize, &contexts[n]);
+	};
 
 	// Queue-up the first batch of transfer requests
-	for (int n = 0; n < USB_READ_CONCURRENT; n++) {
-		auto ptr = inputbuffer->peekWritePtr(n);
-		if (!BeginDataXfer((uint8_t*)ptr, transferSize, &contexts[n])) {
+	for (int n = 0; n < numofblock; n++) {
+		if (!submit(n)) {
 			DbgPrintf("Xfer request rejected.\n");
 			return;
 		}
@@ -358,20 +372,38 @@ void fx3handler::AdcSamplesProcess()
 			break;
 		}
 
-		inputbuffer->WriteDone();
+		// the transfers complete in order, one into the ring is at write_index;
+		// the gap is reported with the next block in the ring, as on Linux
+		if (inRing[read_idx]) {
+			auto meta = inputbuffer->getWriteMeta();
+			meta->stamp();
+			meta->sample = adcSample;
+			meta->flags = pendingDrop ? BLOCK_DISCONTINUITY : 0;
+			meta->dropped = pendingDrop;
+			meta->generation = inputbuffer->getGeneration();
+			if (pendingDrop) {
+				DbgPrintf("USB dropped %" PRIu64 " samples\n", pendingDrop);
+				pendingDrop = 0;
+			}
+			inputbuffer->WriteDone();
+			reserved--;
+		}
+		else {
+			pendingDrop += samples;
+		}
+		adcSample += samples;
 
 		// Re-submit this queue element to keep the queue full
-		auto ptr = inputbuffer->peekWritePtr(USB_READ_CONCURRENT - 1);
-		if (!BeginDataXfer((uint8_t*)ptr, transferSize, &contexts[read_idx])) { // BeginDataXfer failed
+		if (!submit(read_idx)) { // BeginDataXfer failed
 			DbgPrintf("Xfer request rejected.\n");
 			break;
 		}
 
 		buf_idx = (buf_idx + 1) % QUEUE_SIZE;
-		read_idx = (read_idx + 1) % USB_READ_CONCURRENT;
+		read_idx = (read_idx + 1) % numofblock;
 	}  // End of the infinite loop
 
-	for (int n = 0; n < USB_READ_CONCURRENT; n++) {
+	for (int n = 0; n < numofblock; n++) {
 		CleanupDataXfer(&contexts[n]);
 	}
 
@@ -379,21 +411,33 @@ void fx3handler::AdcSamplesProcess()
 	return;  // void *
 }
 
-void fx3handler::StartStream(ringbuffer<int16_t>& input, int numofblock)
+bool fx3handler::StartStream(ringbuffer<int16_t>& input, int numofblock)
 {
 	// Allocate the context and buffers
 	inputbuffer = &input;
 
-	inputbuffer->setBlockSize(transferSamples);
+	long transferSize = input.getBlockSize() * sizeof(int16_t);
+	long pktSize = EndPt->MaxPktSize;
+	if (transferSize % pktSize != 0) {
+		DbgPrintf("transferSize %ld is not a multiple of packet size %ld\n", transferSize, pktSize);
+		return false;
+	}
+	EndPt->SetXferSize(transferSize);
+	long ppx = transferSize / pktSize;
+	DbgPrintf("buffer transferSize = %ld. packet size = %ld. packets per transfer = %ld\n"
+		, transferSize, pktSize, ppx);
 
 	// create the thread
 	this->numofblock = numofblock;
 	run = true;
 	adc_samples_thread = new std::thread(
 		[this]() {
+			ApplyThreadSched(eventSched);
 			this->AdcSamplesProcess();
 		}
 	);
+
+	return true;
 }
 
 void fx3handler::StopStream()
@@ -16,6 +16,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <time.h>
+#include <vector>
 
 #include "../../dsp/ringbuffer.h"
 
@@ -42,8 +43,9 @@ public:
 	bool SetArgument(uint16_t index, uint16_t value);
 	bool GetHardwareInfo(uint32_t* data);
 	bool ReadDebugTrace(uint8_t* pdata, uint8_t len);
-	void StartStream(ringbuffer<int16_t>& input, int numofblock);
+	bool StartStream(ringbuffer<int16_t>& input, int numofblock);
 	void StopStream();
+	void SetEventThreadSched(const thread_sched& sched) { eventSched = sched; }
 	bool Enumerate(unsigned char &idx, char *lbuf);
 private:
 	bool SendI2cbytes(uint8_t i2caddr, uint8_t regaddr, uint8_t* pdata, uint8_t len);
@@ -65,6 +67,7 @@ private:
 
 	ringbuffer<int16_t> *inputbuffer;
 	int numofblock;
+	thread_sched eventSched;
 	bool run;
 	UCHAR devidx;
 };
@@ -0,0 +1,16 @@
+#ifndef BLOCKTAP_H
+#define BLOCKTAP_H
+
+#include "license.txt"
+
+#include <stdint.h>
+#include "dsp/ringbuffer.h"
+
+// receives a copy of every block of a stream in order, from one thread at a time
+class blocktap {
+public:
+    virtual ~blocktap() {}
+    virtual void Push(const void* data, uint32_t bytes, const blockmeta& meta) = 0;
+};
+
+#endif
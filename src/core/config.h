@@ -43,7 +43,7 @@
 #define SETTINGS_IDENTIFIER	"sddc_1.06"
 #define SWNAME				"ExtIO_sddc.dll"
 
-#define	QUEUE_SIZE 32
+#define	QUEUE_SIZE 32  // max number of concurrent USB transfers
 #define WIDEFFTN  // test FFTN 8192 
 
 #define FFTN_R_ADC (8192)       // FFTN used for ADC real stream DDC  tested at  2048, 8192, 32768, 131072
@@ -76,14 +76,21 @@ enum rf_mode { NOMODE = 0, HFMODE = 0x1, VHFMODE = 0x2 };
 extern bool saveADCsamplesflag;
 extern uint32_t  adcnominalfreq;
 
-// transferSize must be a multiple of 16 (maxBurst) * 1024 (SS packet size) = 16384
-const uint32_t transferSize = 131072;
-const uint32_t transferSamples = transferSize / sizeof(int16_t);
-const uint32_t concurrentTransfers = 16;  // used to be 96, but I think it is too high
+// transfer size must be a multiple of 16 (maxBurst) * 1024 (SS packet size) = 16384
+// and hold halfFft + n * 3/4 FFTN_R_ADC samples for r2iq: 32, 80, 128, 176 .. KiB
+// both can be changed per device with RadioHandlerClass::SetTransferParams()
+const uint32_t DEFAULT_TRANSFER_SIZE = 131072;
+const uint32_t DEFAULT_TRANSFER_SAMPLES = DEFAULT_TRANSFER_SIZE / sizeof(int16_t);
+const uint32_t DEFAULT_CONCURRENT_TRANSFERS = 16;  // used to be 96, but I think it is too high
+
+// blocks of the output ring, RadioHandlerClass::SetOutputBlocks()
+const int DEFAULT_OUTPUT_BLOCKS = 64;
+const int MIN_OUTPUT_BLOCKS = 4;
+const int MAX_OUTPUT_BLOCKS = 1024;
 
 const uint32_t DEFAULT_ADC_FREQ = 64000000;	// ADC sampling frequency
 
-const uint32_t DEFAULT_TRANSFERS_PER_SEC = DEFAULT_ADC_FREQ / transferSamples;
+const uint32_t DEFAULT_TRANSFERS_PER_SEC = DEFAULT_ADC_FREQ / DEFAULT_TRANSFER_SAMPLES;
 
 extern uint32_t MIN_ADC_FREQ;		// ADC sampling frequency minimum
 extern uint32_t MAX_ADC_FREQ;		// ADC sampling frequency minimum
@@ -0,0 +1,173 @@
+#include "license.txt"
+#include "detector.h"
+#include "fft_mt_r2iq.h"
+#include "config.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+// bins under the threshold between two over it still make one cluster
+static const int merge_gap = 2;
+
+// bins of the flat pieces of the first floor
+static const int learn_piece = 64;
+
+detector::detector() :
+	power(nullptr),
+	noise(nullptr),
+	over(nullptr),
+	frame(0),
+	average(1),
+	minBins(1),
+	ratio(10.0f),
+	alpha(0.0f),
+	firstSample(0),
+	learning(true),
+	adcRate(0.0),
+	binHz(0.0),
+	rf(0.0),
+	adcOffset(0.0),
+	inverted(false),
+	callback(nullptr),
+	context(nullptr),
+	spectrumCallback(nullptr),
+	spectrumContext(nullptr),
+	detections(0)
+{
+	power = (float*)fftwf_malloc(sizeof(float) * halfFft);
+	noise = (float*)fftwf_malloc(sizeof(float) * halfFft);
+	over = (uint8_t*)fftwf_malloc(halfFft);
+	memset(power, 0, sizeof(float) * halfFft);
+	memset(noise, 0, sizeof(float) * halfFft);
+	memset(over, 0, halfFft);
+}
+
+detector::~detector()
+{
+	fftwf_free(power);
+	fftwf_free(noise);
+	fftwf_free(over);
+}
+
+bool detector::Configure(double adcRate, float threshold, double tau, int average, int minBins)
+{
+	if (adcRate <= 0 || threshold < 0 || (threshold > 0 && tau <= 0) || average < 1 || minBins < 1)
+	{
+		DbgPrintf("detector: invalid settings\n");
+		return false;
+	}
+
+	// segments advance by 3/4 of the forward fft
+	const double decisions = adcRate / (3 * halfFft / 2) / average;
+	this->average = average;
+	this->minBins = minBins;
+	this->ratio = threshold > 0 ? powf(10.0f, threshold / 10.0f) : 0.0f;
+	this->alpha = threshold > 0 ? (float)(1.0 - exp(-1.0 / (tau * decisions))) : 0.0f;
+	this->adcRate = adcRate;
+	this->binHz = adcRate / (2 * halfFft);
+	this->frame = 0;
+	this->detections = 0;
+	Reset();
+	return true;
+}
+
+void detector::SetCallback(detection_cb callback, void* context)
+{
+	this->callback = callback;
+	this->context = context;
+}
+
+void detector::SetSpectrumCallback(spectrum_cb callback, void* context)
+{
+	spectrumCallback = callback;
+	spectrumContext = context;
+}
+
+void detector::SetTuning(double rf, double adcOffset, bool inverted)
+{
+	std::lock_guard<std::mutex> lk(tuningMutex);
+	this->rf = rf;
+	this->adcOffset = adcOffset;
+	this->inverted = inverted;
+}
+
+void detector::Learn()
+{
+	// narrower signals do not move the median of a piece
+	float sorted[learn_piece];
+	for (int i = 0; i < halfFft; i += learn_piece)
+	{
+		std::copy(power + i, power + i + learn_piece, sorted);
+		std::nth_element(sorted, sorted + learn_piece / 2, sorted + learn_piece);
+		std::fill(noise + i, noise + i + learn_piece, sorted[learn_piece / 2]);
+	}
+	learning = false;
+}
+
+void detector::Cluster(uint64_t lastSample)
+{
+	detection found[maxDetections];
+	uint32_t count = 0;
+
+	std::unique_lock<std::mutex> lk(tuningMutex);
+	for (int i = 0; i < halfFft && count < maxDetections; i++)
+	{
+		if (!over[i])
+			continue;
+
+		// the cluster from bin i to last
+		int last = i;
+		for (int j = i + 1; j < halfFft && j <= last + merge_gap + 1; j++)
+		{
+			if (over[j])
+				last = j;
+		}
+
+		if (last - i + 1 >= minBins)
+		{
+			double sum = 0, moment = 0, base = 0;
+			for (int j = i; j <= last; j++)
+			{
+				sum += power[j];
+				moment += (double)power[j] * j;
+				base += noise[j];
+			}
+			double f = moment / sum * binHz - adcOffset;
+
+			detection& d = found[count++];
+			d.frequency = inverted ? rf - f : rf + f;
+			d.bandwidth = (last - i + 1) * binHz;
+			d.snr = base > 0 ? (float)(10 * log10(sum / base)) : 0.0f;
+			d.sample = (firstSample + lastSample) / 2;
+		}
+		i = last;
+	}
+	lk.unlock();
+
+	if (count == 0)
+		return;
+	detections += count;
+	if (callback)
+		callback(context, found, count);
+}
+
+void detector::Spectrum(uint64_t blockEnd, int64_t blockNs)
+{
+	spectrum_frame f;
+	f.power = power;
+	f.bins = halfFft;
+	f.segments = average;
+	f.adcRate = adcRate;
+	f.binHz = binHz;
+	f.sample = firstSample;
+	// the last sample of the block came in at blockNs
+	f.startNs = blockNs - (int64_t)((blockEnd - firstSample) * 1e9 / adcRate);
+	{
+		std::lock_guard<std::mutex> lk(tuningMutex);
+		f.rf = rf;
+		f.adcOffset = adcOffset;
+		f.inverted = inverted;
+	}
+	spectrumCallback(spectrumContext, f);
+}
@@ -0,0 +1,106 @@
+#ifndef DETECTOR_H
+#define DETECTOR_H
+
+#include "license.txt"
+
+//
+// detector: finds signals in the forward spectrum of the r2iq filter bank
+// Every segment of the overlap-scrap convolution is a full band spectrum
+// of the ADC; the worker sums the power of `average` of them per bin and
+// compares the sum against a noise floor tracked per bin by an exponential
+// average, one pass over the bins it has anyway. Bins over the threshold
+// are clustered, a cluster of minBins or more is a detection.
+// The spectrum is not windowed: a strong signal off the bin grid leaks
+// into its neighbours and shows wider than it is.
+// The floor starts at the median of the first spectrum in pieces of 64
+// bins, so a signal present from the start is found, and holds still in
+// the bins over the threshold; Reset() learns it again after a change of
+// the gain or of the tuner.
+// A spectrum callback receives every averaged spectrum as it is, e.g. for
+// the sweeper (see sweep.h); with threshold 0 that is all the detector does.
+//
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+
+struct detection {
+    double frequency;       // Hz, the power weighted center
+    double bandwidth;       // Hz, from the first to the last bin over the threshold
+    float snr;              // dB of the cluster over its noise floor
+    uint64_t sample;        // ADC sample at the middle of the averaged spectra
+};
+
+// from the r2iq worker thread, count detections of one averaged spectrum
+typedef void (*detection_cb)(void* context, const detection* d, uint32_t count);
+
+struct spectrum_frame {
+    const float* power;     // sum of segments spectra per bin, bin i at i * binHz of the ADC
+    int bins;
+    int segments;
+    double adcRate;
+    double binHz;
+    double rf, adcOffset;   // the mapping of SetTuning() when the spectrum was done
+    bool inverted;
+    uint64_t sample;        // ADC sample of the first segment
+    int64_t startNs;        // host time of that sample, steady clock
+};
+
+// from the r2iq worker thread, one averaged spectrum
+typedef void (*spectrum_cb)(void* context, const spectrum_frame& frame);
+
+class detector {
+public:
+    detector();
+    ~detector();
+
+    // threshold dB over the floor, floor time constant tau in seconds, threshold 0 for
+    // spectra only; set while the r2iq is off
+    bool Configure(double adcRate, float threshold, double tau, int average, int minBins);
+    void SetCallback(detection_cb callback, void* context);
+    void SetSpectrumCallback(spectrum_cb callback, void* context);
+    bool HasSpectrumCallback() const { return spectrumCallback != nullptr; }
+    // maps the ADC spectrum to RF: adcOffset on the ADC axis is rf, mirrored when inverted
+    void SetTuning(double rf, double adcOffset, bool inverted);
+    // learn the floor again, e.g. after the tuner moved
+    void Reset() { learning = true; }
+
+    uint64_t getDetections() const { return detections; }
+
+    static const int maxDetections = 64;   // per averaged spectrum
+
+    // used by the r2iq kernel, see fft_mt_r2iq_detect.hpp
+    float* power;           // sum of average segments per bin
+    float* noise;           // noise floor per bin, same scale
+    uint8_t* over;          // bins over the threshold
+    int frame;              // segments summed so far
+    int average;
+    int minBins;
+    float ratio;            // threshold as a power ratio, 0 for no detection
+    float alpha;            // floor update of the bins under the threshold
+    uint64_t firstSample;
+    std::atomic<bool> learning;
+
+    // the floor from the first spectrum after a Reset
+    void Learn();
+    // the clusters of over into detections for the callback
+    void Cluster(uint64_t lastSample);
+    // power to the spectrum callback; the input block of the last segment ends at
+    // blockEnd and was received at blockNs
+    void Spectrum(uint64_t blockEnd, int64_t blockNs);
+
+private:
+    double adcRate;
+    double binHz;
+    double rf, adcOffset;
+    bool inverted;
+    std::mutex tuningMutex;
+
+    detection_cb callback;
+    void* context;
+    spectrum_cb spectrumCallback;
+    void* spectrumContext;
+    std::atomic<uint64_t> detections;
+};
+
+#endif
@@ -0,0 +1,88 @@
+#pragma once
+
+//
+// float samples to integers with the scaling, rounding and saturation in one
+// pass, e.g. the CF32 IQ straight into the CS16 or CS8 buffer of a reader:
+// out[i] = round(in[i] * scale), limited to the range of the type. SSE2 and
+// AArch64 NEON convert 8 or 16 floats at a time, other CPUs and the tail the
+// plain loop; both round to nearest even.
+//
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CONVERT_SSE2
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define CONVERT_NEON
+#endif
+
+template<typename T> inline void convert_float_int(const float* in, T* out, size_t n, float scale, float limit)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        float v = std::min(std::max(in[i] * scale, -limit - 1.0f), limit);
+        out[i] = (T)lrintf(v);
+    }
+}
+
+inline void convert_to_int16(const float* in, int16_t* out, size_t n, float scale)
+{
+    size_t i = 0;
+#if defined(CONVERT_SSE2)
+    // the clamp keeps the conversion in range, the pack is exact then
+    const __m128 s = _mm_set1_ps(scale);
+    const __m128 lo = _mm_set1_ps(-32768.0f);
+    const __m128 hi = _mm_set1_ps(32767.0f);
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i), s), lo), hi);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), s), lo), hi);
+        __m128i p = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+        _mm_storeu_si128((__m128i*)(out + i), p);
+    }
+#elif defined(CONVERT_NEON)
+    const float32x4_t lo = vdupq_n_f32(-32768.0f);
+    const float32x4_t hi = vdupq_n_f32(32767.0f);
+    for (; i + 8 <= n; i += 8)
+    {
+        float32x4_t a = vminq_f32(vmaxq_f32(vmulq_n_f32(vld1q_f32(in + i), scale), lo), hi);
+        float32x4_t b = vminq_f32(vmaxq_f32(vmulq_n_f32(vld1q_f32(in + i + 4), scale), lo), hi);
+        vst1q_s16(out + i, vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(a)), vqmovn_s32(vcvtnq_s32_f32(b))));
+    }
+#endif
+    convert_float_int(in + i, out + i, n - i, scale, 32767.0f);
+}
+
+inline void convert_to_int8(const float* in, int8_t* out, size_t n, float scale)
+{
+    size_t i = 0;
+#if defined(CONVERT_SSE2)
+    const __m128 s = _mm_set1_ps(scale);
+    const __m128 lo = _mm_set1_ps(-128.0f);
+    const __m128 hi = _mm_set1_ps(127.0f);
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v[4];
+        for (int k = 0; k < 4; k++)
+            v[k] = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4 * k), s), lo), hi));
+        __m128i p = _mm_packs_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3]));
+        _mm_storeu_si128((__m128i*)(out + i), p);
+    }
+#elif defined(CONVERT_NEON)
+    const float32x4_t lo = vdupq_n_f32(-128.0f);
+    const float32x4_t hi = vdupq_n_f32(127.0f);
+    for (; i + 16 <= n; i += 16)
+    {
+        int16x4_t v[4];
+        for (int k = 0; k < 4; k++)
+            v[k] = vqmovn_s32(vcvtnq_s32_f32(vminq_f32(vmaxq_f32(vmulq_n_f32(vld1q_f32(in + i + 4 * k), scale), lo), hi)));
+        vst1q_s8(out + i, vcombine_s8(vqmovn_s16(vcombine_s16(v[0], v[1])), vqmovn_s16(vcombine_s16(v[2], v[3]))));
+    }
+#endif
+    convert_float_int(in + i, out + i, n - i, scale, 127.0f);
+}
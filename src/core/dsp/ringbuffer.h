@@ -1,24 +1,69 @@
 #pragma once
 
 #include <thread>
+#include <atomic>
 #include <mutex>
+#include <chrono>
 #include <condition_variable>
+#include <stdint.h>
 
 const int default_count = 64;
 const int spin_count = 100;
 #define ALIGN (8)
 
+// block flags carried in blockmeta::flags
+enum {
+    BLOCK_DISCONTINUITY = 1 << 0,   // samples were lost right before this block
+    BLOCK_OVERLOAD = 1 << 1,        // the ADC clipped within this block
+    BLOCK_SETTINGS_CHANGED = 1 << 2,    // generation differs from the previous block
+    BLOCK_RETUNED = 1 << 3,         // the tuning changes at sample tuneOffset of this block
+    BLOCK_RATE_CHANGED = 1 << 4,    // the first block at another decimation
+};
+
+// side information travelling with each ring slot
+struct blockmeta {
+    uint32_t flags;         // BLOCK_xxx
+    uint64_t dropped;       // number of samples lost right before this block
+    uint64_t sample;        // index of the first sample of the block since Start, lost samples included
+    int64_t monoNs;         // host steady clock (CLOCK_MONOTONIC) when the USB transfer completed
+    int64_t realNs;         // host wall clock (CLOCK_REALTIME) at the same instant
+    uint32_t generation;    // settings generation the block was produced with
+    uint16_t peak;          // largest absolute ADC sample of the block
+    uint8_t decimation;     // the block's sample rate is the ADC rate / (2 << decimation)
+    uint8_t channel;        // the r2iq output that made the block, 0 for the main one
+    uint32_t tuneOffset;    // with BLOCK_RETUNED, first sample of the block made with the new tuning
+    float shift;            // fine tuning left to the consumer's mixer, cycles per sample, from tuneOffset on
+
+    // capture both host clocks, done at USB completion
+    void stamp()
+    {
+        using namespace std::chrono;
+        monoNs = duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+        realNs = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+    }
+};
+
 class ringbufferbase {
 public:
     ringbufferbase(int count) :
         max_count(count),
         read_index(0),
         write_index(0),
+        hold_index(0),
         emptyCount(0),
         fullCount(0),
         writeCount(0),
-        stopped(false)
+        stopped(false),
+        notify(nullptr),
+        notifyContext(nullptr),
+        generation(0)
+    {
+        meta = new blockmeta[max_count]();
+    }
+
+    ~ringbufferbase()
     {
+        delete[] meta;
     }
 
     int getFullCount() const { return fullCount; }
@@ -27,9 +72,57 @@ public:
 
     int getWriteCount() const { return writeCount; }
 
+    bool isFull() const { return (write_index + 1) % max_count == read_index; }
+
+    // blocks the producer can write from write_index on before the ring is full
+    int getFreeCount() const { return (read_index - write_index - 1 + 2 * max_count) % max_count; }
+
+    bool isEmpty() const { return read_index == write_index; }
+
+    // blocks handed out by HoldDone() and not yet freed by ReadDone()
+    int getHeldCount() const { return (hold_index - read_index + max_count) % max_count; }
+
+    int getCount() const { return max_count; }
+
+    // called after every WriteDone and ReadDone, from the thread that made it;
+    // wakes whoever serves the ring without waiting on it, set while stopped
+    void setNotify(void (*notify)(void* context), void* context)
+    {
+        this->notify = notify;
+        this->notifyContext = context;
+    }
+
+    // the settings generation of the blocks completed from now on: the producer
+    // stamps it into blockmeta::generation when the block arrives, so the blocks
+    // queued before a change keep the one they were made with
+    void setGeneration(uint32_t g) { generation = g; }
+    uint32_t getGeneration() const { return generation; }
+
+    blockmeta* getWriteMeta() { return &meta[write_index]; }
+
+    const blockmeta* getReadMeta() const { return &meta[read_index]; }
+
+    const blockmeta* getHoldMeta() const { return &meta[hold_index]; }
+
+    const blockmeta* peekReadMeta(int offset) const
+    {
+        return &meta[(read_index + max_count + offset) % max_count];
+    }
+
+    // a reader that keeps its blocks takes them with getHoldPtr() and HoldDone(),
+    // they stay out of the writer's reach until ReadDone() frees the oldest one
+    void HoldDone()
+    {
+        std::unique_lock<std::mutex> lk(mutex);
+        hold_index = (hold_index + 1) % max_count;
+    }
+
     void ReadDone()
     {
         std::unique_lock<std::mutex> lk(mutex);
+        // a plain reader holds nothing, its hold cursor follows
+        if (hold_index == read_index)
+            hold_index = (hold_index + 1) % max_count;
         if ((write_index + 1) % max_count == read_index)
         {
             read_index = (read_index + 1) % max_count;
@@ -39,12 +132,15 @@ public:
         {
             read_index = (read_index + 1) % max_count;
         }
+        lk.unlock();
+        if (notify)
+            notify(notifyContext);
     }
 
     void WriteDone()
     {
         std::unique_lock<std::mutex> lk(mutex);
-        if (read_index == write_index)
+        if (hold_index == write_index)
         {
             write_index = (write_index + 1) % max_count;
             nonemptyCV.notify_all();
@@ -54,19 +150,24 @@ public:
             write_index = (write_index + 1) % max_count;
         }
         writeCount++;
+        lk.unlock();
+        if (notify)
+            notify(notifyContext);
     }
 
     void Start()
     {
         std::unique_lock<std::mutex> lk(mutex);
-        write_index = read_index = 0;
+        write_index = read_index = hold_index = 0;
+        for (int i = 0; i < max_count; i++)
+            meta[i] = blockmeta();
         stopped = false;
     }
 
     void Stop()
     {
         std::unique_lock<std::mutex> lk(mutex);
-        read_index = 0;
+        read_index = hold_index = 0;
         stopped = true;
         write_index = max_count / 2;
         nonfullCV.notify_all();
@@ -75,6 +176,15 @@ public:
 
 protected:
 
+    // another number of blocks, empty, while neither side runs
+    void resize(int count)
+    {
+        delete[] meta;
+        max_count = count;
+        meta = new blockmeta[max_count]();
+        read_index = write_index = hold_index = 0;
+    }
+
     void WaitUntilNotEmpty()
     {
         if (stopped) return;
@@ -97,6 +207,27 @@ protected:
         }
     }
 
+    void WaitUntilHoldable()
+    {
+        if (stopped) return;
+
+        for (int i = 0; i < spin_count; i++)
+        {
+            if (hold_index != write_index)
+                return;
+        }
+
+        if (hold_index == write_index)
+        {
+            std::unique_lock<std::mutex> lk(mutex);
+
+            emptyCount++;
+            nonemptyCV.wait(lk, [this] {
+                return hold_index != write_index;
+            });
+        }
+    }
+
     void WaitUntilNotFull()
     {
         if (stopped) return;
@@ -121,6 +252,9 @@ protected:
 
     volatile int read_index;
     volatile int write_index;
+    volatile int hold_index;    // next block for a reader that keeps them, read_index when none are kept
+
+    blockmeta* meta;
 
 private:
     int emptyCount;
@@ -131,6 +265,9 @@ private:
     bool stopped;
     std::condition_variable nonemptyCV;
     std::condition_variable nonfullCV;
+    void (*notify)(void* context);
+    void* notifyContext;
+    std::atomic<uint32_t> generation;
 };
 
 template<typename T> class ringbuffer : public ringbufferbase {
@@ -152,6 +289,21 @@ public:
         delete[] buffers;
     }
 
+    // the blocks are allocated again by setBlockSize(), while neither side runs
+    void setCount(int count)
+    {
+        if (count == max_count || count < 2)
+            return;
+
+        if (buffers[0])
+            delete[] buffers[0];
+        delete[] buffers;
+        resize(count);
+        buffers = new TPtr[max_count];
+        buffers[0] = nullptr;
+        block_size = 0;
+    }
+
     void setBlockSize(int size)
     {
         if (block_size != size)
@@ -189,6 +341,14 @@ public:
         return buffers[(write_index) % max_count];
     }
 
+    // non blocking getWritePtr(): returns nullptr when the ring is full
+    T* tryGetWritePtr()
+    {
+        if (isFull())
+            return nullptr;
+        return buffers[write_index];
+    }
+
     const T* getReadPtr()
     {
         WaitUntilNotEmpty();
@@ -196,6 +356,25 @@ public:
         return buffers[read_index];
     }
 
+    // the next block past the held ones, see HoldDone()
+    T* getHoldPtr()
+    {
+        WaitUntilHoldable();
+
+        return buffers[hold_index];
+    }
+
+    // block index of the ring, valid until the block size changes
+    T* getBlock(int index) { return buffers[index]; }
+
+    // non blocking getReadPtr(): returns nullptr when the ring is empty
+    const T* tryGetReadPtr()
+    {
+        if (isEmpty())
+            return nullptr;
+        return buffers[read_index];
+    }
+
     int getBlockSize() const { return block_size; }
 
 private:
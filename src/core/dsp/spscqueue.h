@@ -0,0 +1,101 @@
+#pragma once
+
+//
+// spscqueue: entries from one producer thread to one consumer thread without
+// a lock on either side. The consumer sleeps in wait() until the number of
+// entries it asked for are there; the producer takes the mutex and wakes it
+// only then, so a consumer that wants many entries is woken once for them
+// and a producer with nobody waiting never blocks.
+//
+
+#include <stddef.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+template<typename T> class spscqueue {
+public:
+    spscqueue(size_t capacity = 1) :
+        slots(capacity),
+        head(0),
+        tail(0),
+        wanted(0)
+    {
+    }
+
+    // empties the queue, neither side may run
+    void reset(size_t capacity)
+    {
+        slots.assign(capacity, T());
+        head = 0;
+        tail = 0;
+        wanted = 0;
+    }
+
+    size_t capacity() const { return slots.size(); }
+
+    size_t size() const { return tail.load() - head.load(); }
+
+    // producer: false when full
+    bool push(const T& value)
+    {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == slots.size())
+            return false;
+        slots[t % slots.size()] = value;
+        tail.store(t + 1);
+
+        // seq_cst against wait(): either it sees the entry or we see it waiting
+        const size_t w = wanted.load();
+        if (w != 0 && t + 1 - head.load() >= w)
+        {
+            std::lock_guard<std::mutex> lk(mutex);
+            cv.notify_one();
+        }
+        return true;
+    }
+
+    // consumer: the oldest entry, nullptr when empty; it stays until pop()
+    T* front()
+    {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return nullptr;
+        return &slots[h % slots.size()];
+    }
+
+    // consumer
+    bool pop(T& value)
+    {
+        T* f = front();
+        if (!f)
+            return false;
+        value = *f;
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer: until count entries are queued, at most timeout; true when they are
+    bool wait(size_t count, std::chrono::microseconds timeout)
+    {
+        count = count < 1 ? 1 : count > slots.size() ? slots.size() : count;
+        if (size() >= count)
+            return true;
+
+        std::unique_lock<std::mutex> lk(mutex);
+        wanted.store(count);
+        bool ok = cv.wait_for(lk, timeout, [this, count] { return size() >= count; });
+        wanted.store(0);
+        return ok;
+    }
+
+private:
+    std::vector<T> slots;
+    std::atomic<size_t> head;       // entries popped
+    std::atomic<size_t> tail;       // entries pushed
+    std::atomic<size_t> wanted;     // entries the sleeping consumer waits for, 0 when awake
+    std::mutex mutex;
+    std::condition_variable cv;
+};
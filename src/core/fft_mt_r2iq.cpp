@@ -18,17 +18,31 @@ The name r2iq as Real 2 I+Q stream
 #include "RadioHandler.h"
 
 #include "fir.h"
+#include "blocktap.h"
+#include "r2iq_pool.h"
 
 #include <assert.h>
 #include <utility>
 
+// the FFTW planner and wisdom are not thread safe, the execute functions are
+static std::mutex plannerMutex;
+
+static const double two_pi = 6.283185307179586;
+
 
 r2iqControlClass::r2iqControlClass()
 {
 	r2iqOn = false;
+	pooled = false;
 	randADC = false;
 	sideband = false;
 	mdecimation = 0;
+	sched = { -1, SCHED_POLICY_OTHER, 0 };
+	generation = 0;
+	inputSamples = 0;
+	for (auto& tap : inputTap)
+		tap = nullptr;
+	spectrumDetector = nullptr;
 	mratio[0] = 1;  // 1,2,4,8,16
 	for (int i = 1; i < NDECIDX; i++)
 	{
@@ -36,11 +50,53 @@ r2iqControlClass::r2iqControlClass()
 	}
 }
 
+void r2iqControlClass::tapInput(const int16_t* data, int samples, const blockmeta& meta)
+{
+	for (auto tap : inputTap)
+	{
+		if (tap)
+			tap->Push(data, samples * sizeof(int16_t), meta);
+	}
+}
+
+void r2iqControlClass::notifyPool(ringbufferbase* ring)
+{
+	ring->setNotify(r2iq_pool::Instance().GetWorkers() > 0 ? r2iq_pool::Notify : nullptr, nullptr);
+}
+
+bool r2iqControlClass::attachPool(ringbufferbase* input, ringbufferbase* output)
+{
+	r2iq_pool& pool = r2iq_pool::Instance();
+	pooled = pool.GetWorkers() > 0;
+	notifyPool(input);
+	notifyPool(output);
+	if (pooled)
+		pool.Attach(this, sched);
+	return pooled;
+}
+
+void r2iqControlClass::detachPool()
+{
+	if (pooled)
+		r2iq_pool::Instance().Detach(this);
+	pooled = false;
+}
+
 fft_mt_r2iq::fft_mt_r2iq() :
 	r2iqControlClass(),
+	fftPerBuf(0),
+	maxBlockSamples(0),
 	filterHw(nullptr)
 {
 	mtunebin = halfFft / 4;
+	for (auto& ch : channels)
+	{
+		ch.output = nullptr;
+		ch.pendingTuning = tuning{ mtunebin, 0.0f };
+		ch.decimation = 0;
+		ch.enabled = false;
+	}
+	channels[0].enabled = true;
 	mfftdim[0] = halfFft;
 	for (int i = 1; i < NDECIDX; i++)
 	{
@@ -73,6 +129,7 @@ fft_mt_r2iq::~fft_mt_r2iq()
 	if (filterHw == nullptr)
 		return;
 
+	std::lock_guard<std::mutex> lk(plannerMutex);
 	fftwf_export_wisdom_to_filename("wisdom");
 
 	for (int d = 0; d < NDECIDX; d++)
@@ -92,49 +149,184 @@ fft_mt_r2iq::~fft_mt_r2iq()
 		fftwf_free(th->ADCinTime);
 		fftwf_free(th->ADCinFreq);
 		fftwf_free(th->inFreqTmp);
+		for (auto& cs : th->chan)
+			fftwf_free(cs.filterTune);
 
 		delete threadArgs[t];
 	}
 }
 
 
-float fft_mt_r2iq::setFreqOffset(float offset)
+fft_mt_r2iq::tuning fft_mt_r2iq::offsetTuning(float offset) const
 {
 	// align to 1/4 of halfft
-	this->mtunebin = int(offset * halfFft / 4) * 4;  // mtunebin step 4 bin  ?
-	float delta = ((float)this->mtunebin  / halfFft) - offset;
-	float ret = delta * getRatio(); // ret increases with higher decimation
-	DbgPrintf("offset %f mtunebin %d delta %f (%f)\n", offset, this->mtunebin, delta, ret);
+	const int bin = int(offset * halfFft / 4) * 4;  // mtunebin step 4 bin  ?
+	return tuning{ bin, ((float)bin / halfFft) - offset };
+}
+
+float fft_mt_r2iq::setFreqOffset(float offset)
+{
+	const tuning tune = offsetTuning(offset);
+	this->mtunebin = tune.bin;
+	float ret = tune.shift * getRatio(); // ret increases with higher decimation
+	DbgPrintf("offset %f mtunebin %d delta %f (%f)\n", offset, this->mtunebin, tune.shift, ret);
+	channels[0].pendingTuning = tune;
 	return ret;
 }
 
+void fft_mt_r2iq::setChannelOutput(int channel, ringbuffer<float>* output)
+{
+	if (channel > 0 && channel < N_MAX_R2IQ_CHANNELS)
+		channels[channel].output = output;
+}
+
+void fft_mt_r2iq::setChannelDecimate(int channel, int dec)
+{
+	if (channel == 0)
+		setDecimate(dec);
+	else if (channel < N_MAX_R2IQ_CHANNELS)
+		channels[channel].decimation = dec;
+}
+
+float fft_mt_r2iq::setChannelOffset(int channel, float offset)
+{
+	if (channel == 0)
+		return setFreqOffset(offset);
+	if (channel >= N_MAX_R2IQ_CHANNELS)
+		return 0;
+
+	const tuning tune = offsetTuning(offset);
+	channels[channel].pendingTuning = tune;
+	return tune.shift * mratio[channels[channel].decimation];
+}
+
+void fft_mt_r2iq::enableChannel(int channel, bool enable)
+{
+	// the main one always runs, the consumers wait on its ring
+	if (channel > 0 && channel < N_MAX_R2IQ_CHANNELS)
+		channels[channel].enabled = enable;
+}
+
+void fft_mt_r2iq::retuneFilter(r2iqChannelState* cs, int decimate, int tunebin)
+{
+	// the filter is centered halfFft / 8 + 1 samples of the halfFft grid before
+	// the end of the segment (see Init), a bin shift turns its output by as many
+	// halfFft-cs of a cycle per bin
+	const int center = halfFft / 8 + 1;
+	cs->tuneTurns = (cs->tuneTurns + (tunebin - cs->tunebin) * center) & (halfFft - 1);
+	if (cs->tuneTurns == 0)
+		return;
+
+	const double phase = two_pi * cs->tuneTurns / halfFft;
+	const float c = (float)cos(phase), s = (float)sin(phase);
+	const fftwf_complex* filter = filterHw[decimate];
+	for (int i = 0; i < halfFft; i++)
+	{
+		cs->filterTune[i][0] = filter[i][0] * c - filter[i][1] * s;
+		cs->filterTune[i][1] = filter[i][0] * s + filter[i][1] * c;
+	}
+	cs->filterDecimate = decimate;
+}
+
+bool fft_mt_r2iq::checkBlockSize(uint32_t samples) const
+{
+	// the block must be an integral number of 3/4 overlapped ffts
+	return samples > (uint32_t)halfFft && (samples - halfFft) % (3 * halfFft / 2) == 0;
+}
+
 void fft_mt_r2iq::TurnOn() {
+	const uint32_t samples = inputbuffer->getBlockSize();
+	assert(checkBlockSize(samples));
+	fftPerBuf = samples / (3 * halfFft / 2) + 1;
+	reserveBlock(samples);
+
 	this->r2iqOn = true;
 	this->bufIdx = 0;
 	this->lastThread = threadArgs[0];
+	this->inputSamples = 0;
+	channels[0].output = outputbuffer;
+	for (unsigned t = 0; t < processor_count; t++) {
+		for (int c = 0; c < N_MAX_R2IQ_CHANNELS; c++) {
+			r2iqChannelState& cs = threadArgs[t]->chan[c];
+			cs.pout = nullptr;
+			cs.pmeta = nullptr;
+			cs.decimate_count = 0;
+			cs.lastGeneration = this->generation;
+			const tuning tune = channels[c].pendingTuning;
+			cs.tunebin = tune.bin;
+			cs.shift = getSideband() ? -tune.shift : tune.shift;
+			cs.decimate = c == 0 ? (int)mdecimation : (int)channels[c].decimation;
+			cs.outBase = 0;
+			cs.adcBase = 0;
+			cs.tuneTurns = 0;
+			cs.active = false;
+		}
+	}
 
 	inputbuffer->Start();
 	outputbuffer->Start();
+	for (int c = 1; c < N_MAX_R2IQ_CHANNELS; c++) {
+		if (channels[c].output) {
+			channels[c].output->Start();
+			notifyPool(channels[c].output);
+		}
+	}
+
+	if (attachPool(inputbuffer, outputbuffer))
+		return;
 
 	for (unsigned t = 0; t < processor_count; t++) {
 		r2iq_thread[t] = std::thread(
 			[this] (void* arg)
-				{ return this->r2iqThreadf((r2iqThreadArg*)arg); }, (void*)threadArgs[t]);
+				{
+					ApplyThreadSched(this->sched);
+					return this->r2iqThreadf((r2iqThreadArg*)arg);
+				}, (void*)threadArgs[t]);
 	}
 }
 
 void fft_mt_r2iq::TurnOff(void) {
 	this->r2iqOn = false;
 
+	if (pooled)
+	{
+		detachPool();
+		inputbuffer->Stop();
+		outputbuffer->Stop();
+		stopChannels();
+		return;
+	}
+
 	inputbuffer->Stop();
 	outputbuffer->Stop();
+	stopChannels();
 	for (unsigned t = 0; t < processor_count; t++) {
 		r2iq_thread[t].join();
 	}
 }
 
+void fft_mt_r2iq::stopChannels()
+{
+	for (int c = 1; c < N_MAX_R2IQ_CHANNELS; c++) {
+		if (channels[c].output)
+			channels[c].output->Stop();
+	}
+}
+
 bool fft_mt_r2iq::IsOn(void) { return(this->r2iqOn); }
 
+void fft_mt_r2iq::reserveBlock(uint32_t samples)
+{
+	if (samples <= maxBlockSamples)
+		return;
+
+	for (unsigned t = 0; t < processor_count; t++) {
+		fftwf_free(threadArgs[t]->ADCinTime);
+		threadArgs[t]->ADCinTime = (float*)fftwf_malloc(sizeof(float) * (halfFft + samples));
+	}
+	maxBlockSamples = samples;
+}
+
 void fft_mt_r2iq::Init(float gain, ringbuffer<int16_t> *input, ringbuffer<float>* obuffers)
 {
 	this->inputbuffer = input;    // set to the global exported by main_loop
@@ -142,6 +334,7 @@ void fft_mt_r2iq::Init(float gain, ringbuffer<int16_t> *input, ringbuffer<float>
 
 	this->GainScale = gain;
 
+	std::lock_guard<std::mutex> lk(plannerMutex);
 	fftwf_import_wisdom_from_filename("wisdom");
 
 	// Get the processor count
@@ -203,12 +396,16 @@ void fft_mt_r2iq::Init(float gain, ringbuffer<int16_t> *input, ringbuffer<float>
 			r2iqThreadArg *th = new r2iqThreadArg();
 			threadArgs[t] = th;
 
-			th->ADCinTime = (float*)fftwf_malloc(sizeof(float) * (halfFft + transferSize / 2));                 // 2048
+			th->ADCinTime = (float*)fftwf_malloc(sizeof(float) * (halfFft + DEFAULT_TRANSFER_SAMPLES));                 // 2048
 
 			th->ADCinFreq = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex)*(halfFft + 1)); // 1024+1
 			th->inFreqTmp = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex)*(halfFft));    // 1024
+			for (auto& cs : th->chan)
+				cs.filterTune = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex)*(halfFft));
 		}
 
+		maxBlockSamples = DEFAULT_TRANSFER_SAMPLES;
+
 		plan_t2f_r2c = fftwf_plan_dft_r2c_1d(2 * halfFft, threadArgs[0]->ADCinTime, threadArgs[0]->ADCinFreq, FFTW_MEASURE);
 		for (int d = 0; d < NDECIDX; d++)
 		{
@@ -251,11 +448,14 @@ void fft_mt_r2iq::Init(float gain, ringbuffer<int16_t> *input, ringbuffer<float>
 #error Compiler does not identify an x86 or ARM core..
 #endif
 
-void * fft_mt_r2iq::r2iqThreadf(r2iqThreadArg *th)
+enum simd_level { SIMD_DEF, SIMD_AVX, SIMD_AVX2, SIMD_AVX512, SIMD_NEON };
+
+// best instruction set of this CPU, detected once
+static simd_level detect_simd()
 {
 #ifdef NO_SIMD_OPTIM
 	DbgPrintf("Hardware Capability: all SIMD features (AVX, AVX2, AVX512) deactivated\n");
-	return r2iqThreadf_def(th);
+	return SIMD_DEF;
 #else
 #if defined(DETECT_AVX)
 	int info[4];
@@ -280,20 +480,75 @@ void * fft_mt_r2iq::r2iqThreadf(r2iqThreadArg *th)
 	DbgPrintf("Hardware Capability: AVX:%d AVX2:%d AVX512:%d\n", HW_AVX, HW_AVX2, HW_AVX512F);
 
 	if (HW_AVX512F)
-		return r2iqThreadf_avx512(th);
+		return SIMD_AVX512;
 	else if (HW_AVX2)
-		return r2iqThreadf_avx2(th);
+		return SIMD_AVX2;
 	else if (HW_AVX)
-		return r2iqThreadf_avx(th);
+		return SIMD_AVX;
 	else
-		return r2iqThreadf_def(th);
+		return SIMD_DEF;
 #elif defined(DETECT_NEON)
 	bool NEON = detect_neon();
 	DbgPrintf("Hardware Capability: NEON:%d\n", NEON);
-	if (NEON)
-		return r2iqThreadf_neon(th);
-	else
-		return r2iqThreadf_def(th);
+	return NEON ? SIMD_NEON : SIMD_DEF;
 #endif
 #endif
 }
+
+static simd_level cpu_simd()
+{
+	static const simd_level level = detect_simd();
+	return level;
+}
+
+void * fft_mt_r2iq::r2iqThreadf(r2iqThreadArg *th)
+{
+	while (r2iqOn)
+		r2iqStep(th, true);
+	return 0;
+}
+
+bool fft_mt_r2iq::Step()
+{
+	return r2iqOn && r2iqStep(threadArgs[0], false);
+}
+
+bool fft_mt_r2iq::r2iqStep(r2iqThreadArg *th, bool wait)
+{
+	switch (cpu_simd())
+	{
+#if defined(DETECT_AVX)
+	case SIMD_AVX512:
+		return r2iqStep_avx512(th, wait);
+	case SIMD_AVX2:
+		return r2iqStep_avx2(th, wait);
+	case SIMD_AVX:
+		return r2iqStep_avx(th, wait);
+#elif defined(DETECT_NEON)
+	case SIMD_NEON:
+		return r2iqStep_neon(th, wait);
+#endif
+	default:
+		return r2iqStep_def(th, wait);
+	}
+}
+
+int fft_mt_r2iq::processBlock(r2iqThreadArg *th, const int16_t *dataADC, const int16_t *endloop, int transferSamples, fftwf_complex *pout)
+{
+	switch (cpu_simd())
+	{
+#if defined(DETECT_AVX)
+	case SIMD_AVX512:
+		return processBlock_avx512(th, dataADC, endloop, transferSamples, pout);
+	case SIMD_AVX2:
+		return processBlock_avx2(th, dataADC, endloop, transferSamples, pout);
+	case SIMD_AVX:
+		return processBlock_avx(th, dataADC, endloop, transferSamples, pout);
+#elif defined(DETECT_NEON)
+	case SIMD_NEON:
+		return processBlock_neon(th, dataADC, endloop, transferSamples, pout);
+#endif
+	default:
+		return processBlock_def(th, dataADC, endloop, transferSamples, pout);
+	}
+}
@@ -3,15 +3,20 @@
 #include "r2iq.h"
 #include "fftw3.h"
 #include "config.h"
+#include "detector.h"
 #include <algorithm>
+#include <stdlib.h>
 #include <string.h>
 
 // use up to this many threads
 #define N_MAX_R2IQ_THREADS 1
+// outputs of the filter bank, the main one included
+#define N_MAX_R2IQ_CHANNELS 4
 #define PRINT_INPUT_RANGE  0
 
 static const int halfFft = FFTN_R_ADC / 2;    // half the size of the first fft at ADC 64Msps real rate (2048)
-static const int fftPerBuf = transferSize / sizeof(short) / (3 * halfFft / 2) + 1; // number of ffts per buffer with 256|768 overlap
+
+struct r2iqChannelState;
 
 class fft_mt_r2iq : public r2iqControlClass
 {
@@ -25,11 +30,36 @@ public:
     void TurnOn();
     void TurnOff(void);
     bool IsOn(void);
+    bool checkBlockSize(uint32_t samples) const;
+    bool Step() override;
+
+    int getMaxChannels() const override { return N_MAX_R2IQ_CHANNELS; }
+    void setChannelOutput(int channel, ringbuffer<float>* output) override;
+    void setChannelDecimate(int channel, int dec) override;
+    float setChannelOffset(int channel, float offset) override;
+    void enableChannel(int channel, bool enable) override;
 
 protected:
 
-    template<bool rand> void convert_float(const int16_t *input, float* output, int size)
+    // one input block through the filter bank, the kernel of the workers for this CPU:
+    // endloop holds the halfFft samples before dataADC, pout receives
+    // transferSamples / 2 >> mdecimation complex samples; returns the peak
+    int processBlock(r2iqThreadArg *th, const int16_t *dataADC, const int16_t *endloop, int transferSamples, fftwf_complex *pout);
+
+    // grow the ADCinTime buffers for blocks of this many samples
+    void reserveBlock(uint32_t samples);
+
+    // a retune by whole bins turns the output by a fraction of a cycle, as the filter is
+    // not centered at the start of the segment; the channel's filter turned as much the
+    // other way, cs->filterTune, keeps the output in phase across retunes
+    void retuneFilter(r2iqChannelState *cs, int decimate, int tunebin);
+
+    r2iqThreadArg* threadArgs[N_MAX_R2IQ_THREADS];
+
+    // returns the largest absolute value, so the peak costs no extra pass
+    template<bool rand> int convert_float(const int16_t *input, float* output, int size)
     {
+        int peak = 0;
         for(int m = 0; m < size; m++)
         {
             int16_t val;
@@ -42,7 +72,9 @@ protected:
                 val = input[m];
             }
             output[m] = float(val);
+            peak = std::max(peak, std::abs((int)val));
         }
+        return peak;
     }
 
     void shift_freq(fftwf_complex* dest, const fftwf_complex* source1, const fftwf_complex* source2, int start, int end)
@@ -79,32 +111,117 @@ private:
     ringbuffer<int16_t>* inputbuffer;    // pointer to input buffers
     ringbuffer<float>* outputbuffer;    // pointer to ouput buffers
     int bufIdx;         // index to next buffer to be processed
+    int fftPerBuf;      // number of ffts per input block with 256|768 overlap
+    uint32_t maxBlockSamples; // size of the ADCinTime buffers, halfFft excluded
     r2iqThreadArg* lastThread;
 
     float GainScale;
     int mfftdim [NDECIDX]; // FFT N dimensions: mfftdim[k] = halfFft / 2^k
     int mtunebin;
 
+    // the tuning of setFreqOffset, taken by the workers at the next input block
+    struct tuning {
+        int32_t bin;        // whole bins, a multiple of 4 so that the segments stay in phase
+        float shift;        // the rest for the consumer's mixer, at decimation 0
+    };
+
+    // an output of the filter bank, 0 is the main one of Init
+    struct channel {
+        ringbuffer<float>* output;
+        std::atomic<tuning> pendingTuning;
+        std::atomic<int> decimation;    // the main one follows mdecimation
+        std::atomic<bool> enabled;
+    };
+    channel channels[N_MAX_R2IQ_CHANNELS];
+
+    // the tuning of offset, relative to ADC/2, in whole bins and the rest
+    tuning offsetTuning(float offset) const;
+    // at TurnOff, the rings of the channels besides the main one
+    void stopChannels();
+
     void *r2iqThreadf(r2iqThreadArg *th);   // thread function
 
-    void * r2iqThreadf_def(r2iqThreadArg *th);
-    void * r2iqThreadf_avx(r2iqThreadArg *th);
-    void * r2iqThreadf_avx2(r2iqThreadArg *th);
-    void * r2iqThreadf_avx512(r2iqThreadArg *th);
-    void * r2iqThreadf_neon(r2iqThreadArg *th);
+    // the next block into the output ring, the kernel for this CPU; see fft_mt_r2iq_impl.hpp
+    bool r2iqStep(r2iqThreadArg *th, bool wait);
+    bool r2iqStep_def(r2iqThreadArg *th, bool wait);
+    bool r2iqStep_avx(r2iqThreadArg *th, bool wait);
+    bool r2iqStep_avx2(r2iqThreadArg *th, bool wait);
+    bool r2iqStep_avx512(r2iqThreadArg *th, bool wait);
+    bool r2iqStep_neon(r2iqThreadArg *th, bool wait);
+
+    int processBlock_def(r2iqThreadArg *th, const int16_t *dataADC, const int16_t *endloop, int transferSamples, fftwf_complex *pout);
+    int processBlock_avx(r2iqThreadArg *th, const int16_t *dataADC, const int16_t *endloop, int transferSamples, fftwf_complex *pout);
+    int processBlock_avx2(r2iqThreadArg *th, const int16_t *dataADC, const int16_t *endloop, int transferSamples, fftwf_complex *pout);
+    int processBlock_avx512(r2iqThreadArg *th, const int16_t *dataADC, const int16_t *endloop, int transferSamples, fftwf_complex *pout);
+    int processBlock_neon(r2iqThreadArg *th, const int16_t *dataADC, const int16_t *endloop, int transferSamples, fftwf_complex *pout);
 
     fftwf_complex **filterHw;       // Hw complex to each decimation ratio
 
 	fftwf_plan plan_t2f_r2c;          // fftw plan buffers Freq to Time complex to complex per decimation ratio
-	fftwf_plan *plan_f2t_c2c;          // fftw plan buffers Time to Freq real to complex per buffer
 	fftwf_plan plans_f2t_c2c[NDECIDX];
 
     uint32_t processor_count;
-    r2iqThreadArg* threadArgs[N_MAX_R2IQ_THREADS];
     std::mutex mutexR2iqControl;                   // r2iq control lock
     std::thread r2iq_thread[N_MAX_R2IQ_THREADS]; // thread pointers
 };
 
+// the work of one output in the kernel for an input block: where its bins come
+// from, its filter and inverse fft and where its samples go; see
+// fft_mt_r2iq_kernel.hpp
+struct r2iqPass {
+	int channel;
+	int mfft;
+	int count;                      // bins of the first half
+	int start;                      // first bin of the second half
+	const fftwf_complex *source;    // the bins of the first half
+	const fftwf_complex *source2;   // of the second half
+	const fftwf_complex *filter;
+	const fftwf_complex *filter2;
+	fftwf_plan *plan_f2t_c2c;
+	fftwf_complex *pout;
+};
+
+// the state of a worker for a channel that spans input blocks
+struct r2iqChannelState {
+
+	r2iqChannelState() :
+		pout(nullptr),
+		pmeta(nullptr),
+		decimate_count(0),
+		lastGeneration(0),
+		decimate(0),
+		outBase(0),
+		adcBase(0),
+		tunebin(0),
+		shift(0.0f),
+		tuneTurns(0),
+		filterDecimate(-1),
+		filterTune(nullptr),
+		active(false)
+	{
+	}
+
+	// the output block being filled over 2^decimate input blocks
+	fftwf_complex *pout;
+	blockmeta *pmeta;
+	int decimate_count;
+	uint32_t lastGeneration;
+	// the decimation of the blocks being made, from the output sample outBase at the
+	// ADC sample adcBase on
+	int decimate;
+	uint64_t outBase;
+	uint64_t adcBase;
+	// the tuning of the blocks being made, shift at decimation 0
+	int tunebin;
+	float shift;
+	// after a retune the filter turned by tuneTurns / halfFft of a cycle, see retuneFilter()
+	int tuneTurns;
+	int filterDecimate;
+	fftwf_complex *filterTune;
+	// makes blocks, taken from channel::enabled with each output block
+	bool active;
+};
+
 // assure, that ADC is not oversteered?
 struct r2iqThreadArg {
 
@@ -119,7 +236,9 @@ struct r2iqThreadArg {
 
 	float *ADCinTime;                // point to each threads input buffers [nftt][n]
 	fftwf_complex *ADCinFreq;         // buffers in frequency
-	fftwf_complex *inFreqTmp;         // tmp decimation output buffers (after tune shift)
+	fftwf_complex *inFreqTmp;         // tmp decimation output buffers (after tune shift), shared by the channels
+
+	r2iqChannelState chan[N_MAX_R2IQ_CHANNELS];
 #if PRINT_INPUT_RANGE
 	int MinMaxBlockCount;
 	int16_t MinValue;
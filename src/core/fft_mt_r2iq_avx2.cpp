@@ -3,7 +3,12 @@
 #include "fftw3.h"
 #include "RadioHandler.h"
 
-void * fft_mt_r2iq::r2iqThreadf_avx2(r2iqThreadArg *th)
+bool fft_mt_r2iq::r2iqStep_avx2(r2iqThreadArg *th, bool wait)
 {
     #include "fft_mt_r2iq_impl.hpp"
-}
\ No newline at end of file
+}
+
+int fft_mt_r2iq::processBlock_avx2(r2iqThreadArg *th, const int16_t *dataADC, const int16_t *endloop, int transferSamples, fftwf_complex *pout)
+{
+    #include "fft_mt_r2iq_block.hpp"
+}
@@ -0,0 +1,47 @@
+// body of processBlock_xxx(): the r2iq worker without the rings, one input block
+// of transferSamples at dataADC, endloop holds the last halfFft samples before it
+{
+	const int decimate = this->mdecimation;
+	const int mfft = this->mfftdim[decimate];	// = halfFft / 2^mdecimation
+	const fftwf_complex* filter = filterHw[decimate];
+	const bool lsb = this->getSideband();
+	const int _mtunebin = this->mtunebin;
+	const int fftPerBuf = transferSamples / (3 * halfFft / 2) + 1;
+
+	auto inloop = th->ADCinTime;
+	int peak;
+
+	if (!this->getRand())        // plain samples no ADC rand set
+	{
+		convert_float<false>(endloop, inloop, halfFft);
+		peak = convert_float<false>(dataADC, inloop + halfFft, transferSamples);
+	}
+	else
+	{
+		convert_float<true>(endloop, inloop, halfFft);
+		peak = convert_float<true>(dataADC, inloop + halfFft, transferSamples);
+	}
+
+	// the main output alone, the parameters of both halves as in the workers
+	r2iqPass passes[1];
+	const int npasses = 1;
+	passes[0].channel = 0;
+	passes[0].mfft = mfft;
+	passes[0].count = std::min(mfft/2, halfFft - _mtunebin);
+	passes[0].source = &th->ADCinFreq[_mtunebin];
+	passes[0].start = std::max(0, mfft / 2 - _mtunebin);
+	passes[0].source2 = &th->ADCinFreq[_mtunebin - mfft / 2];
+	passes[0].filter = filter;
+	passes[0].filter2 = &filter[halfFft - mfft / 2];
+	passes[0].plan_f2t_c2c = &plans_f2t_c2c[decimate];
+	passes[0].pout = pout;
+
+	// no sample count here, the batch API does not set a detector
+	detector* const detect = this->spectrumDetector;
+	const uint64_t detSample = 0;
+	const int64_t detNs = 0;
+
+#include "fft_mt_r2iq_kernel.hpp"
+
+	return peak;
+}
@@ -0,0 +1,57 @@
+// the detector's work on the forward spectrum of segment k, see detector.h:
+// the power of average segments summed per bin, then one compare of the sum
+// against the floor; branch free so that it vectorizes for the instruction set
+// of the including worker. uses th, k, transferSamples, detect, detSample and
+// detNs of the including scope
+{
+	const fftwf_complex* spectrum = th->ADCinFreq;
+	float* acc = detect->power;
+	const uint64_t segment = detSample + (3 * halfFft / 2) * k;
+
+	if (detect->frame == 0)
+	{
+		detect->firstSample = segment;
+		for (int i = 0; i < halfFft; i++)
+			acc[i] = spectrum[i][0] * spectrum[i][0] + spectrum[i][1] * spectrum[i][1];
+	}
+	else
+	{
+		for (int i = 0; i < halfFft; i++)
+			acc[i] += spectrum[i][0] * spectrum[i][0] + spectrum[i][1] * spectrum[i][1];
+	}
+
+	if (++detect->frame == detect->average)
+	{
+		detect->frame = 0;
+		if (detect->HasSpectrumCallback())
+			detect->Spectrum(detSample + transferSamples, detNs);
+
+		if (detect->ratio == 0)
+		{
+			// spectra only
+		}
+		else if (detect->learning)
+		{
+			detect->Learn();
+		}
+		else
+		{
+			float* fl = detect->noise;
+			uint8_t* over = detect->over;
+			const float ratio = detect->ratio;
+			const float alpha = detect->alpha;
+			int n = 0;
+			for (int i = 0; i < halfFft; i++)
+			{
+				const float a = acc[i];
+				const float f = fl[i];
+				const bool o = a > f * ratio;
+				fl[i] = f + (o ? 0.0f : alpha) * (a - f);
+				over[i] = o;
+				n += o;
+			}
+			if (n >= detect->minBins)
+				detect->Cluster(segment);
+		}
+	}
+}
@@ -1,171 +1,204 @@
-
+// body of r2iqStep_xxx(): the next input block through the filter bank into the
+// output rings of the channels; with wait it blocks for the block and for room in
+// the output rings, without it returns false when either is missing. The state
+// that spans blocks, the output block being filled, is kept per channel in th.
 {
-	const int decimate = this->mdecimation;
-	const int mfft = this->mfftdim[decimate];	// = halfFft / 2^mdecimation
-	const fftwf_complex* filter = filterHw[decimate];
+	const int transferSamples = inputbuffer->getBlockSize();
 	const bool lsb = this->getSideband();
-	const auto filter2 = &filter[halfFft - mfft / 2];
-
-	plan_f2t_c2c = &plans_f2t_c2c[decimate];
-	fftwf_complex* pout = nullptr;
-	int decimate_count = 0;
 
-	while (r2iqOn) {
-		const int16_t *dataADC;  // pointer to input data
-		const int16_t *endloop;    // pointer to end data to be copied to beginning
+	const int16_t *dataADC;  // pointer to input data
+	const int16_t *endloop;    // pointer to end data to be copied to beginning
+	blockmeta inmeta;          // side information of the input block
 
-		const int _mtunebin = this->mtunebin;  // Update LO tune is possible during run
+	int peak;
 
+	if (!wait)
+	{
+		if (inputbuffer->isEmpty())
+			return false;
+		for (int c = 0; c < N_MAX_R2IQ_CHANNELS; c++)
 		{
-			std::unique_lock<std::mutex> lk(mutexR2iqControl);
-			dataADC = inputbuffer->getReadPtr();
+			const channel& ch = this->channels[c];
+			if (ch.output && ch.enabled && th->chan[c].decimate_count == 0 && ch.output->isFull())
+				return false;
+		}
+	}
 
-			if (!r2iqOn)
-				return 0;
+	{
+		std::unique_lock<std::mutex> lk(mutexR2iqControl);
+		dataADC = inputbuffer->getReadPtr();
 
-			this->bufIdx = (this->bufIdx + 1) % QUEUE_SIZE;
+		if (!r2iqOn)
+			return false;
 
-			endloop = inputbuffer->peekReadPtr(-1) + transferSamples - halfFft;
-		}
+		inmeta = *inputbuffer->getReadMeta();
+		tapInput(dataADC, transferSamples, inmeta);
+		this->inputSamples = inmeta.sample + transferSamples;
 
-		auto inloop = th->ADCinTime;
+		this->bufIdx = (this->bufIdx + 1) % QUEUE_SIZE;
 
-		// @todo: move the following int16_t conversion to (32-bit) float
-		// directly inside the following loop (for "k < fftPerBuf")
-		//   just before the forward fft "fftwf_execute_dft_r2c" is called
-		// idea: this should improve cache/memory locality
+		endloop = inputbuffer->peekReadPtr(-1) + transferSamples - halfFft;
+	}
+
+	auto inloop = th->ADCinTime;
+
+	// @todo: move the following int16_t conversion to (32-bit) float
+	// directly inside the following loop (for "k < fftPerBuf")
+	//   just before the forward fft "fftwf_execute_dft_r2c" is called
+	// idea: this should improve cache/memory locality
 #if PRINT_INPUT_RANGE
-		std::pair<int16_t, int16_t> blockMinMax = std::make_pair<int16_t, int16_t>(0, 0);
+	std::pair<int16_t, int16_t> blockMinMax = std::make_pair<int16_t, int16_t>(0, 0);
 #endif
-		if (!this->getRand())        // plain samples no ADC rand set
-		{
-			convert_float<false>(endloop, inloop, halfFft);
+	if (!this->getRand())        // plain samples no ADC rand set
+	{
+		convert_float<false>(endloop, inloop, halfFft);
 #if PRINT_INPUT_RANGE
-			auto minmax = std::minmax_element(dataADC, dataADC + transferSamples);
-			blockMinMax.first = *minmax.first;
-			blockMinMax.second = *minmax.second;
+		auto minmax = std::minmax_element(dataADC, dataADC + transferSamples);
+		blockMinMax.first = *minmax.first;
+		blockMinMax.second = *minmax.second;
 #endif
-			convert_float<false>(dataADC, inloop + halfFft, transferSamples);
-		}
-		else
-		{
-			convert_float<true>(endloop, inloop, halfFft);
-			convert_float<true>(dataADC, inloop + halfFft, transferSamples);
-		}
+		peak = convert_float<false>(dataADC, inloop + halfFft, transferSamples);
+	}
+	else
+	{
+		convert_float<true>(endloop, inloop, halfFft);
+		peak = convert_float<true>(dataADC, inloop + halfFft, transferSamples);
+	}
 
 #if PRINT_INPUT_RANGE
-		th->MinValue = std::min(blockMinMax.first, th->MinValue);
-		th->MaxValue = std::max(blockMinMax.second, th->MaxValue);
-		++th->MinMaxBlockCount;
-		if (th->MinMaxBlockCount * processor_count / 3 >= DEFAULT_TRANSFERS_PER_SEC )
-		{
-			float minBits = (th->MinValue < 0) ? (log10f((float)(-th->MinValue)) / log10f(2.0f)) : -1.0f;
-			float maxBits = (th->MaxValue > 0) ? (log10f((float)(th->MaxValue)) / log10f(2.0f)) : -1.0f;
-			printf("r2iq: min = %d (%.1f bits) %.2f%%, max = %d (%.1f bits) %.2f%%\n",
-				(int)th->MinValue, minBits, th->MinValue *-100.0f / 32768.0f,
-				(int)th->MaxValue, maxBits, th->MaxValue * 100.0f / 32768.0f);
-			th->MinValue = 0;
-			th->MaxValue = 0;
-			th->MinMaxBlockCount = 0;
-		}
+	th->MinValue = std::min(blockMinMax.first, th->MinValue);
+	th->MaxValue = std::max(blockMinMax.second, th->MaxValue);
+	++th->MinMaxBlockCount;
+	if (th->MinMaxBlockCount * processor_count / 3 >= DEFAULT_TRANSFERS_PER_SEC )
+	{
+		float minBits = (th->MinValue < 0) ? (log10f((float)(-th->MinValue)) / log10f(2.0f)) : -1.0f;
+		float maxBits = (th->MaxValue > 0) ? (log10f((float)(th->MaxValue)) / log10f(2.0f)) : -1.0f;
+		printf("r2iq: min = %d (%.1f bits) %.2f%%, max = %d (%.1f bits) %.2f%%\n",
+			(int)th->MinValue, minBits, th->MinValue *-100.0f / 32768.0f,
+			(int)th->MaxValue, maxBits, th->MaxValue * 100.0f / 32768.0f);
+		th->MinValue = 0;
+		th->MaxValue = 0;
+		th->MinMaxBlockCount = 0;
+	}
 #endif
-		dataADC = nullptr;
-		inputbuffer->ReadDone();
-		// decimate in frequency plus tuning
-
-		if (decimate_count == 0)
-			pout = (fftwf_complex*)outputbuffer->getWritePtr();
-
-		decimate_count = (decimate_count + 1) & ((1 << decimate) - 1);
-
-		// Calculate the parameters for the first half
-		const auto count = std::min(mfft/2, halfFft - _mtunebin);
-		const auto source = &th->ADCinFreq[_mtunebin];
-
-		// Calculate the parameters for the second half
-		const auto start = std::max(0, mfft / 2 - _mtunebin);
-		const auto source2 = &th->ADCinFreq[_mtunebin - mfft / 2];
-		const auto dest = &th->inFreqTmp[mfft / 2];
-		for (int k = 0; k < fftPerBuf; k++)
+	dataADC = nullptr;
+	inputbuffer->ReadDone();
+	// decimate in frequency plus tuning
+
+	detector* const detect = this->spectrumDetector;
+	const uint64_t detSample = inmeta.sample;
+	const int64_t detNs = inmeta.monoNs;
+
+	// every channel that makes a block takes its bins from the same forward ffts
+	r2iqPass passes[N_MAX_R2IQ_CHANNELS];
+	int npasses = 0;
+	for (int c = 0; c < N_MAX_R2IQ_CHANNELS; c++)
+	{
+		channel& ch = this->channels[c];
+		r2iqChannelState* const cs = &th->chan[c];
+
+		// a channel starts and stops with an output block
+		if (cs->decimate_count == 0)
+			cs->active = ch.output && ch.enabled;
+		if (!cs->active)
+			continue;
+
+		if (cs->decimate_count == 0)
 		{
-			// core of fast convolution including filter and decimation
-			//   main part is 'overlap-scrap' (IMHO better name for 'overlap-save'), see
-			//   https://en.wikipedia.org/wiki/Overlap%E2%80%93save_method
+			cs->pout = (fftwf_complex*)ch.output->getWritePtr();
+			cs->pmeta = ch.output->getWriteMeta();
+			*cs->pmeta = blockmeta();
+			cs->pmeta->channel = (uint8_t)c;
+
+			// the decimation changes with an output block, the sample count goes on
+			const int wished = c == 0 ? (int)this->mdecimation : (int)ch.decimation;
+			if (wished != cs->decimate)
 			{
-				// FFT first stage: time to frequency, real to complex
-				// 'full' transformation size: 2 * halfFft
-				fftwf_execute_dft_r2c(plan_t2f_r2c, th->ADCinTime + (3 * halfFft / 2) * k, th->ADCinFreq);
-				// result now in th->ADCinFreq[]
-
-				// circular shift (mixing in full bins) and low/bandpass filtering (complex multiplication)
-				{
-					// circular shift tune fs/2 first half array into th->inFreqTmp[]
-					shift_freq(th->inFreqTmp, source, filter, 0, count);
-					if (mfft / 2 != count)
-						memset(th->inFreqTmp[count], 0, sizeof(float) * 2 * (mfft / 2 - count));
-
-					// circular shift tune fs/2 second half array
-					shift_freq(dest, source2, filter2, start, mfft/2);
-					if (start != 0)
-						memset(th->inFreqTmp[mfft / 2], 0, sizeof(float) * 2 * start);
-				}
-				// result now in th->inFreqTmp[]
-
-				// 'shorter' inverse FFT transform (decimation); frequency (back) to COMPLEX time domain
-				// transform size: mfft = mfftdim[k] = halfFft / 2^k with k = mdecimation
-				fftwf_execute_dft(*plan_f2t_c2c, th->inFreqTmp, th->inFreqTmp);     //  c2c decimation
-				// result now in th->inFreqTmp[]
+				cs->outBase += (inmeta.sample - cs->adcBase) / (2 << cs->decimate);
+				cs->adcBase = inmeta.sample;
+				cs->decimate = wished;
+				cs->pmeta->flags |= BLOCK_RATE_CHANGED;
 			}
+			cs->pmeta->sample = cs->outBase + (inmeta.sample - cs->adcBase) / (2 << cs->decimate);
+			cs->pmeta->decimation = cs->decimate;
+		}
+		const int decimate = cs->decimate;
+		const int mfft = this->mfftdim[decimate];	// = halfFft / 2^decimate
+		blockmeta* pmeta = cs->pmeta;
+
+		// a retune takes effect with this input block, whole segments into the output
+		// block; at most one per output block, another one waits for the next
+		const tuning tune = ch.pendingTuning;
+		const float shift = lsb ? -tune.shift : tune.shift;   // sign change with sideband used
+		if ((tune.bin != cs->tunebin || shift != cs->shift) && !(pmeta->flags & BLOCK_RETUNED))
+		{
+			if (tune.bin != cs->tunebin)
+				retuneFilter(cs, decimate, tune.bin);
+			cs->tunebin = tune.bin;
+			cs->shift = shift;
+			pmeta->flags |= BLOCK_RETUNED;
+			pmeta->tuneOffset = cs->decimate_count * (transferSamples >> (decimate + 1));
+		}
+		pmeta->shift = cs->shift * this->mratio[decimate];
+		const int _mtunebin = cs->tunebin;
+		if (cs->tuneTurns != 0 && cs->filterDecimate != decimate)
+			retuneFilter(cs, decimate, _mtunebin);
+		const fftwf_complex* filter = cs->tuneTurns != 0 ? cs->filterTune : filterHw[decimate];
+
+		// host time of the most recent input block in this output block
+		pmeta->monoNs = inmeta.monoNs;
+		pmeta->realNs = inmeta.realNs;
+
+		// a gap in the ADC stream is a gap in the output: 2 * ratio real samples per complex one
+		if (inmeta.flags & BLOCK_DISCONTINUITY)
+		{
+			pmeta->flags |= BLOCK_DISCONTINUITY;
+			pmeta->dropped += inmeta.dropped / (2 << decimate);
+		}
 
-			// postprocessing
-			// @todo: is it possible to ..
-			//  1)
-			//    let inverse FFT produce/save it's result directly
-			//    in "this->obuffers[modx] + offset" (pout)
-			//    ( obuffers[] would need to have additional space ..;
-			//      need to move 'scrap' of 'ovelap-scrap'? )
-			//    at least FFTW would allow so,
-			//      see http://www.fftw.org/fftw3_doc/New_002darray-Execute-Functions.html
-			//    attention: multithreading!
-			//  2)
-			//    could mirroring (lower sideband) get calculated together
-			//    with fine mixer - modifying the mixer frequency? (fs - fc)/fs
-			//    (this would reduce one memory pass)
-			if (lsb) // lower sideband
-			{
-				// mirror just by negating the imaginary Q of complex I/Q
-				if (k == 0)
-				{
-					copy<true>(pout, &th->inFreqTmp[mfft / 4], mfft/2);
-				}
-				else
-				{
-					copy<true>(pout + mfft / 2 + (3 * mfft / 4) * (k - 1), &th->inFreqTmp[0], (3 * mfft / 4));
-				}
-			}
-			else // upper sideband
-			{
-				if (k == 0)
-				{
-					copy<false>(pout, &th->inFreqTmp[mfft / 4], mfft/2);
-				}
-				else
-				{
-					copy<false>(pout + mfft / 2 + (3 * mfft / 4) * (k - 1), &th->inFreqTmp[0], (3 * mfft / 4));
-				}
-			}
-			// result now in this->obuffers[]
+		pmeta->peak = std::max<int>(pmeta->peak, peak);
+		if (peak >= adcClipLevel)
+			pmeta->flags |= BLOCK_OVERLOAD;
+		// the settings the input block was made with, stamped when it arrived
+		pmeta->generation = inmeta.generation;
+		if (inmeta.generation != cs->lastGeneration)
+		{
+			pmeta->flags |= BLOCK_SETTINGS_CHANGED;
+			cs->lastGeneration = inmeta.generation;
 		}
 
-		if (decimate_count == 0) {
-			outputbuffer->WriteDone();
-			pout = nullptr;
+		r2iqPass& pass = passes[npasses++];
+		pass.channel = c;
+		pass.mfft = mfft;
+		// Calculate the parameters for the first half
+		pass.count = std::min(mfft/2, halfFft - _mtunebin);
+		pass.source = &th->ADCinFreq[_mtunebin];
+		// Calculate the parameters for the second half
+		pass.start = std::max(0, mfft / 2 - _mtunebin);
+		pass.source2 = &th->ADCinFreq[_mtunebin - mfft / 2];
+		pass.filter = filter;
+		pass.filter2 = &filter[halfFft - mfft / 2];
+		pass.plan_f2t_c2c = &plans_f2t_c2c[decimate];
+		pass.pout = cs->pout;
+	}
+
+#include "fft_mt_r2iq_kernel.hpp"
+
+	for (int p = 0; p < npasses; p++)
+	{
+		r2iqChannelState* const cs = &th->chan[passes[p].channel];
+		const int mfft = passes[p].mfft;
+
+		cs->decimate_count = (cs->decimate_count + 1) & ((1 << cs->decimate) - 1);
+		if (cs->decimate_count == 0) {
+			this->channels[passes[p].channel].output->WriteDone();
+			cs->pout = nullptr;
+			cs->pmeta = nullptr;
 		}
 		else
 		{
-			pout += mfft / 2 + (3 * mfft / 4) * (fftPerBuf - 1);
+			cs->pout += mfft / 2 + (3 * mfft / 4) * (fftPerBuf - 1);
 		}
-	} // while(run)
-//    DbgPrintf("r2iqThreadf idx %d pthread_exit %u\n",(int)th->t, pthread_self());
-	return 0;
+	}
+	return true;
 }
@@ -0,0 +1,89 @@
+// the fft filter bank of one input block: overlap-scrap fast convolution, tuning
+// by bin shift, decimation by a shorter inverse fft and the sideband mirror;
+// included by the r2iq workers and by processBlock() of each instruction set.
+// Each forward fft feeds the npasses outputs in passes[], see r2iqPass.
+// uses th, fftPerBuf, lsb, passes, npasses, transferSamples, detect, detSample
+// and detNs of the including scope
+	for (int k = 0; k < fftPerBuf; k++)
+	{
+		// FFT first stage: time to frequency, real to complex
+		// 'full' transformation size: 2 * halfFft
+		fftwf_execute_dft_r2c(plan_t2f_r2c, th->ADCinTime + (3 * halfFft / 2) * k, th->ADCinFreq);
+		// result now in th->ADCinFreq[]
+
+		if (detect)
+#include "fft_mt_r2iq_detect.hpp"
+
+		for (int p = 0; p < npasses; p++)
+		{
+			const r2iqPass& pass = passes[p];
+			const int mfft = pass.mfft;
+			const auto count = pass.count;
+			const auto start = pass.start;
+			fftwf_complex* const pout = pass.pout;
+			const auto dest = &th->inFreqTmp[mfft / 2];
+
+			// core of fast convolution including filter and decimation
+			//   main part is 'overlap-scrap' (IMHO better name for 'overlap-save'), see
+			//   https://en.wikipedia.org/wiki/Overlap%E2%80%93save_method
+			{
+				// circular shift (mixing in full bins) and low/bandpass filtering (complex multiplication)
+				{
+					// circular shift tune fs/2 first half array into th->inFreqTmp[]
+					shift_freq(th->inFreqTmp, pass.source, pass.filter, 0, count);
+					if (mfft / 2 != count)
+						memset(th->inFreqTmp[count], 0, sizeof(float) * 2 * (mfft / 2 - count));
+
+					// circular shift tune fs/2 second half array
+					shift_freq(dest, pass.source2, pass.filter2, start, mfft/2);
+					if (start != 0)
+						memset(th->inFreqTmp[mfft / 2], 0, sizeof(float) * 2 * start);
+				}
+				// result now in th->inFreqTmp[]
+
+				// 'shorter' inverse FFT transform (decimation); frequency (back) to COMPLEX time domain
+				// transform size: mfft = mfftdim[k] = halfFft / 2^k with k = the channel's decimation
+				fftwf_execute_dft(*pass.plan_f2t_c2c, th->inFreqTmp, th->inFreqTmp);     //  c2c decimation
+				// result now in th->inFreqTmp[]
+			}
+
+			// postprocessing
+			// @todo: is it possible to ..
+			//  1)
+			//    let inverse FFT produce/save it's result directly
+			//    in "this->obuffers[modx] + offset" (pout)
+			//    ( obuffers[] would need to have additional space ..;
+			//      need to move 'scrap' of 'ovelap-scrap'? )
+			//    at least FFTW would allow so,
+			//      see http://www.fftw.org/fftw3_doc/New_002darray-Execute-Functions.html
+			//    attention: multithreading!
+			//  2)
+			//    could mirroring (lower sideband) get calculated together
+			//    with fine mixer - modifying the mixer frequency? (fs - fc)/fs
+			//    (this would reduce one memory pass)
+			if (lsb) // lower sideband
+			{
+				// mirror just by negating the imaginary Q of complex I/Q
+				if (k == 0)
+				{
+					copy<true>(pout, &th->inFreqTmp[mfft / 4], mfft/2);
+				}
+				else
+				{
+					copy<true>(pout + mfft / 2 + (3 * mfft / 4) * (k - 1), &th->inFreqTmp[0], (3 * mfft / 4));
+				}
+			}
+			else // upper sideband
+			{
+				if (k == 0)
+				{
+					copy<false>(pout, &th->inFreqTmp[mfft / 4], mfft/2);
+				}
+				else
+				{
+					copy<false>(pout + mfft / 2 + (3 * mfft / 4) * (k - 1), &th->inFreqTmp[0], (3 * mfft / 4));
+				}
+			}
+			// result now in this->obuffers[]
+		}
+	}
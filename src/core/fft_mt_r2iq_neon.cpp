@@ -3,7 +3,12 @@
 #include "fftw3.h"
 #include "RadioHandler.h"
 
-void * fft_mt_r2iq::r2iqThreadf_neon(r2iqThreadArg *th)
+bool fft_mt_r2iq::r2iqStep_neon(r2iqThreadArg *th, bool wait)
 {
     #include "fft_mt_r2iq_impl.hpp"
 }
+
+int fft_mt_r2iq::processBlock_neon(r2iqThreadArg *th, const int16_t *dataADC, const int16_t *endloop, int transferSamples, fftwf_complex *pout)
+{
+    #include "fft_mt_r2iq_block.hpp"
+}
@@ -0,0 +1,363 @@
+#include "license.txt"
+#include "history.h"
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <algorithm>
+#include <chrono>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+using namespace std::chrono;
+
+static const size_t huge_page_size = 2 * 1024 * 1024;
+
+// blocks of the streams are 16 KiB or more, a few more entries for safety
+static const uint64_t min_block_size = 16 * 1024;
+
+// zeroed memory faulted in, from huge pages when there are
+static uint8_t* AllocateRing(size_t& size, bool& huge)
+{
+#ifdef _WIN32
+	// large pages need the lock pages in memory privilege
+	size_t large = GetLargePageMinimum();
+	if (large)
+	{
+		size_t n = (size + large - 1) / large * large;
+		void* p = VirtualAlloc(NULL, n, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (p)
+		{
+			size = n;
+			huge = true;
+			return (uint8_t*)p;
+		}
+	}
+	huge = false;
+	void* p = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (p == NULL)
+		return nullptr;
+	for (size_t i = 0; i < size; i += 4096)
+		((volatile uint8_t*)p)[i] = 0;
+	return (uint8_t*)p;
+#else
+	size = (size + huge_page_size - 1) / huge_page_size * huge_page_size;
+	void* p;
+#ifdef MAP_HUGETLB
+	// reserved huge pages, see /proc/sys/vm/nr_hugepages
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+	if (p != MAP_FAILED)
+	{
+		huge = true;
+		return (uint8_t*)p;
+	}
+#endif
+	huge = false;
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return nullptr;
+#ifdef MADV_HUGEPAGE
+	madvise(p, size, MADV_HUGEPAGE);
+#endif
+	// fault in now rather than at the stream rate
+	for (size_t i = 0; i < size; i += 4096)
+		((volatile uint8_t*)p)[i] = 0;
+	return (uint8_t*)p;
+#endif
+}
+
+static void FreeRing(uint8_t* ring, size_t size)
+{
+#ifdef _WIN32
+	VirtualFree(ring, 0, MEM_RELEASE);
+#else
+	munmap(ring, size);
+#endif
+}
+
+history::history() :
+	sampleSize(0),
+	ring(nullptr),
+	capacity(0),
+	allocated(0),
+	hugePages(false),
+	head(0),
+	count(0),
+	maxBlock(0),
+	state(IDLE),
+	pre(0.0),
+	post(0.0),
+	atNs(0),
+	startSample(0),
+	endSample(0),
+	firstEntry(0),
+	finishing(false),
+	closing(false),
+	captures(0),
+	capturedBytes(0),
+	lostBytes(0)
+{
+}
+
+history::~history()
+{
+	Close();
+}
+
+bool history::Open(const recorder_info& info, double seconds)
+{
+	uint32_t size = recorder::SampleSize(info.datatype);
+	if (size == 0 || info.sampleRate <= 0 || seconds <= 0)
+	{
+		DbgPrintf("history: invalid datatype, rate or length\n");
+		return false;
+	}
+
+	uint64_t bytes = (uint64_t)(seconds * info.sampleRate) * size;
+	if ((uint64_t)(size_t)bytes != bytes)
+	{
+		DbgPrintf("history: %.1f s do not fit into memory\n", seconds);
+		return false;
+	}
+
+	Finish();
+	this->info = info;
+	sampleSize = size;
+
+	if (ring && bytes == capacity)
+	{
+		Reset();
+		return true;
+	}
+	Close();
+
+	size_t alloc = (size_t)bytes;
+	ring = AllocateRing(alloc, hugePages);
+	if (ring == nullptr)
+	{
+		DbgPrintf("history: can not allocate %" PRIu64 " bytes\n", bytes);
+		return false;
+	}
+	allocated = alloc;
+	capacity = bytes;
+	entries.resize(capacity / min_block_size + 64);
+	Reset();
+
+	DbgPrintf("history: %.1f s in %" PRIu64 " MiB%s\n", seconds, capacity >> 20, hugePages ? " of huge pages" : "");
+
+	closing = false;
+	capture_thread = std::thread([this]() { this->Capture(); });
+	return true;
+}
+
+void history::Close()
+{
+	if (capture_thread.joinable())
+	{
+		Finish();
+		closing = true;
+		cv.notify_all();
+		capture_thread.join();
+	}
+
+	if (ring)
+		FreeRing(ring, allocated);
+	ring = nullptr;
+	capacity = 0;
+	allocated = 0;
+	entries.clear();
+}
+
+void history::Reset()
+{
+	head = 0;
+	count = 0;
+	maxBlock = 0;
+}
+
+void history::Push(const void* data, uint32_t bytes, const blockmeta& meta)
+{
+	if (ring == nullptr || bytes > capacity)
+		return;
+
+	const uint64_t h = head.load(std::memory_order_relaxed);
+	const uint64_t n = count.load(std::memory_order_relaxed);
+	if (bytes > maxBlock)
+		maxBlock = bytes;
+
+	entry& e = entries[n % entries.size()];
+	e.pos = h;
+	e.bytes = bytes;
+	e.meta = meta;
+
+	size_t at = (size_t)(h % capacity);
+	size_t first = std::min<size_t>(bytes, (size_t)(capacity - at));
+	memcpy(ring + at, data, first);
+	memcpy(ring, (const uint8_t*)data + first, bytes - first);
+
+	head.store(h + bytes, std::memory_order_release);
+	count.store(n + 1, std::memory_order_release);
+
+	if (state.load(std::memory_order_acquire) == ARMED && meta.realNs >= atNs)
+	{
+		uint64_t preSamples = (uint64_t)(pre * info.sampleRate);
+		startSample = meta.sample > preSamples ? meta.sample - preSamples : 0;
+		endSample = meta.sample + (uint64_t)(post * info.sampleRate);
+		firstEntry = n;
+		state = RUNNING;
+		cv.notify_all();
+	}
+}
+
+bool history::Trigger(const char* base, double pre, double post, int64_t atNs)
+{
+	std::lock_guard<std::mutex> lk(mutex);
+	if (ring == nullptr || state != IDLE || pre < 0 || post < 0)
+		return false;
+
+	this->base = base;
+	this->pre = pre;
+	this->post = post;
+	this->atNs = atNs;
+	finishing = false;
+	state = ARMED;
+	return true;
+}
+
+bool history::TriggerSamples(const char* base, double pre, double post, uint64_t first, uint64_t last)
+{
+	std::lock_guard<std::mutex> lk(mutex);
+	if (ring == nullptr || state != IDLE || pre < 0 || post < 0 || last < first)
+		return false;
+
+	this->base = base;
+	this->pre = pre;
+	this->post = post;
+	finishing = false;
+	uint64_t preSamples = (uint64_t)(pre * info.sampleRate);
+	startSample = first > preSamples ? first - preSamples : 0;
+	endSample = last + (uint64_t)(post * info.sampleRate);
+	// the capture looks back from the newest block for the start
+	firstEntry = count.load(std::memory_order_acquire);
+	state = RUNNING;
+	cv.notify_all();
+	return true;
+}
+
+void history::Finish()
+{
+	std::unique_lock<std::mutex> lk(mutex);
+	capture_state armed = ARMED;
+	state.compare_exchange_strong(armed, IDLE);
+	if (state == IDLE)
+		return;
+
+	finishing = true;
+	cv.notify_all();
+	cv.wait(lk, [this]() { return state == IDLE; });
+}
+
+// 1 with the block copied, 0 when not pushed yet, -1 when the ring has overwritten it;
+// data nullptr for the entry only
+int history::ReadEntry(uint64_t n, entry& e, std::vector<uint8_t>* data)
+{
+	if (n >= count.load(std::memory_order_acquire))
+		return 0;
+
+	e = entries[n % entries.size()];
+	if (data)
+	{
+		if (e.bytes > data->size())
+			data->resize(e.bytes);
+		size_t at = (size_t)(e.pos % capacity);
+		size_t first = std::min<size_t>(e.bytes, (size_t)(capacity - at));
+		memcpy(data->data(), ring + at, first);
+		memcpy(data->data() + first, ring, e.bytes - first);
+	}
+
+	// still there when the producer has not reached it, a block it may be writing included
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (count.load() >= n + entries.size() ||
+		head.load() + maxBlock.load() > e.pos + capacity)
+		return -1;
+	return 1;
+}
+
+void history::Capture()
+{
+	std::vector<uint8_t> data;
+
+	while (!closing)
+	{
+		{
+			std::unique_lock<std::mutex> lk(mutex);
+			cv.wait_for(lk, milliseconds(10), [this]() { return state == RUNNING || closing; });
+			if (state != RUNNING)
+				continue;
+		}
+
+		recorder_info ri = info;
+		if (!rec.Open(base.c_str(), ri))
+		{
+			DbgPrintf("history: can not capture to %s\n", base.c_str());
+		}
+		else
+		{
+			rec.SetBlocking(true);
+
+			// back to the oldest block in the ring that ends after the start
+			uint64_t n = firstEntry;
+			entry e;
+			while (n > 0 && ReadEntry(n - 1, e, nullptr) > 0 &&
+				e.meta.sample + e.bytes / sampleSize > startSample)
+				n--;
+
+			bool gap = false;
+			while (!closing)
+			{
+				int r = ReadEntry(n, e, &data);
+				if (r == 0)
+				{
+					if (finishing)
+						break;
+					std::this_thread::sleep_for(milliseconds(10));
+					continue;
+				}
+				n++;
+				if (r < 0)
+				{
+					// the capture fell behind the stream by the whole ring
+					lostBytes += e.bytes;
+					gap = true;
+					continue;
+				}
+				if (e.meta.sample >= endSample)
+					break;
+				if (e.meta.sample + e.bytes / sampleSize <= startSample)
+					continue;
+
+				if (gap)
+				{
+					e.meta.flags |= BLOCK_DISCONTINUITY;
+					gap = false;
+				}
+				rec.Push(data.data(), e.bytes, e.meta);
+				capturedBytes += e.bytes;
+			}
+
+			rec.Close();
+			captures++;
+			DbgPrintf("history: captured %s\n", base.c_str());
+		}
+
+		std::lock_guard<std::mutex> lk(mutex);
+		finishing = false;
+		state = IDLE;
+		cv.notify_all();
+	}
+}
@@ -0,0 +1,108 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "license.txt"
+
+//
+// history: a time machine over the last seconds of a stream
+// Push() copies every block into a large ring in memory and never waits,
+// so recording everything is not needed to keep a transient. The ring is
+// backed by huge pages when the system has them reserved (transparent huge
+// pages otherwise) and is faulted in at Open, not in the stream.
+// Trigger() saves from some seconds before the trigger to some seconds
+// after it as a SigMF recording while the stream goes on: a thread of the
+// history hands the blocks from the ring to a recorder, the pre-trigger
+// ones first, then it catches up with the live stream. When the ring laps
+// a capture that can not keep up, the lost blocks are a gap in it.
+//
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "blocktap.h"
+#include "recorder.h"
+
+class history : public blocktap {
+public:
+    history();
+    ~history();
+
+    // a ring for seconds of the stream described by info, kept when the size is the same
+    bool Open(const recorder_info& info, double seconds);
+    void Close();
+    bool IsOpen() const { return ring != nullptr; }
+    // forget the blocks, at a new start of the stream
+    void Reset();
+
+    // producer side, from one thread at a time
+    void Push(const void* data, uint32_t bytes, const blockmeta& meta) override;
+    void SetFrequency(double frequency) { info.frequency = frequency; }
+
+    // save pre seconds before the trigger to post seconds after it to <base>.sigmf-data/-meta;
+    // the trigger is the first block pushed at or after the host time atNs, 0 for the next one.
+    // false while a capture is armed or running
+    bool Trigger(const char* base, double pre, double post, int64_t atNs = 0);
+    // the same with the trigger at the samples first..last of the stream, pushed
+    // already or not: for an event seen further down the stream than the ring is
+    bool TriggerSamples(const char* base, double pre, double post, uint64_t first, uint64_t last);
+    // the stream stopped: cancel an armed trigger, finish a capture with the blocks there are
+    void Finish();
+    bool IsCapturing() const { return state != IDLE; }
+
+    uint64_t getCapacity() const { return capacity; }
+    bool getHugePages() const { return hugePages; }
+    uint32_t getCaptures() const { return captures; }
+    uint64_t getCapturedBytes() const { return capturedBytes; }
+    uint64_t getLostBytes() const { return lostBytes; }
+
+private:
+    enum capture_state { IDLE, ARMED, RUNNING };
+
+    struct entry {
+        uint64_t pos;           // bytes pushed before the block
+        uint32_t bytes;
+        blockmeta meta;
+    };
+
+    void Capture();
+    int ReadEntry(uint64_t n, entry& e, std::vector<uint8_t>* data);
+
+    recorder_info info;
+    uint32_t sampleSize;
+
+    // the ring
+    uint8_t* ring;
+    uint64_t capacity;
+    size_t allocated;
+    bool hugePages;
+    std::vector<entry> entries;
+    std::atomic<uint64_t> head;         // bytes pushed
+    std::atomic<uint64_t> count;        // blocks pushed
+    std::atomic<uint32_t> maxBlock;     // largest block, for the overwrite check
+
+    // the capture
+    std::atomic<capture_state> state;
+    std::string base;
+    double pre, post;
+    int64_t atNs;
+    uint64_t startSample, endSample;    // from .. before
+    std::atomic<uint64_t> firstEntry;   // block of the trigger
+    std::atomic<bool> finishing;
+    recorder rec;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::atomic<bool> closing;
+    std::thread capture_thread;
+
+    std::atomic<uint32_t> captures;
+    std::atomic<uint64_t> capturedBytes;
+    std::atomic<uint64_t> lostBytes;
+};
+
+#endif
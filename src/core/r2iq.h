@@ -10,8 +10,14 @@
 #include <atomic>
 
 #include "dsp/ringbuffer.h"
+#include "thread_sched.h"
+
+// an input block reaching this level is flagged BLOCK_OVERLOAD, by every r2iq
+static const int adcClipLevel = 32767;
 
 struct r2iqThreadArg;
+class blocktap;
+class detector;
 
 class r2iqControlClass {
 public:
@@ -26,21 +32,72 @@ public:
     void setSideband(bool lsb) { this->sideband = lsb; }
     bool getSideband() const { return this->sideband; }
 
+    // while on, the workers take it with the next output block, see BLOCK_RATE_CHANGED
     void setDecimate(int dec) {this->mdecimation = dec; }
 
+    // bumped by every setting change, the blocks record the value they were made with
+    void nextGeneration() { this->generation++; }
+    uint32_t getGeneration() const { return this->generation; }
+
+    // ADC samples of the input blocks taken since TurnOn, lost ones included
+    uint64_t getInputSamples() const { return this->inputSamples; }
+
+    // placement and scheduling of the worker threads, used from the next TurnOn
+    void setThreadSched(const thread_sched& s) { this->sched = s; }
+
+    // taps receive a copy of every input block in order, nullptr for none; set while off
+    static const int maxInputTaps = 2;
+    void setInputTap(int index, blocktap* tap) { this->inputTap[index] = tap; }
+
+    // runs on the forward spectrum where there is one, nullptr for none; set while off
+    void setDetector(detector* d) { this->spectrumDetector = d; }
+
     virtual void Init(float gain, ringbuffer<int16_t>* input, ringbuffer<float>* obuffers) {}
     virtual void TurnOn() { this->r2iqOn = true; }
     virtual void TurnOff(void) { this->r2iqOn = false; }
     virtual bool IsOn(void) { return this->r2iqOn; }
     virtual void DataReady(void) {}
+    // offset relative to ADC/2, taken with the next input block; the block of the change
+    // is flagged BLOCK_RETUNED. Returns the rest left to a mixer at the current decimation
     virtual float setFreqOffset(float offset) { return 0; };
+    virtual bool checkBlockSize(uint32_t samples) const { return true; }
+
+    // outputs besides the main one of Init, made from the same forward fft with a
+    // tuning and decimation of their own; their blocks carry blockmeta::channel.
+    // The outputs are set while off, nullptr for none
+    virtual int getMaxChannels() const { return 1; }
+    virtual void setChannelOutput(int channel, ringbuffer<float>* output) {}
+    // as setDecimate and setFreqOffset for the main one, channel 0
+    virtual void setChannelDecimate(int channel, int dec) {}
+    virtual float setChannelOffset(int channel, float offset) { return 0; }
+    // a disabled channel makes no blocks, it stops and starts at a block boundary
+    virtual void enableChannel(int channel, bool enable) {}
+    // the next input block into the output ring when there are the block and room
+    // for it, never waits; false when there was nothing to do. see r2iq_pool.h
+    virtual bool Step() { return false; }
 
 protected:
-    int mdecimation ;   // selected decimation ratio
+    std::atomic<int> mdecimation;   // selected decimation ratio
       // 64 Msps:               0 => 32Msps, 1=> 16Msps, 2 = 8Msps, 3 = 4Msps, 4 = 2Msps
       // 128 Msps: 0 => 64Msps, 1 => 32Msps, 2=> 16Msps, 3 = 8Msps, 4 = 4Msps, 5 = 2Msps
     bool r2iqOn;        // r2iq on flag
+    bool pooled;        // run by the r2iq_pool rather than threads of its own
     int mratio [NDECIDX];  // ratio
+    thread_sched sched;
+    std::atomic<uint32_t> generation;
+    std::atomic<uint64_t> inputSamples;
+    blocktap* inputTap[maxInputTaps];
+    detector* spectrumDetector;
+
+    // hand the block being read to the tap, from the reader of the input ring
+    void tapInput(const int16_t* data, int samples, const blockmeta& meta);
+
+    // at TurnOn: a job of the r2iq_pool when it has workers, then true; false for own threads
+    bool attachPool(ringbufferbase* input, ringbufferbase* output);
+    // before attachPool: another ring of the job that wakes the pool
+    void notifyPool(ringbufferbase* ring);
+    // at TurnOff, before the rings stop
+    void detachPool();
 
 private:
     bool randADC;       // randomized ADC output
@@ -0,0 +1,133 @@
+#include "license.txt"
+#include "r2iq_batch.h"
+#include "config.h"
+#include "pffft/pf_mixer.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+static const double two_pi = 6.283185307179586;
+
+r2iq_batch::r2iq_batch(float gain, uint32_t blockSamples) :
+	blockSamples(blockSamples),
+	overlap(halfFft, 0),
+	pending(blockSamples),
+	pendingSamples(0),
+	position(0),
+	tune(0.25),
+	fc(0.0f),
+	mixerValid(false)
+{
+	assert(checkBlockSize(blockSamples));
+	Init(gain, nullptr, nullptr);
+	reserveBlock(blockSamples);
+	stateFineTune = new shift_limited_unroll_C_sse_data_t();
+}
+
+r2iq_batch::~r2iq_batch()
+{
+	delete stateFineTune;
+}
+
+bool r2iq_batch::setDecimation(int decimate)
+{
+	if (decimate < 0 || decimate >= NDECIDX)
+		return false;
+
+	setDecimate(decimate);
+	mixerValid = false;
+	return true;
+}
+
+void r2iq_batch::setTune(double offset)
+{
+	tune = offset;
+	mixerValid = false;
+}
+
+void r2iq_batch::setSideband(bool lsb)
+{
+	fft_mt_r2iq::setSideband(lsb);
+	mixerValid = false;
+}
+
+void r2iq_batch::reset()
+{
+	seek(0, nullptr);
+}
+
+void r2iq_batch::seek(uint64_t block, const int16_t* history)
+{
+	pendingSamples = 0;
+	if (history)
+		memcpy(overlap.data(), history, halfFft * sizeof(int16_t));
+	else
+		std::fill(overlap.begin(), overlap.end(), 0);
+	position = block;
+	mixerValid = false;
+}
+
+size_t r2iq_batch::outputSamples(size_t n) const
+{
+	return (pendingSamples + n) / blockSamples * (blockSamples >> (mdecimation + 1));
+}
+
+void r2iq_batch::updateMixer()
+{
+	// as RadioHandlerClass::TuneLO: whole bins in r2iq, the rest in the mixer
+	fc = setFreqOffset((float)tune);
+	if (getSideband())
+		fc = -fc;   // sign change with sideband used
+	// the phase the mixer has after position blocks
+	double cycles = (double)fc * (double)(position * (blockSamples >> (mdecimation + 1)));
+	float phase = (float)(two_pi * (cycles - floor(cycles)));
+	*stateFineTune = shift_limited_unroll_C_sse_init(fc, phase);
+	mixerValid = true;
+}
+
+size_t r2iq_batch::process(const int16_t* in, size_t n, float* out)
+{
+	if (!mixerValid)
+		updateMixer();
+
+	const int outSamples = blockSamples >> (mdecimation + 1);
+	auto pout = (fftwf_complex*)out;
+	size_t written = 0;
+
+	while (pendingSamples + n >= blockSamples)
+	{
+		const int16_t* block;
+		if (pendingSamples == 0)
+		{
+			// whole block in the input, no copy
+			block = in;
+			in += blockSamples;
+			n -= blockSamples;
+		}
+		else
+		{
+			size_t fill = blockSamples - pendingSamples;
+			memcpy(&pending[pendingSamples], in, fill * sizeof(int16_t));
+			in += fill;
+			n -= fill;
+			pendingSamples = 0;
+			block = pending.data();
+		}
+
+		processBlock(threadArgs[0], block, overlap.data(), blockSamples, pout);
+		memcpy(overlap.data(), block + blockSamples - halfFft, halfFft * sizeof(int16_t));
+
+		if (fc != 0.0f)
+			shift_limited_unroll_C_sse_inp_c((complexf*)pout, outSamples, stateFineTune);
+
+		pout += outSamples;
+		written += outSamples;
+		position++;
+	}
+
+	memcpy(&pending[pendingSamples], in, n * sizeof(int16_t));
+	pendingSamples += n;
+
+	return written;
+}
@@ -0,0 +1,71 @@
+#ifndef R2IQ_BATCH_H
+#define R2IQ_BATCH_H
+
+#include "license.txt"
+
+//
+// r2iq_batch: the r2iq DDC as a plain function call
+// The same filter bank and SIMD kernels as the streaming fft_mt_r2iq, but
+// without worker threads and rings: process() converts real ADC samples to
+// complex IQ on the calling thread. The overlap with the previous block and
+// the fine mixer phase are kept in the object, so a long capture can be fed
+// in chunks of any size and the output is the same as from one call.
+// Instances are independent, each one can run on its own thread.
+//
+// The input is consumed in blocks of blockSamples (halfFft + n * 3/4 FFTN_R_ADC),
+// a block gives blockSamples / 2^(decimation+1) complex samples. A partial
+// block is kept until the next call.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "fft_mt_r2iq.h"
+
+struct shift_limited_unroll_C_sse_data_s;
+typedef struct shift_limited_unroll_C_sse_data_s shift_limited_unroll_C_sse_data_t;
+
+class r2iq_batch : private fft_mt_r2iq
+{
+public:
+    r2iq_batch(float gain = RX888mk2_GAINFACTOR, uint32_t blockSamples = DEFAULT_TRANSFER_SAMPLES);
+    ~r2iq_batch();
+
+    // 0 => adc/2 complex rate .. NDECIDX-1, false when out of range
+    bool setDecimation(int decimate);
+    // center of the output band as a fraction of adc/2, 0.25 by default
+    void setTune(double offset);
+    void setSideband(bool lsb);
+    using fft_mt_r2iq::updateRand;
+
+    // start over: drop the partial block, clear the overlap and the mixer phase
+    void reset();
+    // continue at input block number block as if the ones before had been processed,
+    // history holds the halfFft samples before it; for parallel chunks of one capture
+    void seek(uint64_t block, const int16_t* history);
+
+    uint32_t getBlockSamples() const { return blockSamples; }
+    // complex samples the next process() call writes for n input samples
+    size_t outputSamples(size_t n) const;
+
+    // out receives I/Q float pairs and must be 16 byte aligned,
+    // returns the number of complex samples written
+    size_t process(const int16_t* in, size_t n, float* out);
+
+private:
+    void updateMixer();
+
+    const uint32_t blockSamples;
+    std::vector<int16_t> overlap;       // last halfFft samples of the previous block
+    std::vector<int16_t> pending;       // partial block
+    size_t pendingSamples;
+    uint64_t position;                  // blocks since the start, for the mixer phase
+
+    double tune;
+    float fc;                           // fine mixer frequency, relative to the output rate
+    bool mixerValid;
+    shift_limited_unroll_C_sse_data_t* stateFineTune;
+};
+
+#endif
@@ -0,0 +1,136 @@
+#include "license.txt"
+#include "r2iq_pool.h"
+#include "r2iq.h"
+#include "config.h"
+
+#include <stdlib.h>
+#include <chrono>
+
+using namespace std::chrono;
+
+// blocks of a job before a worker looks at the others
+static const int batch_blocks = 4;
+
+r2iq_pool& r2iq_pool::Instance()
+{
+	static r2iq_pool pool;
+	return pool;
+}
+
+r2iq_pool::r2iq_pool() :
+	workers(0),
+	pending(false),
+	running(false)
+{
+	const char* env = getenv("SDDC_R2IQ_WORKERS");
+	if (env)
+		SetWorkers(atoi(env));
+}
+
+r2iq_pool::~r2iq_pool()
+{
+	StopWorkers();
+}
+
+void r2iq_pool::SetWorkers(int count)
+{
+	workers = count > 0 ? count : 0;
+}
+
+void r2iq_pool::Attach(r2iqControlClass* r2iq, const thread_sched& sched)
+{
+	std::lock_guard<std::mutex> alk(attachMutex);
+	std::unique_lock<std::mutex> lk(mutex);
+	jobs.push_back({ r2iq, false });
+	pending = true;
+
+	if (!running)
+	{
+		running = true;
+		int count = workers > 0 ? workers : 1;
+		for (int i = 0; i < count; i++)
+		{
+			threads.emplace_back([this, sched]() {
+				ApplyThreadSched(sched);
+				this->Worker();
+			});
+		}
+		DbgPrintf("r2iq_pool: %d workers\n", count);
+	}
+	cv.notify_all();
+}
+
+void r2iq_pool::Detach(r2iqControlClass* r2iq)
+{
+	std::lock_guard<std::mutex> alk(attachMutex);
+	{
+		std::unique_lock<std::mutex> lk(mutex);
+		for (auto it = jobs.begin(); it != jobs.end(); ++it)
+		{
+			if (it->r2iq != r2iq)
+				continue;
+			idle.wait(lk, [it]() { return !it->busy; });
+			jobs.erase(it);
+			break;
+		}
+		if (!jobs.empty())
+			return;
+	}
+	StopWorkers();
+}
+
+void r2iq_pool::StopWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lk(mutex);
+		running = false;
+		cv.notify_all();
+	}
+	for (auto& t : threads)
+		t.join();
+	threads.clear();
+}
+
+void r2iq_pool::Notify(void* context)
+{
+	r2iq_pool& pool = Instance();
+	std::lock_guard<std::mutex> lk(pool.mutex);
+	pool.pending = true;
+	pool.cv.notify_one();
+}
+
+void r2iq_pool::Worker()
+{
+	std::unique_lock<std::mutex> lk(mutex);
+	while (running)
+	{
+		bool progress = false;
+		pending = false;
+
+		for (auto it = jobs.begin(); it != jobs.end(); ++it)
+		{
+			if (it->busy)
+				continue;
+			it->busy = true;
+			lk.unlock();
+
+			int n = 0;
+			while (n < batch_blocks && it->r2iq->Step())
+				n++;
+
+			lk.lock();
+			it->busy = false;
+			idle.notify_all();
+			if (n > 0)
+				progress = true;
+		}
+
+		// the next pass starts with another job
+		if (jobs.size() > 1)
+			jobs.splice(jobs.end(), jobs, jobs.begin());
+
+		// a pass without work sleeps until a ring changes, the timeout is a safety net
+		if (!progress && !pending)
+			cv.wait_for(lk, milliseconds(10));
+	}
+}
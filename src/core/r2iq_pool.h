@@ -0,0 +1,67 @@
+#ifndef R2IQ_POOL_H
+#define R2IQ_POOL_H
+
+#include "license.txt"
+
+//
+// r2iq_pool: worker threads shared by the r2iq of all the receivers of a process
+// Without the pool each r2iq runs a thread of its own. With it an r2iq that
+// is on is a job of the pool: a worker takes a job whose input ring holds a
+// block and whose output ring has room, runs a few blocks of it and moves
+// on, so that N receivers share the pool's threads instead of adding N.
+// One worker at a time runs a job, its blocks stay in order. The rings wake
+// the pool through ringbuffer::setNotify(); the workers exist while there
+// are jobs.
+//
+
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "thread_sched.h"
+
+class r2iqControlClass;
+
+class r2iq_pool {
+public:
+    static r2iq_pool& Instance();
+
+    // number of shared workers, 0 for a thread of each r2iq; used by the r2iq turned on
+    // next, the SDDC_R2IQ_WORKERS env variable gives the default
+    void SetWorkers(int count);
+    int GetWorkers() const { return workers; }
+
+    // the workers start with the scheduling of the first job
+    void Attach(r2iqControlClass* r2iq, const thread_sched& sched);
+    // returns once no worker runs the job any more
+    void Detach(r2iqControlClass* r2iq);
+
+    // for ringbuffer::setNotify(): a block or room for one is there
+    static void Notify(void* context);
+
+private:
+    r2iq_pool();
+    ~r2iq_pool();
+
+    struct job {
+        r2iqControlClass* r2iq;
+        bool busy;
+    };
+
+    void Worker();
+    void StopWorkers();
+
+    int workers;
+    std::mutex attachMutex;     // Attach and Detach one at a time
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::condition_variable idle;
+    std::list<job> jobs;
+    bool pending;
+    bool running;
+    std::vector<std::thread> threads;
+};
+
+#endif
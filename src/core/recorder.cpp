@@ -0,0 +1,412 @@
+#include "license.txt"
+#include "recorder.h"
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std::chrono;
+
+uint32_t recorder::SampleSize(const char* datatype)
+{
+	if (datatype == nullptr || (datatype[0] != 'r' && datatype[0] != 'c'))
+		return 0;
+	int bits = atoi(datatype + 2);
+	if (bits != 8 && bits != 16 && bits != 32)
+		return 0;
+	return (datatype[0] == 'c' ? 2 : 1) * bits / 8;
+}
+
+// ISO 8601 UTC with microseconds, as SigMF core:datetime
+static std::string datetime(int64_t realNs)
+{
+	time_t sec = (time_t)(realNs / 1000000000);
+	int usec = (int)(realNs % 1000000000 / 1000);
+	struct tm t;
+#ifdef _WIN32
+	gmtime_s(&t, &sec);
+#else
+	gmtime_r(&sec, &t);
+#endif
+	char buf[64];
+	size_t n = strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &t);
+	snprintf(buf + n, sizeof(buf) - n, ".%06dZ", usec);
+	return buf;
+}
+
+recorder::recorder() :
+	sampleSize(0),
+	rolloverBytes(0),
+	frequency(0.0),
+	head(0),
+	tail(0),
+	gap(true),
+	blocking(false),
+	closing(false),
+#ifdef _WIN32
+	file(INVALID_HANDLE_VALUE),
+#else
+	fd(-1),
+#endif
+	fileOpen(false),
+	fileBytes(0),
+	writtenBytes(0),
+	lostBytes(0),
+	files(0),
+	error(false)
+{
+}
+
+recorder::~recorder()
+{
+	Close();
+}
+
+bool recorder::Open(const char* base, const recorder_info& info, uint64_t rolloverBytes, double rolloverSeconds)
+{
+	Close();
+
+	sampleSize = SampleSize(info.datatype);
+	if (sampleSize == 0 || info.sampleRate <= 0)
+	{
+		DbgPrintf("recorder: invalid datatype or rate\n");
+		return false;
+	}
+
+	this->base = base;
+	this->info = info;
+	frequency = info.frequency;
+
+	// rollover at a buffer boundary
+	uint64_t limit = rolloverBytes;
+	if (rolloverSeconds > 0)
+	{
+		uint64_t bytes = (uint64_t)(rolloverSeconds * info.sampleRate) * sampleSize;
+		limit = limit ? std::min(limit, bytes) : bytes;
+	}
+	this->rolloverBytes = (limit + buffer_size - 1) / buffer_size * buffer_size;
+
+	buffers.resize(buffer_count);
+	for (auto& b : buffers)
+	{
+#ifdef _WIN32
+		b.data = (uint8_t*)_aligned_malloc(buffer_size, sector_size);
+#else
+		void* p = nullptr;
+		b.data = posix_memalign(&p, sector_size, buffer_size) == 0 ? (uint8_t*)p : nullptr;
+#endif
+		b.used = 0;
+		b.marks.clear();
+		b.marks.reserve(8);
+	}
+	for (auto& b : buffers)
+	{
+		if (b.data == nullptr)
+		{
+			DbgPrintf("recorder: out of memory\n");
+			Close();
+			return false;
+		}
+	}
+
+	head = 0;
+	tail = 0;
+	gap = true;
+	closing = false;
+	error = false;
+	writtenBytes = 0;
+	lostBytes = 0;
+	files = 0;
+
+	if (!OpenFile())
+	{
+		Close();
+		return false;
+	}
+
+	writer = std::thread([this]() { this->Writer(); });
+	return true;
+}
+
+void recorder::Close()
+{
+	if (writer.joinable())
+	{
+		// hand over the partly filled buffer, it is still ours when not all are queued
+		uint32_t h = head;
+		if (h - tail < (uint32_t)buffer_count && buffers[h % buffer_count].used > 0)
+			head = h + 1;
+
+		closing = true;
+		cv.notify_one();
+		writer.join();
+
+		DbgPrintf("recorder: %" PRIu64 " bytes in %u files, %" PRIu64 " bytes lost\n",
+			(uint64_t)writtenBytes, (uint32_t)files, (uint64_t)lostBytes);
+	}
+
+	if (fileOpen)
+		CloseFile();
+
+	for (auto& b : buffers)
+	{
+#ifdef _WIN32
+		_aligned_free(b.data);
+#else
+		free(b.data);
+#endif
+	}
+	buffers.clear();
+}
+
+void recorder::Push(const void* data, uint32_t bytes, const blockmeta& meta)
+{
+	if (buffers.empty())
+		return;
+
+	if (meta.flags & (BLOCK_DISCONTINUITY | BLOCK_SETTINGS_CHANGED))
+		gap = true;
+
+	// all or nothing: a partial block would hide the gap
+	uint32_t h = head;
+	uint32_t avail = buffer_count - (h - tail.load(std::memory_order_acquire));
+	while (blocking && (avail == 0 || (uint64_t)avail * buffer_size - buffers[h % buffer_count].used < bytes) &&
+		(uint64_t)bytes <= (uint64_t)(buffer_count - 1) * buffer_size && !error)
+	{
+		std::unique_lock<std::mutex> lk(mutex);
+		spaceCv.wait_for(lk, milliseconds(10));
+		avail = buffer_count - (h - tail.load(std::memory_order_acquire));
+	}
+	if (avail == 0 || (uint64_t)avail * buffer_size - buffers[h % buffer_count].used < bytes)
+	{
+		lostBytes += bytes;
+		gap = true;
+		return;
+	}
+
+	const uint8_t* src = (const uint8_t*)data;
+	uint32_t done = 0;
+	while (done < bytes)
+	{
+		buffer& b = buffers[h % buffer_count];
+
+		if (b.used == 0 || gap)
+		{
+			uint64_t n = done / sampleSize;
+			b.marks.emplace_back();
+			mark& m = b.marks.back();
+			m.offset = b.used;
+			m.segment = gap;
+			m.global = meta.sample + n;
+			m.realNs = meta.realNs + (int64_t)(n * 1e9 / info.sampleRate);
+			m.frequency = frequency;
+		}
+		gap = false;
+
+		uint32_t n = std::min(bytes - done, buffer_size - b.used);
+		memcpy(b.data + b.used, src + done, n);
+		b.used += n;
+		done += n;
+
+		if (b.used == buffer_size)
+		{
+			head.store(++h, std::memory_order_release);
+			cv.notify_one();
+		}
+	}
+}
+
+void recorder::Writer()
+{
+	while (true)
+	{
+		uint32_t t = tail;
+		if (t == head.load(std::memory_order_acquire))
+		{
+			if (closing && t == head)
+				break;
+			std::unique_lock<std::mutex> lk(mutex);
+			cv.wait_for(lk, milliseconds(10));
+			continue;
+		}
+
+		buffer& b = buffers[t % buffer_count];
+
+		if (rolloverBytes && fileBytes >= rolloverBytes)
+		{
+			CloseFile();
+			if (!OpenFile())
+				error = true;
+		}
+
+		for (size_t i = 0; i < b.marks.size(); i++)
+		{
+			mark m = b.marks[i];
+			if (m.segment || (fileBytes == 0 && i == 0))
+			{
+				m.offset = (fileBytes + m.offset) / sampleSize;
+				captures.push_back(m);
+			}
+		}
+
+		if (fileOpen && WriteData(b.data, b.used))
+		{
+			fileBytes += b.used;
+			writtenBytes += b.used;
+		}
+		else
+		{
+			lostBytes += b.used;
+		}
+
+		b.used = 0;
+		b.marks.clear();
+		tail.store(t + 1, std::memory_order_release);
+		if (blocking)
+			spaceCv.notify_one();
+	}
+
+	CloseFile();
+}
+
+bool recorder::OpenFile()
+{
+	char name[32] = "";
+	if (rolloverBytes)
+		snprintf(name, sizeof(name), "-%04u", (uint32_t)files);
+	fileName = base + name;
+	std::string path = fileName + ".sigmf-data";
+
+#ifdef _WIN32
+	file = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+		FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		DbgPrintf("recorder: can not create %s\n", path.c_str());
+		return false;
+	}
+#else
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+	fd = open(path.c_str(), flags | O_DIRECT, 0644);
+	if (fd < 0 && errno == EINVAL)
+#endif
+		fd = open(path.c_str(), flags, 0644);   // e.g. tmpfs has no direct I/O
+	if (fd < 0)
+	{
+		DbgPrintf("recorder: can not create %s: %s\n", path.c_str(), strerror(errno));
+		return false;
+	}
+#endif
+
+	fileOpen = true;
+	fileBytes = 0;
+	captures.clear();
+	files++;
+	return true;
+}
+
+bool recorder::WriteData(const uint8_t* data, uint32_t bytes)
+{
+	// direct I/O writes whole sectors, the last buffer is padded and truncated by CloseFile
+	uint32_t len = (bytes + sector_size - 1) / sector_size * sector_size;
+
+#ifdef _WIN32
+	DWORD written;
+	if (!WriteFile(file, data, len, &written, NULL) || written != len)
+	{
+		DbgPrintf("recorder: write failed %lu\n", GetLastError());
+		error = true;
+		return false;
+	}
+#else
+	while (len > 0)
+	{
+		ssize_t n = write(fd, data, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+		{
+			DbgPrintf("recorder: write failed: %s\n", strerror(errno));
+			error = true;
+			return false;
+		}
+		data += n;
+		len -= n;
+	}
+#endif
+	return true;
+}
+
+void recorder::CloseFile()
+{
+	if (!fileOpen)
+		return;
+
+#ifdef _WIN32
+	LARGE_INTEGER size;
+	size.QuadPart = fileBytes;
+	SetFilePointerEx(file, size, NULL, FILE_BEGIN);
+	SetEndOfFile(file);
+	CloseHandle(file);
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (ftruncate(fd, fileBytes) != 0)
+		DbgPrintf("recorder: truncate failed: %s\n", strerror(errno));
+	close(fd);
+	fd = -1;
+#endif
+	fileOpen = false;
+
+	if (!WriteMeta())
+		error = true;
+}
+
+bool recorder::WriteMeta()
+{
+	std::string path = fileName + ".sigmf-meta";
+	FILE* f = fopen(path.c_str(), "w");
+	if (f == nullptr)
+	{
+		DbgPrintf("recorder: can not create %s\n", path.c_str());
+		return false;
+	}
+
+	fprintf(f, "{\n");
+	fprintf(f, "    \"global\": {\n");
+	fprintf(f, "        \"core:datatype\": \"%s\",\n", info.datatype);
+	fprintf(f, "        \"core:sample_rate\": %.17g,\n", info.sampleRate);
+	fprintf(f, "        \"core:version\": \"1.0.0\",\n");
+	fprintf(f, "        \"core:hw\": \"%s\",\n", info.hw.c_str());
+	fprintf(f, "        \"core:recorder\": \"sddc\",\n");
+	fprintf(f, "        \"core:extensions\": [ { \"name\": \"sddc\", \"version\": \"1.0.0\", \"optional\": true } ],\n");
+	fprintf(f, "        \"sddc:gain\": %.17g\n", info.gain);
+	fprintf(f, "    },\n");
+	fprintf(f, "    \"captures\": [");
+	for (size_t i = 0; i < captures.size(); i++)
+	{
+		const mark& m = captures[i];
+		fprintf(f, "%s\n        { \"core:sample_start\": %" PRIu64 ", \"core:global_index\": %" PRIu64
+			", \"core:frequency\": %.17g, \"core:datetime\": \"%s\" }",
+			i ? "," : "", m.offset, m.global, m.frequency, datetime(m.realNs).c_str());
+	}
+	fprintf(f, "\n    ],\n");
+	fprintf(f, "    \"annotations\": []\n");
+	fprintf(f, "}\n");
+
+	return fclose(f) == 0;
+}
@@ -0,0 +1,122 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "license.txt"
+
+//
+// recorder: writes a sample stream to disk in SigMF format
+// Push() copies each block into large aligned buffers and never waits: when
+// the disk falls behind and no buffer is free, the whole block is dropped and
+// counted. A writer thread stores the filled buffers with O_DIRECT
+// (FILE_FLAG_NO_BUFFERING on Windows), so the page cache is not flooded at
+// 128..260 MB/s. Every file <base>.sigmf-data gets a <base>.sigmf-meta
+// sidecar with the rate, frequency, gain, hardware and the time of its
+// first sample; a capture segment is added at each gap in the stream.
+// With rollover the files are numbered <base>-0000, <base>-0001, ..,
+// a new one is started at the first buffer boundary past the limit.
+//
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "blocktap.h"
+
+struct recorder_info {
+    const char* datatype;   // SigMF core:datatype, "ri16_le" for the ADC, "cf32_le" for IQ
+    double sampleRate;      // of the recorded stream
+    double frequency;       // center frequency, Hz
+    double gain;            // dB, recorded as sddc:gain
+    std::string hw;         // radio model
+};
+
+class recorder : public blocktap {
+public:
+    recorder();
+    ~recorder();
+
+    // rollover by size and/or seconds of samples, 0 for none
+    bool Open(const char* base, const recorder_info& info, uint64_t rolloverBytes = 0, double rolloverSeconds = 0.0);
+    // flush the last buffer, finish the sidecar and join the writer
+    void Close();
+    bool IsOpen() const { return writer.joinable(); }
+
+    // producer side, from one thread at a time
+    void Push(const void* data, uint32_t bytes, const blockmeta& meta) override;
+    // Push() waits for the disk instead of dropping, for producers that can wait
+    void SetBlocking(bool wait) { blocking = wait; }
+    // frequency of the next capture segments, e.g. after a retune
+    void SetFrequency(double frequency) { this->frequency = frequency; }
+
+    uint64_t getWrittenBytes() const { return writtenBytes; }
+    uint64_t getLostBytes() const { return lostBytes; }
+    uint32_t getFiles() const { return files; }
+    bool getError() const { return error; }
+
+    // bytes per sample of a SigMF datatype such as "ri16_le" or "cf32_le", 0 when unknown
+    static uint32_t SampleSize(const char* datatype);
+
+    static const uint32_t buffer_size = 4 * 1024 * 1024;
+    static const int buffer_count = 16;
+    static const uint32_t sector_size = 4096;
+
+private:
+    struct mark {
+        uint64_t offset;        // bytes into the buffer, samples into the file for the captures
+        bool segment;           // a gap or a settings change, otherwise the start of the buffer
+        uint64_t global;        // sample index of the stream, lost samples included
+        int64_t realNs;         // host wall clock of that sample
+        double frequency;
+    };
+
+    struct buffer {
+        uint8_t* data;
+        uint32_t used;
+        std::vector<mark> marks;    // as many as the buffer has segments, room for 8 kept
+    };
+
+    void Writer();
+    bool OpenFile();
+    void CloseFile();
+    bool WriteData(const uint8_t* data, uint32_t bytes);
+    bool WriteMeta();
+
+    std::string base;
+    recorder_info info;
+    uint32_t sampleSize;
+    uint64_t rolloverBytes;
+    std::atomic<double> frequency;
+
+    std::vector<buffer> buffers;
+    std::atomic<uint32_t> head;     // buffers handed to the writer
+    std::atomic<uint32_t> tail;     // buffers written
+    bool gap;                       // the next pushed sample starts a segment
+    bool blocking;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::condition_variable spaceCv;    // a buffer was written, for blocking Push
+    std::atomic<bool> closing;
+    std::thread writer;
+
+    // writer side
+#ifdef _WIN32
+    void* file;
+#else
+    int fd;
+#endif
+    bool fileOpen;
+    std::string fileName;           // without extension
+    uint64_t fileBytes;
+    std::vector<mark> captures;
+
+    std::atomic<uint64_t> writtenBytes;
+    std::atomic<uint64_t> lostBytes;
+    std::atomic<uint32_t> files;
+    std::atomic<bool> error;
+};
+
+#endif
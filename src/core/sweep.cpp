@@ -0,0 +1,418 @@
+#include "license.txt"
+#include "sweep.h"
+#include "RadioHandler.h"
+#include "fft_mt_r2iq.h"
+
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+
+using namespace std::chrono;
+
+// spectra the settle is measured with, about a millisecond each
+static const double frame_seconds = 0.001;
+
+// power ratio of the settled spectra to the integrated one, 1 dB
+static const float settled_ratio = 1.26f;
+
+// times a step is integrated again before it is taken as it is
+static const int max_retries = 2;
+
+// bounds of the tracked settle time, seconds
+static const double min_settle = 0.001;
+static const double max_settle = 0.1;
+
+// a sine of full scale on a bin of the forward fft
+static const double full_scale_power = (32767.0 * halfFft) * (32767.0 * halfFft);
+
+// the band the steps use around the IF and the first settle estimate of each tuner
+static struct tuner_info {
+	RadioModel model;
+	double span;            // Hz
+	double settle;          // s, tracked
+} tuners[] = {
+	{ BBRF103, 6e6, 0.05 },
+	{ RX888, 6e6, 0.05 },
+	{ RX888r2, 6e6, 0.05 },
+	{ RX888r3, 14e6, 0.05 },
+	{ RX999, 20e6, 0.05 },
+	{ RXLUCY, 20e6, 0.05 },
+	{ NORADIO, 6e6, 0.05 },
+};
+static std::mutex tunersMutex;
+
+// no tuner moves in HF, the preselector relays switch
+static const double hf_settle = 0.001;
+
+static tuner_info& Tuner(RadioModel model)
+{
+	for (auto& t : tuners)
+	{
+		if (t.model == model)
+			return t;
+	}
+	return tuners[sizeof(tuners) / sizeof(tuners[0]) - 1];
+}
+
+static int64_t Now()
+{
+	return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+double sweeper::GetSettle(RadioModel model, rf_mode mode)
+{
+	if (mode != VHFMODE)
+		return hf_settle;
+	std::lock_guard<std::mutex> lk(tunersMutex);
+	return Tuner(model).settle;
+}
+
+sweeper::sweeper(RadioHandlerClass* radio) :
+	radio(radio),
+	start(0.0),
+	stop(0.0),
+	span(0.0),
+	integrate(1),
+	binHz(0.0),
+	bins(0),
+	out(nullptr),
+	format(SWEEP_CSV),
+	collecting(false),
+	stopping(false),
+	bandLow(0.0),
+	bandHigh(0.0),
+	tunedNs(0),
+	tunedSample(0),
+	tunedSampleValid(false),
+	discardNs(0),
+	accSegments(0),
+	sweeps(0),
+	steps(0),
+	retries(0)
+{
+	mapping = spectrum_frame();
+}
+
+sweeper::~sweeper()
+{
+	Close();
+}
+
+bool sweeper::Configure(double start, double stop, int integrate, double span)
+{
+	const double adcRate = radio->getSampleRate();
+	if (start <= 0 || stop <= start || integrate < 1 || span < 0 || adcRate <= 0)
+	{
+		DbgPrintf("sweeper: invalid settings\n");
+		return false;
+	}
+
+	this->start = start;
+	this->stop = stop;
+	this->integrate = integrate;
+	this->span = span;
+	binHz = adcRate / (2 * halfFft);
+	bins = (uint32_t)ceil((stop - start) / binHz);
+	spectrum.assign(bins, NAN);
+	return true;
+}
+
+bool sweeper::Open(const char* path, sweep_format format)
+{
+	Close();
+	out = fopen(path, format == SWEEP_BINARY ? "wb" : "w");
+	if (!out)
+	{
+		DbgPrintf("sweeper: can not write %s\n", path);
+		return false;
+	}
+	this->format = format;
+	return true;
+}
+
+void sweeper::Close()
+{
+	if (out)
+		fclose(out);
+	out = nullptr;
+}
+
+void sweeper::Stop()
+{
+	std::lock_guard<std::mutex> lk(mutex);
+	stopping = true;
+	cv.notify_all();
+}
+
+void sweeper::OnSpectrum(void* context, const spectrum_frame& frame)
+{
+	((sweeper*)context)->Frame(frame);
+}
+
+float sweeper::BandPower(const spectrum_frame& f) const
+{
+	// the ADC bins of the band of the step
+	double a = f.inverted ? f.rf - bandLow : bandLow - f.rf;
+	double b = f.inverted ? f.rf - bandHigh : bandHigh - f.rf;
+	int first = std::max(1, (int)ceil((std::min(a, b) + f.adcOffset) / f.binHz));
+	int last = std::min(f.bins - 1, (int)floor((std::max(a, b) + f.adcOffset) / f.binHz));
+
+	double sum = 0.0;
+	for (int i = first; i <= last; i++)
+		sum += f.power[i];
+	return (float)(sum / f.segments);
+}
+
+void sweeper::Frame(const spectrum_frame& f)
+{
+	std::lock_guard<std::mutex> lk(mutex);
+	if (!collecting || f.startNs < tunedNs)
+		return;
+
+	// the tuner settles in ADC time, which a slow host is behind of: the time of a
+	// spectrum counts from the first one after the retune at the ADC rate
+	if (!tunedSampleValid)
+	{
+		tunedSample = f.sample;
+		tunedSampleValid = true;
+	}
+	const int64_t atNs = tunedNs + (int64_t)((f.sample - tunedSample) * 1e9 / f.adcRate);
+
+	// all of them for the settle, the ones after the estimate for the sum
+	history.push_back({ atNs, BandPower(f) });
+	if (atNs < discardNs)
+		return;
+
+	if (acc.size() != (size_t)f.bins)
+		acc.assign(f.bins, 0.0);
+	for (int i = 0; i < f.bins; i++)
+		acc[i] += f.power[i];
+	accSegments += f.segments;
+	mapping = f;
+	mapping.power = nullptr;
+
+	if (accSegments >= integrate)
+	{
+		collecting = false;
+		cv.notify_all();
+	}
+}
+
+bool sweeper::Step(uint32_t first, uint32_t count)
+{
+	const RadioModel model = radio->getModel();
+	const rf_mode mode = radio->GetmodeRF();
+	const double settle = GetSettle(model, mode);
+	const double low = start + first * binHz;
+	const double high = start + (first + count) * binHz;
+
+	// the middle of the step on the IF
+	radio->TuneLO((uint64_t)((low + high) / 2));
+
+	std::unique_lock<std::mutex> lk(mutex);
+	bandLow = low;
+	bandHigh = high;
+	history.clear();
+	std::fill(acc.begin(), acc.end(), 0.0);
+	accSegments = 0;
+	tunedNs = Now();
+	tunedSampleValid = false;
+	discardNs = tunedNs + (int64_t)(settle * 1e9);
+	collecting = true;
+
+	for (int attempt = 0; ; attempt++)
+	{
+		// generous, a busy host may take seconds for what the ADC does in a few ms
+		const auto timeout = duration<double>(settle + 10.0);
+		if (!cv.wait_for(lk, timeout, [this]() { return !collecting || stopping; }))
+		{
+			DbgPrintf("sweeper: no spectra at %.0f Hz\n", (low + high) / 2);
+			collecting = false;
+			return false;
+		}
+		if (stopping)
+		{
+			collecting = false;
+			return true;
+		}
+
+		// settled from the spectrum after the last one off the integrated power
+		double sum = 0.0;
+		int n = 0;
+		for (auto& h : history)
+		{
+			if (h.startNs >= discardNs)
+			{
+				sum += h.power;
+				n++;
+			}
+		}
+		const float level = (float)(sum / std::max(n, 1));
+		int64_t settledNs = tunedNs;
+		for (size_t i = 0; i < history.size(); i++)
+		{
+			const float p = history[i].power;
+			if (p > level * settled_ratio || p * settled_ratio < level)
+				settledNs = i + 1 < history.size() ? history[i + 1].startNs : history[i].startNs + 1;
+		}
+
+		// a band that did not change tells nothing about the tuner
+		if (mode == VHFMODE && settledNs > tunedNs)
+		{
+			// up at once, down by a tenth of the way
+			const double measured = std::min(max_settle, 1.25 * (settledNs - tunedNs) / 1e9);
+			std::lock_guard<std::mutex> tlk(tunersMutex);
+			double& estimate = Tuner(model).settle;
+			estimate = measured > estimate ? measured : estimate + 0.1 * (measured - estimate);
+			estimate = std::max(min_settle, estimate);
+		}
+
+		if (settledNs <= discardNs || attempt == max_retries)
+			break;
+
+		// a spectrum of the sum was not settled: again from the settled ones
+		retries++;
+		std::fill(acc.begin(), acc.end(), 0.0);
+		accSegments = 0;
+		discardNs = settledNs;
+		collecting = true;
+	}
+
+	// the step onto the grid, between the ADC bins
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const double rf = start + (first + i) * binHz;
+		const double f = mapping.inverted ? mapping.rf - rf : rf - mapping.rf;
+		const double x = (f + mapping.adcOffset) / binHz;
+		if (x < 0 || x >= (double)acc.size() - 1)
+			continue;
+
+		const int b = (int)x;
+		const double w = x - b;
+		const double p = (acc[b] * (1.0 - w) + acc[b + 1] * w) / accSegments;
+		spectrum[first + i] = (float)(10.0 * log10(p / full_scale_power + 1e-30));
+	}
+	steps++;
+	return true;
+}
+
+bool sweeper::Write(int64_t realNs)
+{
+	if (!out)
+		return true;
+
+	if (format == SWEEP_BINARY)
+	{
+		sweep_header h;
+		h.magic = magic;
+		h.bins = bins;
+		h.start = start;
+		h.binHz = binHz;
+		h.realNs = realNs;
+		h.sweep = sweeps;
+		h.segments = (uint32_t)integrate;
+		fwrite(&h, sizeof(h), 1, out);
+		fwrite(spectrum.data(), sizeof(float), bins, out);
+	}
+	else
+	{
+		// as rtl_power, UTC
+		time_t sec = (time_t)(realNs / 1000000000);
+		struct tm t;
+#ifdef _WIN32
+		gmtime_s(&t, &sec);
+#else
+		gmtime_r(&sec, &t);
+#endif
+		char date[64];
+		strftime(date, sizeof(date), "%Y-%m-%d, %H:%M:%S", &t);
+		fprintf(out, "%s, %.0f, %.0f, %.2f, %d", date, start, start + bins * binHz, binHz, integrate);
+		for (float v : spectrum)
+			fprintf(out, ", %.2f", v);
+		fprintf(out, "\n");
+	}
+
+	fflush(out);
+	if (ferror(out))
+	{
+		DbgPrintf("sweeper: write failed\n");
+		return false;
+	}
+	return true;
+}
+
+bool sweeper::Run(uint32_t count)
+{
+	const double adcRate = radio->getSampleRate();
+	if (bins == 0 || adcRate / (2 * halfFft) != binHz)
+	{
+		DbgPrintf("sweeper: not configured for the ADC rate\n");
+		return false;
+	}
+	// the detector settings of the user would be lost
+	if (radio->HasDetector())
+	{
+		DbgPrintf("sweeper: the detector of the radio is in use\n");
+		return false;
+	}
+
+	// the detector makes the spectra only, about a millisecond each
+	const int average = std::max(1, (int)(adcRate * frame_seconds / (3 * halfFft / 2)));
+	radio->SetDetector(0.0f, 1.0, average, 1, nullptr);
+	radio->SetSpectrum(OnSpectrum, this);
+	stopping = false;
+
+	// the lowest output rate, the IQ is not used
+	if (!radio->Start(0))
+	{
+		radio->SetSpectrum(nullptr);
+		return false;
+	}
+
+	bool ok = true;
+	for (uint32_t n = 0; ok && !stopping && (count == 0 || n < count); n++)
+	{
+		const int64_t realNs = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+		std::fill(spectrum.begin(), spectrum.end(), NAN);
+
+		for (uint32_t first = 0; ok && !stopping && first < bins; )
+		{
+			// the mode and the band a step of that mode sees
+			const double low = start + first * binHz;
+			const rf_mode mode = radio->PrepareLo((uint64_t)low);
+			if (mode == NOMODE)
+			{
+				DbgPrintf("sweeper: %.0f Hz can not be tuned\n", low);
+				ok = false;
+				break;
+			}
+			if (mode != radio->GetmodeRF())
+				radio->UpdatemodeRF(mode);
+
+			double width = span;
+			if (width == 0)
+			{
+				std::lock_guard<std::mutex> lk(tunersMutex);
+				if (mode == VHFMODE)
+					width = Tuner(radio->getModel()).span;
+				else
+					width = low < adcRate / 2 ? adcRate / 2 - low : adcRate / 4;
+			}
+			const uint32_t stepBins = std::min(bins - first, std::max(1u, (uint32_t)(width / binHz)));
+			ok = Step(first, stepBins);
+			first += stepBins;
+		}
+
+		// a sweep cut by Stop() is not written
+		if (ok && !stopping)
+		{
+			ok = Write(realNs);
+			sweeps++;
+		}
+	}
+
+	radio->Stop();
+	radio->SetSpectrum(nullptr);
+	return ok;
+}
@@ -0,0 +1,130 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "license.txt"
+
+//
+// sweeper: wideband power spectra by stepping the tuner, like rtl_power
+// One stream runs for all the sweeps: every step tunes with TuneLO and takes
+// the averaged forward spectra of the r2iq from the detector (see
+// detector.h), so a step costs the PLL settle and the integration, not a
+// restart. The spectra that begin before the settle time after the retune,
+// in ADC samples from the first spectrum after it, are dropped, the next
+// ones are summed until integrate segments, and the span of the step is
+// interpolated from the ADC bins onto one grid from start to stop at the bin
+// width of the forward fft.
+// The settle time is measured at every step: the band power of each
+// spectrum after the retune is kept, the tuner is settled from the first
+// one after which all are within 1 dB of the integrated power. A step that
+// summed an unsettled spectrum is integrated again. The estimate of a model
+// follows the measurements of the steps whose band changed, up at once and
+// down slowly, for the process; a tuner that settles later than the first
+// estimate and the integration time is not seen, so that one is generous.
+// A sweep is written as one CSV line,
+//   date, time, Hz low, Hz high, Hz step, segments, dB, dB, ..
+// or in binary as a sweep_header and bins floats; dB are relative to a full
+// scale sine on a bin, NAN where no step can see.
+// Run() takes over the detector of the radio and sets its mode per step, it
+// refuses a radio with a detector threshold or spectrum callback set.
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "config.h"
+#include "detector.h"
+
+class RadioHandlerClass;
+
+enum sweep_format { SWEEP_CSV, SWEEP_BINARY };
+
+struct sweep_header {
+    uint32_t magic;         // sweeper::magic
+    uint32_t bins;          // floats that follow
+    double start;           // Hz of bin 0
+    double binHz;
+    int64_t realNs;         // wall clock at the start of the sweep
+    uint32_t sweep;         // counted from 0
+    uint32_t segments;      // spectra summed per step
+};
+
+class sweeper {
+public:
+    static const uint32_t magic = 0x31575353;   // "SSW1"
+
+    sweeper(RadioHandlerClass* radio);
+    ~sweeper();
+
+    // from start to stop Hz with integrate segments per step and span Hz of
+    // each step, 0 for the band the tuner passes
+    bool Configure(double start, double stop, int integrate, double span = 0.0);
+    // the sweeps to path as well, see above
+    bool Open(const char* path, sweep_format format);
+    void Close();
+
+    // starts the stream, count sweeps or until Stop() with 0, stops it; false when
+    // the detector is in use, a step can not be tuned, its spectra do not come or
+    // the output fails
+    bool Run(uint32_t count);
+    // from another thread, Run() returns after the current step
+    void Stop();
+
+    // dB of the last sweep, bin i at getStart() + i * getBinHz()
+    const std::vector<float>& GetSpectrum() const { return spectrum; }
+    double getStart() const { return start; }
+    double getBinHz() const { return binHz; }
+    uint32_t getSweeps() const { return sweeps; }
+    uint32_t getSteps() const { return steps; }
+    uint32_t getRetries() const { return retries; }
+
+    // the tracked settle time of the tuner of a model in mode, seconds
+    static double GetSettle(RadioModel model, rf_mode mode);
+
+private:
+    struct band_power {
+        int64_t startNs;
+        float power;
+    };
+
+    static void OnSpectrum(void* context, const spectrum_frame& frame);
+    void Frame(const spectrum_frame& frame);
+    float BandPower(const spectrum_frame& frame) const;
+    bool Step(uint32_t first, uint32_t count);
+    bool Write(int64_t realNs);
+
+    RadioHandlerClass* radio;
+    double start, stop;
+    double span;
+    int integrate;
+    double binHz;
+    uint32_t bins;
+    std::vector<float> spectrum;
+
+    FILE* out;
+    sweep_format format;
+
+    // the step being integrated, shared with the r2iq thread
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool collecting;
+    std::atomic<bool> stopping;
+    double bandLow, bandHigh;   // Hz of the step
+    int64_t tunedNs;            // host time of the retune
+    uint64_t tunedSample;       // ADC sample of the first spectrum after it
+    bool tunedSampleValid;
+    int64_t discardNs;          // spectra that begin before are dropped
+    std::vector<band_power> history;
+    std::vector<double> acc;    // power per ADC bin
+    int accSegments;
+    spectrum_frame mapping;     // of the summed spectra
+
+    uint32_t sweeps;
+    uint32_t steps;
+    uint32_t retries;
+};
+
+#endif
@@ -0,0 +1,182 @@
+#include "license.txt"
+#include "thread_sched.h"
+#include "config.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+static const char* const roleNames[THREAD_ROLES] = { "usb", "r2iq", "callback", "stats" };
+
+const char* ThreadRoleName(ThreadRole role)
+{
+	return roleNames[role];
+}
+
+void ThreadSchedDefaults(ThreadSchedConfig& cfg)
+{
+	for (int r = 0; r < THREAD_ROLES; r++)
+	{
+		cfg.role[r].cpu = -1;
+		cfg.role[r].policy = SCHED_POLICY_OTHER;
+		cfg.role[r].priority = 0;
+	}
+	cfg.lockMemory = false;
+}
+
+bool ParseThreadSched(const char* str, thread_sched& sched)
+{
+	thread_sched s = { -1, SCHED_POLICY_OTHER, 0 };
+	char* end;
+
+	// only a cpu this machine has, and one the affinity mask can hold
+#ifdef _WIN32
+	const long maxCpus = 8 * sizeof(DWORD_PTR);
+#else
+	const long maxCpus = CPU_SETSIZE;
+#endif
+	const unsigned cpus = std::thread::hardware_concurrency();
+	long cpu = strtol(str, &end, 10);
+	if (end == str || cpu < -1 || cpu >= maxCpus || (cpus > 0 && cpu >= (long)cpus))
+		return false;
+	s.cpu = (int)cpu;
+
+	if (*end == ',')
+	{
+		const char* policy = end + 1;
+		const char* comma = strchr(policy, ',');
+		size_t len = comma ? (size_t)(comma - policy) : strlen(policy);
+
+		if (len == 4 && strncmp(policy, "fifo", 4) == 0)
+			s.policy = SCHED_POLICY_FIFO;
+		else if (len == 2 && strncmp(policy, "rr", 2) == 0)
+			s.policy = SCHED_POLICY_RR;
+		else if (len == 5 && strncmp(policy, "other", 5) == 0)
+			s.policy = SCHED_POLICY_OTHER;
+		else
+			return false;
+
+		end = (char*)policy + len;
+		if (comma)
+		{
+			// pthread_setschedparam takes 1..99 for fifo and rr, 0 for other
+			s.priority = strtol(comma + 1, &end, 10);
+			if (end == comma + 1 || s.priority > 99)
+				return false;
+			if (s.policy == SCHED_POLICY_OTHER ? s.priority != 0 : s.priority < 1)
+				return false;
+		}
+		else if (s.policy != SCHED_POLICY_OTHER)
+		{
+			s.priority = 1;
+		}
+	}
+
+	if (*end != '\0')
+		return false;
+
+	sched = s;
+	return true;
+}
+
+void ThreadSchedFromEnv(ThreadSchedConfig& cfg)
+{
+	static const char* const envNames[THREAD_ROLES] = {
+		"SDDC_SCHED_USB", "SDDC_SCHED_R2IQ", "SDDC_SCHED_CALLBACK", "SDDC_SCHED_STATS"
+	};
+
+	for (int r = 0; r < THREAD_ROLES; r++)
+	{
+		const char* value = getenv(envNames[r]);
+		if (value && !ParseThreadSched(value, cfg.role[r]))
+			DbgPrintf("ignoring invalid %s=%s\n", envNames[r], value);
+	}
+
+	const char* lock = getenv("SDDC_MLOCKALL");
+	if (lock)
+		cfg.lockMemory = atoi(lock) != 0;
+}
+
+bool ApplyThreadSched(const thread_sched& sched)
+{
+	bool ok = true;
+
+#ifdef _WIN32
+	if (sched.cpu >= 0 &&
+		SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << sched.cpu) == 0)
+	{
+		DbgPrintf("SetThreadAffinityMask(%d) failed\n", sched.cpu);
+		ok = false;
+	}
+	if (sched.policy != SCHED_POLICY_OTHER)
+	{
+		// no real-time classes for a thread, map 1..99 onto the upper priorities
+		int prio = sched.priority >= 50 ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_HIGHEST;
+		if (!SetThreadPriority(GetCurrentThread(), prio))
+		{
+			DbgPrintf("SetThreadPriority(%d) failed\n", prio);
+			ok = false;
+		}
+	}
+#else
+#if defined(__linux__)
+	if (sched.cpu >= 0)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(sched.cpu, &set);
+		int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (err != 0)
+		{
+			DbgPrintf("pthread_setaffinity_np(%d) failed: %s\n", sched.cpu, strerror(err));
+			ok = false;
+		}
+	}
+#else
+	if (sched.cpu >= 0)
+	{
+		DbgPrintf("CPU affinity is not supported on this platform\n");
+		ok = false;
+	}
+#endif
+	if (sched.policy != SCHED_POLICY_OTHER)
+	{
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = sched.priority;
+		int policy = sched.policy == SCHED_POLICY_FIFO ? SCHED_FIFO : SCHED_RR;
+		int err = pthread_setschedparam(pthread_self(), policy, &param);
+		if (err != 0)
+		{
+			DbgPrintf("pthread_setschedparam(%d, %d) failed: %s\n", policy, sched.priority, strerror(err));
+			ok = false;
+		}
+	}
+#endif
+
+	return ok;
+}
+
+bool LockProcessMemory()
+{
+#ifdef _WIN32
+	DbgPrintf("mlockall is not supported on this platform\n");
+	return false;
+#else
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+	{
+		DbgPrintf("mlockall failed: %s\n", strerror(errno));
+		return false;
+	}
+	return true;
+#endif
+}
@@ -0,0 +1,53 @@
+#ifndef THREAD_SCHED_H
+#define THREAD_SCHED_H
+
+#include "license.txt"
+
+#include <stdint.h>
+
+// threads of the streaming pipeline
+enum ThreadRole {
+    THREAD_USB,         // USB event loop / transfer completion
+    THREAD_R2IQ,        // r2iq workers
+    THREAD_CALLBACK,    // delivery of the output blocks to the user callback
+    THREAD_STATS,       // statistics
+    THREAD_ROLES
+};
+
+enum ThreadPolicy {
+    SCHED_POLICY_OTHER, // leave the OS defaults
+    SCHED_POLICY_FIFO,
+    SCHED_POLICY_RR
+};
+
+struct thread_sched {
+    int cpu;            // CPU the thread is pinned to, -1 for any
+    ThreadPolicy policy;
+    int priority;       // 1..99 for the real-time policies, 0 for other
+};
+
+struct ThreadSchedConfig {
+    thread_sched role[THREAD_ROLES];
+    bool lockMemory;    // mlockall() before streaming starts
+};
+
+// no placement, OS default scheduling
+void ThreadSchedDefaults(ThreadSchedConfig& cfg);
+
+// "cpu[,policy[,priority]]" such as "2,fifo,80", "-1,rr,10" or "3",
+// false for a cpu the machine does not have
+bool ParseThreadSched(const char* str, thread_sched& sched);
+
+// SDDC_SCHED_USB, SDDC_SCHED_R2IQ, SDDC_SCHED_CALLBACK, SDDC_SCHED_STATS and SDDC_MLOCKALL
+void ThreadSchedFromEnv(ThreadSchedConfig& cfg);
+
+// name of the role in the env variables and stream args: "usb", "r2iq", ..
+const char* ThreadRoleName(ThreadRole role);
+
+// apply to the calling thread; failures (e.g. missing CAP_SYS_NICE) are reported and ignored
+bool ApplyThreadSched(const thread_sched& sched);
+
+// lock the process memory so that page faults can not stall the stream
+bool LockProcessMemory();
+
+#endif
@@ -2,99 +2,237 @@
 #include "config.h"
 #include "r2iq.h"
 #include "RadioHandler.h"
+#include "recorder.h"
+#include "r2iq_pool.h"
+#include "fft_mt_r2iq.h"
+#include "sweep.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
 
 struct sddc
 {
     SDDCStatus status;
     RadioHandlerClass* handler;
+    fx3class* fx3;
+    r2iqControlClass* r2iq;
     uint8_t led;
     int samplerateidx;
     double freq;
 
     sddc_read_async_cb_t callback;
+    sddc_read_async_ex_cb_t callback_ex;
     void *callback_context;
-};
+    bool streaming;
 
-sddc_t *current_running;
+    // the sweeps need the spectra of the fft r2iq, rawdata makes none
+    RadioHandlerClass* sweepHandler;
+    r2iqControlClass* sweepR2iq;
+    sweeper* sweep;
+};
 
-static void Callback(void* context, const float* data, uint32_t len)
+// the output blocks carry the raw ADC samples, see rawdata
+static void Callback(void* context, const float* data, uint32_t len, const blockmeta& meta)
 {
+    sddc_t *t = (sddc_t *)context;
+    uint32_t data_size = len * 2 * sizeof(int16_t);
+    if (t->callback_ex)
+    {
+        sddc_block_info info;
+        info.sample_count = meta.sample;
+        info.monotonic_ns = meta.monoNs;
+        info.realtime_ns = meta.realNs;
+        info.dropped = meta.dropped;
+        info.generation = meta.generation;
+        info.flags = meta.flags;
+        info.peak = meta.peak;
+        t->callback_ex(data_size, (uint8_t*)data, &info, t->callback_context);
+    }
+    else if (t->callback)
+    {
+        t->callback(data_size, (uint8_t*)data, t->callback_context);
+    }
 }
 
+// pass the ADC blocks unchanged to the output ring, one output block
+// of len complex slots per input block of 2 * len real samples
 class rawdata : public r2iqControlClass {
     void Init(float gain, ringbuffer<int16_t>* buffers, ringbuffer<float>* obuffers) override
     {
-        idx = 0;
+        inputbuffer = buffers;
+        outputbuffer = obuffers;
     }
 
     void TurnOn() override
     {
         this->r2iqOn = true;
-        idx = 0;
+        lastGeneration = this->generation;
+        inputbuffer->Start();
+        outputbuffer->Start();
+        if (attachPool(inputbuffer, outputbuffer))
+            return;
+
+        worker = std::thread([this]() {
+            ApplyThreadSched(this->sched);
+            while (r2iqOn)
+                this->Copy(true);
+        });
+    }
+
+    void TurnOff() override
+    {
+        this->r2iqOn = false;
+        if (pooled)
+            detachPool();
+        inputbuffer->Stop();
+        outputbuffer->Stop();
+        if (worker.joinable())
+            worker.join();
+    }
+
+    bool Step() override
+    {
+        return r2iqOn && Copy(false);
     }
 
 private:
-    int idx;
+    bool Copy(bool wait)
+    {
+        if (!wait && (inputbuffer->isEmpty() || outputbuffer->isFull()))
+            return false;
+
+        auto src = inputbuffer->getReadPtr();
+        if (!r2iqOn)
+            return false;
+
+        const int size = inputbuffer->getBlockSize();
+        tapInput(src, size, *inputbuffer->getReadMeta());
+        // the peak is found on the way, the block is read once
+        auto dst = (int16_t*)outputbuffer->getWritePtr();
+        int peak = 0;
+        for (int i = 0; i < size; i++)
+        {
+            dst[i] = src[i];
+            peak = std::max(peak, abs((int)src[i]));
+        }
+
+        auto meta = outputbuffer->getWriteMeta();
+        *meta = *inputbuffer->getReadMeta();
+        meta->peak = peak;
+        if (peak >= adcClipLevel)
+            meta->flags |= BLOCK_OVERLOAD;
+        if (meta->generation != lastGeneration)
+        {
+            meta->flags |= BLOCK_SETTINGS_CHANGED;
+            lastGeneration = meta->generation;
+        }
+
+        inputbuffer->ReadDone();
+        outputbuffer->WriteDone();
+        return true;
+    }
+
+    ringbuffer<int16_t>* inputbuffer;
+    ringbuffer<float>* outputbuffer;
+    uint32_t lastGeneration;
+    std::thread worker;
 };
 
+// the devices as fx3class::Enumerate() names them, "<product>   sn:<serial>"
+static int EnumerateDevices(std::vector<std::string>* names)
+{
+    fx3class *fx3 = CreateUsbHandler();
+    if (fx3 == nullptr)
+        return 0;
+
+    char name[256];
+    int count = 0;
+    for (unsigned char idx = 0; idx < 255 && fx3->Enumerate(idx, name); idx++)
+    {
+        if (names)
+            names->push_back(name);
+        count++;
+    }
+    delete fx3;
+    return count;
+}
+
 int sddc_get_device_count()
 {
-    return 1;
+    return EnumerateDevices(nullptr);
 }
 
 int sddc_get_device_info(struct sddc_device_info **sddc_device_infos)
 {
-    auto ret = new sddc_device_info();
-    const char *todo = "TODO";
-    ret->manufacturer = todo;
-    ret->product = todo;
-    ret->serial_number = todo;
+    std::vector<std::string> names;
+    int count = EnumerateDevices(&names);
 
-    *sddc_device_infos = ret;
+    // one allocation: the entries, then their strings
+    size_t size = (count + 1) * sizeof(sddc_device_info);
+    for (auto& name : names)
+        size += name.size() + 2;
+    auto ret = (sddc_device_info*)calloc(1, size);
+    if (ret == nullptr)
+        return -1;
 
-    return 1;
+    char *strings = (char*)&ret[count + 1];
+    for (int i = 0; i < count; i++)
+    {
+        std::string product = names[i];
+        std::string serial;
+        size_t sn = product.find("sn:");
+        if (sn != std::string::npos)
+        {
+            serial = product.substr(sn + 3);
+            product.erase(sn);
+        }
+        product.erase(product.find_last_not_of(' ') + 1);
+
+        ret[i].manufacturer = "";
+        strcpy(strings, product.c_str());
+        ret[i].product = strings;
+        strings += product.size() + 1;
+        strcpy(strings, serial.c_str());
+        ret[i].serial_number = strings;
+        strings += serial.size() + 1;
+    }
+
+    *sddc_device_infos = ret;
+    return count;
 }
 
 int sddc_free_device_info(struct sddc_device_info *sddc_device_infos)
 {
-    delete sddc_device_infos;
+    free(sddc_device_infos);
     return 0;
 }
 
 sddc_t *sddc_open(int index, const char* imagefile)
 {
-    auto ret_val = new sddc_t();
-
     fx3class *fx3 = CreateUsbHandler();
     if (fx3 == nullptr)
     {
         return nullptr;
     }
 
-    // open the firmware
-    unsigned char* res_data;
-    uint32_t res_size;
-
-    FILE *fp = fopen(imagefile, "rb");
-    if (fp == nullptr)
+    // selects the device for Open(); the handlers carry the firmware, imagefile is not read
+    char name[256];
+    unsigned char idx = (unsigned char)index;
+    if (index < 0 || index > 255 || !fx3->Enumerate(idx, name) || !fx3->Open())
     {
+        delete fx3;
         return nullptr;
     }
 
-    fseek(fp, 0, SEEK_END);
-    res_size = ftell(fp);
-    res_data = (unsigned char*)malloc(res_size);
-    fseek(fp, 0, SEEK_SET);
-    if (fread(res_data, 1, res_size, fp) != res_size)
-        return nullptr;
-
-    bool openOK = fx3->Open();
-    if (!openOK)
-        return nullptr;
-
+    auto ret_val = new sddc_t();
+    ret_val->fx3 = fx3;
+    ret_val->r2iq = new rawdata();
     ret_val->handler = new RadioHandlerClass();
 
-    if (ret_val->handler->Init(fx3, Callback, new rawdata()))
+    if (ret_val->handler->Init(fx3, Callback, ret_val->r2iq, ret_val))
     {
         ret_val->status = SDDC_STATUS_READY;
         ret_val->samplerateidx = 0;
@@ -105,8 +243,16 @@ sddc_t *sddc_open(int index, const char* imagefile)
 
 void sddc_close(sddc_t *that)
 {
+    delete that->sweep;
+    delete that->sweepHandler;
+    delete that->sweepR2iq;
     if (that->handler)
+    {
+        that->handler->Stop();
         delete that->handler;
+    }
+    delete that->r2iq;
+    delete that->fx3;
     delete that;
 }
 
@@ -360,16 +506,205 @@ int sddc_set_async_params(sddc_t *t, uint32_t frame_size,
                           uint32_t num_frames, sddc_read_async_cb_t callback,
                           void *callback_context)
 {
-    // TODO: ignore frame_size, num_frames
+    // frame_size and num_frames are the USB transfer size in bytes and
+    // the number of transfers in flight; 0 keeps the defaults
+    if (frame_size == 0)
+        frame_size = DEFAULT_TRANSFER_SIZE;
+    if (num_frames == 0)
+        num_frames = DEFAULT_CONCURRENT_TRANSFERS;
+    if (!t->handler->SetTransferParams(frame_size, num_frames))
+        return -1;
+
     t->callback = callback;
+    t->callback_ex = nullptr;
     t->callback_context = callback_context;
     return 0;
 }
 
+int sddc_set_async_params_ex(sddc_t *t, uint32_t frame_size,
+                             uint32_t num_frames, sddc_read_async_ex_cb_t callback,
+                             void *callback_context)
+{
+    if (sddc_set_async_params(t, frame_size, num_frames, nullptr, callback_context) < 0)
+        return -1;
+
+    t->callback_ex = callback;
+    return 0;
+}
+
+int sddc_set_thread_sched(sddc_t *t, enum SDDCThreadRole role, int cpu,
+                          enum SDDCSchedPolicy policy, int priority)
+{
+    if (role < SDDC_THREAD_USB || role > SDDC_THREAD_STATS || cpu < -1)
+        return -1;
+
+    thread_sched sched;
+    sched.cpu = cpu;
+    sched.priority = priority;
+    switch (policy)
+    {
+    case SDDC_SCHED_OTHER:
+        sched.policy = SCHED_POLICY_OTHER;
+        break;
+    case SDDC_SCHED_FIFO:
+        sched.policy = SCHED_POLICY_FIFO;
+        break;
+    case SDDC_SCHED_RR:
+        sched.policy = SCHED_POLICY_RR;
+        break;
+    default:
+        return -1;
+    }
+    if (sched.policy != SCHED_POLICY_OTHER && (priority < 1 || priority > 99))
+        return -1;
+
+    t->handler->SetThreadSched((ThreadRole)role, sched);
+    return 0;
+}
+
+int sddc_set_memory_lock(sddc_t *t, int lock)
+{
+    t->handler->SetMemoryLock(lock != 0);
+    return 0;
+}
+
+int sddc_set_recording(sddc_t *t, const char *base, uint64_t rollover_bytes,
+                       double rollover_seconds)
+{
+    if (rollover_seconds < 0)
+        return -1;
+
+    t->handler->SetRecording(base, nullptr, rollover_bytes, rollover_seconds);
+    return 0;
+}
+
+int sddc_get_recording_stats(sddc_t *t, uint64_t *written, uint64_t *lost)
+{
+    auto rec = t->handler->GetRecorder(false);
+    if (written)
+        *written = rec->getWrittenBytes();
+    if (lost)
+        *lost = rec->getLostBytes();
+    return rec->getError() ? -1 : 0;
+}
+
+int sddc_set_history(sddc_t *t, double seconds, int iq)
+{
+    if (seconds < 0)
+        return -1;
+
+    t->handler->SetHistory(seconds, iq != 0);
+    return 0;
+}
+
+int sddc_trigger_history(sddc_t *t, const char *base, double pre, double post,
+                         int64_t at_ns)
+{
+    if (base == nullptr)
+        return -1;
+
+    return t->handler->TriggerHistory(base, pre, post, at_ns) ? 0 : -1;
+}
+
+int sddc_set_history_trigger(sddc_t *t, int level, const char *base,
+                             double pre, double post)
+{
+    if (pre < 0 || post < 0)
+        return -1;
+
+    t->handler->SetHistoryTrigger(level, base, pre, post);
+    return 0;
+}
+
+int sddc_set_worker_threads(int count)
+{
+    if (count < 0)
+        return -1;
+
+    r2iq_pool::Instance().SetWorkers(count);
+    return 0;
+}
+
+static void SweepCallback(void* context, const float* data, uint32_t len)
+{
+}
+
+int sddc_sweep_configure(sddc_t *t, double start, double stop, int integrate,
+                         double span)
+{
+    if (t->sweep == nullptr)
+    {
+        auto handler = new RadioHandlerClass();
+        auto r2iq = new fft_mt_r2iq();
+        if (!handler->Init(t->fx3, SweepCallback, r2iq, t))
+        {
+            delete handler;
+            delete r2iq;
+            return -1;
+        }
+        t->sweepHandler = handler;
+        t->sweepR2iq = r2iq;
+        t->sweep = new sweeper(handler);
+    }
+
+    return t->sweep->Configure(start, stop, integrate, span) ? 0 : -1;
+}
+
+int sddc_sweep_open(sddc_t *t, const char *path, int binary)
+{
+    if (t->sweep == nullptr || path == nullptr)
+        return -1;
+
+    return t->sweep->Open(path, binary ? SWEEP_BINARY : SWEEP_CSV) ? 0 : -1;
+}
+
+int sddc_sweep_close(sddc_t *t)
+{
+    if (t->sweep == nullptr)
+        return -1;
+
+    t->sweep->Close();
+    return 0;
+}
+
+int sddc_sweep_run(sddc_t *t, uint32_t count)
+{
+    if (t->sweep == nullptr || t->streaming)
+        return -1;
+
+    return t->sweep->Run(count) ? 0 : -1;
+}
+
+int sddc_sweep_stop(sddc_t *t)
+{
+    if (t->sweep == nullptr)
+        return -1;
+
+    t->sweep->Stop();
+    return 0;
+}
+
+int sddc_sweep_get_spectrum(sddc_t *t, const float **db, double *start,
+                            double *bin_hz)
+{
+    if (t->sweep == nullptr)
+        return -1;
+
+    const auto& spectrum = t->sweep->GetSpectrum();
+    if (db)
+        *db = spectrum.data();
+    if (start)
+        *start = t->sweep->getStart();
+    if (bin_hz)
+        *bin_hz = t->sweep->getBinHz();
+    return (int)spectrum.size();
+}
+
 int sddc_start_streaming(sddc_t *t)
 {
-    current_running = t;
-    t->handler->Start(t->samplerateidx);
+    if (!t->handler->Start(t->samplerateidx))
+        return -1;
+    t->streaming = true;
     return 0;
 }
 
@@ -381,7 +716,7 @@ int sddc_handle_events(sddc_t *t)
 int sddc_stop_streaming(sddc_t *t)
 {
     t->handler->Stop();
-    current_running = nullptr;
+    t->streaming = false;
     return 0;
 }
 
@@ -60,6 +60,19 @@ enum RFMode {
   VHF_MODE
 };
 
+enum SDDCThreadRole {
+  SDDC_THREAD_USB,        /* USB event loop */
+  SDDC_THREAD_R2IQ,       /* r2iq workers */
+  SDDC_THREAD_CALLBACK,   /* callback delivery */
+  SDDC_THREAD_STATS
+};
+
+enum SDDCSchedPolicy {
+  SDDC_SCHED_OTHER,
+  SDDC_SCHED_FIFO,
+  SDDC_SCHED_RR
+};
+
 enum LEDColors {
   YELLOW_LED = 0x01,
   RED_LED    = 0x02,
@@ -154,6 +167,97 @@ int sddc_set_async_params(sddc_t *t, uint32_t frame_size,
                           uint32_t num_frames, sddc_read_async_cb_t callback,
                           void *callback_context);
 
+enum SDDCBlockFlags {
+  SDDC_BLOCK_DISCONTINUITY    = 0x01,  /* samples were lost right before this block */
+  SDDC_BLOCK_OVERLOAD         = 0x02,  /* the ADC clipped within this block */
+  SDDC_BLOCK_SETTINGS_CHANGED = 0x04   /* generation differs from the previous block */
+};
+
+/* side information of a block of ADC samples */
+struct sddc_block_info {
+  uint64_t sample_count;  /* index of the first sample since streaming started, lost samples included */
+  int64_t monotonic_ns;   /* host CLOCK_MONOTONIC when the USB transfer completed */
+  int64_t realtime_ns;    /* host CLOCK_REALTIME at the same instant */
+  uint64_t dropped;       /* samples lost right before this block */
+  uint32_t generation;    /* bumped by every tuning, gain, attenuation or ADC setting change */
+  uint32_t flags;         /* SDDC_BLOCK_xxx */
+  uint16_t peak;          /* largest absolute ADC sample of the block */
+};
+
+typedef void (*sddc_read_async_ex_cb_t)(uint32_t data_size, uint8_t *data,
+                                         const struct sddc_block_info *info,
+                                         void *context);
+
+/* same as sddc_set_async_params(), the callback receives the block time too */
+int sddc_set_async_params_ex(sddc_t *t, uint32_t frame_size,
+                             uint32_t num_frames, sddc_read_async_ex_cb_t callback,
+                             void *callback_context);
+
+/* pin a pipeline thread to cpu (-1 for any) and set its scheduling;
+ * the SDDC_SCHED_<ROLE> env variables ("cpu,policy,priority") give the defaults */
+int sddc_set_thread_sched(sddc_t *t, enum SDDCThreadRole role, int cpu,
+                          enum SDDCSchedPolicy policy, int priority);
+
+/* mlockall() before streaming starts, default from SDDC_MLOCKALL */
+int sddc_set_memory_lock(sddc_t *t, int lock);
+
+/* process wide: the devices started after the call share count worker
+ * threads for their sample processing instead of one thread each, so that
+ * many receivers in a process use a bounded number of threads; 0 for a
+ * thread per device, the default unless SDDC_R2IQ_WORKERS is set */
+int sddc_set_worker_threads(int count);
+
+/* record the ADC samples from the next sddc_start_streaming until
+ * sddc_stop_streaming as SigMF <base>.sigmf-data and <base>.sigmf-meta,
+ * written with direct I/O by a thread of its own; blocks are dropped
+ * rather than delaying the stream when the disk can not keep up.
+ * rollover_bytes / rollover_seconds > 0 start <base>-0000, <base>-0001, ..
+ * base NULL stops recording */
+int sddc_set_recording(sddc_t *t, const char *base, uint64_t rollover_bytes,
+                       double rollover_seconds);
+
+/* bytes written and lost by the current or last recording */
+int sddc_get_recording_stats(sddc_t *t, uint64_t *written, uint64_t *lost);
+
+/* time machine: from the next start keep the last seconds of the stream
+ * in memory, the raw ADC samples or with iq != 0 the IQ samples; 0 for none */
+int sddc_set_history(sddc_t *t, double seconds, int iq);
+
+/* while streaming save pre seconds before to post seconds after the trigger
+ * as <base>.sigmf-data/-meta, without stopping the stream; the trigger is now
+ * or with at_ns != 0 the host wall clock time in ns since the epoch.
+ * -1 when there is no history or a capture is still running */
+int sddc_trigger_history(sddc_t *t, const char *base, double pre, double post,
+                         int64_t at_ns);
+
+/* from the next start trigger <base>-0000, <base>-0001, .. whenever a block
+ * peaks at level (0..32767 of the ADC) or above; base NULL for none */
+int sddc_set_history_trigger(sddc_t *t, int level, const char *base,
+                             double pre, double post);
+
+/* power sweep like rtl_power: from start to stop Hz with integrate
+ * spectra per step and span Hz of each step, 0 for the band the tuner
+ * passes. The sweeps tune the device themselves: while they run t can
+ * not stream, and after them the tuner is where the last step left it */
+int sddc_sweep_configure(sddc_t *t, double start, double stop, int integrate,
+                         double span);
+
+/* also write every sweep to path, a CSV line as rtl_power or with
+ * binary != 0 a header and the floats, see sweep.h */
+int sddc_sweep_open(sddc_t *t, const char *path, int binary);
+
+int sddc_sweep_close(sddc_t *t);
+
+/* blocks for count sweeps, 0 until sddc_sweep_stop from another thread;
+ * -1 while streaming or when a step fails */
+int sddc_sweep_run(sddc_t *t, uint32_t count);
+
+int sddc_sweep_stop(sddc_t *t);
+
+/* dB of the last sweep, bin i at start + i * bin_hz; returns the bins */
+int sddc_sweep_get_spectrum(sddc_t *t, const float **db, double *start,
+                            double *bin_hz);
+
 int sddc_start_streaming(sddc_t *t);
 
 int sddc_handle_events(sddc_t *t);
@@ -0,0 +1,557 @@
+/*
+ * sddc_convert - offline conversion of raw ADC captures to IQ
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/*
+ * The input is memory mapped and cut into segments of whole r2iq blocks.
+ * Every worker converts the next free segment with its own r2iq_batch,
+ * primed with the halfFft samples before the segment, so the output does
+ * not depend on the number of workers. The segments are written in order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "r2iq_batch.h"
+#include "wavewrite.h"
+#include "wavehdr.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std::chrono;
+
+/* gain of r2iq_batch that turns a full scale sine at the ADC into amplitude 1.0 */
+static const float unity_gain = 1.0f / (32768.0f * halfFft / 4);
+
+/* input blocks per segment handed to a worker */
+static const int segment_blocks = 32;
+
+enum out_format { CF32, CS16, CS8 };
+
+static const struct { const char *name; out_format format; int size; const char *datatype; } formats[] = {
+  { "cf32", CF32, 8, "cf32_le" },
+  { "cs16", CS16, 4, "ci16_le" },
+  { "cs8",  CS8,  2, "ci8" },
+};
+
+struct input_file {
+  std::string path;
+  const int16_t *samples;
+  uint64_t count;
+  double rate;          /* 0 when the file does not tell */
+  double frequency;
+#ifdef _WIN32
+  HANDLE file;
+  HANDLE mapping;
+#else
+  int fd;
+  size_t size;
+#endif
+  void *view;
+};
+
+static bool map_input(input_file &in, uint64_t &size)
+{
+#ifdef _WIN32
+  in.file = CreateFileA(in.path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (in.file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER li;
+  if (!GetFileSizeEx(in.file, &li) || li.QuadPart == 0)
+    return false;
+  size = li.QuadPart;
+  in.mapping = CreateFileMappingA(in.file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (in.mapping == NULL)
+    return false;
+  in.view = MapViewOfFile(in.mapping, FILE_MAP_READ, 0, 0, 0);
+  return in.view != NULL;
+#else
+  in.fd = open(in.path.c_str(), O_RDONLY);
+  if (in.fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(in.fd, &st) != 0 || st.st_size == 0)
+    return false;
+  size = st.st_size;
+  in.size = st.st_size;
+  void *view = mmap(NULL, in.size, PROT_READ, MAP_SHARED, in.fd, 0);
+  if (view == MAP_FAILED)
+    return false;
+  madvise(view, in.size, MADV_SEQUENTIAL);
+  in.view = view;
+  return true;
+#endif
+}
+
+static void unmap_input(input_file &in)
+{
+#ifdef _WIN32
+  if (in.view)
+    UnmapViewOfFile(in.view);
+  if (in.mapping)
+    CloseHandle(in.mapping);
+  if (in.file != INVALID_HANDLE_VALUE)
+    CloseHandle(in.file);
+#else
+  if (in.view)
+    munmap(in.view, in.size);
+  if (in.fd >= 0)
+    close(in.fd);
+#endif
+}
+
+static bool ends_with(const std::string &s, const char *suffix)
+{
+  size_t n = strlen(suffix);
+  return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+/* value of the first "key": in a SigMF meta file, strings without the quotes */
+static bool json_value(const std::string &json, const char *key, std::string &value)
+{
+  std::string quoted = std::string("\"") + key + "\"";
+  size_t pos = json.find(quoted);
+  if (pos == std::string::npos)
+    return false;
+  pos = json.find(':', pos + quoted.size());
+  if (pos == std::string::npos)
+    return false;
+  pos = json.find_first_not_of(" \t\r\n", pos + 1);
+  if (pos == std::string::npos)
+    return false;
+  if (json[pos] == '"') {
+    size_t end = json.find('"', pos + 1);
+    if (end == std::string::npos)
+      return false;
+    value = json.substr(pos + 1, end - pos - 1);
+  }
+  else {
+    size_t end = json.find_first_of(",}] \t\r\n", pos);
+    value = json.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+  }
+  return true;
+}
+
+/* <base>.sigmf-meta of 16 bit real samples, the samples in <base>.sigmf-data */
+static bool open_sigmf(input_file &in, const std::string &base)
+{
+  std::string json;
+  FILE *f = fopen((base + ".sigmf-meta").c_str(), "rb");
+  if (f == NULL) {
+    fprintf(stderr, "ERROR - can not open '%s.sigmf-meta'\n", base.c_str());
+    return false;
+  }
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    json.append(buf, n);
+  fclose(f);
+
+  std::string value;
+  if (!json_value(json, "core:datatype", value) || value != "ri16_le") {
+    fprintf(stderr, "ERROR - '%s.sigmf-meta' is not ri16_le\n", base.c_str());
+    return false;
+  }
+  if (json_value(json, "core:sample_rate", value))
+    in.rate = atof(value.c_str());
+  if (json_value(json, "core:frequency", value))
+    in.frequency = atof(value.c_str());
+
+  in.path = base + ".sigmf-data";
+  uint64_t size;
+  if (!map_input(in, size)) {
+    fprintf(stderr, "ERROR - can not map '%s'\n", in.path.c_str());
+    return false;
+  }
+  in.samples = (const int16_t *)in.view;
+  in.count = size / sizeof(int16_t);
+  return true;
+}
+
+/* RIFF or RF64 with one channel of 16 bit PCM */
+static bool open_wav(input_file &in)
+{
+  uint64_t size;
+  if (!map_input(in, size)) {
+    fprintf(stderr, "ERROR - can not map '%s'\n", in.path.c_str());
+    return false;
+  }
+
+  const uint8_t *p = (const uint8_t *)in.view;
+  if (size < sizeof(riff_chunk) || (memcmp(p, "RIFF", 4) && memcmp(p, "RF64", 4)) || memcmp(p + 8, "WAVE", 4)) {
+    fprintf(stderr, "ERROR - '%s' is not a wave file\n", in.path.c_str());
+    return false;
+  }
+
+  uint64_t dataSize64 = 0;
+  bool pcm16 = false;
+  uint64_t pos = sizeof(riff_chunk);
+  while (pos + sizeof(chunk_hdr) <= size) {
+    const chunk_hdr *hdr = (const chunk_hdr *)(p + pos);
+    const uint8_t *body = p + pos + sizeof(chunk_hdr);
+    uint64_t len = hdr->size;
+
+    if (!memcmp(hdr->ID, "ds64", 4) && len >= 16)
+      dataSize64 = ((const ds64_chunk *)hdr)->dataSize;
+    else if (!memcmp(hdr->ID, "fmt ", 4) && len >= 16) {
+      const fmt_chunk *fmt = (const fmt_chunk *)hdr;
+      pcm16 = fmt->wFormatTag == 1 && fmt->nChannels == 1 && fmt->nBitsPerSample == 16;
+      in.rate = fmt->nSamplesPerSec;
+    }
+    else if (!memcmp(hdr->ID, "auxi", 4) && len >= sizeof(auxi_chunk) - sizeof(chunk_hdr))
+      in.frequency = ((const auxi_chunk *)hdr)->centerFreq;
+    else if (!memcmp(hdr->ID, "data", 4)) {
+      if (!pcm16) {
+        fprintf(stderr, "ERROR - '%s' is not mono 16 bit PCM\n", in.path.c_str());
+        return false;
+      }
+      if (len == 0xFFFFFFFF && dataSize64)
+        len = dataSize64;
+      len = std::min(len, size - (body - p));
+      in.samples = (const int16_t *)body;
+      in.count = len / sizeof(int16_t);
+      return true;
+    }
+    pos += sizeof(chunk_hdr) + len + (len & 1);
+  }
+
+  fprintf(stderr, "ERROR - '%s' has no data chunk\n", in.path.c_str());
+  return false;
+}
+
+static bool open_raw(input_file &in)
+{
+  uint64_t size;
+  if (!map_input(in, size)) {
+    fprintf(stderr, "ERROR - can not map '%s'\n", in.path.c_str());
+    return false;
+  }
+  in.samples = (const int16_t *)in.view;
+  in.count = size / sizeof(int16_t);
+  return true;
+}
+
+template<typename T> static void quantize(const float *in, T *out, size_t n, float scale, float limit)
+{
+  for (size_t i = 0; i < n; i++) {
+    float v = in[i] * scale;
+    v = std::min(std::max(v, -limit - 1.0f), limit);
+    out[i] = (T)lrintf(v);
+  }
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [options] <input> <output>\n", name);
+  fprintf(stderr, "  <input>   raw 16 bit ADC samples: <name>.wav, <name>.sigmf(-meta|-data) or headerless\n");
+  fprintf(stderr, "  <output>  <name>.wav (cs16), <name>.sigmf for <name>.sigmf-data/-meta, otherwise headerless\n");
+  fprintf(stderr, "  -r <Hz>   ADC rate, required for a headerless input\n");
+  fprintf(stderr, "  -d <0..%d> decimation, the IQ rate is ADC rate / 2^(d+1) (0)\n", NDECIDX - 1);
+  fprintf(stderr, "  -t <Hz>   center of the IQ band in the ADC spectrum (ADC rate / 8)\n");
+  fprintf(stderr, "  -l        lower sideband: mirror the spectrum, as for VHF captures\n");
+  fprintf(stderr, "  -R        the capture was made with ADC randomization\n");
+  fprintf(stderr, "  -f <cf32|cs16|cs8>  output samples (cf32, cs16 for .wav)\n");
+  fprintf(stderr, "  -g <dB>   gain, 0 dB maps a full scale sine at the ADC to full scale IQ (0)\n");
+  fprintf(stderr, "  -j <n>    worker threads (all cores)\n");
+}
+
+int main(int argc, char **argv)
+{
+  double adcRate = 0;
+  int decimate = 0;
+  double tune = -1;
+  bool lsb = false;
+  bool rand = false;
+  int format = -1;
+  double gain_dB = 0;
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  const char *inname = 0;
+  const char *outname = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : 0;
+    if (arg[0] != '-' || arg[1] == '\0') {
+      if (!inname)
+        inname = arg;
+      else if (!outname)
+        outname = arg;
+      else {
+        usage(argv[0]);
+        return -1;
+      }
+      continue;
+    }
+    if (!strcmp(arg, "-l"))
+      lsb = true;
+    else if (!strcmp(arg, "-R"))
+      rand = true;
+    else if (value == 0) {
+      usage(argv[0]);
+      return -1;
+    }
+    else {
+      i++;
+      if (!strcmp(arg, "-r"))
+        adcRate = atof(value);
+      else if (!strcmp(arg, "-d"))
+        decimate = atoi(value);
+      else if (!strcmp(arg, "-t"))
+        tune = atof(value);
+      else if (!strcmp(arg, "-g"))
+        gain_dB = atof(value);
+      else if (!strcmp(arg, "-j"))
+        threads = std::max(1, atoi(value));
+      else if (!strcmp(arg, "-f")) {
+        format = -1;
+        for (int k = 0; k < 3; k++)
+          if (!strcmp(value, formats[k].name))
+            format = k;
+        if (format < 0) {
+          fprintf(stderr, "ERROR - unknown output format '%s'\n", value);
+          return -1;
+        }
+      }
+      else {
+        usage(argv[0]);
+        return -1;
+      }
+    }
+  }
+  if (!inname || !outname) {
+    usage(argv[0]);
+    return -1;
+  }
+  if (decimate < 0 || decimate >= NDECIDX) {
+    fprintf(stderr, "ERROR - decimation %d is not 0..%d\n", decimate, NDECIDX - 1);
+    return -1;
+  }
+
+  /* input */
+  input_file in = input_file();
+#ifdef _WIN32
+  in.file = INVALID_HANDLE_VALUE;
+#else
+  in.fd = -1;
+#endif
+  std::string inpath = inname;
+  bool ok;
+  if (ends_with(inpath, ".sigmf-meta") || ends_with(inpath, ".sigmf-data"))
+    ok = open_sigmf(in, inpath.substr(0, inpath.size() - 11));
+  else if (ends_with(inpath, ".sigmf"))
+    ok = open_sigmf(in, inpath.substr(0, inpath.size() - 6));
+  else {
+    in.path = inpath;
+    ok = ends_with(inpath, ".wav") ? open_wav(in) : open_raw(in);
+  }
+  if (!ok) {
+    unmap_input(in);
+    return -1;
+  }
+  if (adcRate <= 0)
+    adcRate = in.rate;
+  if (adcRate <= 0) {
+    fprintf(stderr, "ERROR - the ADC rate of '%s' is not known, use -r\n", inname);
+    unmap_input(in);
+    return -1;
+  }
+  if (tune < 0)
+    tune = adcRate / 8;
+  if (tune > adcRate / 2) {
+    fprintf(stderr, "ERROR - tune %.0f Hz is beyond the ADC band\n", tune);
+    unmap_input(in);
+    return -1;
+  }
+
+  const uint32_t block = DEFAULT_TRANSFER_SAMPLES;
+  const uint32_t outBlock = block >> (decimate + 1);
+  const uint64_t blocks = in.count / block;
+  const uint64_t segments = (blocks + segment_blocks - 1) / segment_blocks;
+  const double outRate = adcRate / (2 << decimate);
+  if (blocks == 0) {
+    fprintf(stderr, "ERROR - '%s' holds less than one block of %u samples\n", inname, block);
+    unmap_input(in);
+    return -1;
+  }
+
+  /* output */
+  std::string outpath = outname;
+  bool sigmf = ends_with(outpath, ".sigmf");
+  bool wav = ends_with(outpath, ".wav");
+  FILE *out = 0;
+  waveWriter *writer = 0;
+  std::string base = sigmf ? outpath.substr(0, outpath.size() - 6) : outpath;
+  double frequency = lsb ? in.frequency - tune : in.frequency + tune;
+  if (wav && format >= 0 && formats[format].format != CS16) {
+    fprintf(stderr, "ERROR - a wave file holds cs16\n");
+    unmap_input(in);
+    return -1;
+  }
+  if (format < 0)
+    format = wav ? 1 : 0;
+  if (wav) {
+    writer = waveWriterOpen(outname, (unsigned)(0.5 + outRate), (unsigned)(0.5 + frequency), 16, 2, 0);
+  }
+  else {
+    out = fopen(sigmf ? (base + ".sigmf-data").c_str() : outname, "wb");
+  }
+  if (!writer && !out) {
+    fprintf(stderr, "ERROR - can not create '%s'\n", outname);
+    unmap_input(in);
+    return -1;
+  }
+
+  const float gain = unity_gain * (float)pow(10.0, gain_dB / 20.0);
+  const out_format fmt = formats[format].format;
+  const size_t segmentBytes = (size_t)segment_blocks * outBlock * formats[format].size;
+
+  fprintf(stderr, "converting %" PRIu64 " samples at %.0f Hz to %s IQ at %.0f Hz around %.0f Hz, %u threads\n",
+          blocks * block, adcRate, formats[format].name, outRate, frequency, threads);
+
+  /* a ring of segment buffers between the workers and the writer */
+  const unsigned slots = 2 * threads;
+  std::vector<std::vector<uint8_t>> slot(slots, std::vector<uint8_t>(segmentBytes));
+  std::vector<size_t> slotBytes(slots);
+  std::vector<int64_t> slotSegment(slots, -1);
+  std::atomic<uint64_t> next(0);
+  uint64_t written = 0;
+  std::mutex mutex;
+  std::condition_variable cv;
+
+  auto worker = [&]() {
+    r2iq_batch batch(gain, block);
+    batch.setDecimation(decimate);
+    batch.setTune(tune / (adcRate / 2));
+    batch.setSideband(lsb);
+    batch.updateRand(rand);
+
+    float *iq = (float *)fftwf_malloc(sizeof(float) * 2 * segment_blocks * outBlock);
+    for (uint64_t seg; (seg = next++) < segments; ) {
+      uint64_t first = seg * segment_blocks;
+      uint64_t count = std::min<uint64_t>(segment_blocks, blocks - first);
+
+      batch.seek(first, first ? in.samples + first * block - halfFft : 0);
+      size_t n = batch.process(in.samples + first * block, count * block, iq);
+
+      {
+        std::unique_lock<std::mutex> lk(mutex);
+        cv.wait(lk, [&]() { return seg < written + slots; });
+      }
+      uint8_t *dest = slot[seg % slots].data();
+      if (fmt == CF32)
+        memcpy(dest, iq, n * 2 * sizeof(float));
+      else if (fmt == CS16)
+        quantize(iq, (int16_t *)dest, n * 2, 32767.0f, 32767.0f);
+      else
+        quantize(iq, (int8_t *)dest, n * 2, 127.0f, 127.0f);
+
+      std::lock_guard<std::mutex> lk(mutex);
+      slotBytes[seg % slots] = n * formats[format].size;
+      slotSegment[seg % slots] = seg;
+      cv.notify_all();
+    }
+    fftwf_free(iq);
+  };
+
+  auto start = steady_clock::now();
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; t++)
+    workers.emplace_back(worker);
+
+  int ret_val = 0;
+  uint64_t bytes = 0;
+  for (uint64_t seg = 0; seg < segments; seg++) {
+    unsigned s = seg % slots;
+    {
+      std::unique_lock<std::mutex> lk(mutex);
+      cv.wait(lk, [&]() { return slotSegment[s] == (int64_t)seg; });
+    }
+    if (ret_val == 0) {
+      if (writer)
+        ret_val = waveWriterWrite(writer, slot[s].data(), slotBytes[s] / formats[format].size) ? -1 : 0;
+      else if (fwrite(slot[s].data(), 1, slotBytes[s], out) != slotBytes[s])
+        ret_val = -1;
+      bytes += slotBytes[s];
+    }
+    std::lock_guard<std::mutex> lk(mutex);
+    written = seg + 1;
+    cv.notify_all();
+  }
+  for (auto &t : workers)
+    t.join();
+
+  if (writer && waveWriterClose(writer))
+    ret_val = -1;
+  if (out && fclose(out))
+    ret_val = -1;
+
+  if (ret_val == 0 && sigmf) {
+    FILE *f = fopen((base + ".sigmf-meta").c_str(), "w");
+    if (f == NULL) {
+      ret_val = -1;
+    }
+    else {
+      fprintf(f, "{\n");
+      fprintf(f, "    \"global\": {\n");
+      fprintf(f, "        \"core:datatype\": \"%s\",\n", formats[format].datatype);
+      fprintf(f, "        \"core:sample_rate\": %.17g,\n", outRate);
+      fprintf(f, "        \"core:version\": \"1.0.0\",\n");
+      fprintf(f, "        \"core:recorder\": \"sddc_convert\"\n");
+      fprintf(f, "    },\n");
+      fprintf(f, "    \"captures\": [\n");
+      fprintf(f, "        { \"core:sample_start\": 0, \"core:frequency\": %.17g }\n", frequency);
+      fprintf(f, "    ],\n");
+      fprintf(f, "    \"annotations\": []\n");
+      fprintf(f, "}\n");
+      if (fclose(f))
+        ret_val = -1;
+    }
+  }
+
+  double dur = duration<double>(steady_clock::now() - start).count();
+  if (ret_val == 0)
+    fprintf(stderr, "wrote %" PRIu64 " bytes to %s in %.2f s, %.1f Msps ADC\n",
+            bytes, outname, dur, blocks * block / dur / 1e6);
+  else
+    fprintf(stderr, "ERROR - writing '%s' failed\n", outname);
+  if (in.count % block)
+    fprintf(stderr, "the last %u samples are less than a block and not converted\n",
+            (unsigned)(in.count % block));
+
+  unmap_input(in);
+  return ret_val;
+}
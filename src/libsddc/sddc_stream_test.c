@@ -99,7 +99,7 @@ static void count_bytes_callback(uint32_t data_size, uint8_t *data,
 static unsigned long long received_samples = 0;
 static unsigned long long total_samples = 0;
 static int num_callbacks;
-static int16_t *sampleData = 0;
+static waveWriter *writer = 0;
 static int runtime = 3000;
 static struct timespec clk_start, clk_end;
 static int stop_reception = 0;
@@ -114,10 +114,13 @@ int main(int argc, char **argv)
 {
   if (argc < 3) {
     fprintf(stderr, "usage: %s <image file> <sample rate> [<runtime_in_ms> [<output_filename>]\n", argv[0]);
+    fprintf(stderr, "  an output_filename ending in .sigmf records to <name>.sigmf-data/-meta\n");
+    fprintf(stderr, "  while streaming, SDDC_ROLLOVER=<seconds> splits the recording\n");
     return -1;
   }
   char *imagefile = argv[1];
   const char *outfilename = 0;
+  char *recordbase = 0;
   double sample_rate = 0.0;
   sscanf(argv[2], "%lf", &sample_rate);
   if (3 < argc)
@@ -143,11 +146,35 @@ int main(int argc, char **argv)
     goto DONE;
   }
 
+  /* <name>.sigmf: record through libsddc instead of buffering in memory */
+  if (outfilename && strlen(outfilename) > 6 &&
+      strcmp(outfilename + strlen(outfilename) - 6, ".sigmf") == 0) {
+    const char *rollover = getenv("SDDC_ROLLOVER");
+    recordbase = strdup(outfilename);
+    recordbase[strlen(recordbase) - 6] = 0;
+    outfilename = 0;
+    if (sddc_set_recording(sddc, recordbase, 0, rollover ? atof(rollover) : 0.0) < 0) {
+      fprintf(stderr, "ERROR - sddc_set_recording() failed\n");
+      goto DONE;
+    }
+  }
+
   if (sddc_set_async_params(sddc, 0, 0, count_bytes_callback, sddc) < 0) {
     fprintf(stderr, "ERROR - sddc_set_async_params() failed\n");
     goto DONE;
   }
 
+  total_samples = (unsigned long long)(runtime * sample_rate / 1000.0);
+
+  /* written out by the wave writer while streaming */
+  if (outfilename) {
+    writer = waveWriterOpen(outfilename, (unsigned)(0.5 + sample_rate), 0U /*frequency*/, 16 /*bitsPerSample*/, 1 /*numChannels*/, 0 /*default batch*/);
+    if (!writer) {
+      fprintf(stderr, "ERROR - can not create '%s'\n", outfilename);
+      goto DONE;
+    }
+  }
+
   received_samples = 0;
   num_callbacks = 0;
   if (sddc_start_streaming(sddc) < 0) {
@@ -156,10 +183,6 @@ int main(int argc, char **argv)
   }
 
   fprintf(stderr, "started streaming .. for %d ms ..\n", runtime);
-  total_samples = (unsigned long long)(runtime * sample_rate / 1000.0);
-
-  if (outfilename)
-    sampleData = (int16_t*)malloc(total_samples * sizeof(int16_t));
 
   /* todo: move this into a thread */
   stop_reception = 0;
@@ -178,22 +201,26 @@ int main(int argc, char **argv)
   fprintf(stderr, "run for %f sec\n", dur);
   fprintf(stderr, "approx. samplerate is %f kSamples/sec\n", received_samples / (1000.0*dur) );
 
-  if (outfilename && sampleData && received_samples) {
-    FILE * f = fopen(outfilename, "wb");
-    if (f) {
-      fprintf(stderr, "saving received real samples to file ..\n");
-      waveWriteHeader( (unsigned)(0.5 + sample_rate), 0U /*frequency*/, 16 /*bitsPerSample*/, 1 /*numChannels*/, f);
-      for ( unsigned long long off = 0; off + 65536 < received_samples; off += 65536 )
-        waveWriteSamples(f,  sampleData + off, 65536, 0 /*needCleanData*/);
-      waveFinalizeHeader(f);
-      fclose(f);
-    }
+  if (recordbase) {
+    uint64_t written = 0, lost = 0;
+    int err = sddc_get_recording_stats(sddc, &written, &lost);
+    fprintf(stderr, "recorded %llu bytes to %s*.sigmf-data, %llu bytes lost%s\n",
+            (unsigned long long)written, recordbase, (unsigned long long)lost,
+            err < 0 ? ", write errors" : "");
+  }
+
+  if (writer) {
+    fprintf(stderr, "finishing the file ..\n");
+    if (waveWriterClose(writer))
+      fprintf(stderr, "ERROR - writing '%s' failed\n", outfilename);
+    writer = 0;
   }
 
   /* done - all good */
   ret_val = 0;
 
 DONE:
+  free(recordbase);
   sddc_close(sddc);
 
   return ret_val;
@@ -208,8 +235,8 @@ static void count_bytes_callback(uint32_t data_size,
   ++num_callbacks;
   unsigned N = data_size / sizeof(int16_t);
   if ( received_samples + N < total_samples ) {
-    if (sampleData)
-      memcpy( sampleData+received_samples, data, data_size);
+    if (writer)
+      waveWriterWrite(writer, data, N);
     received_samples += N;
   }
   else {
@@ -0,0 +1,113 @@
+/*
+ * sddc_sweep - wideband power sweeps with libsddc, like rtl_power
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "libsddc.h"
+
+
+int main(int argc, char **argv)
+{
+  if (argc < 4) {
+    fprintf(stderr, "usage: %s <image file> <start Hz> <stop Hz> [<integrate> [<sweeps> [<output_filename> [<span Hz>]]]]\n", argv[0]);
+    fprintf(stderr, "  integrate spectra per step, 256 by default; 1 sweep by default\n");
+    fprintf(stderr, "  an output_filename ending in .bin is written in binary, else as CSV lines\n");
+    fprintf(stderr, "  span 0, the default, steps by the band the tuner passes\n");
+    return -1;
+  }
+  char *imagefile = argv[1];
+  double start = 0.0;
+  double stop = 0.0;
+  int integrate = 256;
+  int sweeps = 1;
+  const char *outfilename = 0;
+  double span = 0.0;
+  sscanf(argv[2], "%lf", &start);
+  sscanf(argv[3], "%lf", &stop);
+  if (4 < argc)
+    integrate = atoi(argv[4]);
+  if (5 < argc)
+    sweeps = atoi(argv[5]);
+  if (6 < argc)
+    outfilename = argv[6];
+  if (7 < argc)
+    sscanf(argv[7], "%lf", &span);
+
+  if (start <= 0 || stop <= start) {
+    fprintf(stderr, "ERROR - given range %f to %f Hz is empty\n", start, stop);
+    return -1;
+  }
+  if (integrate < 1 || sweeps < 1 || span < 0) {
+    fprintf(stderr, "ERROR - integrate and sweeps should be > 0, span >= 0\n");
+    return -1;
+  }
+
+  int ret_val = -1;
+
+  sddc_t *sddc = sddc_open(0, imagefile);
+  if (sddc == 0) {
+    fprintf(stderr, "ERROR - sddc_open() failed\n");
+    return -1;
+  }
+
+  if (sddc_sweep_configure(sddc, start, stop, integrate, span) < 0) {
+    fprintf(stderr, "ERROR - sddc_sweep_configure() failed\n");
+    goto DONE;
+  }
+
+  if (outfilename) {
+    size_t len = strlen(outfilename);
+    int binary = len > 4 && strcmp(outfilename + len - 4, ".bin") == 0;
+    if (sddc_sweep_open(sddc, outfilename, binary) < 0) {
+      fprintf(stderr, "ERROR - sddc_sweep_open() failed\n");
+      goto DONE;
+    }
+  }
+
+  if (sddc_sweep_run(sddc, (uint32_t)sweeps) < 0) {
+    fprintf(stderr, "ERROR - sddc_sweep_run() failed\n");
+    goto DONE;
+  }
+  sddc_sweep_close(sddc);
+
+  /* the strongest bin of the last sweep */
+  const float *db = 0;
+  double first = 0.0;
+  double bin_hz = 0.0;
+  int bins = sddc_sweep_get_spectrum(sddc, &db, &first, &bin_hz);
+  int peak = -1;
+  for (int i = 0; i < bins; i++) {
+    if (!isnan(db[i]) && (peak < 0 || db[i] > db[peak]))
+      peak = i;
+  }
+  fprintf(stderr, "%d sweeps of %d bins of %.2f Hz\n", sweeps, bins, bin_hz);
+  if (peak >= 0)
+    fprintf(stderr, "peak %.1f dB at %.0f Hz\n", db[peak], first + peak * bin_hz);
+
+  /* done - all good */
+  ret_val = 0;
+
+DONE:
+  sddc_close(sddc);
+
+  return ret_val;
+}
@@ -99,7 +99,7 @@ static void count_bytes_callback(uint32_t data_size, uint8_t *data,
 static unsigned long long received_samples = 0;
 static unsigned long long total_samples = 0;
 static int num_callbacks;
-static int16_t *sampleData = 0;
+static waveWriter *writer = 0;
 static int runtime = 3000;
 static struct timespec clk_start, clk_end;
 static int stop_reception = 0;
@@ -167,6 +167,17 @@ int main(int argc, char **argv)
     goto DONE;
   }
 
+  total_samples = (unsigned long long)(runtime * sample_rate / 1000.0);
+
+  /* written out by the wave writer while streaming */
+  if (outfilename) {
+    writer = waveWriterOpen(outfilename, (unsigned)(0.5 + sample_rate), 0U /*frequency*/, 16 /*bitsPerSample*/, 1 /*numChannels*/, 0 /*default batch*/);
+    if (!writer) {
+      fprintf(stderr, "ERROR - can not create '%s'\n", outfilename);
+      goto DONE;
+    }
+  }
+
   received_samples = 0;
   num_callbacks = 0;
   if (sddc_start_streaming(sddc) < 0) {
@@ -175,10 +186,6 @@ int main(int argc, char **argv)
   }
 
   fprintf(stderr, "started streaming .. for %d ms ..\n", runtime);
-  total_samples = (unsigned long long)(runtime * sample_rate / 1000.0);
-
-  if (outfilename)
-    sampleData = (int16_t*)malloc(total_samples * sizeof(int16_t));
 
   /* todo: move this into a thread */
   stop_reception = 0;
@@ -197,16 +204,11 @@ int main(int argc, char **argv)
   fprintf(stderr, "run for %f sec\n", dur);
   fprintf(stderr, "approx. samplerate is %f kSamples/sec\n", received_samples / (1000.0*dur) );
 
-  if (outfilename && sampleData && received_samples) {
-    FILE * f = fopen(outfilename, "wb");
-    if (f) {
-      fprintf(stderr, "saving received real samples to file ..\n");
-      waveWriteHeader( (unsigned)(0.5 + sample_rate), 0U /*frequency*/, 16 /*bitsPerSample*/, 1 /*numChannels*/, f);
-      for ( unsigned long long off = 0; off + 65536 < received_samples; off += 65536 )
-        waveWriteSamples(f,  sampleData + off, 65536, 0 /*needCleanData*/);
-      waveFinalizeHeader(f);
-      fclose(f);
-    }
+  if (writer) {
+    fprintf(stderr, "finishing the file ..\n");
+    if (waveWriterClose(writer))
+      fprintf(stderr, "ERROR - writing '%s' failed\n", outfilename);
+    writer = 0;
   }
 
   /* done - all good */
@@ -227,8 +229,8 @@ static void count_bytes_callback(uint32_t data_size,
   ++num_callbacks;
   unsigned N = data_size / sizeof(int16_t);
   if ( received_samples + N < total_samples ) {
-    if (sampleData)
-      memcpy( sampleData+received_samples, data, data_size);
+    if (writer)
+      waveWriterWrite(writer, data, N);
     received_samples += N;
   }
   else {
@@ -51,6 +51,17 @@ typedef struct
 	char		waveID[4];	/* "WAVE" string */
 } riff_chunk;
 
+typedef struct
+{
+	/* ds64 header - 64 bit sizes of RF64 (EBU Tech 3306), placed right after the RIFF header.
+	 * written as "JUNK" while the file fits into classic RIFF, turned into "ds64" beyond 4 GiB */
+	chunk_hdr	hdr;		/* ID == "ds64" or "JUNK", size == 28 */
+	uint64_t	riffSize;	/* full filesize - 8 bytes */
+	uint64_t	dataSize;	/* size of the data chunk */
+	uint64_t	sampleCount;	/* number of frames */
+	uint32_t	tableLength;	/* no further chunk sizes */
+} ds64_chunk;
+
 typedef struct
 {
 	/* FMT header */
@@ -89,6 +100,7 @@ typedef struct
 typedef struct
 {
 	riff_chunk r;
+	ds64_chunk x;
 	fmt_chunk  f;
 	auxi_chunk a;
 	data_chunk d;
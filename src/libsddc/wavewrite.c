@@ -26,6 +26,7 @@
 #ifndef _WIN32
 #include <unistd.h>
 #include <sys/time.h>
+#include <pthread.h>
 #else
 #include <windows.h>
 #include <fcntl.h>
@@ -63,9 +64,11 @@ int gettimeofday(struct timeval * tp, struct timezone * tzp)
 
 static waveFileHeader waveHdr;
 
-static uint32_t	waveDataSize = 0;
+static uint64_t	waveDataSize = 0;
 int	waveHdrStarted = 0;
 
+static uint64_t	waveRiffLimit = 0xFFFFFFFFULL;
+
 
 static void waveSetCurrTime(Wind_SystemTime *p)
 {
@@ -112,40 +115,81 @@ void waveSetStartTime(time_t tim, double fraction)
 }
 
 
-void wavePrepareHeader(unsigned samplerate, unsigned freq, int bitsPerSample, int numChannels)
+static void wavePrepareHeaderInt(waveFileHeader *h, unsigned samplerate, unsigned freq, int bitsPerSample, int numChannels)
 {
 	int	bytesPerSample = bitsPerSample / 8;
 	int bytesPerFrame = bytesPerSample * numChannels;
 
-	memcpy( waveHdr.r.hdr.ID, "RIFF", 4 );
-	waveHdr.r.hdr.size = sizeof(waveFileHeader) - 8;		/* to fix */
-	memcpy( waveHdr.r.waveID, "WAVE", 4 );
-
-	memcpy( waveHdr.f.hdr.ID, "fmt ", 4 );
-	waveHdr.f.hdr.size = 16;
-	waveHdr.f.wFormatTag = 1;					/* PCM */
-	waveHdr.f.nChannels = numChannels;		/* I and Q channels */
-	waveHdr.f.nSamplesPerSec = samplerate;
-	waveHdr.f.nAvgBytesPerSec = samplerate * bytesPerFrame;
-	waveHdr.f.nBlockAlign = waveHdr.f.nChannels;
-	waveHdr.f.nBitsPerSample = bitsPerSample;
-
-	memcpy( waveHdr.a.hdr.ID, "auxi", 4 );
-	waveHdr.a.hdr.size = 2 * sizeof(Wind_SystemTime) + 9 * sizeof(int32_t);  /* = 2 * 16 + 9 * 4 = 68 */
-	waveSetCurrTime( &waveHdr.a.StartTime );
-	waveHdr.a.StopTime = waveHdr.a.StartTime;		/* to fix */
-	waveHdr.a.centerFreq = freq;
-	waveHdr.a.ADsamplerate = samplerate;
-	waveHdr.a.IFFrequency = 0;
-	waveHdr.a.Bandwidth = 0;
-	waveHdr.a.IQOffset = 0;
-	waveHdr.a.Unused2 = 0;
-	waveHdr.a.Unused3 = 0;
-	waveHdr.a.Unused4 = 0;
-	waveHdr.a.Unused5 = 0;
-
-	memcpy( waveHdr.d.hdr.ID, "data", 4 );
-	waveHdr.d.hdr.size = 0;		/* to fix later */
+	memcpy( h->r.hdr.ID, "RIFF", 4 );
+	h->r.hdr.size = sizeof(waveFileHeader) - 8;		/* to fix */
+	memcpy( h->r.waveID, "WAVE", 4 );
+
+	memcpy( h->x.hdr.ID, "JUNK", 4 );		/* room for ds64 */
+	h->x.hdr.size = sizeof(ds64_chunk) - sizeof(chunk_hdr);	/* = 28 */
+	h->x.riffSize = 0;
+	h->x.dataSize = 0;
+	h->x.sampleCount = 0;
+	h->x.tableLength = 0;
+
+	memcpy( h->f.hdr.ID, "fmt ", 4 );
+	h->f.hdr.size = 16;
+	h->f.wFormatTag = 1;					/* PCM */
+	h->f.nChannels = numChannels;		/* I and Q channels */
+	h->f.nSamplesPerSec = samplerate;
+	h->f.nAvgBytesPerSec = samplerate * bytesPerFrame;
+	h->f.nBlockAlign = bytesPerFrame;
+	h->f.nBitsPerSample = bitsPerSample;
+
+	memcpy( h->a.hdr.ID, "auxi", 4 );
+	h->a.hdr.size = 2 * sizeof(Wind_SystemTime) + 9 * sizeof(int32_t);  /* = 2 * 16 + 9 * 4 = 68 */
+	waveSetCurrTime( &h->a.StartTime );
+	h->a.StopTime = h->a.StartTime;		/* to fix */
+	h->a.centerFreq = freq;
+	h->a.ADsamplerate = samplerate;
+	h->a.IFFrequency = 0;
+	h->a.Bandwidth = 0;
+	h->a.IQOffset = 0;
+	h->a.Unused2 = 0;
+	h->a.Unused3 = 0;
+	h->a.Unused4 = 0;
+	h->a.Unused5 = 0;
+
+	memcpy( h->d.hdr.ID, "data", 4 );
+	h->d.hdr.size = 0;		/* to fix later */
+}
+
+/* classic RIFF up to 4 GiB, RF64 with the sizes in ds64 beyond */
+static void waveSetSizes(waveFileHeader *h, uint64_t dataSize)
+{
+	uint64_t riffSize = sizeof(waveFileHeader) - 8 + dataSize;
+
+	if (riffSize > waveRiffLimit) {
+		memcpy( h->r.hdr.ID, "RF64", 4 );
+		h->r.hdr.size = 0xFFFFFFFF;
+		memcpy( h->x.hdr.ID, "ds64", 4 );
+		h->x.riffSize = riffSize;
+		h->x.dataSize = dataSize;
+		h->x.sampleCount = h->f.nBlockAlign ? dataSize / h->f.nBlockAlign : 0;
+		h->d.hdr.size = 0xFFFFFFFF;
+	} else {
+		memcpy( h->r.hdr.ID, "RIFF", 4 );
+		h->r.hdr.size = (uint32_t)riffSize;
+		memcpy( h->x.hdr.ID, "JUNK", 4 );
+		h->x.riffSize = 0;
+		h->x.dataSize = 0;
+		h->x.sampleCount = 0;
+		h->d.hdr.size = (uint32_t)dataSize;
+	}
+}
+
+void waveSetRF64Limit(uint64_t riffSize)
+{
+	waveRiffLimit = riffSize < 0xFFFFFFFFULL ? riffSize : 0xFFFFFFFFULL;
+}
+
+void wavePrepareHeader(unsigned samplerate, unsigned freq, int bitsPerSample, int numChannels)
+{
+	wavePrepareHeaderInt(&waveHdr, samplerate, freq, bitsPerSample, numChannels);
 	waveDataSize = 0;
 }
 
@@ -215,8 +259,7 @@ int  waveFinalizeHeader(FILE * f)
 	if (f != stdout) {
 		assert( waveHdrStarted );
 		waveSetCurrTime( &waveHdr.a.StopTime );
-		waveHdr.d.hdr.size = waveDataSize;
-		waveHdr.r.hdr.size += waveDataSize;
+		waveSetSizes( &waveHdr, waveDataSize );
 		/* fprintf(stderr, "waveFinalizeHeader(): datasize = %d\n", waveHdr.dataSize); */
 		waveHdrStarted = 0;
 		if ( fseek(f, 0, SEEK_SET) )
@@ -229,4 +272,220 @@ int  waveFinalizeHeader(FILE * f)
 	return 1;
 }
 
+
+/* batched writer: the caller fills large batches, a thread writes them out */
+
+#define WAVE_WRITER_BATCHES	4
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION	wave_mutex_t;
+typedef CONDITION_VARIABLE	wave_cond_t;
+typedef HANDLE			wave_thread_t;
+#define wave_mutex_init(m)	InitializeCriticalSection(m)
+#define wave_mutex_destroy(m)	DeleteCriticalSection(m)
+#define wave_lock(m)		EnterCriticalSection(m)
+#define wave_unlock(m)		LeaveCriticalSection(m)
+#define wave_cond_init(c)	InitializeConditionVariable(c)
+#define wave_cond_destroy(c)
+#define wave_wait(c, m)		SleepConditionVariableCS(c, m, INFINITE)
+#define wave_broadcast(c)	WakeAllConditionVariable(c)
+#else
+typedef pthread_mutex_t		wave_mutex_t;
+typedef pthread_cond_t		wave_cond_t;
+typedef pthread_t		wave_thread_t;
+#define wave_mutex_init(m)	pthread_mutex_init(m, NULL)
+#define wave_mutex_destroy(m)	pthread_mutex_destroy(m)
+#define wave_lock(m)		pthread_mutex_lock(m)
+#define wave_unlock(m)		pthread_mutex_unlock(m)
+#define wave_cond_init(c)	pthread_cond_init(c, NULL)
+#define wave_cond_destroy(c)	pthread_cond_destroy(c)
+#define wave_wait(c, m)		pthread_cond_wait(c, m)
+#define wave_broadcast(c)	pthread_cond_broadcast(c)
+#endif
+
+struct waveWriter
+{
+	FILE		*f;
+	waveFileHeader	hdr;
+	uint64_t	dataSize;	/* bytes written to the data chunk */
+	size_t		frameSize;
+	size_t		batchSize;
+	uint8_t		*batch[WAVE_WRITER_BATCHES];
+	size_t		fill[WAVE_WRITER_BATCHES];
+	unsigned	head;		/* batches handed to the thread */
+	unsigned	tail;		/* batches written */
+	int		closing;
+	int		error;
+	wave_mutex_t	mutex;
+	wave_cond_t	cond;
+	wave_thread_t	thread;
+};
+
+#ifdef _WIN32
+static unsigned __stdcall waveWriterThread(void *arg)
+#else
+static void *waveWriterThread(void *arg)
+#endif
+{
+	waveWriter *w = (waveWriter *)arg;
+
+	wave_lock(&w->mutex);
+	for (;;) {
+		unsigned b;
+		size_t n;
+
+		while (w->tail == w->head && !w->closing)
+			wave_wait(&w->cond, &w->mutex);
+		if (w->tail == w->head)
+			break;
+
+		b = w->tail % WAVE_WRITER_BATCHES;
+		n = w->fill[b];
+		wave_unlock(&w->mutex);
+
+		if (!w->error && fwrite(w->batch[b], 1, n, w->f) != n)
+			w->error = 1;
+
+		wave_lock(&w->mutex);
+		w->dataSize += n;
+		w->fill[b] = 0;
+		w->tail++;
+		wave_broadcast(&w->cond);
+	}
+	wave_unlock(&w->mutex);
+	return 0;
+}
+
+waveWriter * waveWriterOpen(const char *filename, unsigned samplerate, unsigned freq, int bitsPerSample, int numChannels, size_t batchSize)
+{
+	waveWriter *w;
+	int i;
+
+	if ((bitsPerSample != 8 && bitsPerSample != 16) || numChannels < 1)
+		return NULL;
+
+	w = (waveWriter *)calloc(1, sizeof(waveWriter));
+	if (!w)
+		return NULL;
+
+	w->frameSize = (bitsPerSample / 8) * numChannels;
+	w->batchSize = batchSize ? batchSize : WAVE_WRITER_DEFAULT_BATCH;
+	for (i = 0; i < WAVE_WRITER_BATCHES; i++) {
+		w->batch[i] = (uint8_t *)malloc(w->batchSize);
+		if (!w->batch[i])
+			goto FAIL;
+	}
+
+	w->f = fopen(filename, "wb");
+	if (!w->f)
+		goto FAIL;
+	/* the batches are large already, no copy into the stdio buffer */
+	setvbuf(w->f, NULL, _IONBF, 0);
+
+	wavePrepareHeaderInt(&w->hdr, samplerate, freq, bitsPerSample, numChannels);
+	if (fwrite(&w->hdr, sizeof(waveFileHeader), 1, w->f) != 1)
+		goto FAIL;
+
+	wave_mutex_init(&w->mutex);
+	wave_cond_init(&w->cond);
+#ifdef _WIN32
+	w->thread = (HANDLE)_beginthreadex(NULL, 0, waveWriterThread, w, 0, NULL);
+	if (w->thread == 0) {
+#else
+	if (pthread_create(&w->thread, NULL, waveWriterThread, w) != 0) {
+#endif
+		wave_cond_destroy(&w->cond);
+		wave_mutex_destroy(&w->mutex);
+		goto FAIL;
+	}
+	return w;
+
+FAIL:
+	if (w->f)
+		fclose(w->f);
+	for (i = 0; i < WAVE_WRITER_BATCHES; i++)
+		free(w->batch[i]);
+	free(w);
+	return NULL;
+}
+
+int waveWriterWrite(waveWriter *w, const void *vpData, size_t numFrames)
+{
+	const uint8_t *src = (const uint8_t *)vpData;
+	size_t bytes = numFrames * w->frameSize;
+
+	while (bytes > 0) {
+		unsigned b;
+		size_t n;
+
+		/* the batch at head is ours while not all of them are queued */
+		wave_lock(&w->mutex);
+		while (w->head - w->tail == WAVE_WRITER_BATCHES)
+			wave_wait(&w->cond, &w->mutex);
+		b = w->head % WAVE_WRITER_BATCHES;
+		wave_unlock(&w->mutex);
+
+		n = w->batchSize - w->fill[b];
+		if (n > bytes)
+			n = bytes;
+		memcpy(w->batch[b] + w->fill[b], src, n);
+		w->fill[b] += n;
+		src += n;
+		bytes -= n;
+
+		if (w->fill[b] == w->batchSize) {
+			wave_lock(&w->mutex);
+			w->head++;
+			wave_broadcast(&w->cond);
+			wave_unlock(&w->mutex);
+		}
+	}
+	return w->error;
+}
+
+uint64_t waveWriterDataSize(waveWriter *w)
+{
+	uint64_t n;
+
+	wave_lock(&w->mutex);
+	n = w->dataSize;
+	wave_unlock(&w->mutex);
+	return n;
+}
+
+int waveWriterClose(waveWriter *w)
+{
+	int err;
+	int i;
+
+	wave_lock(&w->mutex);
+	if (w->head - w->tail < WAVE_WRITER_BATCHES && w->fill[w->head % WAVE_WRITER_BATCHES] > 0)
+		w->head++;
+	w->closing = 1;
+	wave_broadcast(&w->cond);
+	wave_unlock(&w->mutex);
+
+#ifdef _WIN32
+	WaitForSingleObject(w->thread, INFINITE);
+	CloseHandle(w->thread);
+#else
+	pthread_join(w->thread, NULL);
+#endif
+	wave_cond_destroy(&w->cond);
+	wave_mutex_destroy(&w->mutex);
+
+	waveSetCurrTime( &w->hdr.a.StopTime );
+	waveSetSizes( &w->hdr, w->dataSize );
+	err = w->error;
+	if ( fseek(w->f, 0, SEEK_SET) || 1 != fwrite(&w->hdr, sizeof(waveFileHeader), 1, w->f) )
+		err = 1;
+	if ( fclose(w->f) )
+		err = 1;
+
+	for (i = 0; i < WAVE_WRITER_BATCHES; i++)
+		free(w->batch[i]);
+	free(w);
+	return err;
+}
+
 // vim: tabstop=8:softtabstop=8:shiftwidth=8:noexpandtab
@@ -48,6 +48,28 @@ int  waveWriteSamples(FILE* f,  void * vpData, size_t numSamples, int needCleanD
 void waveSetStartTime(time_t t, double fraction);
 int  waveFinalizeHeader(FILE * f);      /* returns 0, when no errors occured */
 
+/*!
+ * batched writer for long captures:
+ * waveWriterWrite() copies into batches of batchSize bytes (0 for the default),
+ * a thread of the writer stores the full ones, the caller only waits when all
+ * batches are still queued. waveWriterClose() flushes and finalizes the header,
+ * RF64 with a ds64 chunk when the file grows beyond 4 GiB.
+ * waveWriterWrite() and waveWriterClose() return 0, when no errors occured
+ */
+
+#define WAVE_WRITER_DEFAULT_BATCH	(8 * 1024 * 1024)
+
+typedef struct waveWriter waveWriter;
+
+waveWriter * waveWriterOpen(const char *filename, unsigned samplerate, unsigned freq, int bitsPerSample, int numChannels, size_t batchSize);
+int  waveWriterWrite(waveWriter *w, const void *vpData, size_t numFrames);
+uint64_t waveWriterDataSize(waveWriter *w);	/* bytes written out so far */
+int  waveWriterClose(waveWriter *w);
+
+/* RIFF size beyond which the headers are finalized as RF64: 0xFFFFFFFF, the
+ * default, or less so that tests see RF64 without writing 4 GiB */
+void waveSetRF64Limit(uint64_t riffSize);
+
 #ifdef __cplusplus
 }
 #endif
@@ -10,8 +10,30 @@ SoapySDR::KwargsList findSDDC(const SoapySDR::Kwargs &args)
 
     std::vector<SoapySDR::Kwargs> results;
 
+    // driver=sddc,emulator=<config> streams from the emulator, see FX3Emulator.h
+    if (args.count("emulator"))
+    {
+        SoapySDR::Kwargs devInfo;
+        devInfo["label"] = "SDDC :: emulator";
+        devInfo["emulator"] = args.at("emulator");
+        results.push_back(devInfo);
+        return results;
+    }
+
+    // driver=sddc,replay=<config> streams a raw ADC capture, see FX3Replay.h
+    if (args.count("replay"))
+    {
+        SoapySDR::Kwargs devInfo;
+        devInfo["label"] = "SDDC :: replay";
+        devInfo["replay"] = args.at("replay");
+        results.push_back(devInfo);
+        return results;
+    }
+
     unsigned char idx = 0;
     fx3class *Fx3(CreateUsbHandler());
+    if (Fx3 == nullptr)
+        return results;
     
     while(Fx3->Enumerate(idx, devicelist.dev[idx]))
     {
@@ -4,53 +4,124 @@
 #include <cstdint>
 #include <sys/types.h>
 #include <cstring>
+#include <algorithm>
 
-static void _Callback(void *context, const float *data, uint32_t len)
+static void _Callback(void *context, const float *data, uint32_t len, const blockmeta &meta)
 {
     SoapySDDC *sddc = (SoapySDDC *)context;
-    sddc->Callback(context, data, len);
+    sddc->Callback(context, data, len, meta);
 }
 
-int SoapySDDC::Callback(void *context, const float *data, uint32_t len)
+int SoapySDDC::Callback(void *context, const float *data, uint32_t len, const blockmeta &meta)
 {
     // DbgPrintf("SoapySDDC::Callback %d\n", len);
-    if (_buf_count == numBuffers)
+    // a thread per channel, each one has the callback's side of its channel_state
+    channel_state &ch = *_channels[meta.channel];
+
+    // the main channel always runs: nobody reads it, its blocks are freed here, each
+    // one at the next callback as the ring takes it back only after this returns
+    if (!ch.active)
     {
-        _overflowEvent = true;
+        if (ch.unreleased)
+            RadioHandler.ReleaseBlock(meta.channel);
+        ch.unreleased = true;
         return 0;
     }
 
-    auto &buff = _buffs[_buf_tail];
-    buff.resize(len * bytesPerSample);
-    memcpy(buff.data(), data, len * bytesPerSample);
-    _buf_tail = (_buf_tail + 1) % numBuffers;
+    // the rate changes with the decimation and with the frequency correction
+    const double rate = RadioHandler.GetEffectiveSampleRate() / (2 << meta.decimation);
+    if (rate != ch.blockRate)
+    {
+        ch.rateBaseNs += SoapySDR::ticksToTimeNs(meta.sample - ch.rateBaseSample, ch.blockRate);
+        ch.rateBaseSample = meta.sample;
+        ch.blockRate = rate;
+    }
 
+    // the block stays in the output ring until releaseReadBuffer, the ring holds
+    // fewer blocks than the queue: a reader that falls behind stalls the DDC and
+    // the lost samples come flagged on a later block
+    size_t handle = std::find(ch.buffs.begin(), ch.buffs.end(), (const char *)data) - ch.buffs.begin();
+    if (handle == numBuffers)
     {
-        std::lock_guard<std::mutex> lock(_buf_mutex);
-        _buf_count++;
+        DbgPrintf("SoapySDDC::Callback block not in the output ring\n");
+        return 0;
     }
-    _buf_cond.notify_one();
+
+    // the queue has room for the whole ring, the reader is woken once it has what it waits for
+    queued_block block;
+    block.handle = handle;
+    block.elems = len;
+    block.timeNs = _timeOffsetNs + ch.rateBaseNs + SoapySDR::ticksToTimeNs(meta.sample - ch.rateBaseSample, ch.blockRate);
+    block.rate = ch.blockRate;
+    block.dropped = (meta.flags & BLOCK_DISCONTINUITY) ? meta.dropped : 0;
+    ch.queue.push(block);
 
     return 0;
 }
 
+static fx3class *CreateHandler(const SoapySDR::Kwargs &args)
+{
+    if (args.count("emulator"))
+        return CreateEmulatorHandler(args.at("emulator").c_str());
+    if (args.count("replay"))
+        return CreateReplayHandler(args.at("replay").c_str());
+    return CreateUsbHandler();
+}
+
 SoapySDDC::SoapySDDC(const SoapySDR::Kwargs &args) : deviceId(-1),
-                                                     Fx3(CreateUsbHandler()),
+                                                     Fx3(CreateHandler(args)),
                                                      numBuffers(16),
-                                                     sampleRate(32000000)
+                                                     streamActive(false)
 {
     DbgPrintf("SoapySDDC::SoapySDDC\n");
+    if (Fx3 == nullptr)
+        throw std::runtime_error("SoapySDDC: invalid emulator or replay configuration");
     unsigned char idx = 0;
     DevContext devicelist;
     Fx3->Enumerate(idx, devicelist.dev[0]);
     Fx3->Open();
     RadioHandler.Init(Fx3, _Callback, nullptr, this);
+    RadioHandler.SetBlockHold(true);
+
+    // channels=N: N outputs of the one ADC stream, each with its frequency and rate
+    int channels = 1;
+    if (args.count("channels"))
+        channels = std::stoi(args.at("channels"));
+    if (!RadioHandler.SetChannels(channels))
+    {
+        delete Fx3;
+        throw std::runtime_error("SoapySDDC: invalid channels=" + args.at("channels"));
+    }
+    for (int c = 0; c < channels; c++)
+    {
+        channel_state *ch = new channel_state();
+        ch->currentBuff = nullptr;
+        ch->bufferedElems = 0;
+        ch->currentHandle = 0;
+        ch->currentElems = 0;
+        ch->sampleRate = 32000000;
+        ch->samplerateidx = 4;
+        ch->stream = nullptr;
+        ch->active = false;
+        ch->unreleased = false;
+        _channels.push_back(ch);
+    }
+    numBuffers = RadioHandler.GetOutputBlocks();
+    _droppedSamples = 0;
+    _timeOffsetNs = 0;
+    _elapsedBaseNs = 0;
+    _elapsedBaseSample = 0;
+    _elapsedRate = RadioHandler.GetEffectiveSampleRate();
 }
 
 SoapySDDC::~SoapySDDC(void)
 {
     DbgPrintf("SoapySDDC::~SoapySDDC\n");
     RadioHandler.Stop();
+    for (auto st : _streams)
+        delete st;
+    for (auto ch : _channels)
+        delete ch;
     delete Fx3;
     Fx3 = nullptr;
 
@@ -89,7 +160,7 @@ SoapySDR::Kwargs SoapySDDC::getHardwareInfo(void) const
 size_t SoapySDDC::getNumChannels(const int dir) const
 {
     DbgPrintf("SoapySDDC::getNumChannels\n");
-    return (dir == SOAPY_SDR_RX) ? 1 : 0;
+    return (dir == SOAPY_SDR_RX) ? _channels.size() : 0;
 }
 
 bool SoapySDDC::getFullDuplex(const int, const size_t) const
@@ -171,18 +242,22 @@ bool SoapySDDC::hasDCOffsetMode(const int, const size_t) const
 bool SoapySDDC::hasFrequencyCorrection(const int, const size_t) const
 {
     DbgPrintf("SoapySDDC::hasFrequencyCorrection\n");
-    return false;
+    return true;
 }
 
-void SoapySDDC::setFrequencyCorrection(const int, const size_t, const double)
+// in ppm, of the one reference of all channels: the tuning takes it, the samples
+// come at the effective_sample_rate
+void SoapySDDC::setFrequencyCorrection(const int, const size_t, const double value)
 {
-    DbgPrintf("SoapySDDC::setFrequencyCorrection\n");
+    DbgPrintf("SoapySDDC::setFrequencyCorrection %f\n", value);
+    RadioHandler.SetPpm(value);
+    rebaseElapsed();
 }
 
 double SoapySDDC::getFrequencyCorrection(const int, const size_t) const
 {
     DbgPrintf("SoapySDDC::getFrequencyCorrection\n");
-    return 0.0;
+    return RadioHandler.GetPpm();
 }
 
 std::vector<std::string> SoapySDDC::listGains(const int, const size_t) const
@@ -261,33 +336,34 @@ SoapySDR::Range SoapySDDC::getGainRange(const int direction, const size_t channe
         return SoapySDR::Range();
 }
 
-void SoapySDDC::setFrequency(const int, const size_t, const double frequency, const SoapySDR::Kwargs &)
+void SoapySDDC::setFrequency(const int direction, const size_t channel, const double frequency, const SoapySDR::Kwargs &args)
 {
     DbgPrintf("SoapySDDC::setFrequency %f\n", frequency);
-    centerFrequency = RadioHandler.TuneLO((uint64_t)frequency);
+    setFrequency(direction, channel, "RF", frequency, args);
 }
 
-void SoapySDDC::setFrequency(const int, const size_t, const std::string &, const double frequency, const SoapySDR::Kwargs &)
+void SoapySDDC::setFrequency(const int, const size_t channel, const std::string &, const double frequency, const SoapySDR::Kwargs &)
 {
-    DbgPrintf("SoapySDDC::setFrequency\n");
-    centerFrequency = RadioHandler.TuneLO((uint64_t)frequency);
+    DbgPrintf("SoapySDDC::setFrequency channel %d\n", (int)channel);
+    // the tuner LO follows channel 0, the others are placed in the band it puts at the ADC
+    if (!RadioHandler.TuneChannel((int)channel, (uint64_t)frequency))
+        SoapySDR_logf(SOAPY_SDR_ERROR, "channel %d can not tune to %f, outside the band of channel 0", (int)channel, frequency);
 }
 
-double SoapySDDC::getFrequency(const int, const size_t) const
+double SoapySDDC::getFrequency(const int, const size_t channel) const
 {
-    DbgPrintf("SoapySDDC::getFrequency %f\n", (double)centerFrequency);
-
-    return (double)centerFrequency;
+    DbgPrintf("SoapySDDC::getFrequency\n");
+    return (double)RadioHandler.GetChannelFrequency((int)channel);
 }
 
-double SoapySDDC::getFrequency(const int, const size_t, const std::string &name) const
+double SoapySDDC::getFrequency(const int, const size_t channel, const std::string &name) const
 {
     DbgPrintf("SoapySDDC::getFrequency with name %s\n", name.c_str());
-    if (sampleRate == 32000000)
+    if (channel < _channels.size() && _channels[channel]->sampleRate == 32000000)
     {
         return 8000000.000000;
     }
-    return (double)centerFrequency;
+    return (double)RadioHandler.GetChannelFrequency((int)channel);
 }
 
 std::vector<std::string> SoapySDDC::listFrequencies(const int direction, const size_t channel) const
@@ -316,40 +392,63 @@ SoapySDR::ArgInfoList SoapySDDC::getFrequencyArgsInfo(const int, const size_t) c
     return SoapySDR::ArgInfoList();
 }
 
-void SoapySDDC::setSampleRate(const int, const size_t, const double rate)
+void SoapySDDC::setSampleRate(const int, const size_t channel, const double rate)
 {
     DbgPrintf("SoapySDDC::setSampleRate %f\n", rate);
+    if (channel >= _channels.size())
+        return;
+    int samplerateidx;
     switch ((int)rate)
     {
     case 32000000:
-        sampleRate = 32000000;
         samplerateidx = 4;
         break;
     case 16000000:
-        sampleRate = 16000000;
         samplerateidx = 3;
         break;
     case 8000000:
-        sampleRate = 8000000;
         samplerateidx = 2;
         break;
     case 4000000:
-        sampleRate = 4000000;
         samplerateidx = 1;
         break;
     case 2000000:
-        sampleRate = 2000000;
         samplerateidx = 0;
         break;
     default:
         return;
     }
+
+    // the channels of a stream are read sample by sample together, they share the rate
+    std::vector<size_t> channels(1, channel);
+    if (_channels[channel]->stream)
+        channels = _channels[channel]->stream->channels;
+    for (size_t c : channels)
+    {
+        _channels[c]->sampleRate = rate;
+        _channels[c]->samplerateidx = samplerateidx;
+        applySampleRate(c);
+    }
+}
+
+void SoapySDDC::applySampleRate(size_t channel)
+{
+    const int samplerateidx = _channels[channel]->samplerateidx;
+
+    // a running stream changes rate at a block boundary, unless a restart is needed
+    if (channel != 0)
+        RadioHandler.SetChannelRate((int)channel, samplerateidx);
+    else if (streamActive && !RadioHandler.UpdateOutputRate(samplerateidx))
+    {
+        stopStreams();
+        startStreams();
+    }
 }
 
-double SoapySDDC::getSampleRate(const int, const size_t) const
+double SoapySDDC::getSampleRate(const int, const size_t channel) const
 {
-    DbgPrintf("SoapySDDC::getSampleRate %f\n", sampleRate);
-    return sampleRate;
+    DbgPrintf("SoapySDDC::getSampleRate\n");
+    return channel < _channels.size() ? _channels[channel]->sampleRate : 0.0;
 }
 
 std::vector<double> SoapySDDC::listSampleRates(const int, const size_t) const
@@ -386,9 +485,35 @@ SoapySDR::ArgInfoList SoapySDDC::getSettingInfo(void) const
     BiasTVHFArg.type = SoapySDR::ArgInfo::BOOL;
     setArgs.push_back(BiasTVHFArg);
 
+    SoapySDR::ArgInfo droppedArg;
+    droppedArg.key = "dropped_samples";
+    droppedArg.value = "0";
+    droppedArg.name = "Dropped samples";
+    droppedArg.description = "Samples lost since the stream was activated, read only";
+    droppedArg.type = SoapySDR::ArgInfo::INT;
+    setArgs.push_back(droppedArg);
+
+    SoapySDR::ArgInfo effectiveRateArg;
+    effectiveRateArg.key = "effective_sample_rate";
+    effectiveRateArg.value = "0";
+    effectiveRateArg.name = "Effective sample rate";
+    effectiveRateArg.description = "Sample rate of channel 0 with the frequency correction, read only";
+    effectiveRateArg.units = "Hz";
+    effectiveRateArg.type = SoapySDR::ArgInfo::FLOAT;
+    setArgs.push_back(effectiveRateArg);
+
     return setArgs;
 }
 
+std::string SoapySDDC::readSetting(const std::string &key) const
+{
+    if (key == "dropped_samples")
+        return std::to_string(_droppedSamples.load());
+    if (key == "effective_sample_rate")
+        return std::to_string(_channels[0]->sampleRate * RadioHandler.GetEffectiveSampleRate() / RadioHandler.getSampleRate());
+    return "";
+}
+
 void SoapySDDC::writeSetting(const std::string &key, const std::string &value)
 {
     bool biasTee;
@@ -417,34 +542,54 @@ void SoapySDDC::writeSetting(const std::string &key, const std::string &value)
 //     return masterClockRate;
 // }
 
-// std::vector<std::string> SoapySDDC::listTimeSources(void) const
-// {
-//     DbgPrintf("SoapySDDC::listTimeSources\n");
-//     std::vector<std::string> sources;
-//     sources.push_back("sw_ticks");
-//     return sources;
-// }
+std::vector<std::string> SoapySDDC::listTimeSources(void) const
+{
+    DbgPrintf("SoapySDDC::listTimeSources\n");
+    std::vector<std::string> sources;
+    sources.push_back("internal");
+    return sources;
+}
 
-// std::string SoapySDDC::getTimeSource(void) const
-// {
-//     DbgPrintf("SoapySDDC::getTimeSource\n");
-//     return "sw_ticks";
-// }
+std::string SoapySDDC::getTimeSource(void) const
+{
+    DbgPrintf("SoapySDDC::getTimeSource\n");
+    return "internal";
+}
 
-// bool SoapySDDC::hasHardwareTime(const std::string &what) const
-// {
-//     DbgPrintf("SoapySDDC::hasHardwareTime\n");
-//     return what == "" || what == "sw_ticks";
-// }
+bool SoapySDDC::hasHardwareTime(const std::string &what) const
+{
+    DbgPrintf("SoapySDDC::hasHardwareTime\n");
+    return what.empty();
+}
 
-// long long SoapySDDC::getHardwareTime(const std::string &what) const
-// {
-//     DbgPrintf("SoapySDDC::getHardwareTime\n");
-//     return SoapySDR::ticksToTimeNs(ticks, sampleRate);
-// }
+// the time of the ADC sample counter, the one the buffers are stamped with: it
+// runs while the DDC streams and goes on from there at the next activateStream
+long long SoapySDDC::getHardwareTime(const std::string &what) const
+{
+    DbgPrintf("SoapySDDC::getHardwareTime\n");
+    return _timeOffsetNs + elapsedNs();
+}
 
-// void SoapySDDC::setHardwareTime(const long long timeNs, const std::string &what)
-// {
-//     DbgPrintf("SoapySDDC::setHardwareTime\n");
-//     ticks = SoapySDR::timeNsToTicks(timeNs, sampleRate);
-// }
+void SoapySDDC::setHardwareTime(const long long timeNs, const std::string &what)
+{
+    DbgPrintf("SoapySDDC::setHardwareTime\n");
+    _timeOffsetNs = timeNs - elapsedNs();
+}
+
+long long SoapySDDC::elapsedNs() const
+{
+    if (!streamActive)
+        return 0;
+    return _elapsedBaseNs + SoapySDR::ticksToTimeNs(RadioHandler.GetAdcSamples() - _elapsedBaseSample, _elapsedRate);
+}
+
+void SoapySDDC::rebaseElapsed()
+{
+    if (streamActive)
+    {
+        const uint64_t samples = RadioHandler.GetAdcSamples();
+        _elapsedBaseNs += SoapySDR::ticksToTimeNs(samples - _elapsedBaseSample, _elapsedRate);
+        _elapsedBaseSample = samples;
+    }
+    _elapsedRate = RadioHandler.GetEffectiveSampleRate();
+}
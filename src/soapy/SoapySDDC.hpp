@@ -7,6 +7,8 @@
 #include <sys/types.h>
 #include "FX3Class.h"
 #include "RadioHandler.h"
+#include "dsp/spscqueue.h"
+#include <deque>
 
 struct DevContext
 {
@@ -49,9 +51,9 @@ public:
 
     int readStream(SoapySDR::Stream *stream, void *const *buffs, const size_t numElems, int &flags, long long &timeNs, const long timeoutUs = 100000);
 
-    // size_t getNumDirectAccessBuffers(SoapySDR::Stream *stream);
+    size_t getNumDirectAccessBuffers(SoapySDR::Stream *stream);
 
-    // int getDirectAccessBufferAddrs(SoapySDR::Stream *stream, const size_t handle, void **buffs);
+    int getDirectAccessBufferAddrs(SoapySDR::Stream *stream, const size_t handle, void **buffs);
 
     int acquireReadBuffer(SoapySDR::Stream *stream, size_t &handle, const void **buffs, int &flags, long long &timeNs, const long timeoutUs = 100000);
 
@@ -111,49 +113,113 @@ public:
 
     void writeSetting(const std::string &key, const std::string &value);
 
+    std::string readSetting(const std::string &key) const;
+
     // void setMasterClockRate(const double rate);
 
     // double getMasterClockRate(void) const;
 
-    // std::vector<std::string> listTimeSources(void) const;
+    std::vector<std::string> listTimeSources(void) const;
 
-    // std::string getTimeSource(void) const;
+    std::string getTimeSource(void) const;
 
-    // bool hasHardwareTime(const std::string &what = "") const;
+    bool hasHardwareTime(const std::string &what = "") const;
 
-    // long long getHardwareTime(const std::string &what = "") const;
+    long long getHardwareTime(const std::string &what = "") const;
 
-    // void setHardwareTime(const long long timeNs, const std::string &what = "");
+    void setHardwareTime(const long long timeNs, const std::string &what = "");
 
 private:
+    enum stream_format { FORMAT_CF32, FORMAT_CS16, FORMAT_CS8 };
+
     int deviceId;
-    int bytesPerSample;
+    int bytesPerSample;             // of the CF32 buffers
 
-    uint64_t centerFrequency;
-    double sampleRate;
     size_t numBuffers, bufferLength, asyncBuffs;
-    std::atomic<long long> ticks;
+    // the hardware time is the ADC sample counter from this time on, see getHardwareTime
+    std::atomic<long long> _timeOffsetNs;
+    // the time base of elapsedNs: the samples count at the effective rate from the last
+    // frequency correction on, as the callback's rateBaseNs/rateBaseSample
+    long long _elapsedBaseNs;
+    uint64_t _elapsedBaseSample;
+    double _elapsedRate;
 
     fx3class *Fx3;
     RadioHandlerClass RadioHandler;
 
 public:
-    int Callback(void *context, const float *data, uint32_t len);
-
-    std::mutex _buf_mutex;
-    std::condition_variable _buf_cond;
-
-    std::vector<std::vector<char>> _buffs;
-    size_t _buf_head;
-    size_t _buf_tail;
-    std::atomic<size_t> _buf_count;
-    char *_currentBuff;
-    std::atomic<bool> _overflowEvent;
-    size_t bufferedElems;
-    size_t _currentHandle;
-    bool resetBuffer;
-
-    int samplerateidx;
+    int Callback(void *context, const float *data, uint32_t len, const blockmeta &meta);
+
+    struct queued_block
+    {
+        size_t handle;      // block of the DDC output ring
+        size_t elems;
+        long long timeNs;   // of the first element
+        double rate;
+        uint64_t dropped;   // samples lost right before the block, not reported yet
+    };
+
+    // the channels of a stream are read together, element by element in time
+    struct sddc_stream
+    {
+        std::vector<size_t> channels;
+        stream_format format;   // of the reader
+        float scale;            // CF32 to format
+        bool active;
+        bool timed;         // the samples before startNs are dropped, see activateStream
+        long long startNs;
+    };
+    std::vector<sddc_stream *> _streams;
+
+    // a channel of the DDC, channel 0 is the main output, the others are made from
+    // the same ADC stream; see RadioHandlerClass::SetChannels
+    struct channel_state
+    {
+        // the buffers are the blocks of the channel's DDC output ring, the handle is the
+        // block index; the callback queues them without a lock, the reader's side is the rest
+        std::vector<char *> buffs;
+        spscqueue<queued_block> queue;
+        std::vector<queued_block> acquired; // by handle
+        std::deque<size_t> held;            // acquired handles in ring order, freed oldest first
+        std::vector<char> released;         // released before an older buffer
+        char *currentBuff;
+        size_t bufferedElems;
+        size_t currentHandle;
+        size_t currentElems;                // elements of the current buffer read so far
+
+        // the callback's time base: the blocks count at their rate from the last rate change on
+        long long rateBaseNs;
+        uint64_t rateBaseSample;
+        double blockRate;
+
+        double sampleRate;
+        int samplerateidx;
+        sddc_stream *stream;    // the stream set up with the channel, nullptr for none
+        bool active;            // read by an active stream, the callback frees the blocks of the others
+        bool unreleased;        // the callback's last block of an inactive channel
+    };
+    std::vector<channel_state *> _channels;
+
+    std::atomic<uint64_t> _droppedSamples;  // since activateStream, reported with SOAPY_SDR_OVERFLOW
+    bool streamActive;                      // the DDC runs for an active stream
 
     double masterClockRate;
+
+private:
+    // the next buffer of a channel; a gap before it is SOAPY_SDR_OVERFLOW when reported,
+    // else it is only skipped
+    int acquireBlock(channel_state &ch, bool report, size_t &handle, const void **buffs, int &flags, long long &timeNs, const long timeoutUs);
+    void releaseBlock(size_t channel, const size_t handle);
+    // n elements of the current buffer of a channel are read
+    void consumeElems(size_t channel, size_t n);
+    // the time of the next element of a channel
+    long long nextTimeNs(const channel_state &ch) const;
+    // restarts the DDC for the channels of the active streams, stops it when there are none
+    void startStreams();
+    void stopStreams();
+    // the hardware time of the ADC sample counter since the DDC started
+    long long elapsedNs() const;
+    // the ADC samples from now on count at the effective rate, those before at theirs
+    void rebaseElapsed();
+    void applySampleRate(size_t channel);
 };
@@ -7,20 +7,40 @@
 #include <SoapySDR/Time.hpp>
 #include <cstdint>
 #include <cstring>
+#include <algorithm>
 #include "SoapySDDC.hpp"
+#include "dsp/convert.h"
+
+// the latency stream arg: the USB transfer in bytes, transfers in flight and blocks
+// of the output ring; smaller and fewer for less delay, larger and more to ride
+// out the stalls of a busy host
+static const struct latency_preset
+{
+    const char *name;
+    uint32_t transferSize;
+    uint32_t transfers;
+    int blocks;
+} presets[] = {
+    {"low", 32768, 4, 16},
+    {"default", DEFAULT_TRANSFER_SIZE, DEFAULT_CONCURRENT_TRANSFERS, DEFAULT_OUTPUT_BLOCKS},
+    {"throughput", 180224, QUEUE_SIZE, DEFAULT_OUTPUT_BLOCKS},
+};
 
 std::vector<std::string> SoapySDDC::getStreamFormats(const int direction, const size_t channel) const
 {
     DbgPrintf("SoapySDDC::getStreamFormats\n");
     std::vector<std::string> formats;
     formats.push_back(SOAPY_SDR_CF32);
+    formats.push_back(SOAPY_SDR_CS16);
+    formats.push_back(SOAPY_SDR_CS8);
     return formats;
 }
 
 std::string SoapySDDC::getNativeStreamFormat(const int direction, const size_t channel, double &fullScale) const
 {
     DbgPrintf("SoapySDDC::getNativeStreamFormat\n");
-    fullScale = 1.0;
+    // the IQ of a full scale sine at the ADC, CS16 and CS8 are scaled to theirs
+    fullScale = RadioHandler.GetFullScale();
     return SOAPY_SDR_CF32;
 }
 
@@ -29,6 +49,62 @@ SoapySDR::ArgInfoList SoapySDDC::getStreamArgsInfo(const int direction, const si
     DbgPrintf("SoapySDDC::getStreamArgsInfo\n");
     SoapySDR::ArgInfoList streamArgs;
 
+    for (int r = 0; r < THREAD_ROLES; r++)
+    {
+        const std::string role = ThreadRoleName((ThreadRole)r);
+        SoapySDR::ArgInfo schedArg;
+        schedArg.key = role + "_sched";
+        schedArg.value = "-1";
+        schedArg.name = role + " thread scheduling";
+        schedArg.description = "cpu[,policy[,priority]] of the " + role + " thread, cpu -1 for any, policy other, fifo or rr, priority 1..99 for fifo and rr";
+        schedArg.type = SoapySDR::ArgInfo::STRING;
+        streamArgs.push_back(schedArg);
+    }
+
+    SoapySDR::ArgInfo lockArg;
+    lockArg.key = "mlockall";
+    lockArg.value = "false";
+    lockArg.name = "Lock memory";
+    lockArg.description = "Lock the process memory before streaming starts";
+    lockArg.type = SoapySDR::ArgInfo::BOOL;
+    streamArgs.push_back(lockArg);
+
+    SoapySDR::ArgInfo latencyArg;
+    latencyArg.key = "latency";
+    latencyArg.value = "default";
+    latencyArg.name = "Latency";
+    latencyArg.description = "Buffering preset: low for the least delay, throughput for busy hosts";
+    latencyArg.type = SoapySDR::ArgInfo::STRING;
+    for (auto &p : presets)
+        latencyArg.options.push_back(p.name);
+    streamArgs.push_back(latencyArg);
+
+    SoapySDR::ArgInfo buffersArg;
+    buffersArg.key = "buffers";
+    buffersArg.value = std::to_string(DEFAULT_OUTPUT_BLOCKS);
+    buffersArg.name = "Buffer count";
+    buffersArg.description = "Number of stream buffers, overrides the latency preset";
+    buffersArg.type = SoapySDR::ArgInfo::INT;
+    buffersArg.range = SoapySDR::Range(MIN_OUTPUT_BLOCKS, MAX_OUTPUT_BLOCKS);
+    streamArgs.push_back(buffersArg);
+
+    SoapySDR::ArgInfo bufflenArg;
+    bufflenArg.key = "bufflen";
+    bufflenArg.value = std::to_string(DEFAULT_TRANSFER_SIZE / sizeof(int16_t) / 2);
+    bufflenArg.name = "Buffer length";
+    bufflenArg.description = "Elements per buffer, the MTU: 8192 + n * 12288, overrides the latency preset";
+    bufflenArg.type = SoapySDR::ArgInfo::INT;
+    streamArgs.push_back(bufflenArg);
+
+    SoapySDR::ArgInfo priorityArg;
+    priorityArg.key = "priority";
+    priorityArg.value = "0";
+    priorityArg.name = "Thread priority";
+    priorityArg.description = "Real-time FIFO priority of the usb, r2iq and callback threads, 0 to leave them, the *_sched args override it";
+    priorityArg.type = SoapySDR::ArgInfo::INT;
+    priorityArg.range = SoapySDR::Range(0, 99);
+    streamArgs.push_back(priorityArg);
+
     return streamArgs;
 }
 
@@ -40,43 +116,140 @@ SoapySDR::Stream *SoapySDDC::setupStream(const int direction,
     DbgPrintf("SoapySDDC::setupStream\n");
     if (direction != SOAPY_SDR_RX)
         throw std::runtime_error("setupStream failed: SDDC only supports RX");
-    // if (channels.size() != 1) throw std::runtime_error("setupStream failed: SDDC only supports one channel");
+    // the channels of the stream, each one in one stream only
+    std::vector<size_t> streamChannels = channels.empty() ? std::vector<size_t>(1, 0) : channels;
+    for (size_t i = 0; i < streamChannels.size(); i++)
+    {
+        const size_t c = streamChannels[i];
+        if (c >= _channels.size() || _channels[c]->stream != nullptr ||
+            std::count(streamChannels.begin(), streamChannels.end(), c) > 1)
+            throw std::runtime_error("setupStream failed: invalid or already streamed channel " + std::to_string(c));
+    }
+    // CS16 and CS8 are converted from CF32 while they are copied to the reader
+    stream_format streamFormat;
+    float convertScale;
     if (format == SOAPY_SDR_CF32)
     {
-        SoapySDR_logf(SOAPY_SDR_INFO, "Using format CF32.");
+        streamFormat = FORMAT_CF32;
+        convertScale = 1.0f;
+    }
+    else if (format == SOAPY_SDR_CS16)
+    {
+        streamFormat = FORMAT_CS16;
+        convertScale = 32767.0f / RadioHandler.GetFullScale();
+    }
+    else if (format == SOAPY_SDR_CS8)
+    {
+        streamFormat = FORMAT_CS8;
+        convertScale = 127.0f / RadioHandler.GetFullScale();
     }
     else
     {
-        throw std::runtime_error("setupStream failed: SDDC only supports CF32.");
+        throw std::runtime_error("setupStream failed: SDDC only supports CF32, CS16 and CS8.");
     }
+    SoapySDR_logf(SOAPY_SDR_INFO, "Using format %s.", format.c_str());
 
-    bytesPerSample = 8;
+    if (streamActive)
+        throw std::runtime_error("setupStream failed: the stream is active");
 
-    bufferLength = 262144 / bytesPerSample;
+    // the preset, then the buffers and their length on their own
+    const latency_preset *preset = &presets[1];
+    if (args.count("latency"))
+    {
+        preset = nullptr;
+        for (auto &p : presets)
+        {
+            if (args.at("latency") == p.name)
+                preset = &p;
+        }
+        if (preset == nullptr)
+            throw std::runtime_error("setupStream failed: invalid latency=" + args.at("latency"));
+    }
+    uint32_t transferSize = preset->transferSize;
+    int blocks = preset->blocks;
+    if (args.count("bufflen"))
+        transferSize = (uint32_t)std::stoul(args.at("bufflen")) * 2 * sizeof(int16_t);
+    if (args.count("buffers"))
+        blocks = std::stoi(args.at("buffers"));
+    if (!RadioHandler.SetTransferParams(transferSize, preset->transfers))
+        throw std::runtime_error("setupStream failed: invalid bufflen, 8192 + n * 12288 elements");
+    if (!RadioHandler.SetOutputBlocks(blocks))
+        throw std::runtime_error("setupStream failed: invalid buffers=" + std::to_string(blocks));
+    numBuffers = RadioHandler.GetOutputBlocks();
 
-    _buf_tail = 0;
-    _buf_head = 0;
-    _buf_count = 0;
+    if (args.count("priority"))
+    {
+        const int priority = std::stoi(args.at("priority"));
+        if (priority < 0 || priority > 99)
+            throw std::runtime_error("setupStream failed: invalid priority=" + args.at("priority"));
+        for (ThreadRole role : {THREAD_USB, THREAD_R2IQ, THREAD_CALLBACK})
+        {
+            thread_sched sched = RadioHandler.GetThreadSched(role);
+            if (priority == 0)
+                continue;
+            sched.policy = SCHED_POLICY_FIFO;
+            sched.priority = priority;
+            RadioHandler.SetThreadSched(role, sched);
+        }
+    }
 
-    // allocate buffers
-    _buffs.resize(numBuffers);
-    for (auto &buff : _buffs)
-        buff.reserve(bufferLength * bytesPerSample);
-    for (auto &buff : _buffs)
-        buff.resize(bufferLength * bytesPerSample);
+    for (int r = 0; r < THREAD_ROLES; r++)
+    {
+        auto it = args.find(std::string(ThreadRoleName((ThreadRole)r)) + "_sched");
+        if (it == args.end())
+            continue;
 
-    // RadioHandler.Init(Fx3, _Callback, nullptr,this);
-    // RadioHandler.Start(samplerateidx);
+        thread_sched sched;
+        if (!ParseThreadSched(it->second.c_str(), sched))
+            throw std::runtime_error("setupStream failed: invalid " + it->first + "=" + it->second);
+        RadioHandler.SetThreadSched((ThreadRole)r, sched);
+    }
+    if (args.count("mlockall"))
+        RadioHandler.SetMemoryLock(args.at("mlockall") == "true" || args.at("mlockall") == "1");
+
+    bytesPerSample = 8;
 
-    // std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-    return (SoapySDR::Stream *)this;
+    // a block of the DDC output, the MTU
+    bufferLength = RadioHandler.GetTransferSize() / sizeof(int16_t) / 2;
+
+    // the blocks of the output rings, no buffers of our own; the queues take them all
+    for (size_t c = 0; c < _channels.size(); c++)
+    {
+        channel_state &ch = *_channels[c];
+        ch.buffs.resize(numBuffers);
+        ch.acquired.assign(numBuffers, queued_block());
+        ch.released.assign(numBuffers, 0);
+        ch.queue.reset(numBuffers);
+        for (size_t i = 0; i < numBuffers; i++)
+            ch.buffs[i] = (char *)RadioHandler.GetOutputBlock((int)i, (int)c);
+    }
+
+    // the channels of the stream at the rate of its first one
+    sddc_stream *st = new sddc_stream();
+    st->channels = streamChannels;
+    st->format = streamFormat;
+    st->scale = convertScale;
+    st->active = false;
+    st->timed = false;
+    st->startNs = 0;
+    _streams.push_back(st);
+    for (size_t c : st->channels)
+        _channels[c]->stream = st;
+    setSampleRate(direction, st->channels[0], _channels[st->channels[0]]->sampleRate);
+
+    return (SoapySDR::Stream *)st;
 }
 
 void SoapySDDC::closeStream(SoapySDR::Stream *stream)
 {
     DbgPrintf("SoapySDDC::closeStream\n");
-    RadioHandler.Stop();
-    // RadioHandler.Close();
+    sddc_stream *st = (sddc_stream *)stream;
+    if (st->active)
+        deactivateStream(stream);
+    for (size_t c : st->channels)
+        _channels[c]->stream = nullptr;
+    _streams.erase(std::find(_streams.begin(), _streams.end(), st));
+    delete st;
 }
 
 size_t SoapySDDC::getStreamMTU(SoapySDR::Stream *stream) const
@@ -90,10 +263,15 @@ int SoapySDDC::activateStream(SoapySDR::Stream *stream,
                               const long long timeNs,
                               const size_t numElems)
 {
-    DbgPrintf("SoapySDDC::activateStream %d\n", samplerateidx);
-    resetBuffer = true;
-    bufferedElems = 0;
-    RadioHandler.Start(samplerateidx);
+    DbgPrintf("SoapySDDC::activateStream\n");
+    stopStreams();
+    sddc_stream *st = (sddc_stream *)stream;
+    st->active = true;
+    // with a time the reader gets the samples from then on, the ones before are dropped
+    st->timed = (flags & SOAPY_SDR_HAS_TIME) != 0;
+    st->startNs = timeNs;
+    _droppedSamples = 0;
+    startStreams();
 
     return 0;
 }
@@ -103,10 +281,53 @@ int SoapySDDC::deactivateStream(SoapySDR::Stream *stream,
                                 const long long timeNs)
 {
     DbgPrintf("SoapySDDC::deactivateStream\n");
-    RadioHandler.Stop();
+    stopStreams();
+    ((sddc_stream *)stream)->active = false;
+    startStreams();
     return 0;
 }
 
+void SoapySDDC::startStreams()
+{
+    // the channels share the DDC, a stream that starts or stops restarts the others:
+    // the rings start empty, the buffers held from before are gone with them
+    streamActive = false;
+    for (size_t c = 0; c < _channels.size(); c++)
+    {
+        channel_state &ch = *_channels[c];
+        ch.active = ch.stream && ch.stream->active;
+        streamActive |= ch.active;
+        for (size_t i = 0; i < numBuffers; i++)
+            ch.buffs[i] = (char *)RadioHandler.GetOutputBlock((int)i, (int)c);
+        ch.released.assign(numBuffers, 0);
+        ch.held.clear();
+        ch.queue.reset(numBuffers);
+        ch.bufferedElems = 0;
+        ch.rateBaseNs = 0;
+        ch.rateBaseSample = 0;
+        ch.blockRate = ch.sampleRate * RadioHandler.GetEffectiveSampleRate() / RadioHandler.getSampleRate();
+        ch.unreleased = false;
+        if (c != 0)
+        {
+            RadioHandler.EnableChannel((int)c, ch.active);
+            RadioHandler.SetChannelRate((int)c, ch.samplerateidx);
+        }
+    }
+    _elapsedBaseNs = 0;
+    _elapsedBaseSample = 0;
+    _elapsedRate = RadioHandler.GetEffectiveSampleRate();
+    if (streamActive)
+        RadioHandler.Start(_channels[0]->samplerateidx);
+}
+
+void SoapySDDC::stopStreams()
+{
+    // the sample counter restarts with the DDC, the hardware time goes on from here
+    RadioHandler.Stop();
+    _timeOffsetNs += elapsedNs();
+    streamActive = false;
+}
+
 int SoapySDDC::readStream(SoapySDR::Stream *stream,
                           void *const *buffs,
                           const size_t numElems,
@@ -115,32 +336,160 @@ int SoapySDDC::readStream(SoapySDR::Stream *stream,
                           const long timeoutUs)
 {
     // DbgPrintf("SoapySDDC::readStream\n");
-    void *buff0 = buffs[0];
-    if (bufferedElems == 0)
+    sddc_stream *st = (sddc_stream *)stream;
+    const std::vector<size_t> &channels = st->channels;
+    const size_t outBytes = st->format == FORMAT_CS16 ? 2 * sizeof(int16_t) : st->format == FORMAT_CS8 ? 2 * sizeof(int8_t) : bytesPerSample;
+
+    // one wait for all the blocks the request needs past the current one, as many
+    // as the ring can hold besides the held ones; after the timeout what is there.
+    // The channels get their blocks together, each waits for what is left of the timeout
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeoutUs);
+    for (size_t c : channels)
     {
-        int ret = this->acquireReadBuffer(stream, _currentHandle, (const void **)&_currentBuff, flags, timeNs, timeoutUs);
-        if (ret < 0)
-            return ret;
-        bufferedElems = ret;
+        channel_state &ch = *_channels[c];
+        if (numElems > ch.bufferedElems)
+        {
+            size_t blocks = (numElems - ch.bufferedElems + bufferLength - 1) / bufferLength;
+            blocks = std::min(blocks, numBuffers - 1 - ch.held.size());
+            auto left = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now());
+            if (!ch.queue.wait(blocks, std::max(left, std::chrono::microseconds(0))) && ch.bufferedElems == 0 && ch.queue.size() == 0)
+                return SOAPY_SDR_TIMEOUT;
+        }
     }
 
-    size_t returnedElems = std::min(bufferedElems, numElems);
+    size_t returnedElems = 0;
+    long long firstNs = 0;
+    while (returnedElems < numElems)
+    {
+        // every channel at a buffer: contiguous samples of one rate in a read, a gap
+        // or a new rate starts the next; the first channel reports the gap
+        bool more = true;
+        for (size_t i = 0; i < channels.size() && more; i++)
+        {
+            channel_state &ch = *_channels[channels[i]];
+            if (ch.bufferedElems != 0)
+                continue;
 
-    // convert into user's buff0
-    std::memcpy(buff0, _currentBuff, returnedElems * bytesPerSample);
+            const queued_block *next = ch.queue.front();
+            if (returnedElems != 0 && (next == nullptr || next->dropped != 0 || next->rate != ch.acquired[ch.currentHandle].rate))
+            {
+                more = false;
+                break;
+            }
 
-    // bump variables for next call into readStream
-    bufferedElems -= returnedElems;
-    _currentBuff += returnedElems * bytesPerSample;
+            // the first ones may wait for what is left of the timeout, see the alignment below
+            long long blockNs;
+            long waitUs = 0;
+            if (returnedElems == 0)
+                waitUs = (long)std::max<long long>(0, std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count());
+            int ret = acquireBlock(ch, i == 0, ch.currentHandle, (const void **)&ch.currentBuff, flags, blockNs, waitUs);
+            if (ret < 0)
+            {
+                if (ret == SOAPY_SDR_OVERFLOW)
+                    timeNs = blockNs;
+                return ret;
+            }
+            ch.bufferedElems = ret;
+            ch.currentElems = 0;
+        }
+        if (!more)
+            break;
 
-    // return number of elements written to buff0
-    if (bufferedElems != 0)
-        flags |= SOAPY_SDR_MORE_FRAGMENTS;
-    else
-        this->releaseReadBuffer(stream, _currentHandle);
+        if (returnedElems == 0)
+        {
+            // the channels line up at the latest of their next elements, one that is
+            // behind after a gap skips to it, a whole buffer at a time if need be;
+            // all of them skip to the start time of activateStream
+            long long alignNs = nextTimeNs(*_channels[channels[0]]);
+            for (size_t c : channels)
+                alignNs = std::max(alignNs, nextTimeNs(*_channels[c]));
+            if (st->timed)
+                alignNs = std::max(alignNs, st->startNs);
+            bool aligned = true;
+            for (size_t c : channels)
+            {
+                channel_state &ch = *_channels[c];
+                const double rate = ch.acquired[ch.currentHandle].rate;
+                const long long behind = SoapySDR::timeNsToTicks(alignNs - nextTimeNs(ch), rate);
+                if (behind > 0)
+                {
+                    consumeElems(c, std::min((size_t)behind, ch.bufferedElems));
+                    aligned &= ch.bufferedElems != 0;
+                }
+            }
+            if (!aligned)
+                continue;
+            firstNs = alignNs;
+            st->timed = false;
+        }
+
+        size_t n = numElems - returnedElems;
+        for (size_t c : channels)
+            n = std::min(n, _channels[c]->bufferedElems);
+
+        for (size_t i = 0; i < channels.size(); i++)
+        {
+            channel_state &ch = *_channels[channels[i]];
+            char *out = (char *)buffs[i] + returnedElems * outBytes;
+
+            // into user's buffs, converted in the same pass
+            if (st->format == FORMAT_CS16)
+                convert_to_int16((const float *)ch.currentBuff, (int16_t *)out, n * 2, st->scale);
+            else if (st->format == FORMAT_CS8)
+                convert_to_int8((const float *)ch.currentBuff, (int8_t *)out, n * 2, st->scale);
+            else
+                std::memcpy(out, ch.currentBuff, n * bytesPerSample);
+
+            // bump variables for next call into readStream
+            consumeElems(channels[i], n);
+        }
+        returnedElems += n;
+    }
+
+    // return number of elements written to each buff, the time of the first one
+    flags = SOAPY_SDR_HAS_TIME;
+    timeNs = firstNs;
+    for (size_t c : channels)
+    {
+        if (_channels[c]->bufferedElems != 0)
+            flags |= SOAPY_SDR_MORE_FRAGMENTS;
+    }
     return returnedElems;
 }
 
+long long SoapySDDC::nextTimeNs(const channel_state &ch) const
+{
+    const queued_block &block = ch.acquired[ch.currentHandle];
+    return block.timeNs + SoapySDR::ticksToTimeNs(ch.currentElems, block.rate);
+}
+
+void SoapySDDC::consumeElems(size_t channel, size_t n)
+{
+    channel_state &ch = *_channels[channel];
+    ch.bufferedElems -= n;
+    ch.currentBuff += n * bytesPerSample;
+    ch.currentElems += n;
+    if (ch.bufferedElems == 0)
+        releaseBlock(channel, ch.currentHandle);
+}
+
+size_t SoapySDDC::getNumDirectAccessBuffers(SoapySDR::Stream *stream)
+{
+    DbgPrintf("SoapySDDC::getNumDirectAccessBuffers\n");
+    return numBuffers;
+}
+
+int SoapySDDC::getDirectAccessBufferAddrs(SoapySDR::Stream *stream, const size_t handle, void **buffs)
+{
+    DbgPrintf("SoapySDDC::getDirectAccessBufferAddrs\n");
+    const std::vector<size_t> &channels = ((sddc_stream *)stream)->channels;
+    if (handle >= numBuffers)
+        return SOAPY_SDR_NOT_SUPPORTED;
+    for (size_t i = 0; i < channels.size(); i++)
+        buffs[i] = RadioHandler.GetOutputBlock((int)handle, (int)channels[i]);
+    return 0;
+}
+
 int SoapySDDC::acquireReadBuffer(SoapySDR::Stream *stream,
                                  size_t &handle,
                                  const void **buffs,
@@ -148,43 +497,104 @@ int SoapySDDC::acquireReadBuffer(SoapySDR::Stream *stream,
                                  long long &timeNs,
                                  const long timeoutUs)
 {
-    if (resetBuffer)
+    // the buffers are CF32, the other formats are converted by readStream; the
+    // buffers of the channels of a stream do not line up, readStream aligns them
+    sddc_stream *st = (sddc_stream *)stream;
+    const std::vector<size_t> &channels = st->channels;
+    if (st->format != FORMAT_CF32 || channels.size() != 1)
+        return SOAPY_SDR_NOT_SUPPORTED;
+    channel_state &ch = *_channels[channels[0]];
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeoutUs);
+    for (;;)
     {
-        _buf_head = (_buf_head + _buf_count.exchange(0)) % numBuffers;
-        resetBuffer = false;
-        _overflowEvent = false;
+        const long waitUs = (long)std::max<long long>(0, std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count());
+        int ret = acquireBlock(ch, true, handle, buffs, flags, timeNs, waitUs);
+        if (ret < 0 || !st->timed)
+            return ret;
+
+        // before the start time of activateStream whole buffers are dropped, the one
+        // it falls in is handed out from there
+        const queued_block &block = ch.acquired[handle];
+        const long long skip = SoapySDR::timeNsToTicks(st->startNs - block.timeNs, block.rate);
+        if (skip < ret)
+        {
+            st->timed = false;
+            if (skip > 0)
+            {
+                buffs[0] = (const char *)buffs[0] + skip * bytesPerSample;
+                timeNs = block.timeNs + SoapySDR::ticksToTimeNs(skip, block.rate);
+                ret -= (int)skip;
+            }
+            return ret;
+        }
+        releaseBlock(channels[0], handle);
     }
+}
 
-    if (_overflowEvent)
+int SoapySDDC::acquireBlock(channel_state &ch,
+                            bool report,
+                            size_t &handle,
+                            const void **buffs,
+                            int &flags,
+                            long long &timeNs,
+                            const long timeoutUs)
+{
+    // wait for a buffer to become available
+    if (!ch.queue.wait(1, std::chrono::microseconds(timeoutUs)))
+        return SOAPY_SDR_TIMEOUT;
+
+    // a gap before the buffer first: the samples lost, the time the stream resumes at
+    queued_block *block = ch.queue.front();
+    if (block->dropped != 0 && report)
     {
-        _buf_head = (_buf_head + _buf_count.exchange(0)) % numBuffers;
-        _overflowEvent = false;
+        _droppedSamples += block->dropped;
+        block->dropped = 0;
+        flags = SOAPY_SDR_HAS_TIME;
+        timeNs = block->timeNs;
         SoapySDR::log(SOAPY_SDR_SSI, "O");
         return SOAPY_SDR_OVERFLOW;
     }
-    // wait for a buffer to become available
-    if (_buf_count == 0)
-    {
-        std::unique_lock<std::mutex> lock(_buf_mutex);
-        _buf_cond.wait_for(lock, std::chrono::microseconds(timeoutUs), [this]
-                           { return _buf_count != 0; });
-        if (_buf_count == 0)
-            return SOAPY_SDR_TIMEOUT;
-    }
+
     // extract handle and buffer
-    handle = _buf_head;
-    _buf_head = (_buf_head + 1) % numBuffers;
-    buffs[0] = (void *)_buffs[handle].data();
-    flags = 0;
+    queued_block next;
+    ch.queue.pop(next);
+    handle = next.handle;
+    ch.acquired[handle] = next;
+    ch.held.push_back(handle);
+    buffs[0] = (void *)ch.buffs[handle];
+
+    // the time of the first sample since activateStream
+    flags = SOAPY_SDR_HAS_TIME;
+    timeNs = next.timeNs;
 
     // return number available
-    return _buffs[handle].size() / bytesPerSample;
+    return next.elems;
 }
 
 void SoapySDDC::releaseReadBuffer(SoapySDR::Stream *stream,
                                   const size_t handle)
 {
     // DbgPrintf("SoapySDDC::releaseReadBuffer\n");
-    std::lock_guard<std::mutex> lock(_buf_mutex);
-    _buf_count--;
+    const std::vector<size_t> &channels = ((sddc_stream *)stream)->channels;
+    if (channels.size() == 1)
+        releaseBlock(channels[0], handle);
+}
+
+void SoapySDDC::releaseBlock(size_t channel, const size_t handle)
+{
+    // the reader's thread, as acquireReadBuffer
+    channel_state &ch = *_channels[channel];
+    if (handle >= numBuffers || ch.released[handle] ||
+        std::find(ch.held.begin(), ch.held.end(), handle) == ch.held.end())
+        return;
+
+    // the ring frees its oldest block, one released before it waits for it
+    ch.released[handle] = 1;
+    while (!ch.held.empty() && ch.released[ch.held.front()])
+    {
+        ch.released[ch.held.front()] = 0;
+        ch.held.pop_front();
+        RadioHandler.ReleaseBlock((int)channel);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,190 @@
+#include "r2iq_batch.h"
+#include "FX3Emulator.h"
+#include "RadioHandler.h"
+#include "CppUnitTestFramework.hpp"
+#include <thread>
+#include <chrono>
+#include <complex>
+#include <vector>
+#include <math.h>
+#include <string.h>
+
+using namespace std::chrono;
+
+namespace {
+    struct BatchFixture {};
+}
+
+static const char* signal = "model=none,tone=3e6:-10,tone=10.51e6:-20,noise=-50,realtime=0";
+
+// ADC samples as the emulator streams them, block by block
+static std::vector<int16_t> Capture(const char* config, uint32_t block, int count)
+{
+    auto emu = (fx3emulator*)CreateEmulatorHandler(config);
+    std::vector<int16_t> adc((size_t)block * count);
+    for (int k = 0; k < count; k++)
+        emu->Generate(&adc[(size_t)k * block], block);
+    delete emu;
+    return adc;
+}
+
+static std::vector<float> live;
+static size_t liveSamples;
+
+static void Callback(void* context, const float* data, uint32_t len, const blockmeta& meta)
+{
+    if (live.size() < liveSamples * 2 && meta.sample * 2 == live.size())
+        live.insert(live.end(), data, data + len * 2);
+}
+
+TEST_CASE(BatchFixture, ChunkTest)
+{
+    const uint32_t block = DEFAULT_TRANSFER_SAMPLES;
+    auto adc = Capture(signal, block, 6);
+    const size_t n = adc.size() - 1000;    // ends with a partial block
+
+    r2iq_batch ref;
+    ref.setDecimation(2);
+    ref.setTune(0.3128125);     // 10.01 MHz, off the bin grid: the fine mixer runs
+    REQUIRE_EQUAL(ref.outputSamples(n), 5u * (block >> 3));
+    std::vector<float> expect(ref.outputSamples(n) * 2);
+    REQUIRE_EQUAL(ref.process(adc.data(), n, expect.data()), 5u * (block >> 3));
+
+    // any split gives the same samples
+    r2iq_batch batch;
+    batch.setDecimation(2);
+    batch.setTune(0.3128125);
+    std::vector<float> out(expect.size() + 2 * (block >> 3));
+    const size_t chunks[] = { 1, 4095, block, 3 * block - 7, 100000 };
+    size_t pos = 0, done = 0;
+    for (int i = 0; pos < n; i++)
+    {
+        size_t len = std::min(chunks[i % 5], n - pos);
+        done += batch.process(&adc[pos], len, &out[done * 2]);
+        pos += len;
+    }
+    REQUIRE_EQUAL(done, expect.size() / 2);
+    REQUIRE_TRUE(memcmp(out.data(), expect.data(), expect.size() * sizeof(float)) == 0);
+
+    // the rest of the last block completes it
+    REQUIRE_EQUAL(batch.process(&adc[n], 1000, out.data()), (size_t)(block >> 3));
+
+    // reset starts over
+    batch.reset();
+    REQUIRE_EQUAL(batch.process(adc.data(), n, out.data()), expect.size() / 2);
+    REQUIRE_TRUE(memcmp(out.data(), expect.data(), expect.size() * sizeof(float)) == 0);
+
+    REQUIRE_FALSE(batch.setDecimation(NDECIDX));
+    REQUIRE_FALSE(batch.setDecimation(-1));
+}
+
+TEST_CASE(BatchFixture, SeekTest)
+{
+    const uint32_t block = DEFAULT_TRANSFER_SAMPLES;
+    const uint32_t outBlock = block >> 3;
+    auto adc = Capture(signal, block, 6);
+
+    r2iq_batch ref;
+    ref.setDecimation(2);
+    ref.setTune(0.3128125);
+    std::vector<float> expect(ref.outputSamples(adc.size()) * 2);
+    ref.process(adc.data(), adc.size(), expect.data());
+
+    // from block 3 on, primed with the samples before it: same filter output, same mixer phase
+    r2iq_batch batch;
+    batch.setDecimation(2);
+    batch.setTune(0.3128125);
+    batch.seek(3, &adc[3 * block - halfFft]);
+    std::vector<float> out(3 * outBlock * 2);
+    REQUIRE_EQUAL(batch.process(&adc[3 * block], 3 * block, out.data()), 3u * outBlock);
+
+    double err = 0, power = 0;
+    for (size_t i = 0; i < out.size(); i++)
+    {
+        double d = out[i] - expect[3 * outBlock * 2 + i];
+        err += d * d;
+        power += (double)out[i] * out[i];
+    }
+    REQUIRE_TRUE(err < power * 1e-9);
+}
+
+TEST_CASE(BatchFixture, ThreadTest)
+{
+    const uint32_t block = DEFAULT_TRANSFER_SAMPLES;
+    auto adc = Capture(signal, block, 8);
+
+    r2iq_batch ref;
+    std::vector<float> expect(ref.outputSamples(adc.size()) * 2);
+    ref.process(adc.data(), adc.size(), expect.data());
+
+    // independent instances on their own threads
+    const int count = 4;
+    std::vector<float> out[count];
+    std::thread threads[count];
+    for (int t = 0; t < count; t++)
+    {
+        out[t].resize(expect.size());
+        threads[t] = std::thread([&adc, &out, t]() {
+            r2iq_batch batch;
+            batch.process(adc.data(), adc.size(), out[t].data());
+        });
+    }
+    for (int t = 0; t < count; t++)
+    {
+        threads[t].join();
+        REQUIRE_TRUE(out[t] == expect);
+    }
+}
+
+TEST_CASE(BatchFixture, StreamTest)
+{
+    // the same samples through the threaded pipeline, no decimation and no fine mixer
+    const uint32_t block = DEFAULT_TRANSFER_SAMPLES;
+    const int count = 6;
+    live.clear();
+    liveSamples = (size_t)count * block / 2;
+
+    auto emu = CreateEmulatorHandler(signal);
+    auto radio = new RadioHandlerClass();
+    radio->Init(emu, Callback);
+    radio->Start(4);
+    for (int i = 0; i < 200 && live.size() < liveSamples * 2; i++)
+        std::this_thread::sleep_for(10ms);
+    radio->Stop();
+    delete radio;
+    delete emu;
+    REQUIRE_EQUAL(live.size(), liveSamples * 2);
+
+    auto adc = Capture(signal, block, count);
+    r2iq_batch batch(BBRF103_GAINFACTOR);
+    std::vector<float> out(liveSamples * 2);
+    REQUIRE_EQUAL(batch.process(adc.data(), adc.size(), out.data()), liveSamples);
+
+    // the first live block overlaps whatever the ring held before
+    const size_t skip = block;
+    REQUIRE_TRUE(memcmp(&out[skip], &live[skip], (out.size() - skip) * sizeof(float)) == 0);
+}
+
+TEST_CASE(BatchFixture, ToneTest)
+{
+    const uint32_t block = DEFAULT_TRANSFER_SAMPLES;
+    auto adc = Capture("model=none,tone=10.51e6:-10", block, 4);
+
+    // 4 Msps around 10.01 MHz: the tone is at +500 kHz, -500 kHz mirrored
+    for (int lsb = 0; lsb < 2; lsb++)
+    {
+        r2iq_batch batch;
+        batch.setDecimation(3);
+        batch.setTune(10.01e6 / 32e6);
+        batch.setSideband(lsb != 0);
+        std::vector<std::complex<float>> out(batch.outputSamples(adc.size()));
+        batch.process(adc.data(), adc.size(), (float*)out.data());
+
+        std::complex<double> rot = 0;
+        for (size_t i = out.size() / 2; i < out.size() - 1; i++)
+            rot += std::complex<double>(out[i + 1] * std::conj(out[i]));
+        double freq = std::arg(rot) / 6.283185307179586 * 4e6;
+        printf("tone at %.0f Hz\n", freq);
+        REQUIRE_TRUE(fabs(freq - (lsb ? -500e3 : 500e3)) < 100);
+    }
+}
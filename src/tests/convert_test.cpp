@@ -0,0 +1,94 @@
+#include "dsp/convert.h"
+#include "FX3Emulator.h"
+#include "RadioHandler.h"
+#include "CppUnitTestFramework.hpp"
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <complex>
+#include <vector>
+#include <math.h>
+
+using namespace std::chrono;
+
+namespace {
+    struct ConvertFixture {};
+}
+
+TEST_CASE(ConvertFixture, RoundingTest)
+{
+    // rounding to nearest even, saturation at both ends, tails of every length
+    const float in[] = { 0.5f, 1.5f, -0.5f, -1.5f, 2.49f, -2.51f, 1e9f, -1e9f,
+        32766.6f, -32768.4f, 126.5f, -128.6f, 3.0f, -3.0f, 0.0f, 7.7f, -7.7f };
+    const size_t n = sizeof(in) / sizeof(in[0]);
+
+    for (size_t len = 0; len <= n; len++)
+    {
+        std::vector<int16_t> s16(n, 0x5555), r16(n, 0x5555);
+        std::vector<int8_t> s8(n, 0x55), r8(n, 0x55);
+        convert_to_int16(in, s16.data(), len, 1.0f);
+        convert_float_int(in, r16.data(), len, 1.0f, 32767.0f);
+        convert_to_int8(in, s8.data(), len, 1.0f);
+        convert_float_int(in, r8.data(), len, 1.0f, 127.0f);
+        REQUIRE_TRUE(s16 == r16);
+        REQUIRE_TRUE(s8 == r8);
+    }
+
+    int16_t s16[n];
+    int8_t s8[n];
+    convert_to_int16(in, s16, n, 1.0f);
+    convert_to_int8(in, s8, n, 1.0f);
+    REQUIRE_EQUAL(s16[0], 0);
+    REQUIRE_EQUAL(s16[1], 2);
+    REQUIRE_EQUAL(s16[4], 2);
+    REQUIRE_EQUAL(s16[5], -3);
+    REQUIRE_EQUAL(s16[6], 32767);
+    REQUIRE_EQUAL(s16[7], -32768);
+    REQUIRE_EQUAL(s16[8], 32767);
+    REQUIRE_EQUAL(s16[9], -32768);
+    REQUIRE_EQUAL(s8[10], 126);
+    REQUIRE_EQUAL(s8[11], -128);
+    REQUIRE_EQUAL(s8[6], 127);
+    REQUIRE_EQUAL(s8[16], -8);
+}
+
+static std::vector<std::complex<float>> iq;
+static std::atomic<size_t> kept;
+
+static void Callback(void* context, const float* data, uint32_t len)
+{
+    if (iq.size() < 1000000)
+        iq.insert(iq.end(), (const std::complex<float>*)data, (const std::complex<float>*)data + len);
+    kept = iq.size();
+}
+
+TEST_CASE(ConvertFixture, FullScaleTest)
+{
+    // a sine of half the ADC range is half of the full scale in IQ, at every rate
+    auto emu = CreateEmulatorHandler("model=rx888r2,tone=10.1e6:-6.0206,realtime=0");
+    auto radio = new RadioHandlerClass();
+    radio->Init(emu, Callback);
+    radio->TuneLO(10000000);
+
+    for (int srate = 0; srate <= 4; srate += 2)
+    {
+        iq.clear();
+        kept = 0;
+        radio->Start(srate);
+        auto deadline = steady_clock::now() + 30s;
+        while (kept < 200000 && steady_clock::now() < deadline)
+            std::this_thread::sleep_for(10ms);
+        radio->Stop();
+        REQUIRE_TRUE(iq.size() > 100000);
+
+        double sum = 0;
+        for (size_t i = iq.size() / 2; i < iq.size(); i++)
+            sum += std::abs(iq[i]);
+        double amplitude = sum / (iq.size() - iq.size() / 2);
+        printf("srate %d: %g of full scale %g\n", srate, amplitude, radio->GetFullScale());
+        REQUIRE_TRUE(fabs(amplitude / radio->GetFullScale() - 0.5) < 0.01);
+    }
+
+    delete radio;
+    delete emu;
+}
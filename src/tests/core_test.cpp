@@ -4,83 +4,24 @@
 #include <thread>
 #include <chrono>
 #include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
 #include <inttypes.h>  // For portable 64-bit type printf codes
 
 #include "RadioHandler.h"
+#include "FX3Emulator.h"
 
 using namespace std::chrono;
 
-class fx3handler : public fx3class
+// a Dummy radio streaming one tone at -6 dBFS
+static fx3emulator* CreateTestHandler()
 {
-    bool Open()
-    {
-        return true;
-    }
-
-    bool Control(FX3Command command, uint8_t data = 0)
-    {
-        return true;
-    }
-
-    bool Control(FX3Command command, uint32_t data)
-    {
-        return true;
-    }
-
-    bool Control(FX3Command command, uint64_t data)
-    {
-        return true;
-    }
-
-    bool SetArgument(uint16_t index, uint16_t value)
-    {
-        return true;
-    }
-
-    bool GetHardwareInfo(uint32_t* data) {
-        const uint8_t d[4] = {
-            0, FIRMWARE_VER_MAJOR, FIRMWARE_VER_MINOR, 0
-        };
-
-        *data = *(uint32_t*)d;
-        return true;
-    }
-
-    bool Enumerate(unsigned char& idx, char* lbuf)
-    {
-        return true;
-    }
-
-    bool ReadDebugTrace(uint8_t* pdata, uint8_t len) {
-        return true;
-    }
-
-    std::thread emuthread;
-    bool run;
-	long nxfers;
-    void StartStream(ringbuffer<int16_t>& input, int numofblock)
-    {
-        input.setBlockSize(transferSamples);
-        run = true;
-        emuthread = std::thread([&input, this]{
-            while(run)
-            {
-                auto ptr = input.getWritePtr();
-                memset(ptr, 0x5A, input.getWriteCount());
-                input.WriteDone();
-                ++nxfers;
-                std::this_thread::sleep_for(1ms);
-            }
-        });
-    }
-
-	void StopStream() {
-        run = false;
-        emuthread.join();
-    }
-public:
-	long Xfers(bool clear) { long rv=nxfers; if (clear) nxfers=0; return rv; }
-};
+    return (fx3emulator*)CreateEmulatorHandler("model=none,tone=1000000:-6");
+}
 
 static uint32_t count;
 static uint64_t totalsize;
@@ -97,7 +38,7 @@ namespace {
 
 TEST_CASE(CoreFixture, BasicTest)
 {
-    auto usb = new fx3handler();
+    auto usb = CreateTestHandler();
 
     auto radio = new RadioHandlerClass();
 
@@ -136,7 +77,7 @@ TEST_CASE(CoreFixture, BasicTest)
 
 TEST_CASE(CoreFixture, R2IQTest)
 {
-    auto usb = new fx3handler();
+    auto usb = CreateTestHandler();
 
     auto radio = new RadioHandlerClass();
 
@@ -152,18 +93,346 @@ TEST_CASE(CoreFixture, R2IQTest)
 
         REQUIRE_TRUE(count > 0);
         REQUIRE_TRUE(totalsize > 0);
-        REQUIRE_EQUAL(totalsize / count, transferSamples / 2);
-        printf("decimate=%d nxfers=%ld count=%u totalsize=%" PRIu64 "\n",
-            decimate, usb->Xfers(true), count, totalsize);
+        REQUIRE_EQUAL(totalsize / count, DEFAULT_TRANSFER_SAMPLES / 2);
+        printf("decimate=%d count=%u totalsize=%" PRIu64 "\n",
+            decimate, count, totalsize);
+    }
+
+    delete radio;
+    delete usb;
+}
+
+static std::atomic<uint32_t> gaps;
+static uint64_t lost;
+static fx3emulator* slowUsb;
+
+static void SlowCallback(void* context, const float* data, uint32_t len, const blockmeta& meta)
+{
+    // stall the consumer once, for half a second of ADC samples that fill both
+    // rings, however long the host takes to produce them
+    if (count++ == 0)
+    {
+        auto deadline = steady_clock::now() + 20s;
+        while (slowUsb->GetProducedSamples() < DEFAULT_ADC_FREQ / 2 && steady_clock::now() < deadline)
+            std::this_thread::sleep_for(1ms);
+    }
+
+    if (meta.flags & BLOCK_DISCONTINUITY)
+    {
+        gaps++;
+        lost += meta.dropped;
+    }
+}
+
+TEST_CASE(CoreFixture, DropTest)
+{
+    auto usb = CreateTestHandler();
+
+    auto radio = new RadioHandlerClass();
+
+    radio->Init(usb, SlowCallback);
+
+    count = 0;
+    gaps = 0;
+    lost = 0;
+    slowUsb = usb;
+    radio->Start(4); // no decimation, one output block per input block
+
+    // until the block after the loss is delivered
+    auto deadline = steady_clock::now() + 30s;
+    while (gaps == 0 && steady_clock::now() < deadline)
+        std::this_thread::sleep_for(10ms);
+    radio->Stop();
+
+    REQUIRE_TRUE(gaps > 0);
+    REQUIRE_TRUE(lost > 0);
+    REQUIRE_EQUAL(lost % (DEFAULT_TRANSFER_SAMPLES / 2), 0u);
+    REQUIRE_EQUAL(radio->getDiscontinuities(), gaps);
+    REQUIRE_EQUAL(radio->getDroppedSamples(), lost);
+
+    delete radio;
+    delete usb;
+}
+
+static uint64_t nextSample;
+static int64_t lastMonoNs;
+static uint32_t timeErrors;
+static int timeDecimation;
+
+static void TimeCallback(void* context, const float* data, uint32_t len, const blockmeta& meta)
+{
+    // every block continues where the previous ended, gaps included
+    if (count++ > 0 && meta.sample != nextSample + meta.dropped)
+        timeErrors++;
+    if (meta.monoNs < lastMonoNs || meta.realNs == 0)
+        timeErrors++;
+
+    nextSample = meta.sample + len;
+    lastMonoNs = meta.monoNs;
+    timeDecimation = meta.decimation;
+}
+
+TEST_CASE(CoreFixture, TimestampTest)
+{
+    auto usb = CreateTestHandler();
+
+    auto radio = new RadioHandlerClass();
+
+    radio->Init(usb, TimeCallback);
+
+    for (int decimate = 2; decimate < 5; decimate++)
+    {
+        count = 0;
+        timeErrors = 0;
+        lastMonoNs = 0;
+        radio->Start(decimate);
+        std::this_thread::sleep_for(500ms);
+        radio->Stop();
+
+        REQUIRE_TRUE(count > 1);
+        REQUIRE_EQUAL(timeErrors, 0u);
+        // the ADC counter is at least where the output is, at most the output ring ahead
+        const uint64_t adc = nextSample * (2 << timeDecimation);
+        const uint64_t perBlock = (uint64_t)radio->GetTransferSize() / sizeof(int16_t) << timeDecimation;
+        REQUIRE_TRUE(radio->GetAdcSamples() >= adc);
+        REQUIRE_TRUE(radio->GetAdcSamples() - adc <= (radio->GetOutputBlocks() + 1) * perBlock);
+    }
+
+    delete radio;
+    delete usb;
+}
+
+static uint32_t changes;
+static uint32_t lastGeneration;
+static uint32_t badPeaks;
+
+static void MetaCallback(void* context, const float* data, uint32_t len, const blockmeta& meta)
+{
+    count++;
+    if (meta.flags & BLOCK_SETTINGS_CHANGED)
+        changes++;
+    lastGeneration = meta.generation;
+    if (meta.peak < 16000 || meta.peak > 16500 || (meta.flags & BLOCK_OVERLOAD))
+        badPeaks++;
+}
+
+TEST_CASE(CoreFixture, MetaTest)
+{
+    auto usb = CreateTestHandler();
+
+    auto radio = new RadioHandlerClass();
+
+    radio->Init(usb, MetaCallback);
+
+    count = 0;
+    changes = 0;
+    badPeaks = 0;
+    radio->Start(4);
+    std::this_thread::sleep_for(200ms);
+    uint32_t before = radio->GetGeneration();
+    radio->UptDither(true);
+    radio->UpdateattRF(1);
+    REQUIRE_TRUE(radio->GetGeneration() > before);
+    std::this_thread::sleep_for(200ms);
+    radio->Stop();
+
+    REQUIRE_TRUE(count > 0);
+    REQUIRE_TRUE(changes >= 1);
+    REQUIRE_EQUAL(lastGeneration, radio->GetGeneration());
+    REQUIRE_EQUAL(badPeaks, 0u);
+
+    delete radio;
+    delete usb;
+}
+
+struct generation_block {
+    uint64_t adcEnd;        // ADC sample past the block
+    uint64_t adcStart;
+    uint32_t generation;
+    uint32_t flags;
+};
+static std::vector<generation_block> generationBlocks;
+static std::atomic<bool> generationStalled;
+static std::atomic<bool> generationRelease;
+
+static void GenerationCallback(void* context, const float* data, uint32_t len, const blockmeta& meta)
+{
+    // the first block holds the consumer until the test lets it go, the rings fill up behind it
+    if (generationBlocks.empty())
+    {
+        generationStalled = true;
+        while (!generationRelease)
+            std::this_thread::sleep_for(1ms);
+    }
+    const uint64_t ratio = 2 << meta.decimation;
+    generationBlocks.push_back({ (meta.sample + len) * ratio, meta.sample * ratio, meta.generation, meta.flags });
+}
+
+TEST_CASE(CoreFixture, GenerationTest)
+{
+    // nothing is dropped: the emulator waits for room in the input ring
+    auto usb = (fx3emulator*)CreateEmulatorHandler("model=none,tone=1000000:-6,realtime=0");
+
+    auto radio = new RadioHandlerClass();
+
+    radio->Init(usb, GenerationCallback);
+
+    generationBlocks.clear();
+    generationStalled = false;
+    generationRelease = false;
+    radio->Start(2);
+
+    // the rings are full once the emulator stops making blocks
+    auto deadline = steady_clock::now() + 10s;
+    while (!generationStalled && steady_clock::now() < deadline)
+        std::this_thread::sleep_for(1ms);
+    uint64_t produced = 0;
+    while (steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(100ms);
+        if (usb->GetProducedSamples() == produced)
+            break;
+        produced = usb->GetProducedSamples();
+    }
+    REQUIRE_TRUE(generationStalled);
+
+    // a change now is of the blocks that arrive from now on, not of the queued ones
+    const uint32_t before = radio->GetGeneration();
+    radio->UpdateattRF(1);
+    const uint32_t after = radio->GetGeneration();
+    REQUIRE_TRUE(after != before);
+    generationRelease = true;
+
+    while (steady_clock::now() < deadline &&
+        (generationBlocks.empty() || generationBlocks.back().generation != after))
+        std::this_thread::sleep_for(1ms);
+    radio->Stop();
+
+    int errors = 0;
+    int changes = 0;
+    uint64_t oldEnd = 0;
+    for (const auto& b : generationBlocks)
+    {
+        if (b.generation == before)
+            oldEnd = b.adcEnd;
+        else if (b.generation != after || b.adcStart < produced)
+            errors++;
+        if (b.flags & BLOCK_SETTINGS_CHANGED)
+            changes++;
+    }
+    printf("%zu blocks, %" PRIu64 " samples queued at the change, old generation to %" PRIu64 "\n",
+        generationBlocks.size(), produced, oldEnd);
+    REQUIRE_EQUAL(errors, 0);
+    REQUIRE_EQUAL(changes, 1);
+    REQUIRE_TRUE(oldEnd >= produced);
+    REQUIRE_EQUAL(generationBlocks.back().generation, after);
+
+    delete radio;
+    delete usb;
+}
+
+TEST_CASE(CoreFixture, TransferSizeTest)
+{
+    auto usb = CreateTestHandler();
+
+    auto radio = new RadioHandlerClass();
+
+    radio->Init(usb, Callback);
+
+    REQUIRE_EQUAL(radio->GetTransferSize(), DEFAULT_TRANSFER_SIZE);
+    REQUIRE_EQUAL(radio->GetConcurrentTransfers(), DEFAULT_CONCURRENT_TRANSFERS);
+
+    REQUIRE_FALSE(radio->SetTransferParams(65536, 8));   // not a whole number of ffts
+    REQUIRE_FALSE(radio->SetTransferParams(40000, 8));   // not a multiple of the burst size
+    REQUIRE_FALSE(radio->SetTransferParams(32768, 0));
+    REQUIRE_FALSE(radio->SetTransferParams(32768, QUEUE_SIZE + 1));
+    REQUIRE_EQUAL(radio->GetTransferSize(), DEFAULT_TRANSFER_SIZE);
+
+    REQUIRE_EQUAL(radio->GetOutputBlocks(), DEFAULT_OUTPUT_BLOCKS);
+    REQUIRE_FALSE(radio->SetOutputBlocks(MIN_OUTPUT_BLOCKS - 1));
+    REQUIRE_FALSE(radio->SetOutputBlocks(MAX_OUTPUT_BLOCKS + 1));
+    REQUIRE_TRUE(radio->SetOutputBlocks(8));
+    REQUIRE_EQUAL(radio->GetOutputBlocks(), 8);
+
+    for (uint32_t size : { 32768u, 180224u })
+    {
+        REQUIRE_TRUE(radio->SetTransferParams(size, 4));
+
+        count = 0;
+        totalsize = 0;
+        REQUIRE_TRUE(radio->Start(4));
+        std::this_thread::sleep_for(500ms);
+        radio->Stop();
+
+        REQUIRE_TRUE(count > 0);
+        REQUIRE_EQUAL(totalsize / count, size / sizeof(int16_t) / 2);
     }
 
     delete radio;
     delete usb;
 }
 
+TEST_CASE(CoreFixture, ThreadSchedTest)
+{
+    thread_sched sched;
+
+    REQUIRE_TRUE(ParseThreadSched("0,fifo,80", sched));
+    REQUIRE_EQUAL(sched.cpu, 0);
+    REQUIRE_EQUAL(sched.policy, SCHED_POLICY_FIFO);
+    REQUIRE_EQUAL(sched.priority, 80);
+
+    REQUIRE_TRUE(ParseThreadSched("-1,rr", sched));
+    REQUIRE_EQUAL(sched.cpu, -1);
+    REQUIRE_EQUAL(sched.policy, SCHED_POLICY_RR);
+    REQUIRE_EQUAL(sched.priority, 1);
+
+    REQUIRE_TRUE(ParseThreadSched("0", sched));
+    REQUIRE_EQUAL(sched.policy, SCHED_POLICY_OTHER);
+
+    REQUIRE_FALSE(ParseThreadSched("", sched));
+    REQUIRE_FALSE(ParseThreadSched("-2", sched));
+    REQUIRE_FALSE(ParseThreadSched("0,idle", sched));
+    REQUIRE_FALSE(ParseThreadSched("0,fifo,100", sched));
+    REQUIRE_FALSE(ParseThreadSched("0,fifo,0", sched));
+    REQUIRE_FALSE(ParseThreadSched("0,rr,0", sched));
+    REQUIRE_FALSE(ParseThreadSched("0,other,10", sched));
+    REQUIRE_TRUE(ParseThreadSched("0,other,0", sched));
+    REQUIRE_FALSE(ParseThreadSched("0,fifo,80x", sched));
+
+    // the last CPU of the machine is fine, the one after it is not
+    unsigned cpus = std::thread::hardware_concurrency();
+    char str[32];
+    if (cpus > 0)
+    {
+        snprintf(str, sizeof(str), "%u", cpus - 1);
+        REQUIRE_TRUE(ParseThreadSched(str, sched));
+        REQUIRE_EQUAL(sched.cpu, (int)cpus - 1);
+        snprintf(str, sizeof(str), "%u,fifo,80", cpus);
+        REQUIRE_FALSE(ParseThreadSched(str, sched));
+    }
+    REQUIRE_FALSE(ParseThreadSched("100000", sched));
+    REQUIRE_FALSE(ParseThreadSched("4294967296", sched));
+
+    // pinning to the first CPU needs no privileges, the stream must run as before
+    auto usb = CreateTestHandler();
+    auto radio = new RadioHandlerClass();
+    radio->Init(usb, Callback);
+    for (int r = 0; r < THREAD_ROLES; r++)
+        radio->SetThreadSched((ThreadRole)r, { 0, SCHED_POLICY_OTHER, 0 });
+
+    count = 0;
+    REQUIRE_TRUE(radio->Start(4));
+    std::this_thread::sleep_for(200ms);
+    radio->Stop();
+    REQUIRE_TRUE(count > 0);
+
+    delete radio;
+    delete usb;
+}
+
 TEST_CASE(CoreFixture, TuneTest)
 {
-    auto usb = new fx3handler();
+    auto usb = CreateTestHandler();
 
     auto radio = new RadioHandlerClass();
 
@@ -183,3 +452,326 @@ TEST_CASE(CoreFixture, TuneTest)
     delete radio;
     delete usb;
 }
+
+static uint32_t rateChanges;
+static uint32_t rateErrors;
+static int lastDecimation;
+static double lastFreq;
+static std::atomic<uint32_t> rateBlocks;
+static std::atomic<uint32_t> retunedBlocks;
+static std::atomic<uint32_t> sinceRetune;      // blocks after the last retuned one
+
+static void RateCallback(void* context, const float* data, uint32_t len, const blockmeta& meta)
+{
+    // the samples go on across the change, without a gap
+    if (count++ > 0 && meta.sample != nextSample)
+        rateErrors++;
+    if (meta.flags & BLOCK_DISCONTINUITY)
+        rateErrors++;
+    if (meta.flags & BLOCK_RATE_CHANGED)
+        rateChanges++;
+    if (meta.flags & BLOCK_RETUNED)
+    {
+        retunedBlocks++;
+        sinceRetune = 0;
+    }
+    else
+        sinceRetune++;
+    nextSample = meta.sample + len;
+    lastDecimation = meta.decimation;
+
+    // the tone where it belongs at the rate of the block
+    double re = 0, im = 0;
+    for (uint32_t n = 1; n < len; n++)
+    {
+        re += data[2 * n] * data[2 * n - 2] + data[2 * n + 1] * data[2 * n - 1];
+        im += data[2 * n + 1] * data[2 * n - 2] - data[2 * n] * data[2 * n - 1];
+    }
+    lastFreq = atan2(im, re) / 6.283185307179586 * 64e6 / (2 << meta.decimation);
+    rateBlocks++;
+}
+
+// until n blocks came after the retuned block number retuned, false after the deadline
+static bool WaitRetuned(uint32_t retuned, uint32_t n)
+{
+    auto deadline = steady_clock::now() + 30s;
+    while (retunedBlocks < retuned || sinceRetune < n)
+    {
+        if (steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(10ms);
+    }
+    return true;
+}
+
+// until n more blocks came, false after the deadline
+static bool WaitRateBlocks(uint32_t n)
+{
+    auto deadline = steady_clock::now() + 30s;
+    for (uint32_t first = rateBlocks; rateBlocks - first < n; )
+    {
+        if (steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(10ms);
+    }
+    return true;
+}
+
+TEST_CASE(CoreFixture, RateTest)
+{
+    auto usb = CreateTestHandler();
+
+    auto radio = new RadioHandlerClass();
+
+    radio->Init(usb, RateCallback);
+    REQUIRE_FALSE(radio->UpdateOutputRate(2));
+
+    count = 0;
+    rateChanges = 0;
+    rateErrors = 0;
+    radio->TuneLO(1200000);     // the tone at -200 kHz
+    radio->Start(0);            // 2 Msps
+    std::this_thread::sleep_for(200ms);
+    REQUIRE_EQUAL(lastDecimation, 4);
+    REQUIRE_TRUE(fabs(lastFreq + 200e3) < 1e3);
+
+    REQUIRE_TRUE(radio->UpdateOutputRate(2));  // 8 Msps
+    std::this_thread::sleep_for(200ms);
+    radio->Stop();
+
+    REQUIRE_EQUAL(rateChanges, 1u);
+    REQUIRE_EQUAL(rateErrors, 0u);
+    REQUIRE_EQUAL(lastDecimation, 2);
+    REQUIRE_TRUE(fabs(lastFreq + 200e3) < 1e3);
+
+    delete radio;
+    delete usb;
+}
+
+TEST_CASE(CoreFixture, PpmTest)
+{
+    // the reference 100 ppm fast: the tone at 1 MHz is at 999.9 kHz of the nominal ADC rate
+    auto usb = CreateEmulatorHandler("model=none,tone=1000000:-6,ppm=100");
+
+    auto radio = new RadioHandlerClass();
+
+    radio->Init(usb, RateCallback);
+    radio->TuneLO(1020000);
+    radio->Start(0);
+    REQUIRE_TRUE(WaitRateBlocks(4));
+    printf("uncorrected %.1f Hz\n", lastFreq);
+    REQUIRE_TRUE(fabs(lastFreq + 20100) < 20);
+
+    // corrected while it runs, the tone at -20 kHz of the rate the ADC really has,
+    // from the first whole block after the retuned one
+    uint32_t retuned = retunedBlocks + 1;
+    radio->SetPpm(100);
+    REQUIRE_EQUAL(radio->GetPpm(), 100.0);
+    REQUIRE_TRUE(fabs(radio->GetEffectiveSampleRate() - 64006400.0) < 1e-3);
+    bool corrected = WaitRetuned(retuned, 1);
+    radio->Stop();
+    REQUIRE_TRUE(corrected);
+    double freq = lastFreq * radio->GetEffectiveSampleRate() / radio->getSampleRate();
+    printf("corrected %.1f Hz\n", freq);
+    REQUIRE_TRUE(fabs(freq + 20000) < 20);
+
+    delete radio;
+    delete usb;
+
+    // in VHF the tuner PLL is off by as much
+    usb = CreateEmulatorHandler("model=rx888r2,rf=100000000:-20,ppm=100");
+    radio = new RadioHandlerClass();
+    radio->Init(usb, RateCallback);
+    radio->SetPpm(100);
+    radio->UpdatemodeRF(radio->PrepareLo(100020000));
+    radio->TuneLO(100020000);
+    radio->Start(0);
+    corrected = WaitRateBlocks(4);
+    radio->Stop();
+    REQUIRE_TRUE(corrected);
+    freq = lastFreq * radio->GetEffectiveSampleRate() / radio->getSampleRate();
+    printf("corrected in VHF %.1f Hz\n", freq);
+    REQUIRE_TRUE(fabs(freq + 20000) < 20);
+
+    delete radio;
+    delete usb;
+}
+
+struct held_block {
+    const float* data;
+    float first;
+};
+static std::mutex heldMutex;
+static std::deque<held_block> held;
+static uint32_t foreignBlocks;
+
+static void HoldCallback(void* context, const float* data, uint32_t len)
+{
+    // the block is one of the ring's and stays as it is until released
+    auto radio = (RadioHandlerClass*)context;
+    bool ours = false;
+    for (int i = 0; i < radio->GetOutputBlocks(); i++)
+        ours |= radio->GetOutputBlock(i) == data;
+    if (!ours)
+        foreignBlocks++;
+
+    std::lock_guard<std::mutex> lk(heldMutex);
+    held.push_back({ data, data[0] });
+    count++;
+}
+
+TEST_CASE(CoreFixture, HoldTest)
+{
+    auto usb = CreateTestHandler();
+
+    auto radio = new RadioHandlerClass();
+
+    radio->Init(usb, HoldCallback, nullptr, radio);
+    radio->SetBlockHold(true);
+    REQUIRE_TRUE(radio->SetOutputBlocks(16));
+
+    // nothing released: the ring fills and the stream stalls
+    count = 0;
+    foreignBlocks = 0;
+    held.clear();
+    radio->Start(4);
+    std::this_thread::sleep_for(300ms);
+    REQUIRE_EQUAL(count, 15u);
+    REQUIRE_FALSE(radio->SetOutputBlocks(32));
+
+    // released a few blocks behind, none of the held ones is overwritten
+    uint32_t overwritten = 0;
+    for (int n = 0; n < 200; n++)
+    {
+        std::unique_lock<std::mutex> lk(heldMutex);
+        while (held.size() > 4)
+        {
+            if (held.front().data[0] != held.front().first)
+                overwritten++;
+            held.pop_front();
+            radio->ReleaseBlock();
+        }
+        lk.unlock();
+        std::this_thread::sleep_for(1ms);
+    }
+    radio->Stop();
+
+    REQUIRE_TRUE(count > (uint32_t)radio->GetOutputBlocks());
+    REQUIRE_EQUAL(foreignBlocks, 0u);
+    REQUIRE_EQUAL(overwritten, 0u);
+
+    delete radio;
+    delete usb;
+}
+
+struct channel_stats {
+    uint32_t blocks;
+    uint32_t errors;
+    uint64_t nextSample;
+    int decimation;
+    double freq;
+};
+static channel_stats channelStats[4];
+static std::atomic<uint32_t> channelBlocks[4];
+
+static void ChannelCallback(void* context, const float* data, uint32_t len, const blockmeta& meta)
+{
+    // a thread per channel, each one writes its own stats
+    channel_stats& st = channelStats[meta.channel];
+    channelBlocks[meta.channel]++;
+    if ((st.blocks++ > 0 && meta.sample != st.nextSample) || (meta.flags & BLOCK_DISCONTINUITY))
+        st.errors++;
+    // all channels count the output samples from the same ADC sample on
+    if (meta.sample % len != 0)
+        st.errors++;
+    st.nextSample = meta.sample + len;
+    st.decimation = meta.decimation;
+
+    double re = 0, im = 0;
+    for (uint32_t n = 1; n < len; n++)
+    {
+        re += data[2 * n] * data[2 * n - 2] + data[2 * n + 1] * data[2 * n - 1];
+        im += data[2 * n + 1] * data[2 * n - 2] - data[2 * n] * data[2 * n - 1];
+    }
+    st.freq = atan2(im, re) / 6.283185307179586 * 64e6 / (2 << meta.decimation);
+}
+
+// until each channel has made its minimum of blocks, false after the deadline
+static bool WaitChannelBlocks(const uint32_t (&minimum)[4])
+{
+    auto deadline = steady_clock::now() + 30s;
+    for (int c = 0; c < 4; c++)
+    {
+        while (channelBlocks[c] < minimum[c])
+        {
+            if (steady_clock::now() > deadline)
+                return false;
+            std::this_thread::sleep_for(10ms);
+        }
+    }
+    return true;
+}
+
+static void ResetChannelStats()
+{
+    memset(channelStats, 0, sizeof(channelStats));
+    for (auto& b : channelBlocks)
+        b = 0;
+}
+
+TEST_CASE(CoreFixture, ChannelTest)
+{
+    auto usb = CreateTestHandler();
+
+    auto radio = new RadioHandlerClass();
+
+    radio->Init(usb, ChannelCallback);
+    REQUIRE_FALSE(radio->SetChannels(0));
+    REQUIRE_FALSE(radio->SetChannels(5));     // the r2iq makes 4
+    REQUIRE_TRUE(radio->SetChannels(3));
+    REQUIRE_EQUAL(radio->GetChannels(), 3);
+
+    // the one tone of the emulator at -200 kHz, +100 kHz and -30 kHz
+    radio->TuneLO(1200000);
+    REQUIRE_TRUE(radio->TuneChannel(1, 900000));
+    REQUIRE_TRUE(radio->TuneChannel(2, 1030000));
+    REQUIRE_FALSE(radio->TuneChannel(2, 40000000));   // above the band
+    REQUIRE_EQUAL(radio->GetChannelFrequency(2), 1030000u);
+    REQUIRE_TRUE(radio->SetChannelRate(2, 0));        // 2 Msps, the others 8 Msps
+    REQUIRE_FALSE(radio->SetChannelRate(3, 0));
+
+    ResetChannelStats();
+    radio->Start(2);
+    REQUIRE_FALSE(radio->SetChannels(2));
+    bool made = WaitChannelBlocks({ 4, 4, 4, 0 });
+    radio->Stop();
+    REQUIRE_TRUE(made);
+
+    const double expected[] = { -200e3, 100e3, -30e3 };
+    const int decimation[] = { 2, 2, 4 };
+    for (int c = 0; c < 3; c++)
+    {
+        const channel_stats& st = channelStats[c];
+        printf("channel %d: %u blocks, %.0f Hz\n", c, st.blocks, st.freq);
+        REQUIRE_TRUE(st.blocks > 2);
+        REQUIRE_EQUAL(st.errors, 0u);
+        REQUIRE_EQUAL(st.decimation, decimation[c]);
+        REQUIRE_TRUE(fabs(st.freq - expected[c]) < 1e3);
+    }
+    REQUIRE_EQUAL(channelStats[3].blocks, 0u);
+
+    // a disabled channel makes no blocks, the others go on
+    ResetChannelStats();
+    REQUIRE_TRUE(radio->EnableChannel(1, false));
+    radio->Start(2);
+    made = WaitChannelBlocks({ 4, 0, 4, 0 });
+    radio->Stop();
+    REQUIRE_TRUE(made);
+    REQUIRE_EQUAL(channelStats[1].blocks, 0u);
+    REQUIRE_TRUE(channelStats[0].blocks > 2);
+    REQUIRE_TRUE(channelStats[2].blocks > 0);
+
+    REQUIRE_TRUE(radio->SetChannels(1));
+    delete radio;
+    delete usb;
+}
@@ -0,0 +1,83 @@
+#include "detector.h"
+#include "FX3Emulator.h"
+#include "RadioHandler.h"
+#include "CppUnitTestFramework.hpp"
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <math.h>
+
+using namespace std::chrono;
+
+namespace {
+    struct DetectorFixture {};
+}
+
+static std::mutex foundMutex;
+static std::vector<detection> found;
+
+static void Callback(void* context, const float* data, uint32_t len)
+{
+}
+
+static void OnDetection(void* context, const detection* d, uint32_t count)
+{
+    std::lock_guard<std::mutex> lk(foundMutex);
+    found.insert(found.end(), d, d + count);
+}
+
+TEST_CASE(DetectorFixture, ToneTest)
+{
+    // on the bin grid of 7812.5 Hz, some 60 and 40 dB over the noise in a bin
+    auto emu = CreateEmulatorHandler("model=none,tone=10e6:-30,tone=20e6:-50,noise=-60");
+    auto radio = new RadioHandlerClass();
+    radio->Init(emu, Callback);
+    REQUIRE_FALSE(radio->SetDetector(10.0f, 0.0, 8, 1, OnDetection));
+    REQUIRE_TRUE(radio->SetDetector(10.0f, 0.1, 8, 1, OnDetection));
+    found.clear();
+
+    radio->Start(4);
+    std::this_thread::sleep_for(300ms);
+    radio->Stop();
+
+    std::lock_guard<std::mutex> lk(foundMutex);
+    REQUIRE_TRUE(found.size() > 10);
+    REQUIRE_EQUAL(found.size(), radio->GetDetector()->getDetections());
+
+    int strong = 0, weak = 0;
+    uint64_t sample = 0;
+    for (auto& d : found)
+    {
+        // nothing but the tones
+        bool at10 = fabs(d.frequency - 10e6) < 8e3;
+        bool at20 = fabs(d.frequency - 20e6) < 8e3;
+        REQUIRE_TRUE(at10 || at20);
+        REQUIRE_TRUE(d.bandwidth < 50e3);
+        if (at10)
+        {
+            strong++;
+            REQUIRE_TRUE(d.snr > 45);
+            REQUIRE_TRUE(d.sample >= sample);
+            sample = d.sample;
+        }
+        else
+        {
+            weak++;
+            REQUIRE_TRUE(d.snr > 25 && d.snr < 45);
+        }
+    }
+    printf("%d and %d detections, last at sample %llu\n", strong, weak, (unsigned long long)sample);
+    REQUIRE_TRUE(strong > 10 && weak > 10);
+
+    // none
+    found.clear();
+    radio->SetDetector(0.0f, 0.1, 8, 1, OnDetection);
+    radio->Start(4);
+    std::this_thread::sleep_for(100ms);
+    radio->Stop();
+    REQUIRE_TRUE(found.empty());
+
+    delete radio;
+    delete emu;
+}
@@ -0,0 +1,192 @@
+#include "FX3Emulator.h"
+#include "RadioHandler.h"
+#include "CppUnitTestFramework.hpp"
+#include <thread>
+#include <chrono>
+#include <math.h>
+#include <string.h>
+
+using namespace std::chrono;
+
+namespace {
+    struct EmulatorFixture {};
+}
+
+static uint32_t blocks;
+static uint32_t overloads;
+static uint64_t samples;
+
+static void Callback(void* context, const float* data, uint32_t len, const blockmeta& meta)
+{
+    blocks++;
+    samples += len;
+    if (meta.flags & BLOCK_OVERLOAD)
+        overloads++;
+}
+
+TEST_CASE(EmulatorFixture, ConfigTest)
+{
+    fx3class* emu;
+
+    REQUIRE_TRUE((emu = CreateEmulatorHandler("")) != nullptr);
+    delete emu;
+    REQUIRE_TRUE((emu = CreateEmulatorHandler("model=hf103,rate=100e6,tone=1e6:-3,tone=2e6,noise=-60,chirp=1e6:5e6:0.01:-20,realtime=0")) != nullptr);
+    delete emu;
+
+    REQUIRE_TRUE(CreateEmulatorHandler("model=rx777") == nullptr);
+    REQUIRE_TRUE(CreateEmulatorHandler("tone") == nullptr);
+    REQUIRE_TRUE(CreateEmulatorHandler("tone=1e6:-3:5:6:7") == nullptr);
+    REQUIRE_TRUE(CreateEmulatorHandler("chirp=1e6:2e6") == nullptr);
+    REQUIRE_TRUE(CreateEmulatorHandler("noise=loud") == nullptr);
+    REQUIRE_TRUE(CreateEmulatorHandler("volume=11") == nullptr);
+}
+
+TEST_CASE(EmulatorFixture, ModelTest)
+{
+    static const struct { const char* config; RadioModel model; const char* name; } models[] = {
+        { "model=none", NORADIO, "Dummy" },
+        { "model=bbrf103", BBRF103, "BBRF103" },
+        { "model=hf103", HF103, "HF103" },
+        { "model=rx888", RX888, "RX888" },
+        { "model=rx888r2", RX888r2, "RX888 mkII" },
+        { "model=rx888r3", RX888r3, "RX888 mkIII" },
+        { "model=rx999", RX999, "RX999" },
+        { "model=rxlucy", RXLUCY, "Lucy" },
+    };
+
+    for (auto& m : models)
+    {
+        auto emu = CreateEmulatorHandler(m.config);
+        auto radio = new RadioHandlerClass();
+        radio->Init(emu, Callback);
+
+        REQUIRE_EQUAL(radio->getModel(), m.model);
+        REQUIRE_EQUAL(radio->getName(), m.name);
+        REQUIRE_EQUAL(radio->GetFirmware(), (FIRMWARE_VER_MAJOR << 8) + FIRMWARE_VER_MINOR);
+
+        delete radio;
+        delete emu;
+    }
+}
+
+TEST_CASE(EmulatorFixture, ControlTest)
+{
+    auto emu = (fx3emulator*)CreateEmulatorHandler("model=rx888r2");
+    auto radio = new RadioHandlerClass();
+    radio->Init(emu, Callback);
+
+    // the radio programs the ADC clock at Init
+    REQUIRE_EQUAL(emu->GetAdcRate(), DEFAULT_ADC_FREQ);
+    radio->UpdateSampleRate(100000000);
+    REQUIRE_EQUAL(emu->GetAdcRate(), 100000000u);
+
+    radio->UptDither(true);
+    REQUIRE_TRUE((emu->GetGpio() & DITH) != 0);
+    radio->UptDither(false);
+    REQUIRE_TRUE((emu->GetGpio() & DITH) == 0);
+
+    radio->UpdatemodeRF(VHFMODE);
+    REQUIRE_TRUE(emu->IsTunerOn());
+    radio->TuneLO(144000000);
+    REQUIRE_EQUAL(emu->GetTunerFreq(), 144000000u);
+    radio->UpdatemodeRF(HFMODE);
+    REQUIRE_FALSE(emu->IsTunerOn());
+
+    REQUIRE_FALSE(emu->IsProducing());
+    radio->Start(4);
+    REQUIRE_TRUE(emu->IsProducing());
+    radio->Stop();
+    REQUIRE_FALSE(emu->IsProducing());
+
+    delete radio;
+    delete emu;
+}
+
+TEST_CASE(EmulatorFixture, SignalTest)
+{
+    auto emu = (fx3emulator*)CreateEmulatorHandler("tone=1e6:-6");
+    int16_t buf[6400];
+
+    // 64 samples per period at 64 Msps
+    emu->Generate(buf, 6400);
+    int peak = 0;
+    double power = 0;
+    for (int i = 0; i < 6400; i++)
+    {
+        peak = std::max(peak, abs(buf[i]));
+        power += (double)buf[i] * buf[i];
+    }
+    REQUIRE_TRUE(peak > 16300 && peak < 16500);
+    REQUIRE_TRUE(fabs(sqrt(power / 6400) - 16422 / sqrt(2.0)) < 50);
+    REQUIRE_TRUE(buf[0] == 0 && buf[16] > 16300 && buf[48] < -16300);
+
+    // DAT31 attenuation in 0.5 dB steps
+    emu->SetArgument(DAT31_ATT, 12);
+    emu->Generate(buf, 6400);
+    peak = 0;
+    for (int i = 0; i < 6400; i++)
+        peak = std::max(peak, abs(buf[i]));
+    REQUIRE_TRUE(peak > 8150 && peak < 8300);
+    delete emu;
+
+    emu = (fx3emulator*)CreateEmulatorHandler("noise=-20");
+    emu->Generate(buf, 6400);
+    power = 0;
+    for (int i = 0; i < 6400; i++)
+        power += (double)buf[i] * buf[i];
+    REQUIRE_TRUE(fabs(sqrt(power / 6400) - 3277) < 150);
+    delete emu;
+}
+
+TEST_CASE(EmulatorFixture, ClipTest)
+{
+    auto emu = CreateEmulatorHandler("model=none,tone=1e6:3");
+    auto radio = new RadioHandlerClass();
+    radio->Init(emu, Callback);
+
+    blocks = 0;
+    overloads = 0;
+    radio->Start(4);
+    std::this_thread::sleep_for(200ms);
+    radio->Stop();
+
+    REQUIRE_TRUE(blocks > 0);
+    REQUIRE_EQUAL(overloads, blocks);
+
+    delete radio;
+    delete emu;
+}
+
+TEST_CASE(EmulatorFixture, RateTest)
+{
+    auto emu = (fx3emulator*)CreateEmulatorHandler("model=none,rate=64e6");
+    auto radio = new RadioHandlerClass();
+    radio->Init(emu, Callback);
+
+    // the emulator paces the ADC samples, whether or not the host keeps up with
+    // the r2iq: those it can not take are produced and lost
+    samples = 0;
+    auto start = steady_clock::now();
+    radio->Start(0);
+
+    // a second of the emulated clock, however long a loaded host takes for it
+    auto deadline = start + 30s;
+    while (emu->GetClockNs() < 1000000000 && steady_clock::now() < deadline)
+        std::this_thread::sleep_for(10ms);
+    int64_t clock = emu->GetClockNs();
+    uint64_t produced = emu->GetProducedSamples();
+    double elapsed = duration<double>(steady_clock::now() - start).count();
+    radio->Stop();
+
+    // the samples on the emulated clock, which never runs ahead of the host's
+    double rate = produced / (clock * 1e-9);
+    printf("emulated ADC rate %.3f Msps, %.3f s for %.3f s, %.3f Msps out\n",
+        rate / 1e6, elapsed, clock * 1e-9, samples / elapsed / 1e6);
+    REQUIRE_TRUE(clock >= 1000000000);
+    REQUIRE_TRUE(rate > 64e6 * 0.99 && rate < 64e6 * 1.01);
+    REQUIRE_TRUE(clock * 1e-9 <= elapsed);
+    REQUIRE_TRUE(samples > 0);
+
+    delete radio;
+    delete emu;
+}
@@ -0,0 +1,210 @@
+#include "history.h"
+#include "FX3Emulator.h"
+#include "RadioHandler.h"
+#include "CppUnitTestFramework.hpp"
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+using namespace std::chrono;
+
+namespace {
+    struct HistoryFixture {};
+}
+
+static std::vector<int16_t> ReadSamples(const std::string& path)
+{
+    std::vector<int16_t> samples;
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == nullptr)
+        return samples;
+    int16_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, sizeof(int16_t), 4096, f)) > 0)
+        samples.insert(samples.end(), buf, buf + n);
+    fclose(f);
+    return samples;
+}
+
+static void WaitCapture(const history* h)
+{
+    auto deadline = steady_clock::now() + 30s;
+    while (h->IsCapturing() && steady_clock::now() < deadline)
+        std::this_thread::sleep_for(10ms);
+}
+
+static void Remove(const char* base)
+{
+    remove((std::string(base) + ".sigmf-data").c_str());
+    remove((std::string(base) + ".sigmf-meta").c_str());
+}
+
+static void Callback(void* context, const float* data, uint32_t len)
+{
+}
+
+// ADC samples through the r2iq, the raw history has them
+static std::atomic<uint64_t> adcDelivered;
+
+static void CountCallback(void* context, const float* data, uint32_t len, const blockmeta& meta)
+{
+    adcDelivered = (meta.sample + len) * (2 << meta.decimation);
+}
+
+TEST_CASE(HistoryFixture, CaptureTest)
+{
+    // 1 Msps, 10 ms blocks, a ring of 100 ms
+    const int block = 10000;
+    std::vector<int16_t> data(block);
+    recorder_info info = { "ri16_le", 1e6, 0.0, 0.0, "test" };
+    history h;
+    REQUIRE_TRUE(h.Open(info, 0.1));
+    REQUIRE_EQUAL(h.getCapacity(), 200000u);
+
+    blockmeta meta = blockmeta();
+    int k = 0;
+    auto push = [&](int upto) {
+        for (; k < upto; k++)
+        {
+            std::fill(data.begin(), data.end(), (int16_t)k);
+            meta.sample = (uint64_t)k * block;
+            meta.realNs = (int64_t)k * 10000000;
+            h.Push(data.data(), block * sizeof(int16_t), meta);
+        }
+    };
+
+    // fires with block 30: from 30 ms before to 20 ms after
+    push(30);
+    REQUIRE_TRUE(h.Trigger("history_test", 0.03, 0.02));
+    REQUIRE_FALSE(h.Trigger("history_test", 0.03, 0.02));
+    push(31);
+    // the capture runs behind the stream, not faster than the ring is overwritten here
+    for (int i = 0; i < 500 && h.getCapturedBytes() < 4u * block * sizeof(int16_t); i++)
+        std::this_thread::sleep_for(1ms);
+    push(40);
+    WaitCapture(&h);
+    auto samples = ReadSamples("history_test.sigmf-data");
+    REQUIRE_EQUAL(samples.size(), 5u * block);
+    for (int i = 0; i < 5; i++)
+        REQUIRE_EQUAL(samples[i * block], 27 + i);
+
+    // at a host time, nothing before
+    REQUIRE_TRUE(h.Trigger("history_test", 0.0, 0.01, 450000000));
+    push(44);
+    REQUIRE_TRUE(h.IsCapturing());
+    push(50);
+    WaitCapture(&h);
+    samples = ReadSamples("history_test.sigmf-data");
+    REQUIRE_EQUAL(samples.size(), (size_t)block);
+    REQUIRE_EQUAL(samples[0], 45);
+
+    // more than the ring holds: from the oldest block there is
+    REQUIRE_TRUE(h.Trigger("history_test", 1.0, 0.0));
+    push(51);
+    WaitCapture(&h);
+    samples = ReadSamples("history_test.sigmf-data");
+    REQUIRE_TRUE(samples.size() >= 8u * block && samples.size() <= 10u * block);
+    REQUIRE_EQUAL(samples.back(), 49);
+
+    // the stream ends before the post-trigger time
+    REQUIRE_TRUE(h.Trigger("history_test", 0.0, 1.0));
+    push(53);
+    h.Finish();
+    REQUIRE_FALSE(h.IsCapturing());
+    REQUIRE_EQUAL(ReadSamples("history_test.sigmf-data").size(), 2u * block);
+
+    REQUIRE_EQUAL(h.getCaptures(), 4u);
+    REQUIRE_EQUAL(h.getLostBytes(), 0u);
+    h.Close();
+    Remove("history_test");
+}
+
+TEST_CASE(HistoryFixture, StreamTest)
+{
+    auto emu = CreateEmulatorHandler("model=none,tone=1e6:-6");
+    auto radio = new RadioHandlerClass();
+    radio->Init(emu, CountCallback);
+    radio->SetHistory(0.2);
+
+    REQUIRE_FALSE(radio->TriggerHistory("history_stream", 0.05, 0.02));
+    adcDelivered = 0;
+    radio->Start(4);
+    // more than the 50 ms before the trigger in the history, however slow the host
+    auto deadline = steady_clock::now() + 30s;
+    while (adcDelivered < 64e6 * 0.1 && steady_clock::now() < deadline)
+        std::this_thread::sleep_for(10ms);
+    REQUIRE_TRUE(radio->TriggerHistory("history_stream", 0.05, 0.02));
+    WaitCapture(radio->GetHistory());
+    radio->Stop();
+
+    // 70 ms of the ADC at 64 Msps, give or take a block at each end
+    auto h = radio->GetHistory();
+    double seconds = h->getCapturedBytes() / 2 / 64e6;
+    printf("captured %.1f ms\n", seconds * 1000);
+    REQUIRE_TRUE(seconds > 0.068 && seconds < 0.073);
+    REQUIRE_EQUAL(ReadSamples("history_stream.sigmf-data").size() * 2, h->getCapturedBytes());
+
+    delete radio;
+    delete emu;
+    Remove("history_stream");
+}
+
+TEST_CASE(HistoryFixture, LevelTest)
+{
+    // clipping at the ADC triggers a capture of the IQ
+    auto emu = CreateEmulatorHandler("model=none,tone=1e6:3");
+    auto radio = new RadioHandlerClass();
+    radio->Init(emu, Callback);
+    radio->SetHistory(0.05, true);
+    radio->SetHistoryTrigger(32767, "history_level", 0.01, 0.01);
+
+    radio->Start(1);
+    std::this_thread::sleep_for(100ms);
+    WaitCapture(radio->GetHistory());
+    radio->Stop();
+
+    REQUIRE_TRUE(radio->GetHistory()->getCaptures() >= 1);
+    REQUIRE_TRUE(ReadSamples("history_level-0000.sigmf-data").size() > 0);
+
+    delete radio;
+    delete emu;
+    for (uint32_t i = 0; i < 100; i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "history_level-%04u", i);
+        Remove(name);
+    }
+}
+
+TEST_CASE(HistoryFixture, BurstTest)
+{
+    // one clipping burst of 1 ms: the raw capture around the block that crossed the
+    // level has it, though the raw history is ahead of that block by the rings
+    auto emu = CreateEmulatorHandler("model=none,noise=-60,burst=5e6:0.3:0.001:3");
+    auto radio = new RadioHandlerClass();
+    radio->Init(emu, Callback);
+    radio->SetHistory(0.5);
+    radio->SetHistoryTrigger(32767, "history_burst", 0.001, 0.001);
+
+    radio->Start(1);
+    for (int i = 0; i < 1000 && radio->GetHistory()->getCaptures() == 0; i++)
+        std::this_thread::sleep_for(10ms);
+    radio->Stop();
+    REQUIRE_EQUAL(radio->GetHistory()->getCaptures(), 1u);
+
+    auto samples = ReadSamples("history_burst-0000.sigmf-data");
+    int clipped = 0;
+    for (int16_t v : samples)
+        if (v == 32767 || v == -32768)
+            clipped++;
+    printf("%zu samples, %d clipped\n", samples.size(), clipped);
+    REQUIRE_TRUE(samples.size() > 0);
+    REQUIRE_TRUE(clipped > 1000);
+
+    delete radio;
+    delete emu;
+    Remove("history_burst-0000");
+}
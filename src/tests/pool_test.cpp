@@ -0,0 +1,101 @@
+#include "FX3Emulator.h"
+#include "RadioHandler.h"
+#include "r2iq_pool.h"
+#include "CppUnitTestFramework.hpp"
+#include <thread>
+#include <chrono>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <algorithm>
+
+using namespace std::chrono;
+
+namespace {
+    struct PoolFixture {};
+
+    struct stream {
+        uint32_t blocks;
+        uint32_t errors;
+        uint64_t nextSample;
+    };
+}
+
+static void Callback(void* context, const float* data, uint32_t len, const blockmeta& meta)
+{
+    // nothing lost, every block continues the previous one
+    auto s = (stream*)context;
+    if (meta.sample != s->nextSample || (meta.flags & BLOCK_DISCONTINUITY))
+        s->errors++;
+    s->nextSample = meta.sample + len;
+    s->blocks++;
+}
+
+TEST_CASE(PoolFixture, EnumerateTest)
+{
+    auto emu = CreateEmulatorHandler("model=none,devices=3");
+    char name[256];
+    unsigned char idx;
+    for (idx = 0; emu->Enumerate(idx, name); idx++)
+        REQUIRE_TRUE(strstr(name, "sn:EMU") != nullptr);
+    REQUIRE_EQUAL(idx, 3);
+    delete emu;
+}
+
+TEST_CASE(PoolFixture, SharedTest)
+{
+    const int receivers = 3;
+    fx3class* emu[receivers];
+    RadioHandlerClass* radio[receivers];
+    stream streams[receivers] = {};
+
+    // the receivers share one worker
+    r2iq_pool::Instance().SetWorkers(1);
+
+    for (int i = 0; i < receivers; i++)
+    {
+        emu[i] = CreateEmulatorHandler("model=none,tone=5e6:-20,noise=-60,realtime=0");
+        radio[i] = new RadioHandlerClass();
+        radio[i]->Init(emu[i], Callback, nullptr, &streams[i]);
+    }
+
+    for (int i = 0; i < receivers; i++)
+        radio[i]->Start(i + 1);
+    std::this_thread::sleep_for(500ms);
+
+    // the worker shares itself evenly: each receiver got about as many ADC samples
+    // through as the others, whatever its output rate and however fast the host is
+    uint64_t adc[receivers];
+    uint64_t least = UINT64_MAX, most = 0;
+    for (int i = 0; i < receivers; i++)
+    {
+        adc[i] = radio[i]->GetAdcSamples();
+        least = std::min(least, adc[i]);
+        most = std::max(most, adc[i]);
+    }
+
+    // one stops, the others go on
+    radio[0]->Stop();
+    uint32_t stopped = streams[0].blocks;
+    uint32_t before = streams[1].blocks;
+    std::this_thread::sleep_for(200ms);
+    REQUIRE_EQUAL(streams[0].blocks, stopped);
+    REQUIRE_TRUE(streams[1].blocks > before);
+
+    for (int i = 1; i < receivers; i++)
+        radio[i]->Stop();
+
+    for (int i = 0; i < receivers; i++)
+    {
+        printf("receiver %d: %u blocks, %" PRIu64 " ADC samples at 500 ms\n", i, streams[i].blocks, adc[i]);
+        REQUIRE_TRUE(streams[i].blocks > 0);
+        REQUIRE_EQUAL(streams[i].errors, 0u);
+        delete radio[i];
+        delete emu[i];
+    }
+
+    REQUIRE_TRUE(least > 0);
+    REQUIRE_TRUE(least * 3 >= most * 2);
+
+    r2iq_pool::Instance().SetWorkers(0);
+}
@@ -0,0 +1,188 @@
+#include "recorder.h"
+#include "FX3Emulator.h"
+#include "RadioHandler.h"
+#include "CppUnitTestFramework.hpp"
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <string>
+#include <stdio.h>
+
+using namespace std::chrono;
+
+namespace {
+    struct RecorderFixture {};
+}
+
+static std::string ReadFile(const std::string& path)
+{
+    std::string content;
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == nullptr)
+        return content;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        content.append(buf, n);
+    fclose(f);
+    return content;
+}
+
+static std::atomic<uint32_t> blocks;
+
+static void Callback(void* context, const float* data, uint32_t len)
+{
+    blocks++;
+}
+
+TEST_CASE(RecorderFixture, WriteTest)
+{
+    const int block = 65536;
+    std::vector<int16_t> data(block);
+    recorder rec;
+    recorder_info info = { "ri16_le", 64e6, 0.0, -10.0, "RX888 mkIII" };
+
+    REQUIRE_TRUE(rec.Open("recorder_write", info));
+
+    // 10 blocks, one gap before the 6th
+    blockmeta meta = blockmeta();
+    meta.realNs = 1700000000000000000ll;
+    for (int k = 0; k < 10; k++)
+    {
+        for (int i = 0; i < block; i++)
+            data[i] = (int16_t)(k * block + i);
+        meta.flags = k == 5 ? BLOCK_DISCONTINUITY : 0;
+        meta.sample = k < 5 ? k * block : k * block + 1000;
+        rec.Push(data.data(), block * sizeof(int16_t), meta);
+    }
+    rec.Close();
+
+    REQUIRE_EQUAL(rec.getWrittenBytes(), 10u * block * sizeof(int16_t));
+    REQUIRE_EQUAL(rec.getLostBytes(), 0u);
+    REQUIRE_FALSE(rec.getError());
+
+    auto samples = ReadFile("recorder_write.sigmf-data");
+    REQUIRE_EQUAL(samples.size(), 10u * block * sizeof(int16_t));
+    int bad = 0;
+    for (int i = 0; i < 10 * block; i++)
+        if (((const int16_t*)samples.data())[i] != (int16_t)i)
+            bad++;
+    REQUIRE_EQUAL(bad, 0);
+
+    auto sidecar = ReadFile("recorder_write.sigmf-meta");
+    REQUIRE_TRUE(sidecar.find("\"core:datatype\": \"ri16_le\"") != std::string::npos);
+    REQUIRE_TRUE(sidecar.find("\"core:sample_rate\": 64000000") != std::string::npos);
+    REQUIRE_TRUE(sidecar.find("\"core:hw\": \"RX888 mkIII\"") != std::string::npos);
+    REQUIRE_TRUE(sidecar.find("\"sddc:gain\": -10") != std::string::npos);
+    REQUIRE_TRUE(sidecar.find("\"core:sample_start\": 0, \"core:global_index\": 0,") != std::string::npos);
+    REQUIRE_TRUE(sidecar.find("\"core:sample_start\": 327680, \"core:global_index\": 328680,") != std::string::npos);
+    REQUIRE_TRUE(sidecar.find("\"core:datetime\": \"2023-11-14T22:13:20.000000Z\"") != std::string::npos);
+
+    remove("recorder_write.sigmf-data");
+    remove("recorder_write.sigmf-meta");
+}
+
+TEST_CASE(RecorderFixture, SegmentTest)
+{
+    // many more gaps than a buffer has room for marks at first, each one a capture
+    const int block = 1024;
+    const int segments = 20;
+    std::vector<int16_t> data(block);
+    recorder rec;
+    recorder_info info = { "ri16_le", 64e6, 0.0, 0.0, "RX888 mkIII" };
+
+    REQUIRE_TRUE(rec.Open("recorder_segment", info));
+    blockmeta meta = blockmeta();
+    for (int k = 0; k < segments; k++)
+    {
+        meta.flags = k > 0 ? BLOCK_DISCONTINUITY : 0;
+        meta.sample = (uint64_t)k * (block + 100);
+        rec.Push(data.data(), block * sizeof(int16_t), meta);
+    }
+    rec.Close();
+    REQUIRE_EQUAL(rec.getWrittenBytes(), (uint64_t)segments * block * sizeof(int16_t));
+
+    auto sidecar = ReadFile("recorder_segment.sigmf-meta");
+    int captures = 0;
+    for (size_t at = 0; (at = sidecar.find("\"core:sample_start\"", at)) != std::string::npos; at++)
+        captures++;
+    REQUIRE_EQUAL(captures, segments);
+    REQUIRE_TRUE(sidecar.find("\"core:sample_start\": 19456, \"core:global_index\": 21356,") != std::string::npos);
+
+    remove("recorder_segment.sigmf-data");
+    remove("recorder_segment.sigmf-meta");
+}
+
+TEST_CASE(RecorderFixture, RolloverTest)
+{
+    const int block = 65536;
+    std::vector<int16_t> data(block);
+    recorder rec;
+    recorder_info info = { "ri16_le", 64e6, 0.0, 0.0, "RX888 mkIII" };
+
+    // 8 MiB per file, 20 MiB pushed in time for the writer
+    REQUIRE_TRUE(rec.Open("recorder_rollover", info, 0, 8.0 * 1024 * 1024 / 2 / 64e6));
+    blockmeta meta = blockmeta();
+    for (int k = 0; k < 160; k++)
+    {
+        meta.sample = k * block;
+        rec.Push(data.data(), block * sizeof(int16_t), meta);
+        if (k % 8 == 7)
+            std::this_thread::sleep_for(5ms);
+    }
+    rec.Close();
+
+    REQUIRE_EQUAL(rec.getLostBytes(), 0u);
+    REQUIRE_EQUAL(rec.getFiles(), 3u);
+    REQUIRE_EQUAL(ReadFile("recorder_rollover-0000.sigmf-data").size(), 8u << 20);
+    REQUIRE_EQUAL(ReadFile("recorder_rollover-0002.sigmf-data").size(), 4u << 20);
+    REQUIRE_TRUE(ReadFile("recorder_rollover-0001.sigmf-meta").find("\"core:global_index\": 4194304,") != std::string::npos);
+
+    for (int i = 0; i < 3; i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "recorder_rollover-%04d.sigmf-data", i);
+        remove(name);
+        snprintf(name, sizeof(name), "recorder_rollover-%04d.sigmf-meta", i);
+        remove(name);
+    }
+}
+
+TEST_CASE(RecorderFixture, StreamTest)
+{
+    auto emu = CreateEmulatorHandler("model=rx888r3,tone=1e6:-6");
+    auto radio = new RadioHandlerClass();
+    radio->Init(emu, Callback);
+    radio->SetRecording("recorder_raw", "recorder_iq");
+
+    blocks = 0;
+    radio->Start(1);    // 64 Msps ADC, 4 Msps IQ
+    auto deadline = steady_clock::now() + 30s;
+    while (blocks < 16 && steady_clock::now() < deadline)
+        std::this_thread::sleep_for(10ms);
+    radio->Stop();
+    REQUIRE_TRUE(blocks >= 16);
+
+    auto raw = radio->GetRecorder(false);
+    auto iq = radio->GetRecorder(true);
+    REQUIRE_TRUE(raw->getWrittenBytes() > 0);
+    REQUIRE_EQUAL(raw->getLostBytes(), 0u);
+    REQUIRE_EQUAL(ReadFile("recorder_raw.sigmf-data").size(), raw->getWrittenBytes());
+    REQUIRE_TRUE(iq->getWrittenBytes() > 0);
+    REQUIRE_EQUAL(ReadFile("recorder_iq.sigmf-data").size(), iq->getWrittenBytes());
+    REQUIRE_TRUE(ReadFile("recorder_iq.sigmf-meta").find("\"core:sample_rate\": 4000000,") != std::string::npos);
+
+    // recording stays off unless asked for
+    radio->SetRecording(nullptr, nullptr);
+    radio->Start(1);
+    std::this_thread::sleep_for(50ms);
+    radio->Stop();
+    REQUIRE_FALSE(radio->GetRecorder(false)->IsOpen());
+
+    delete radio;
+    delete emu;
+    remove("recorder_raw.sigmf-data");
+    remove("recorder_raw.sigmf-meta");
+    remove("recorder_iq.sigmf-data");
+    remove("recorder_iq.sigmf-meta");
+}
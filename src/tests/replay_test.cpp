@@ -0,0 +1,160 @@
+#include "FX3Replay.h"
+#include "CppUnitTestFramework.hpp"
+#include <thread>
+#include <chrono>
+#include <stdio.h>
+
+using namespace std::chrono;
+
+namespace {
+    struct ReplayFixture {};
+}
+
+static int16_t ramp(uint64_t i)
+{
+    return (int16_t)(i * 7);
+}
+
+// a file per test, so that they can run at the same time
+static void WriteCapture(const char* path, uint64_t samples, uint64_t header = 0)
+{
+    FILE* f = fopen(path, "wb");
+    for (uint64_t i = 0; i < header; i++)
+        fputc(0xff, f);
+    for (uint64_t i = 0; i < samples; i++)
+    {
+        int16_t v = ramp(i);
+        fwrite(&v, sizeof(v), 1, f);
+    }
+    fclose(f);
+}
+
+TEST_CASE(ReplayFixture, ConfigTest)
+{
+    const char* path = "replay_config.raw";
+    fx3class* replay;
+
+    remove(path);
+    REQUIRE_TRUE(CreateReplayHandler(path) == nullptr);
+    REQUIRE_TRUE(CreateReplayHandler("") == nullptr);
+
+    WriteCapture(path, 1000, 16);
+    REQUIRE_TRUE((replay = CreateReplayHandler(path)) != nullptr);
+    REQUIRE_EQUAL(((fx3replay*)replay)->GetLength(), 1008u);
+    delete replay;
+    REQUIRE_TRUE((replay = CreateReplayHandler("file=replay_config.raw,offset=16,loop=1,model=hf103,realtime=0")) != nullptr);
+    REQUIRE_EQUAL(((fx3replay*)replay)->GetLength(), 1000u);
+    delete replay;
+
+    REQUIRE_TRUE(CreateReplayHandler("file=replay_config.raw,offset=15") == nullptr);
+    REQUIRE_TRUE(CreateReplayHandler("file=replay_config.raw,offset=4000") == nullptr);
+    REQUIRE_TRUE(CreateReplayHandler("file=replay_config.raw,model=rx777") == nullptr);
+    remove(path);
+}
+
+TEST_CASE(ReplayFixture, BackpressureTest)
+{
+    const char* path = "replay_backpressure.raw";
+    const int block = 16384;
+    WriteCapture(path, 40 * block + 100);
+
+    auto replay = (fx3replay*)CreateReplayHandler("file=replay_backpressure.raw,realtime=0");
+    ringbuffer<int16_t> input(4);
+    input.setBlockSize(block);
+    input.Start();
+    replay->StartStream(input, 4);
+    replay->Control(STARTFX3);
+
+    // a slow consumer holds the producer back, nothing is lost
+    int bad = 0;
+    for (int k = 0; k < 40; k++)
+    {
+        if (k < 4)
+            std::this_thread::sleep_for(20ms);
+        auto ptr = input.getReadPtr();
+        auto meta = input.getReadMeta();
+        if (meta->sample != (uint64_t)k * block || meta->flags != 0 || meta->dropped != 0)
+            bad++;
+        for (int i = 0; i < block; i++)
+            if (ptr[i] != ramp((uint64_t)k * block + i))
+                bad++;
+        input.ReadDone();
+    }
+    REQUIRE_EQUAL(bad, 0);
+
+    // the partial last block is not streamed
+    for (int i = 0; i < 100 && !replay->IsFinished(); i++)
+        std::this_thread::sleep_for(1ms);
+    REQUIRE_TRUE(replay->IsFinished());
+    REQUIRE_EQUAL(replay->GetPosition(), 40u * block);
+
+    // a restart of the stream replays the capture from its start
+    input.Stop();
+    replay->StopStream();
+    input.Start();
+    replay->StartStream(input, 4);
+    for (int k = 0; k < 2; k++)
+    {
+        auto ptr = input.getReadPtr();
+        auto meta = input.getReadMeta();
+        if (meta->sample != (uint64_t)k * block)
+            bad++;
+        for (int i = 0; i < block; i++)
+            if (ptr[i] != ramp((uint64_t)k * block + i))
+                bad++;
+        input.ReadDone();
+    }
+    REQUIRE_EQUAL(bad, 0);
+    REQUIRE_FALSE(replay->IsFinished());
+
+    input.Stop();
+    delete replay;
+    remove(path);
+}
+
+TEST_CASE(ReplayFixture, PacedTest)
+{
+    const char* path = "replay_paced.raw";
+    const int block = 65536;
+    WriteCapture(path, 1000);
+
+    auto replay = (fx3replay*)CreateReplayHandler("file=replay_paced.raw,loop=1,rate=8e6");
+    ringbuffer<int16_t> input(64);
+    input.setBlockSize(block);
+    input.Start();
+    replay->StartStream(input, 4);
+    replay->Control(STARTFX3);
+
+    // 8 Msps in 64k sample blocks, for half a second of the replay's clock however
+    // long a loaded host takes for it
+    int blocks = 0;
+    int bad = 0;
+    auto start = steady_clock::now();
+    while (replay->GetClockNs() < 500000000 && steady_clock::now() - start < 30s)
+    {
+        auto ptr = input.getReadPtr();
+        auto meta = input.getReadMeta();
+        if (meta->flags != 0)
+            bad++;
+        for (int i = 0; i < block; i++)
+            if (ptr[i] != ramp((meta->sample + i) % 1000))
+                bad++;
+        input.ReadDone();
+        blocks++;
+    }
+    int64_t clock = replay->GetClockNs();
+    uint64_t produced = replay->GetProducedSamples();
+    double elapsed = duration<double>(steady_clock::now() - start).count();
+    replay->Control(STOPFX3);
+    input.Stop();
+    delete replay;
+    remove(path);
+
+    double rate = produced / (clock * 1e-9);
+    printf("replayed %.3f Msps, %d blocks in %.3f s\n", rate / 1e6, blocks, elapsed);
+    REQUIRE_EQUAL(bad, 0);
+    REQUIRE_TRUE(clock >= 500000000);
+    REQUIRE_TRUE(rate > 8e6 * 0.98 && rate < 8e6 * 1.01);
+    REQUIRE_TRUE(clock * 1e-9 <= elapsed);
+    REQUIRE_TRUE(blocks > 0 && (uint64_t)blocks * block <= produced);
+}
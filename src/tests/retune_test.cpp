@@ -0,0 +1,159 @@
+#include "FX3Emulator.h"
+#include "RadioHandler.h"
+#include "CppUnitTestFramework.hpp"
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <complex>
+#include <vector>
+#include <math.h>
+
+using namespace std::chrono;
+
+namespace {
+    struct RetuneFixture {};
+}
+
+static const double tone = 10e6;
+static std::vector<std::complex<float>> iq;
+static std::vector<uint64_t> retunes;
+static std::atomic<uint64_t> kept;
+static std::atomic<uint64_t> lastRetune;
+
+static void Callback(void* context, const float* data, uint32_t len, const blockmeta& meta)
+{
+    // keep all of it, the sample index of every retune
+    if (meta.sample != iq.size())
+        return;
+    auto p = (const std::complex<float>*)data;
+    iq.insert(iq.end(), p, p + len);
+    if (meta.flags & BLOCK_RETUNED)
+    {
+        retunes.push_back(meta.sample + meta.tuneOffset);
+        lastRetune = meta.sample + meta.tuneOffset;
+    }
+    kept = iq.size();
+}
+
+// until the callback kept n samples, false after the deadline
+static bool WaitKept(uint64_t n)
+{
+    auto deadline = steady_clock::now() + 30s;
+    while (kept < n)
+    {
+        if (steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(1ms);
+    }
+    return true;
+}
+
+// mean phase step of the samples from..to, in Hz
+static double Frequency(size_t from, size_t to, double rate)
+{
+    std::complex<double> sum = 0;
+    for (size_t n = from + 1; n < to; n++)
+        sum += std::complex<double>(iq[n] * std::conj(iq[n - 1]));
+    return std::arg(sum) / (2 * 3.14159265358979) * rate;
+}
+
+TEST_CASE(RetuneFixture, BoundaryTest)
+{
+    auto emu = CreateEmulatorHandler("model=none,tone=10e6:-20,noise=-100,realtime=0");
+    auto radio = new RadioHandlerClass();
+    radio->Init(emu, Callback);
+    iq.clear();
+    retunes.clear();
+    kept = 0;
+    lastRetune = 0;
+
+    // off the bin grid, so that both parts of the tuning are used
+    const double f1 = 9.9e6 + 1234, f2 = 10.05e6 + 777;
+    const double rate = 2e6;
+    radio->TuneLO((uint64_t)f1);
+    radio->Start(0);
+    REQUIRE_TRUE(WaitKept(10000));
+    radio->TuneLO((uint64_t)f2);
+    auto deadline = steady_clock::now() + 30s;
+    while (lastRetune == 0 && steady_clock::now() < deadline)
+        std::this_thread::sleep_for(1ms);
+    REQUIRE_TRUE(WaitKept(lastRetune + 10000));
+    radio->Stop();
+
+    REQUIRE_EQUAL(retunes.size(), 1u);
+    const size_t k = (size_t)retunes[0];
+    REQUIRE_TRUE(k > 1000 && k + 1000 < iq.size());
+
+    // the tone moves at the sample the block tells, not before and not after
+    double before = Frequency(k - 500, k, rate);
+    double after = Frequency(k, k + 500, rate);
+    printf("retune at sample %zu: %.1f Hz before, %.1f Hz after\n", k, before, after);
+    REQUIRE_TRUE(fabs(before - (tone - f1)) < 10);
+    REQUIRE_TRUE(fabs(after - (tone - f2)) < 10);
+
+    // and so does the phase, without a step: the step at k is one of the two
+    double step = std::arg(iq[k] * std::conj(iq[k - 1])) / (2 * 3.14159265358979) * rate;
+    printf("phase step at the retune %.1f Hz\n", step);
+    REQUIRE_TRUE(step > std::min(tone - f1, tone - f2) - 1000 && step < std::max(tone - f1, tone - f2) + 1000);
+    REQUIRE_TRUE(fabs(std::abs(iq[k]) / std::abs(iq[k - 1]) - 1) < 0.01);
+
+    delete radio;
+    delete emu;
+}
+
+static std::atomic<int64_t> calledNs;
+static std::atomic<uint32_t> effects;
+static int64_t latencySum;
+static int64_t latencyMax;
+
+static int64_t Now()
+{
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void LatencyCallback(void* context, const float* data, uint32_t len, const blockmeta& meta)
+{
+    if (meta.flags & BLOCK_RETUNED)
+    {
+        int64_t latency = Now() - calledNs;
+        latencySum += latency;
+        latencyMax = std::max(latencyMax, latency);
+        effects++;
+    }
+}
+
+TEST_CASE(RetuneFixture, LatencyBenchmark)
+{
+    // from the call to the callback of the block the retune is made in, at the ADC pace
+    auto emu = CreateEmulatorHandler("model=none,tone=10e6:-20,noise=-60");
+    auto radio = new RadioHandlerClass();
+    radio->Init(emu, LatencyCallback);
+    const int hops = 20;
+
+    for (int srate = 4; srate >= 0; srate -= 2)
+    {
+        effects = 0;
+        latencySum = 0;
+        latencyMax = 0;
+        radio->TuneLO(10000000);
+        radio->Start(srate);
+        std::this_thread::sleep_for(50ms);
+
+        for (int i = 0; i < hops; i++)
+        {
+            calledNs = Now();
+            radio->TuneLO(i & 1 ? 10000000 : 10100000 + i * 1000);
+            auto start = steady_clock::now();
+            while (effects <= (uint32_t)i && steady_clock::now() - start < 1s)
+                std::this_thread::sleep_for(100us);
+        }
+        radio->Stop();
+
+        printf("srate %d: %u retunes, latency %.3f ms mean, %.3f ms max\n", srate, effects.load(),
+            latencySum / 1e6 / std::max<uint32_t>(effects, 1), latencyMax / 1e6);
+        REQUIRE_EQUAL(effects.load(), (uint32_t)hops);
+    }
+
+    delete radio;
+    delete emu;
+}
@@ -174,4 +174,75 @@ TEST_CASE(RingBufferFixture, PeekTest)
 
     auto rptr2 = buffer.peekReadPtr(-1);
     CHECK_EQUAL(rptr0, rptr2);
-}
\ No newline at end of file
+}
+TEST_CASE(RingBufferFixture, TryWriteTest)
+{
+    auto buffer = ringbuffer<int16_t>(4);
+    buffer.setBlockSize(1024);
+
+    // one slot always stays empty
+    REQUIRE_EQUAL(buffer.getFreeCount(), 3);
+    for (int i = 0; i < 3; i++)
+    {
+        auto ptr = buffer.tryGetWritePtr();
+        REQUIRE_TRUE(ptr != nullptr);
+        auto meta = buffer.getWriteMeta();
+        meta->flags = 0;
+        meta->dropped = i;
+        buffer.WriteDone();
+    }
+
+    REQUIRE_TRUE(buffer.isFull());
+    REQUIRE_EQUAL(buffer.getFreeCount(), 0);
+    REQUIRE_TRUE(buffer.tryGetWritePtr() == nullptr);
+
+    buffer.getReadPtr();
+    REQUIRE_EQUAL(buffer.getReadMeta()->dropped, 0u);
+    buffer.ReadDone();
+
+    REQUIRE_TRUE(!buffer.isFull());
+    REQUIRE_EQUAL(buffer.getFreeCount(), 1);
+    REQUIRE_TRUE(buffer.tryGetWritePtr() != nullptr);
+    REQUIRE_EQUAL(buffer.peekReadMeta(0)->dropped, 1u);
+    REQUIRE_EQUAL(buffer.peekReadMeta(1)->dropped, 2u);
+}
+
+TEST_CASE(RingBufferFixture, HoldTest)
+{
+    auto buffer = ringbuffer<int16_t>(4);
+    buffer.setBlockSize(1024);
+
+    for (int i = 0; i < 3; i++)
+    {
+        buffer.getWritePtr();
+        buffer.getWriteMeta()->dropped = i;
+        buffer.WriteDone();
+    }
+
+    // the held blocks are the reader's, the writer waits for them
+    REQUIRE_TRUE(buffer.getHoldPtr() == buffer.getBlock(0));
+    REQUIRE_EQUAL(buffer.getHoldMeta()->dropped, 0u);
+    buffer.HoldDone();
+    REQUIRE_TRUE(buffer.getHoldPtr() == buffer.getBlock(1));
+    REQUIRE_EQUAL(buffer.getHoldMeta()->dropped, 1u);
+    buffer.HoldDone();
+    REQUIRE_EQUAL(buffer.getHeldCount(), 2);
+    REQUIRE_TRUE(buffer.isFull());
+
+    // freed oldest first, the next one is still held
+    buffer.ReadDone();
+    REQUIRE_EQUAL(buffer.getHeldCount(), 1);
+    REQUIRE_TRUE(buffer.tryGetWritePtr() == buffer.getBlock(3));
+    REQUIRE_EQUAL(buffer.getReadMeta()->dropped, 1u);
+
+    // a block written while the reader waits past the held ones wakes it
+    std::thread writer([&buffer]() {
+        std::this_thread::sleep_for(50ms);
+        buffer.getWriteMeta()->dropped = 3;
+        buffer.WriteDone();
+    });
+    buffer.HoldDone();
+    REQUIRE_TRUE(buffer.getHoldPtr() == buffer.getBlock(3));
+    REQUIRE_EQUAL(buffer.getHoldMeta()->dropped, 3u);
+    writer.join();
+}
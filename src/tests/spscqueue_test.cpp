@@ -0,0 +1,72 @@
+#include "dsp/spscqueue.h"
+
+#include "CppUnitTestFramework.hpp"
+#include <thread>
+#include <chrono>
+
+using namespace std::chrono;
+
+namespace {
+    struct SpscQueueFixture {};
+}
+
+TEST_CASE(SpscQueueFixture, BasicTest)
+{
+    spscqueue<int> queue(4);
+    int v = 0;
+
+    REQUIRE_TRUE(queue.front() == nullptr);
+    REQUIRE_FALSE(queue.pop(v));
+    for (int i = 0; i < 4; i++)
+        REQUIRE_TRUE(queue.push(i));
+    REQUIRE_FALSE(queue.push(4));
+    REQUIRE_EQUAL(queue.size(), 4u);
+
+    // the front stays until popped, changes to it included
+    *queue.front() = 10;
+    REQUIRE_TRUE(queue.pop(v));
+    REQUIRE_EQUAL(v, 10);
+    REQUIRE_TRUE(queue.push(4));
+    for (int i = 1; i <= 4; i++)
+    {
+        REQUIRE_TRUE(queue.pop(v));
+        REQUIRE_EQUAL(v, i);
+    }
+    REQUIRE_EQUAL(queue.size(), 0u);
+
+    queue.push(1);
+    queue.reset(8);
+    REQUIRE_EQUAL(queue.size(), 0u);
+    REQUIRE_EQUAL(queue.capacity(), 8u);
+}
+
+TEST_CASE(SpscQueueFixture, WaitTest)
+{
+    spscqueue<int> queue(16);
+
+    auto start = steady_clock::now();
+    REQUIRE_FALSE(queue.wait(1, microseconds(20000)));
+    REQUIRE_TRUE(steady_clock::now() - start >= 20ms);
+
+    // woken when the eighth entry is there, not before
+    std::thread producer([&queue]() {
+        for (int i = 0; i < 10; i++)
+        {
+            std::this_thread::sleep_for(5ms);
+            queue.push(i);
+        }
+    });
+    REQUIRE_TRUE(queue.wait(8, microseconds(2000000)));
+    REQUIRE_TRUE(queue.size() >= 8);
+
+    // everything in order, across the threads
+    int v = 0, expected = 0;
+    while (expected < 10)
+    {
+        if (queue.pop(v))
+            REQUIRE_EQUAL(v, expected++);
+        else
+            REQUIRE_TRUE(queue.wait(1, microseconds(2000000)));
+    }
+    producer.join();
+}
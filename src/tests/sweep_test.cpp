@@ -0,0 +1,148 @@
+#include "sweep.h"
+#include "FX3Emulator.h"
+#include "RadioHandler.h"
+#include "CppUnitTestFramework.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <math.h>
+
+namespace {
+    struct SweepFixture {};
+}
+
+static void Callback(void* context, const float* data, uint32_t len)
+{
+}
+
+// dB and Hz of the strongest bin within 100 kHz of f
+static float Peak(const sweeper& sw, double f, double* at)
+{
+    const auto& s = sw.GetSpectrum();
+    float best = -INFINITY;
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        double fi = sw.getStart() + i * sw.getBinHz();
+        if (fabs(fi - f) < 100e3 && s[i] > best)
+        {
+            best = s[i];
+            *at = fi;
+        }
+    }
+    return best;
+}
+
+TEST_CASE(SweepFixture, StitchTest)
+{
+    // a tone in each of the two steps, heard 30 ms after every retune
+    auto emu = CreateEmulatorHandler("model=rx888r2,rf=100.3e6:-30,rf=104.9e6:-40,noise=-60,settle=0.03");
+    auto radio = new RadioHandlerClass();
+    radio->Init(emu, Callback);
+
+    sweeper sw(radio);
+    REQUIRE_FALSE(sw.Configure(107e6, 98e6, 256));
+    REQUIRE_TRUE(sw.Configure(98e6, 107e6, 256));
+
+    // the detector settings of the user are not taken over
+    REQUIRE_TRUE(radio->SetDetector(10.0f, 1.0, 8, 1, nullptr));
+    REQUIRE_FALSE(sw.Run(1));
+    REQUIRE_EQUAL(sw.getSteps(), 0u);
+    REQUIRE_TRUE(radio->SetDetector(0.0f, 1.0, 8, 1, nullptr));
+
+    REQUIRE_TRUE(sw.Run(3));
+    REQUIRE_EQUAL(sw.getSweeps(), 3u);
+    REQUIRE_EQUAL(sw.getSteps(), 6u);
+    REQUIRE_EQUAL(radio->GetmodeRF(), VHFMODE);
+
+    // both tones where they are, at their level within the loss off the bin grid
+    double at1 = 0, at2 = 0;
+    float p1 = Peak(sw, 100.3e6, &at1);
+    float p2 = Peak(sw, 104.9e6, &at2);
+    printf("%.0f Hz %.1f dB, %.0f Hz %.1f dB\n", at1, p1, at2, p2);
+    REQUIRE_TRUE(fabs(at1 - 100.3e6) < 2 * sw.getBinHz());
+    REQUIRE_TRUE(fabs(at2 - 104.9e6) < 2 * sw.getBinHz());
+    REQUIRE_TRUE(p1 > -35 && p1 < -28);
+    REQUIRE_TRUE(p2 > -45 && p2 < -38);
+
+    // no hole, no image: all but the leakage of the unwindowed fft is far under the weaker tone
+    const auto& s = sw.GetSpectrum();
+    int loud = 0;
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        REQUIRE_FALSE(std::isnan(s[i]));
+        double f = sw.getStart() + i * sw.getBinHz();
+        if (fabs(f - 100.3e6) > 400e3 && fabs(f - 104.9e6) > 400e3 && s[i] > -70)
+            loud++;
+    }
+    REQUIRE_EQUAL(loud, 0);
+
+    // the estimate follows the tuner from the first one: 30 ms of ADC time and
+    // the margin, however slow the host is
+    double settle = sweeper::GetSettle(RX888r2, VHFMODE);
+    printf("settle %.1f ms, %u retries\n", settle * 1e3, sw.getRetries());
+    REQUIRE_TRUE(settle > 0.03 && settle <= 0.1 && settle != 0.05);
+
+    delete radio;
+    delete emu;
+}
+
+TEST_CASE(SweepFixture, FormatTest)
+{
+    auto emu = CreateEmulatorHandler("model=rx888r2,rf=150e6:-20,noise=-60");
+    auto radio = new RadioHandlerClass();
+    radio->Init(emu, Callback);
+    const char* csv = "sweep_test.csv";
+    const char* bin = "sweep_test.bin";
+
+    sweeper sw(radio);
+    REQUIRE_TRUE(sw.Configure(148e6, 152e6, 64));
+    REQUIRE_TRUE(sw.Open(csv, SWEEP_CSV));
+    REQUIRE_TRUE(sw.Run(2));
+    REQUIRE_TRUE(sw.Open(bin, SWEEP_BINARY));
+    REQUIRE_TRUE(sw.Run(1));
+    sw.Close();
+    const uint32_t bins = (uint32_t)sw.GetSpectrum().size();
+
+    // a line per sweep: date, time, low, high, step, segments and the bins
+    FILE* f = fopen(csv, "r");
+    REQUIRE_TRUE(f != nullptr);
+    std::vector<char> line(1 << 20);
+    int lines = 0;
+    while (fgets(line.data(), (int)line.size(), f))
+    {
+        lines++;
+        int fields = 1 + (int)std::count(line.begin(), line.begin() + strlen(line.data()), ',');
+        REQUIRE_EQUAL(fields, 6 + (int)bins);
+        double low, high, step;
+        int segments;
+        REQUIRE_EQUAL(sscanf(strchr(strchr(line.data(), ',') + 1, ',') + 1, " %lf, %lf, %lf, %d",
+            &low, &high, &step, &segments), 4);
+        REQUIRE_EQUAL(low, 148e6);
+        REQUIRE_TRUE(high >= 152e6);
+        REQUIRE_EQUAL(step, sw.getBinHz());
+        REQUIRE_EQUAL(segments, 64);
+    }
+    fclose(f);
+    REQUIRE_EQUAL(lines, 2);
+
+    // a header and the bins
+    f = fopen(bin, "rb");
+    REQUIRE_TRUE(f != nullptr);
+    sweep_header h;
+    REQUIRE_EQUAL(fread(&h, sizeof(h), 1, f), 1u);
+    REQUIRE_EQUAL(h.magic, sweeper::magic);
+    REQUIRE_EQUAL(h.bins, bins);
+    REQUIRE_EQUAL(h.start, 148e6);
+    REQUIRE_EQUAL(h.sweep, 2u);
+    std::vector<float> db(h.bins);
+    REQUIRE_EQUAL(fread(db.data(), sizeof(float), h.bins, f), (size_t)h.bins);
+    REQUIRE_TRUE(*std::max_element(db.begin(), db.end()) > -25);
+    fclose(f);
+
+    remove(csv);
+    remove(bin);
+    delete radio;
+    delete emu;
+}
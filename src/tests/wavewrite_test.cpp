@@ -0,0 +1,113 @@
+#include "wavewrite.h"
+#include "wavehdr.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include "CppUnitTestFramework.hpp"
+
+namespace {
+    struct WaveFixture {};
+}
+
+static std::vector<uint8_t> ReadFile(const char* path)
+{
+    std::vector<uint8_t> bytes;
+    FILE* f = fopen(path, "rb");
+    if (f == nullptr)
+        return bytes;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        bytes.insert(bytes.end(), buf, buf + n);
+    fclose(f);
+    return bytes;
+}
+
+static int16_t pattern(size_t i)
+{
+    return (int16_t)(i * 31 + (i >> 16));
+}
+
+// frames of I and Q through the batched writer in uneven pieces
+static bool WriteFrames(const char* path, size_t frames, size_t batchSize)
+{
+    waveWriter* w = waveWriterOpen(path, 2000000, 100000000, 16, 2, batchSize);
+    if (w == nullptr)
+        return false;
+
+    std::vector<int16_t> iq;
+    int err = 0;
+    for (size_t at = 0, n = 1000; at < frames; at += n, n += 777)
+    {
+        n = std::min(n, frames - at);
+        iq.resize(2 * n);
+        for (size_t i = 0; i < 2 * n; i++)
+            iq[i] = pattern(2 * at + i);
+        err |= waveWriterWrite(w, iq.data(), n);
+    }
+    // the thread stores whole batches only, the rest at the close
+    err |= waveWriterDataSize(w) % batchSize != 0;
+    return (waveWriterClose(w) | err) == 0;
+}
+
+static int CheckFrames(const std::vector<uint8_t>& file, size_t frames)
+{
+    auto data = (const int16_t*)(file.data() + sizeof(waveFileHeader));
+    int bad = 0;
+    for (size_t i = 0; i < 2 * frames; i++)
+        if (data[i] != pattern(i))
+            bad++;
+    return bad;
+}
+
+TEST_CASE(WaveFixture, RiffTest)
+{
+    const char* path = "wave_riff.wav";
+    const size_t frames = 100000;
+    REQUIRE_TRUE(WriteFrames(path, frames, 65536));
+
+    auto file = ReadFile(path);
+    REQUIRE_EQUAL(file.size(), sizeof(waveFileHeader) + frames * 4);
+    waveFileHeader h;
+    memcpy(&h, file.data(), sizeof(h));
+    REQUIRE_EQUAL(memcmp(h.r.hdr.ID, "RIFF", 4), 0);
+    REQUIRE_EQUAL(h.r.hdr.size, (uint32_t)(file.size() - 8));
+    REQUIRE_EQUAL(memcmp(h.x.hdr.ID, "JUNK", 4), 0);
+    REQUIRE_EQUAL(h.d.hdr.size, (uint32_t)(frames * 4));
+    REQUIRE_EQUAL(h.f.nChannels, (int16_t)2);
+    REQUIRE_EQUAL(h.f.nSamplesPerSec, 2000000);
+    REQUIRE_EQUAL(CheckFrames(file, frames), 0);
+
+    remove(path);
+}
+
+TEST_CASE(WaveFixture, RF64Test)
+{
+    // past a 1 MiB RIFF limit as beyond 4 GiB, the sizes in ds64
+    const char* path = "wave_rf64.wav";
+    const size_t frames = 1000000;
+    waveSetRF64Limit(1 << 20);
+    bool written = WriteFrames(path, frames, 65536);
+    waveSetRF64Limit(0xFFFFFFFFULL);
+    REQUIRE_TRUE(written);
+
+    auto file = ReadFile(path);
+    REQUIRE_EQUAL(file.size(), sizeof(waveFileHeader) + frames * 4);
+    waveFileHeader h;
+    memcpy(&h, file.data(), sizeof(h));
+    REQUIRE_EQUAL(memcmp(h.r.hdr.ID, "RF64", 4), 0);
+    REQUIRE_EQUAL(h.r.hdr.size, 0xFFFFFFFFu);
+    REQUIRE_EQUAL(memcmp(h.x.hdr.ID, "ds64", 4), 0);
+    REQUIRE_EQUAL(h.x.hdr.size, 28u);
+    REQUIRE_EQUAL(h.x.riffSize, (uint64_t)file.size() - 8);
+    REQUIRE_EQUAL(h.x.dataSize, (uint64_t)frames * 4);
+    REQUIRE_EQUAL(h.x.sampleCount, (uint64_t)frames);
+    REQUIRE_EQUAL(h.x.tableLength, 0u);
+    REQUIRE_EQUAL(memcmp(h.d.hdr.ID, "data", 4), 0);
+    REQUIRE_EQUAL(h.d.hdr.size, 0xFFFFFFFFu);
+    REQUIRE_EQUAL(CheckFrames(file, frames), 0);
+
+    remove(path);
+}